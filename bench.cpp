@@ -0,0 +1,864 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+// lnkdump2k-bench, throughput of the parser and the outputs on a synthetic corpus.
+// not built by default, "make bench" builds and runs it. the corpus is the same for the same
+// seed and number of files, so numbers from two builds can be compared.
+#include "encoding.h"
+#include "output.h"
+#include "parse.h"
+#include "writer.h"
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#ifdef BENCH_FLTK
+#include "output_fltk.h"
+#include <FL/Fl_Browser.H>
+#endif
+
+// generator {{{
+
+//! splitmix64, the same sequence on every platform
+class Random
+{
+private:
+    uint64_t m_state;
+
+public:
+    explicit Random(uint64_t seed): m_state(seed) { }
+    uint64_t
+    next()
+    {
+        uint64_t z = (m_state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+    uint32_t below(uint32_t n) { return next() % n; }
+    bool chance(uint32_t percent) { return below(100) < percent; }
+};
+
+//! synthetic ShellLink files, written with LnkWriter. file i has the i-th combination of the
+//! structural LinkFlags and its ANSI strings are in the code page codec_defs[i % size], so
+//! every combination of the two is in a corpus of 256 * 15 files. the rest is random, but only
+//! within what the parser accepts without warnings and reads back completely.
+class Generator
+{
+private:
+    uint64_t                m_seed;
+    LnkStruct::All          m_lnk;
+    std::vector<uint8_t>    m_property_store;
+    std::vector<uint8_t>    m_vista_id_list;
+    std::string             m_utf8;
+
+    // 2.1.1 LinkFlags that decide which structures follow the header
+    static const uint32_t HAS_ID_LIST = 0x01;
+    static const uint32_t HAS_LINK_INFO = 0x02;
+    static const uint32_t STRUCTURE_FLAGS = 0xFF;
+    static const uint32_t IS_UNICODE = 0x80;
+
+public:
+    static const size_t MAX_DEPTH = 32;
+
+    explicit Generator(uint64_t seed): m_seed(seed) { m_lnk.clear(); }
+
+    static size_t codec_of(size_t index) { return index % codec_defs.size(); }
+
+    //! code page number from the name of the codec, 0 if it has none
+    static uint32_t
+    code_page(size_t codec)
+    {
+        return std::strtoul(codec_defs[codec].first, nullptr, 10);
+    }
+
+    static bool
+    double_byte(size_t codec)
+    {
+        switch (code_page(codec)) {
+            case 932: case 936: case 949: case 950: case 1361:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    //! text in the code page of the codec. double byte code pages get pairs of high bytes.
+    static std::string
+    ansi(Random& r, size_t codec, size_t length, unsigned high_percent = 40)
+    {
+        static const char* ascii = "abcdefghijklmnopqrstuvwxyz0123456789 _-.";
+        std::string s;
+        while (s.size() < length) {
+            if (!r.chance(high_percent)) {
+                s.push_back(ascii[r.below(strlen(ascii))]);
+            } else if (double_byte(codec)) {
+                s.push_back(char(0xA1 + r.below(0x5C)));
+                s.push_back(char(0xA1 + r.below(0x5C)));
+            } else {
+                s.push_back(char(0x80 + r.below(0x80)));
+            }
+        }
+        return s;
+    }
+
+    //! latin, cyrillic, CJK and the occasional surrogate pair, never NUL
+    static std::u16string
+    unicode(Random& r, size_t length)
+    {
+        std::u16string s;
+        while (s.size() < length) {
+            switch (r.below(8)) {
+                case 0:
+                    s.push_back(char16_t(0xC0 + r.below(0x40)));
+                    break;
+                case 1:
+                    s.push_back(char16_t(0x410 + r.below(0x40)));
+                    break;
+                case 2:
+                    s.push_back(char16_t(0x4E00 + r.below(0x5200)));
+                    break;
+                case 3:
+                    s.push_back(char16_t(0xD83D));
+                    s.push_back(char16_t(0xDE00 + r.below(0x50)));
+                    break;
+                default:
+                    s.push_back(char16_t('a' + r.below(26)));
+                    break;
+            }
+        }
+        return s;
+    }
+
+    //! the same as unicode(), in utf-8 as the structures keep it
+    static std::string
+    utf8(Random& r, size_t length)
+    {
+        return utf16le_to_utf8(unicode(r, length));
+    }
+
+    static LnkStruct::Guid
+    guid(Random& r)
+    {
+        std::array<uint8_t, 16> b;
+        for (auto& x: b) {
+            x = r.below(256);
+        }
+        return LnkStruct::Guid(b);
+    }
+
+    //! FILETIME in 2005..2024, never on a whole second
+    static uint64_t
+    filetime(Random& r)
+    {
+        const uint64_t from = 127481760000000000ULL;  // 2005-01-01
+        const uint64_t span = 20ULL * 365 * 86400 * 10000000;
+        return from + r.next() % span / 10000000 * 10000000 + 1 + r.below(9999999);
+    }
+
+    static uint32_t
+    fat_time(Random& r)
+    {
+        uint16_t date = ((25 + r.below(20)) << 9) | ((1 + r.below(12)) << 5) | (1 + r.below(28));
+        uint16_t time = (r.below(24) << 11) | (r.below(60) << 5) | r.below(30);
+        return (uint32_t(time) << 16) | date;
+    }
+
+private:
+    void
+    header(Random& r, uint32_t flags)
+    {
+        auto& h = m_lnk.header;
+        h.LinkFlags = flags;
+        h.FileAttributes = r.chance(20) ? 0x10 : 0x20;
+        h.CreationTime = filetime(r);
+        h.AccessTime = filetime(r);
+        h.WriteTime = filetime(r);
+        h.FileSize = r.below(1 << 30);
+        h.IconIndex = r.below(16);
+        h.ShowCommand = r.chance(80) ? 1 : 7;
+        bool hot_key = r.chance(50);
+        h.HotKeyLow = hot_key ? 'A' + r.below(26) : 0;
+        h.HotKeyHigh = hot_key ? 0x02 : 0;
+    }
+
+    //! BEEF0004 of a random Windows version
+    static void
+    extension(LnkStruct::ShellId_Beef0004& e, Random& r, const std::string& long_name)
+    {
+        static const uint16_t versions[] = { 3, 7, 8, 9 };
+        static const uint16_t windows[] = { 0x14, 0x26, 0x2A, 0x2E };
+        size_t v = r.below(4);
+        e.Version = versions[v];
+        e.CreationTime = fat_time(r);
+        e.AccessTime = fat_time(r);
+        e.WindowsVersion = windows[v];
+        e.Unknown1 = 0;
+        e.FileReference = (uint64_t(1 + r.below(100)) << 48) | r.below(1 << 30);
+        e.Unknown2 = 0;
+        e.LongStringSize = 0;
+        e.Unknown3 = 0;
+        e.Unknown4 = 0;
+        e.LongName = long_name;
+    }
+
+    //! x31 directory or x32 file with the post-XP BEEF0004 extension
+    static void
+    file_item(LnkStruct::LinkTargetIdList::ID& id, Random& r, size_t codec, bool is_file)
+    {
+        auto& f = id.Item.emplace<LnkStruct::ShellId_x30_Struct>();
+        bool unicode_name = r.chance(25);
+        f.Flags = (is_file ? 0x02 : 0x01) | (unicode_name ? 0x04 : 0);
+        f.Unknown1 = 0;
+        f.FileSize = is_file ? r.below(1 << 24) : 0;
+        f.ModifiedTime = fat_time(r);
+        f.Attributes = is_file ? 0x20 : 0x10;
+        std::string long_name = utf8(r, 4 + r.below(24));
+        f.Name = unicode_name ? long_name : ansi(r, codec, 4 + r.below(8));
+        extension(f.Extension.emplace(), r, long_name);
+    }
+
+    //! a directory in a user folder, as windows 8 and later put them in links
+    static void
+    delegate_item(LnkStruct::LinkTargetIdList::ID& id, Random& r, size_t codec)
+    {
+        auto& f = id.Item.emplace<LnkStruct::ShellId_x74_Struct>();
+        auto& s = f.SubShellItem;
+        f.Unknown1 = 0;
+        s.ClsType = 0x31;
+        s.Unknown1 = 0;
+        s.FileSize = 0;
+        s.ModifiedTime = fat_time(r);
+        s.FileAttributes = 0x10;
+        s.PrimaryName = ansi(r, codec, 4 + r.below(8));
+        s.Unknown2 = 0;
+        f.DelegateGuid = LnkStruct::Guid({0x74, 0x1A, 0x59, 0x5E, 0x96, 0xDF, 0xD3, 0x48,
+                                          0x8D, 0x67, 0x17, 0x33, 0xBC, 0xEE, 0x28, 0xBA});
+        f.DelegateClass = guid(r);
+        extension(f.Extension.emplace(), r, utf8(r, 4 + r.below(24)));
+    }
+
+    //! web or ftp location, in the short form or with the ftp block
+    static void
+    uri_item(LnkStruct::LinkTargetIdList::ID& id, Random& r, size_t codec)
+    {
+        auto& f = id.Item.emplace<LnkStruct::ShellId_x60_Struct>();
+        bool unicode = r.chance(50);
+        bool ftp = r.chance(50);
+        f.Flags = (unicode ? 0x80 : 0) | (ftp ? 0x02 : 0);
+        f.Unknown1 = 0;
+        if (ftp) {
+            f.DataSize = 0x2C;
+            f.Unknown2 = 0;
+            f.Timestamp = filetime(r);
+            f.Unknown4 = f.Unknown5 = f.Unknown6 = f.Unknown7 = f.Unknown8 = 0;
+            f.FTPHostname = "ftp" + std::to_string(r.below(100)) + ".example.org";
+            f.FTPUser = unicode ? utf8(r, 1 + r.below(12)) : ansi(r, codec, 1 + r.below(12));
+            f.FTPPassword = r.chance(50) ? "" : ansi(r, codec, 1 + r.below(12), 0);
+        }
+        std::string path = unicode ? utf8(r, 1 + r.below(40)) : ansi(r, codec, 1 + r.below(40));
+        f.URI = (ftp ? "ftp://" : "https://") + std::string("example.org/") + path;
+    }
+
+    //! a path from my computer, possibly through a user folder, or a single URI
+    void
+    id_list(Random& r, size_t codec)
+    {
+        auto& l = m_lnk.id_list.IdList;
+        m_lnk.id_list_present = true;
+        if (r.chance(10)) {
+            uri_item(l.emplace_back(), r, codec);
+            return;
+        }
+        // the parser does not decode volume items, so this one is given as bytes
+        static const uint8_t volume[0x17] = { 0x2F, 'C', ':', '\\' };
+        auto& root = l.emplace_back().Item.emplace<LnkStruct::ShellId_x1F_Struct>();
+        root.SortIndex = 0x50;
+        root.ShellFolder = LnkStruct::Guid({0xE0, 0x4F, 0xD0, 0x20, 0xEA, 0x3A, 0x69, 0x10,
+                                            0xA2, 0xD8, 0x08, 0x00, 0x2B, 0x30, 0x30, 0x9D});
+        l.emplace_back().Data = volume;
+        if (r.chance(20)) {
+            delegate_item(l.emplace_back(), r, codec);
+        }
+        size_t depth = 1 + r.below(MAX_DEPTH);
+        for (size_t i = 0; i < depth; i++) {
+            file_item(l.emplace_back(), r, codec, i + 1 == depth);
+        }
+    }
+
+    //! with unicode strings, the optional unicode fields are used and the ansi ones left
+    //! empty, because the parser reads only one of the two
+    void
+    link_info(Random& r, size_t codec, bool unicode)
+    {
+        auto& h = m_lnk.info.header;
+        auto& d = m_lnk.info.data;
+        h.LinkInfoHeaderSize = unicode ? 0x24 : 0x1C;
+        h.LinkInfoFlags = 3;  // VolumeIDAndLocalBasePath, CommonNetworkRelativeLinkAndPathSuffix
+        auto& v = d.VolumeID;
+        v.DriveType = 3;      // DRIVE_FIXED
+        v.DriveSerialNumber = r.next();
+        auto& c = d.CommonNetworkRelativeLink;
+        c.Flags = 3;          // ValidDevice, ValidNetType
+        c.NetworkProviderType = 0x00020000;
+        if (unicode) {
+            v.VolumeLabelOffset = 0x14;
+            v.VolumeLabelUnicode = utf8(r, 1 + r.below(11));
+            d.LocalBasePathUnicode = "C:\\" + utf8(r, 8 + r.below(64));
+            c.NetNameOffset = 0x1C;
+            c.NetNameUnicode = "\\\\" + utf8(r, 4 + r.below(12));
+            c.DeviceNameUnicode = "Z:";
+        } else {
+            v.VolumeLabelOffset = 0x10;
+            v.VolumeLabel = ansi(r, codec, 1 + r.below(11));
+            d.LocalBasePath = "C:\\" + ansi(r, codec, 8 + r.below(64));
+            c.NetNameOffset = 0x14;
+            c.NetName = "\\\\" + ansi(r, codec, 4 + r.below(12));
+            c.DeviceName = "Z:";
+        }
+        m_lnk.info_present = true;
+    }
+
+    void
+    string_data(Random& r, size_t codec, uint32_t flags)
+    {
+        auto& s = m_lnk.string_data;
+        bool unicode = flags & IS_UNICODE;
+        for (std::string* x: {&s.Name, &s.RelativePath, &s.WorkingDir, &s.CommandLine,
+                              &s.IconLocation})
+        {
+            *x = unicode ? utf8(r, r.below(80)) : ansi(r, codec, r.below(80));
+        }
+        s.UnicodeFlag = unicode;
+    }
+
+    //! the signatures are in-class constants, so they are passed by value
+    void block(uint32_t signature) { m_lnk.extra_data.signatures.push_back(signature); }
+
+    //! every ExtraData block the parser knows, each one with half probability
+    void
+    extra_data(Random& r, size_t codec, bool all)
+    {
+        auto& e = m_lnk.extra_data;
+        if (all || r.chance(50)) {
+            auto& x = e.console;
+            block(x.Signature);
+            x.FillAttributes = 0x07;
+            x.PopupFillAttributes = 0xF5;
+            x.ScreenBufferSizeX = 80;
+            x.ScreenBufferSizeY = 300 + r.below(9000);
+            x.WindowSizeX = 80;
+            x.WindowSizeY = 25;
+            x.WindowOriginX = x.WindowOriginY = 0;
+            x.Reserved1 = x.Reserved2 = 0;
+            x.FontSize = 0x100000;
+            x.FontFamily.value = 0x36;
+            x.FontWeight = 400;
+            x.FaceName = "Consolas";
+            x.CursorSize = 25;
+            x.FullScreen = 0;
+            x.QuickEdit = x.InsertMode = x.AutoPosition = 1;
+            x.HistoryBufferSize = 50;
+            x.NumberOfHistoryBuffers = 4;
+            x.HistoryNoDup = 0;
+            for (auto& c: x.ColorTable) {
+                c = r.below(1 << 24);
+            }
+        }
+        if (all || r.chance(50)) {
+            block(e.console_fe.Signature);
+            e.console_fe.CodePage = code_page(codec);
+        }
+        if (all || r.chance(50)) {
+            block(e.darwin.Signature);
+            e.darwin.DarwinDataAnsi = ansi(r, codec, 8 + r.below(64));
+            e.darwin.DarwinDataUnicode = utf8(r, 8 + r.below(64));
+        }
+        if (all || r.chance(50)) {
+            block(e.env_var.Signature);
+            e.env_var.TargetAnsi = ansi(r, codec, 8 + r.below(64));
+            e.env_var.TargetUnicode = utf8(r, 8 + r.below(64));
+        }
+        if (all || r.chance(50)) {
+            block(e.icon_env.Signature);
+            e.icon_env.TargetAnsi = ansi(r, codec, 8 + r.below(64));
+            e.icon_env.TargetUnicode = utf8(r, 8 + r.below(64));
+        }
+        if (all || r.chance(50)) {
+            block(e.known_folder.Signature);
+            e.known_folder.KnownFolderId = guid(r);
+            e.known_folder.Offset = 0;
+        }
+        if (all || r.chance(50)) {
+            block(e.property_store.Signature);
+            m_property_store.resize(4 * (1 + r.below(16)));
+            for (auto& b: m_property_store) {
+                b = r.below(256);
+            }
+            e.property_store.Data = m_property_store;
+        }
+        if (all || r.chance(50)) {
+            block(e.shim.Signature);
+            e.shim.LayerName = utf8(r, 4 + r.below(32));
+        }
+        if (all || r.chance(50)) {
+            block(e.special_folder.Signature);
+            e.special_folder.SpecialFolderId = r.below(0x40);
+            e.special_folder.Offset = 0;
+        }
+        if (all || r.chance(50)) {
+            auto& x = e.tracker;
+            block(x.Signature);
+            x.Length = 0x58;
+            x.Version = 0;
+            x.MachineID = ansi(r, codec, 1 + r.below(15), 0);
+            x.Droid1 = guid(r);
+            x.Droid2 = guid(r);
+            x.DroidBirth1 = guid(r);
+            x.DroidBirth2 = guid(r);
+        }
+        if (all || r.chance(50)) {
+            block(e.vista_id_list.Signature);
+            uint16_t item = r.below(0x10000);
+            m_vista_id_list = { 4, 0, uint8_t(item), uint8_t(item >> 8), 0, 0, 0, 0 };
+            e.vista_id_list.Data = m_vista_id_list;
+        }
+    }
+
+public:
+    //! structures of file number 'index', valid until the next call
+    const LnkStruct::All&
+    structures(size_t index)
+    {
+        Random r(m_seed ^ (index * 0xD6E8FEB86659FD93ULL));
+        size_t codec = codec_of(index);
+        uint32_t flags = index & STRUCTURE_FLAGS;
+        m_lnk.clear();
+        header(r, flags);
+        if (flags & HAS_ID_LIST) {
+            id_list(r, codec);
+        }
+        if (flags & HAS_LINK_INFO) {
+            link_info(r, codec, (flags & IS_UNICODE) && r.chance(50));
+        }
+        string_data(r, codec, flags);
+        extra_data(r, codec, index % 3 == 0);
+        return m_lnk;
+    }
+
+    //! contents of file number 'index', appended to out
+    void
+    file(size_t index, std::string& out)
+    {
+        LnkWriter::write(structures(index), out);
+    }
+};
+
+// }}}
+
+// measurement {{{
+
+//! counts what is written and throws it away
+class NullBuffer: public std::streambuf
+{
+private:
+    uint64_t m_count = 0;
+
+protected:
+    int_type overflow(int_type c) override { m_count++; return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) override { m_count += n; return n; }
+
+public:
+    uint64_t count() const { return m_count; }
+};
+
+//! what one round of a benchmark did
+struct Work
+{
+    uint64_t items = 0;
+    uint64_t bytes = 0;
+};
+
+static double min_seconds = 1.0;
+static std::string filter;
+
+//! repeat fn until min_seconds have passed and print items and megabytes per second
+template <class F>
+static void
+bench(const std::string& name, const char* items, F fn)
+{
+    if (!filter.empty() && name.find(filter) == std::string::npos) {
+        return;
+    }
+    using Clock = std::chrono::steady_clock;
+    Work total;
+    size_t rounds = 0;
+    Clock::time_point start = Clock::now();
+    double seconds = 0;
+    do {
+        Work w = fn();
+        total.items += w.items;
+        total.bytes += w.bytes;
+        rounds++;
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (seconds < min_seconds);
+    std::cout << std::left << std::setw(48) << name << std::right << std::fixed
+              << std::setprecision(0) << std::setw(12) << total.items / seconds << " "
+              << std::left << std::setw(8) << (std::string(items) + "/s") << std::right
+              << std::setprecision(1) << std::setw(10) << total.bytes / seconds / 1e6
+              << " MB/s" << std::setw(8) << rounds << " rounds" << std::endl;
+}
+
+// }}}
+
+// benchmarks {{{
+
+static CodecFactory codecs;
+
+static void
+bench_encoding(Random& r)
+{
+    std::vector<std::u16string> unicode;
+    uint64_t unicode_bytes = 0;
+    for (int i = 0; i < 4096; i++) {
+        unicode.push_back(Generator::unicode(r, 1 + r.below(128)));
+        unicode_bytes += unicode.back().size() * 2;
+    }
+    bench("utf16le_to_utf8", "strings", [&]() {
+        std::string out;
+        for (const auto& s: unicode) {
+            out.clear();
+            utf16le_to_utf8(s, out);
+        }
+        return Work{unicode.size(), unicode_bytes};
+    });
+    for (size_t c = 0; c < codec_defs.size(); c++) {
+        std::vector<std::string> ansi;
+        uint64_t ansi_bytes = 0;
+        for (int i = 0; i < 4096; i++) {
+            ansi.push_back(Generator::ansi(r, c, 1 + r.below(128)));
+            ansi_bytes += ansi.back().size();
+        }
+        CodecPtr codec = codecs.get(c);
+        bench(std::string("Codec::string ") + codec_defs[c].first, "strings", [&]() {
+            for (const auto& s: ansi) {
+                std::string u = codec->string(s);
+            }
+            return Work{ansi.size(), ansi_bytes};
+        });
+    }
+}
+
+static Work
+total_size(const std::vector<std::string>& corpus)
+{
+    Work w;
+    for (const auto& f: corpus) {
+        w.items++;
+        w.bytes += f.size();
+    }
+    return w;
+}
+
+//! parse every file from memory with one parser, as a batch would
+static void
+bench_parser(const std::vector<std::string>& corpus)
+{
+    Work size = total_size(corpus);
+    LnkParser::Parser data_only(LnkParser::FieldSelection::data_only());
+    bench("parse, data only", "files", [&]() {
+        for (const auto& f: corpus) {
+            data_only.reset(f.data(), f.size());
+            data_only.parse();
+        }
+        return size;
+    });
+    LnkParser::Parser all;
+    bench("parse, all fields", "files", [&]() {
+        for (const auto& f: corpus) {
+            all.reset(f.data(), f.size());
+            all.parse();
+        }
+        return size;
+    });
+}
+
+//! output of already parsed files, bytes are the size of the output
+static void
+bench_output(const std::vector<std::string>& corpus)
+{
+    std::vector<LnkOutput::StreamPtr> trees;
+    std::vector<CodecPtr> tree_codecs;
+    for (size_t i = 0; i < corpus.size(); i++) {
+        LnkParser::Parser parser;
+        parser.reset(corpus[i].data(), corpus[i].size());
+        parser.parse();
+        trees.push_back(parser.output());
+        tree_codecs.push_back(codecs.get(Generator::codec_of(i)));
+    }
+    const std::string name = "bench.lnk";
+    bench("dump_yaml", "files", [&]() {
+        NullBuffer null;
+        std::ostream out(&null);
+        for (size_t i = 0; i < trees.size(); i++) {
+            LnkOutput::dump_yaml(out, trees[i], tree_codecs[i], name, LnkOutput::DEBUG);
+        }
+        return Work{trees.size(), null.count()};
+    });
+    bench("dump_json", "files", [&]() {
+        NullBuffer null;
+        std::ostream out(&null);
+        for (size_t i = 0; i < trees.size(); i++) {
+            LnkOutput::dump_json(out, trees[i], tree_codecs[i], name, LnkOutput::DEBUG);
+        }
+        return Work{trees.size(), null.count()};
+    });
+#ifdef BENCH_FLTK
+    // the widget is never shown, so this is the cost of building the lines, not of drawing
+    Fl_Browser browser(0, 0, 640, 480);
+    bench("dump_fltk", "files", [&]() {
+        for (size_t i = 0; i < trees.size(); i++) {
+            browser.clear();
+            LnkOutput::dump_fltk(&browser, trees[i], tree_codecs[i], LnkOutput::DEBUG);
+        }
+        return Work{trees.size(), 0};
+    });
+#endif
+}
+
+//! what lnkdump2k-cli does for each file, from memory and, if written, from disk
+static void
+bench_batch(const std::vector<std::string>& corpus, const std::vector<std::string>& paths)
+{
+    Work size = total_size(corpus);
+    const std::string name = "bench.lnk";
+    LnkParser::Parser parser;
+    bench("batch yaml, from memory", "files", [&]() {
+        NullBuffer null;
+        std::ostream out(&null);
+        for (size_t i = 0; i < corpus.size(); i++) {
+            parser.reset(corpus[i].data(), corpus[i].size());
+            parser.parse();
+            LnkOutput::dump_yaml(out, parser.output(), codecs.get(Generator::codec_of(i)),
+                                 name, LnkOutput::NORMAL);
+        }
+        return size;
+    });
+    if (paths.empty()) {
+        return;
+    }
+    bench("batch yaml, from disk", "files", [&]() {
+        NullBuffer null;
+        std::ostream out(&null);
+        for (size_t i = 0; i < paths.size(); i++) {
+            parser.reset(paths[i]);
+            parser.parse();
+            LnkOutput::dump_yaml(out, parser.output(), codecs.get(Generator::codec_of(i)),
+                                 paths[i], LnkOutput::NORMAL);
+        }
+        return size;
+    });
+}
+
+//! generating is what limits the size of a corpus, parsing and writing again is a round trip
+static void
+bench_writer(Generator& generator, const std::vector<std::string>& corpus)
+{
+    std::string out;
+    bench("generate", "files", [&]() {
+        Work w;
+        for (size_t i = 0; i < corpus.size(); i++) {
+            out.clear();
+            generator.file(i, out);
+            w.items++;
+            w.bytes += out.size();
+        }
+        return w;
+    });
+    Work size = total_size(corpus);
+    LnkParser::Parser parser;
+    bench("parse and write again", "files", [&]() {
+        for (const auto& f: corpus) {
+            parser.reset(f.data(), f.size());
+            parser.parse();
+            out.clear();
+            LnkWriter::write(parser.data(), out);
+        }
+        return size;
+    });
+}
+
+// }}}
+
+//! every file has to parse without warnings and be written again byte for byte,
+//! returns the number of files that did not
+static size_t
+round_trip(const std::vector<std::string>& corpus)
+{
+    LnkParser::Parser parser;
+    std::string again;
+    size_t failed = 0;
+    for (size_t i = 0; i < corpus.size(); i++) {
+        parser.reset(corpus[i].data(), corpus[i].size());
+        LnkParser::Status status = parser.try_parse();
+        std::string problem;
+        if (!status.ok()) {
+            problem = status.message();
+        } else if (parser.diagnostics().total() > 0) {
+            problem = LnkParser::warning_name(parser.diagnostics().warnings()[0].kind);
+        } else {
+            again.clear();
+            LnkWriter::write(parser.data(), again);
+            auto diff = std::mismatch(again.begin(), again.end(),
+                                      corpus[i].begin(), corpus[i].end());
+            if (diff.first != again.end() || diff.second != corpus[i].end()) {
+                problem = "differs at offset " + std::to_string(diff.first - again.begin());
+            }
+        }
+        if (!problem.empty() && ++failed <= 10) {
+            std::cerr << "file " << i << ": " << problem << std::endl;
+        }
+    }
+    return failed;
+}
+
+static const char *usage_text =
+    "Usage: lnkdump2k-bench [options]\n"
+    "   -h, --help          show this message and exit\n"
+    "   -n, --files N       number of files in the corpus, default 3840\n"
+    "   -s, --seed N        seed of the generator, default 1\n"
+    "   -t, --time SECONDS  minimum time of each benchmark, default 1\n"
+    "   -f, --filter TEXT   run only benchmarks with TEXT in the name\n"
+    "   -c, --check         only check that the corpus parses and is written again\n"
+    "                       byte for byte, this is also done before the benchmarks\n"
+    "   -w, --write DIR     write the corpus to DIR and also parse it from there\n"
+    "   -g, --generate-only write the corpus and exit, needs -w. files are not kept\n"
+    "                       in memory, so N can be as large as the disk allows\n";
+
+//! corpus file i in dir, from a fresh generator so memory stays flat
+static bool
+write_corpus(const std::string& dir, uint64_t seed, size_t files,
+             std::vector<std::string>& paths)
+{
+    Generator generator(seed);
+    std::string buf;
+    std::filesystem::create_directories(dir);
+    for (size_t i = 0; i < files; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "%06zu.lnk", i);
+        std::string path = (std::filesystem::path(dir) / name).string();
+        buf.clear();
+        generator.file(i, buf);
+        std::ofstream f(path, std::ios::binary);
+        f.write(buf.data(), buf.size());
+        if (!f) {
+            std::cerr << path << ": cannot write" << std::endl;
+            return false;
+        }
+        paths.push_back(std::move(path));
+    }
+    return true;
+}
+
+int
+main(int argc, char** argv)
+{
+    static struct option long_options[] = {
+        {"help",            no_argument, 0,             'h'},
+        {"files",           required_argument, 0,       'n'},
+        {"seed",            required_argument, 0,       's'},
+        {"time",            required_argument, 0,       't'},
+        {"filter",          required_argument, 0,       'f'},
+        {"check",           no_argument, 0,             'c'},
+        {"write",           required_argument, 0,       'w'},
+        {"generate-only",   no_argument, 0,             'g'},
+        {NULL,              0, 0, 0}
+    };
+    size_t files = 256 * codec_defs.size();
+    uint64_t seed = 1;
+    std::string dir;
+    bool check_only = false;
+    bool generate_only = false;
+    while (true) {
+        int c = getopt_long(argc, argv, "hn:s:t:f:cw:g", long_options, nullptr);
+        if (c == -1) {
+            break;
+        }
+        switch (c) {
+            case 'h':
+                std::cout << usage_text;
+                return 0;
+            case 'n':
+                files = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 's':
+                seed = std::strtoull(optarg, nullptr, 10);
+                break;
+            case 't':
+                min_seconds = std::strtod(optarg, nullptr);
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            case 'c':
+                check_only = true;
+                break;
+            case 'w':
+                dir = optarg;
+                break;
+            case 'g':
+                generate_only = true;
+                break;
+            default:
+                std::cerr << usage_text;
+                return 2;
+        }
+    }
+    if (files == 0 || (generate_only && dir.empty())) {
+        std::cerr << usage_text;
+        return 2;
+    }
+
+    std::vector<std::string> paths;
+    if (!dir.empty() && !write_corpus(dir, seed, files, paths)) {
+        return 1;
+    }
+    if (generate_only) {
+        return 0;
+    }
+    Generator generator(seed);
+    std::vector<std::string> corpus(files);
+    for (size_t i = 0; i < files; i++) {
+        generator.file(i, corpus[i]);
+    }
+    Work size = total_size(corpus);
+    std::cout << "corpus: " << size.items << " files, " << size.bytes << " bytes, seed "
+              << seed << std::endl;
+    size_t failed = round_trip(corpus);
+    std::cout << "round trip: " << files - failed << " of " << files << " files the same"
+              << std::endl;
+    if (failed > 0 || check_only) {
+        return failed > 0 ? 1 : 0;
+    }
+
+    Random r(seed);
+    bench_encoding(r);
+    bench_parser(corpus);
+    bench_output(corpus);
+    bench_writer(generator, corpus);
+    bench_batch(corpus, paths);
+    return 0;
+}
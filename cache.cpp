@@ -0,0 +1,299 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#include "cache.h"
+#include "serialize.h"
+
+// std
+#include <cstring>
+#include <iostream>
+
+// posix
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// file     := header record*
+// header   := magic[8] version:u32 warning_kinds:u32
+// record   := dev:u64 ino:u64 size:u64 mtime_ns:i64 fields:u64
+//             warnings:u32[warning_kinds] length:u32 checksum:u64 tree[length]
+// tree is from LnkOutput::serialize(). checksum is FNV-1a of the record without itself, a
+// record that does not match it is a miss and is written again. records are only appended, a
+// later record with the same key replaces an earlier one. numbers are in host byte order, the
+// cache is not portable.
+
+static const char       CACHE_MAGIC[8] = {'L', 'N', 'K', 'C', 'A', 'C', 'H', 'E'};
+static const uint32_t   CACHE_VERSION = 2;
+static const size_t     HEADER_SIZE = sizeof(CACHE_MAGIC) + 2 * sizeof(uint32_t);
+static const size_t     CHECKSUM_OFFSET = sizeof(ResultCache::Key) +
+                                          LnkParser::WARNING_KINDS * sizeof(uint32_t) +
+                                          sizeof(uint32_t);
+static const size_t     RECORD_HEAD_SIZE = CHECKSUM_OFFSET + sizeof(uint64_t);
+
+static_assert(sizeof(ResultCache::Key) == 5 * sizeof(uint64_t));
+
+// helpers {{{
+static uint64_t
+fnv1a(uint64_t h, uint64_t v)
+{
+    for (int i = 0; i < 8; i++) {
+        h ^= (v >> (8 * i)) & 0xFF;
+        h *= 0x100000001B3;
+    }
+    return h;
+}
+
+//! of a whole record, head and tree, without the checksum field
+static uint64_t
+checksum(const std::string& record)
+{
+    uint64_t h = 0xCBF29CE484222325;
+    for (size_t i = 0; i < record.size(); i++) {
+        if (i == CHECKSUM_OFFSET) {
+            i += sizeof(uint64_t) - 1;
+            continue;
+        }
+        h ^= (unsigned char)record[i];
+        h *= 0x100000001B3;
+    }
+    return h;
+}
+
+static uint64_t
+hash_fields(const LnkParser::FieldSelection& f)
+{
+    uint64_t h = 0xCBF29CE484222325;
+    h = fnv1a(h, f.header.value());
+    h = fnv1a(h, f.id_list.value());
+    h = fnv1a(h, f.link_info.value());
+    h = fnv1a(h, f.string_data.value());
+    h = fnv1a(h, f.extra_data.value());
+    h = fnv1a(h, f.diagnostics);
+    h = fnv1a(h, f.everything);
+    h = fnv1a(h, f.output);
+    return h;
+}
+
+//! read exactly size bytes at offset, false on short read
+static bool
+read_at(int fd, void* buf, size_t size, uint64_t offset)
+{
+    char* p = (char*)buf;
+    while (size > 0) {
+        ssize_t r = pread(fd, p, size, offset);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return false;
+        }
+        p += r;
+        size -= r;
+        offset += r;
+    }
+    return true;
+}
+
+static bool
+write_all(int fd, const void* buf, size_t size)
+{
+    const char* p = (const char*)buf;
+    while (size > 0) {
+        ssize_t r = write(fd, p, size);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return false;
+        }
+        p += r;
+        size -= r;
+    }
+    return true;
+}
+// }}}
+
+size_t
+ResultCache::KeyHash::operator()(const Key& k) const
+{
+    uint64_t h = 0xCBF29CE484222325;
+    h = fnv1a(h, k.dev);
+    h = fnv1a(h, k.ino);
+    h = fnv1a(h, k.size);
+    h = fnv1a(h, k.mtime_ns);
+    h = fnv1a(h, k.fields);
+    return h;
+}
+
+ResultCache::~ResultCache()
+{
+    if (m_fd != -1) {
+        close(m_fd);
+    }
+}
+
+bool
+ResultCache::open(const std::string& path, const LnkParser::FieldSelection& fields)
+{
+    m_fields = hash_fields(fields);
+    m_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd == -1) {
+        std::cerr << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (flock(m_fd, LOCK_EX | LOCK_NB) == -1) {
+        std::cerr << path << ": cache is in use by another process" << std::endl;
+    } else if (load()) {
+        return true;
+    } else {
+        std::cerr << path << ": not a cache file of this version" << std::endl;
+    }
+    close(m_fd);
+    m_fd = -1;
+    return false;
+}
+
+//! build the index. a new file gets a header, a partial record at the end is cut off.
+bool
+ResultCache::load()
+{
+    struct stat st;
+    if (fstat(m_fd, &st) == -1) {
+        return false;
+    }
+    uint64_t end = st.st_size;
+    char header[HEADER_SIZE];
+    uint32_t version = CACHE_VERSION;
+    uint32_t kinds = LnkParser::WARNING_KINDS;
+    if (end == 0) {
+        memcpy(header, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        memcpy(header + sizeof(CACHE_MAGIC), &version, sizeof(version));
+        memcpy(header + sizeof(CACHE_MAGIC) + sizeof(version), &kinds, sizeof(kinds));
+        return write_all(m_fd, header, HEADER_SIZE);
+    }
+    if (!read_at(m_fd, header, HEADER_SIZE, 0) ||
+        memcmp(header, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        memcmp(header + sizeof(CACHE_MAGIC), &version, sizeof(version)) != 0 ||
+        memcmp(header + sizeof(CACHE_MAGIC) + sizeof(version), &kinds, sizeof(kinds)) != 0)
+    {
+        return false;
+    }
+    uint64_t offset = HEADER_SIZE;
+    char head[RECORD_HEAD_SIZE];
+    while (offset + RECORD_HEAD_SIZE <= end) {
+        if (!read_at(m_fd, head, RECORD_HEAD_SIZE, offset)) {
+            break;
+        }
+        Key k;
+        Record r;
+        memcpy(&k, head, sizeof(k));
+        memcpy(r.warnings.data(), head + sizeof(k), sizeof(r.warnings));
+        memcpy(&r.size, head + sizeof(k) + sizeof(r.warnings), sizeof(r.size));
+        r.offset = offset + RECORD_HEAD_SIZE;
+        if (r.offset + r.size > end) {
+            break;
+        }
+        m_index[k] = r;
+        offset = r.offset + r.size;
+    }
+    if (offset != end && ftruncate(m_fd, offset) == -1) {
+        return false;
+    }
+    return lseek(m_fd, offset, SEEK_SET) != -1;
+}
+
+ResultCache::Key
+ResultCache::key(const struct stat& st) const
+{
+    Key k;
+    k.dev = st.st_dev;
+    k.ino = st.st_ino;
+    k.size = st.st_size;
+    k.mtime_ns = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    k.fields = m_fields;
+    return k;
+}
+
+bool
+ResultCache::lookup(const Key& k, LnkOutput::StreamPtr& output, LnkParser::Diagnostics& diag)
+{
+    // records are only appended, the one found stays where it is after the lock
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto it = m_index.find(k);
+    if (it == m_index.end()) {
+        return false;
+    }
+    Record r = it->second;
+    std::string buf(RECORD_HEAD_SIZE + r.size, 0);
+    if (!read_at(m_fd, buf.data(), buf.size(), r.offset - RECORD_HEAD_SIZE)) {
+        return false;
+    }
+    lock.unlock();
+    uint64_t stored;
+    memcpy(&stored, buf.data() + CHECKSUM_OFFSET, sizeof(stored));
+    LnkOutput::StreamPtr s;
+    if (stored == checksum(buf)) {
+        s = LnkOutput::deserialize(std::string_view(buf).substr(RECORD_HEAD_SIZE));
+    }
+    if (!s) {
+        // damaged on disk, the caller parses the file again and stores a new record
+        lock.lock();
+        auto again = m_index.find(k);
+        if (again != m_index.end() && again->second.offset == r.offset) {
+            m_index.erase(again);
+        }
+        return false;
+    }
+    output = s;
+    diag.clear();
+    for (size_t i = 0; i < LnkParser::WARNING_KINDS; i++) {
+        diag.add_count(LnkParser::WarningKind(i), r.warnings[i]);
+    }
+    return true;
+}
+
+void
+ResultCache::store(const Key& k, const LnkOutput::StreamPtr& output,
+                   const LnkParser::Diagnostics& diag)
+{
+    std::string buf(RECORD_HEAD_SIZE, 0);
+    LnkOutput::serialize(*output, buf);
+    uint64_t size = buf.size() - RECORD_HEAD_SIZE;
+    if (size > UINT32_MAX) {
+        return;
+    }
+    Record r;
+    r.size = size;
+    for (size_t i = 0; i < LnkParser::WARNING_KINDS; i++) {
+        r.warnings[i] = diag.count(LnkParser::WarningKind(i));
+    }
+    memcpy(buf.data(), &k, sizeof(k));
+    memcpy(buf.data() + sizeof(k), r.warnings.data(), sizeof(r.warnings));
+    memcpy(buf.data() + sizeof(k) + sizeof(r.warnings), &r.size, sizeof(r.size));
+    uint64_t sum = checksum(buf);
+    memcpy(buf.data() + CHECKSUM_OFFSET, &sum, sizeof(sum));
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_fd == -1) {
+        return;
+    }
+    off_t offset = lseek(m_fd, 0, SEEK_CUR);
+    if (offset == -1) {
+        return;
+    }
+    r.offset = offset + RECORD_HEAD_SIZE;
+    if (write_all(m_fd, buf.data(), buf.size())) {
+        m_index[k] = r;
+    } else {
+        // leave no partial record behind, the next load would cut it off anyway
+        if (ftruncate(m_fd, offset) == -1 || lseek(m_fd, offset, SEEK_SET) == -1) {
+            close(m_fd);
+            m_fd = -1;
+            m_index.clear();
+        }
+    }
+}
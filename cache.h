@@ -0,0 +1,79 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+// results of earlier runs, so that batch runs over mostly unchanged files skip the parser.
+// files are known by device, inode, size and modification time, not by name or contents.
+#include "output.h"
+#include "parse.h"
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// posix
+#include <sys/stat.h>
+
+class ResultCache
+{
+public:
+    //! identity of a file on disk plus the field selection it was parsed with
+    struct Key
+    {
+        uint64_t        dev;
+        uint64_t        ino;
+        uint64_t        size;
+        int64_t         mtime_ns;
+        uint64_t        fields;     // hash of FieldSelection
+
+        bool operator==(const Key& other) const = default;
+    };
+
+private:
+    struct KeyHash
+    {
+        size_t operator()(const Key& k) const;
+    };
+
+    struct Record
+    {
+        uint64_t        offset;     // of the serialized tree in the cache file
+        uint32_t        size;
+        std::array<uint32_t, LnkParser::WARNING_KINDS> warnings;
+    };
+
+    std::mutex          m_mutex;    // of the index and the end of the file
+    int                 m_fd;
+    uint64_t            m_fields;
+    std::unordered_map<Key, Record, KeyHash> m_index;
+
+    bool load();
+
+public:
+    ResultCache(): m_fd(-1), m_fields(0) { }
+    ResultCache(const ResultCache&) = delete;
+    ResultCache& operator=(const ResultCache&) = delete;
+    ~ResultCache();
+
+    //! open or create the cache file and read its index. the file is locked while open,
+    //! so only one process uses it. false and a message on stderr if it cannot be used.
+    //! after this, lookup and store may be called from several threads at once.
+    bool open(const std::string& path, const LnkParser::FieldSelection& fields);
+    bool is_open() const { return m_fd != -1; }
+    //! key of a file from the fstat of the open file before it is read. a file that changes
+    //! while it is read is stored under its old modification time, which does not match again.
+    Key key(const struct stat& st) const;
+    //! output and warning counts of an earlier parse, false if there is none
+    bool lookup(const Key& k, LnkOutput::StreamPtr& output, LnkParser::Diagnostics& diag);
+    //! remember a successful parse
+    void store(const Key& k, const LnkOutput::StreamPtr& output,
+               const LnkParser::Diagnostics& diag);
+};
+
+#endif // #ifndef __CACHE_H__
@@ -0,0 +1,138 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#ifndef CIVIL_H
+#define CIVIL_H
+
+// conversion between unix time and UTC calendar dates without libc, so without locks on
+// the timezone or the locale. the day algorithms are from Howard Hinnant,
+// https://howardhinnant.github.io/date_algorithms.html
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Civil {
+
+const int64_t SECONDS_PER_DAY = 86400;
+
+struct Date
+{
+    int64_t             year;
+    unsigned            month;      // 1-12
+    unsigned            day;        // 1-31
+};
+
+struct DateTime
+{
+    Date                date;
+    unsigned            hour;
+    unsigned            minute;
+    unsigned            second;
+    unsigned            weekday;    // 0 is Sunday
+};
+
+//! floor division, for times before 1970
+constexpr int64_t
+floor_div(int64_t a, int64_t b)
+{
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+//! days since 1970-01-01. month and day may be out of range and carry over, like timegm
+constexpr int64_t
+days_from_civil(int64_t year, int64_t month, int64_t day)
+{
+    year += floor_div(month - 1, 12);
+    month -= 12 * floor_div(month - 1, 12);
+    // years start in March, so the leap day is last
+    year -= month <= 2;
+    int64_t era = floor_div(year, 400);
+    int64_t yoe = year - era * 400;
+    int64_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468 + day - 1;
+}
+
+constexpr Date
+civil_from_days(int64_t days)
+{
+    days += 719468;
+    int64_t era = floor_div(days, 146097);
+    int64_t doe = days - era * 146097;
+    int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    int64_t mp = (5 * doy + 2) / 153;
+    unsigned day = doy - (153 * mp + 2) / 5 + 1;
+    unsigned month = mp < 10 ? mp + 3 : mp - 9;
+    return Date{yoe + era * 400 + (month <= 2), month, day};
+}
+
+constexpr DateTime
+from_unix(int64_t t)
+{
+    int64_t days = floor_div(t, SECONDS_PER_DAY);
+    unsigned s = t - days * SECONDS_PER_DAY;
+    return DateTime{civil_from_days(days), s / 3600, s / 60 % 60, s % 60,
+                    unsigned(days - 7 * floor_div(days + 4, 7) + 4)};
+}
+
+static_assert(days_from_civil(1970, 1, 1) == 0);
+static_assert(days_from_civil(2000, 3, 1) == 11017);
+static_assert(days_from_civil(1601, 1, 1) == -134774);
+static_assert(civil_from_days(11016).day == 29);
+static_assert(from_unix(0).weekday == 4);
+
+//! size of buffer for format_iso8601, enough for any year and the fraction
+const size_t ISO8601_SIZE = 48;
+
+//! "YYYY-MM-DDTHH:MM:SSZ", or "YYYY-MM-DDTHH:MM:SS.fffffffZ" if hundred_ns is not negative.
+//! years outside 0-9999 get more digits and a sign. returns the terminating NUL.
+inline char*
+format_iso8601(char* buf, int64_t unix_time, int32_t hundred_ns = -1)
+{
+    auto digits = [](char* p, uint64_t v, int n) {
+        for (int i = n - 1; i >= 0; i--) {
+            p[i] = '0' + v % 10;
+            v /= 10;
+        }
+        return p + n;
+    };
+    DateTime t = from_unix(unix_time);
+    char* p = buf;
+    int64_t y = t.date.year;
+    if (y < 0 || y > 9999) {
+        *p++ = y < 0 ? '-' : '+';
+        y = y < 0 ? -y : y;
+        int n = 4;
+        for (int64_t x = y / 10000; x > 0 && n < 16; x /= 10) {
+            n++;
+        }
+        p = digits(p, y, n);
+    } else {
+        p = digits(p, y, 4);
+    }
+    *p++ = '-';
+    p = digits(p, t.date.month, 2);
+    *p++ = '-';
+    p = digits(p, t.date.day, 2);
+    *p++ = 'T';
+    p = digits(p, t.hour, 2);
+    *p++ = ':';
+    p = digits(p, t.minute, 2);
+    *p++ = ':';
+    p = digits(p, t.second, 2);
+    if (hundred_ns >= 0) {
+        *p++ = '.';
+        p = digits(p, hundred_ns, 7);
+    }
+    *p++ = 'Z';
+    *p = 0;
+    return p;
+}
+
+};  // namespace Civil
+
+#endif  // CIVIL_H
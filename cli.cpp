@@ -0,0 +1,710 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#include "config.h"
+#include "cache.h"
+#include "cli.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "tar.h"
+#include "uring.h"
+
+// std
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+// posix
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// globals {{{
+CommandLine                 command_line;
+CodecFactory                codecs;
+LnkParser::BatchCounters    batch_counters;
+LnkParser::BatchStats       batch_stats;
+static ResultCache          result_cache;
+static std::unique_ptr<LnkOutput::MetricsFile> metrics;
+//! of --files-from, std::cin for -
+static std::ifstream        files_from_file;
+static std::istream*        files_from = nullptr;
+//! of --tar, 0 for -
+static int                  tar_fd = -1;
+
+const char *about_blurb =
+    "lnkump2000 " VERSION "\n"
+    "This program is free software: you can redistribute it and/or modify\n"
+    "it under the terms of the GNU General Public License as published by\n"
+    "the Free Software Foundation, either version 3 of the License, or\n"
+    "(at your option) any later version.\n"
+    "See file COPYING or https://www.gnu.org/licenses/gpl-3.0.txt\n";
+
+const char *usage_text =
+    "Command line options:\n"
+    "   -h, --help          show this message and exit\n"
+    "   -a, --all           show more fields\n"
+    "   -y, --yaml          show output in YAML on the console\n"
+    "   -g, --gui           show output on GUI (not in lnkdump2k-cli)\n"
+    "   -c, --codepage X    if the file contains non-Unicode strings,\n"
+    "                       convert them using this codepage\n"
+    "   -f, --fields LIST   show only these fields, LIST is comma-separated\n"
+    "                       Section or Section.Field, for example\n"
+    "                       ShellLinkHeader.WriteTime,StringData.CommandLine\n"
+    "   -s, --summary       print counts of errors and warnings by kind\n"
+    "                       on stderr after all files\n"
+    "       --stop-on-error end at the first file that fails to parse, instead\n"
+    "                       of going on and returning 1 after all files\n"
+    "       --serve SOCKET  keep running and answer requests on a unix socket\n"
+    "                       with JSON, see serve.cpp for the protocol\n"
+    "                       -j sets how many clients are served at once\n"
+    "       --csv           one line per file with fixed columns on the console,\n"
+    "                       instead of YAML. -a, -f and --cache are ignored\n"
+    "       --tsv           the same, separated by tabs\n"
+    "       --timeline FORMAT\n"
+    "                       one line per timestamp of all files, sorted by time,\n"
+    "                       FORMAT is body (for mactime) or csv\n"
+    "       --cache FILE    keep results in FILE and reuse them for files\n"
+    "                       that did not change since, see cache.cpp\n"
+    "       --stats FORMAT  time of each section, decoding and output, bytes and\n"
+    "                       heap allocations, per file and in total, on stderr\n"
+    "                       after all files. FORMAT is table or json\n"
+    "       --trace FILE    write read, parse and output of each file as Chrome\n"
+    "                       trace events to FILE, for chrome://tracing or Perfetto\n"
+    "       --metrics FILE  keep counters of files, bytes, errors and unknown\n"
+    "                       structures in FILE in the Prometheus text format\n"
+    "       --metrics-interval SECONDS\n"
+    "                       how often FILE is rewritten, default 15\n"
+    "   -j, --jobs N        parse N files at a time, default is one per CPU.\n"
+    "                       output is in the order of the files in any case\n"
+    "       --no-uring      read files one by one, not in batches with io_uring\n"
+    "       --files-from LIST\n"
+    "                       also the files named in LIST, one per line, - is stdin.\n"
+    "                       they are read as they come, output starts at once\n"
+    "   -0, --null          names in LIST end with NUL, as from find -print0\n"
+    "       --tar ARCHIVE   the members of a tar archive instead of files, read\n"
+    "                       in one pass without extracting them, - is stdin.\n"
+    "                       not with --timeline\n"
+    "       --tar-glob GLOB members of ARCHIVE to read, by path, ignoring case.\n"
+    "                       may be repeated, default *.lnk\n"
+    "       --read-order ORDER\n"
+    "                       read files in groups of 16384 sorted by where they are\n"
+    "                       on the disk, for hard disks and images. ORDER is inode\n"
+    "                       or extent (the first block, where the file system tells).\n"
+    "                       output stays in the order of the files, ignored with\n"
+    "                       --timeline\n"
+    "Return value is always 0 if GUI is showing,\n"
+    "otherwise 0 for success, 1 for parse error, 2 for command line error.\n";
+// }}}
+
+// instrumentation {{{
+//! counts what goes through to the console, for the output bytes of --stats
+class CountingBuffer: public std::streambuf
+{
+private:
+    std::streambuf*     m_target = nullptr;
+    uint64_t            m_count = 0;
+
+protected:
+    int_type
+    overflow(int_type c) override
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            m_count++;
+        }
+        return m_target->sputc(traits_type::to_char_type(c));
+    }
+    std::streamsize
+    xsputn(const char* s, std::streamsize n) override
+    {
+        m_count += n;
+        return m_target->sputn(s, n);
+    }
+    int sync() override { return m_target->pubsync(); }
+
+public:
+    //! put this buffer between out and its own buffer
+    void
+    attach(std::ostream& out)
+    {
+        m_target = out.rdbuf(this);
+    }
+    uint64_t count() const { return m_count; }
+};
+
+static CountingBuffer console_count;
+
+//! with --stats, what this thread does until the end of the scope is counted for one file,
+//! or only in the total if there is no name. with --trace, the scope is an event with the
+//! name of the file and its decoding time, which has no events of its own.
+class CollectStats
+{
+private:
+    const std::string*      m_name;
+    LnkParser::FileStats    m_stats;
+    LnkParser::StatsScope   m_scope;
+    LnkParser::TraceSpan    m_span;
+    uint64_t                m_output_start;
+
+public:
+    //! FileStats are needed for --stats, and for the decoding time in --trace
+    static bool
+    collect()
+    {
+        return command_line.stats != LnkParser::StatsFormat::None || !command_line.trace.empty();
+    }
+
+    explicit CollectStats(const std::string* name = nullptr):
+        m_name(name),
+        m_scope(collect() ? &m_stats : nullptr),
+        m_span(name != nullptr ? "File" : "Batch"),
+        m_output_start(console_count.count()) { }
+    ~CollectStats()
+    {
+        m_stats.output_bytes = console_count.count() - m_output_start;
+        if (LnkParser::current_trace != nullptr) {
+            double us = m_stats.ticks[size_t(LnkParser::Stage::Decode)] * 1e6 /
+                        LnkParser::ticks_per_second();
+            std::string args = "\"decode_us\":" + std::to_string(us);
+            if (m_name != nullptr) {
+                args += ",\"file\":" + LnkOutput::json_quote(*m_name);
+            }
+            m_span.stop(std::move(args));
+        }
+        if (command_line.stats == LnkParser::StatsFormat::None) {
+            return;
+        }
+        if (m_name != nullptr) {
+            batch_stats.add(*m_name, m_stats);
+        } else {
+            batch_stats.add_total(m_stats);
+        }
+    }
+};
+
+void
+write_stats()
+{
+    if (command_line.stats == LnkParser::StatsFormat::Table) {
+        batch_stats.print_table(std::cerr);
+    } else if (command_line.stats == LnkParser::StatsFormat::JSON) {
+        batch_stats.print_json(std::cerr);
+    }
+    if (!command_line.trace.empty() && !LnkParser::trace_close()) {
+        std::cerr << "cannot write trace to " << command_line.trace << std::endl;
+    }
+    if (metrics && !metrics->write(batch_counters)) {
+        std::cerr << "cannot write metrics to " << command_line.metrics << std::endl;
+    }
+}
+
+//! add a file to batch_counters, and to the metrics file when it is time
+static void
+count_file(const LnkParser::Status& status, const LnkParser::Diagnostics& diag, uint64_t size)
+{
+    batch_counters.add(status, diag, size);
+    if (metrics) {
+        metrics->update(batch_counters);
+    }
+}
+// }}}
+
+// command line {{{
+void
+usage()
+{
+    std::cerr << about_blurb << usage_text;
+}
+
+bool
+cmdline(int argc, char **argv)
+{
+    static struct option long_options[] = {
+        {"help",            no_argument, 0,             'h'},
+        {"all",             no_argument, 0,             'a'},
+        {"yaml",            no_argument, 0,             'y'},
+        {"gui",             no_argument, 0,             'g'},
+        {"codepage",        required_argument, 0,       'c'},
+        {"fields",          required_argument, 0,       'f'},
+        {"summary",         no_argument, 0,             's'},
+        {"serve",           required_argument, 0,       'S'},
+        {"cache",           required_argument, 0,       'C'},
+        {"csv",             no_argument, 0,             'V'},
+        {"tsv",             no_argument, 0,             'T'},
+        {"timeline",        required_argument, 0,       'L'},
+        {"stats",           required_argument, 0,       'P'},
+        {"trace",           required_argument, 0,       'R'},
+        {"metrics",         required_argument, 0,       'M'},
+        {"metrics-interval", required_argument, 0,      'I'},
+        {"jobs",            required_argument, 0,       'j'},
+        {"no-uring",        no_argument, 0,             'U'},
+        {"read-order",      required_argument, 0,       'O'},
+        {"files-from",      required_argument, 0,       'F'},
+        {"null",            no_argument, 0,             '0'},
+        {"tar",             required_argument, 0,       'A'},
+        {"tar-glob",        required_argument, 0,       'G'},
+        {"stop-on-error",   no_argument, 0,             'E'},
+        {NULL,              0, 0, 0}
+    };
+    while (true) {
+        int c = getopt_long(argc, argv, "haygc:f:sj:0", long_options, nullptr);
+        if (c == -1) {
+            break;
+        }
+        switch (c) {
+            case 'h':
+                usage();
+                exit(0);
+            case 'a':
+                command_line.default_info_level = LnkOutput::DEBUG;
+                break;
+            case 'y':
+                command_line.yaml = true;
+                break;
+            case 'g':
+                command_line.gui = true;
+                break;
+            case 'c':
+                errno = 0;
+                command_line.codepage = std::string(optarg);
+                if (errno != 0) {
+                    return false;
+                }
+                break;
+            case 'f':
+                try {
+                    command_line.fields = LnkParser::FieldSelection::parse(optarg);
+                }
+                catch (LnkParser::Error &e) {
+                    std::cerr << e.what() << std::endl;
+                    return false;
+                }
+                break;
+            case 's':
+                command_line.summary = true;
+                break;
+            case 'S':
+                command_line.serve = std::string(optarg);
+                break;
+            case 'C':
+                command_line.cache = std::string(optarg);
+                break;
+            case 'V':
+                command_line.table = LnkOutput::TableFormat::CSV;
+                break;
+            case 'T':
+                command_line.table = LnkOutput::TableFormat::TSV;
+                break;
+            case 'L':
+                if (strcmp(optarg, "body") == 0) {
+                    command_line.timeline = LnkOutput::TimelineFormat::Bodyfile;
+                } else if (strcmp(optarg, "csv") == 0) {
+                    command_line.timeline = LnkOutput::TimelineFormat::CSV;
+                } else {
+                    std::cerr << "unknown timeline format " << optarg << std::endl;
+                    return false;
+                }
+                break;
+            case 'P':
+                if (strcmp(optarg, "table") == 0) {
+                    command_line.stats = LnkParser::StatsFormat::Table;
+                } else if (strcmp(optarg, "json") == 0) {
+                    command_line.stats = LnkParser::StatsFormat::JSON;
+                } else {
+                    std::cerr << "unknown stats format " << optarg << std::endl;
+                    return false;
+                }
+                break;
+            case 'R':
+                command_line.trace = std::string(optarg);
+                break;
+            case 'M':
+                command_line.metrics = std::string(optarg);
+                break;
+            case 'j': {
+                char* end;
+                unsigned long n = strtoul(optarg, &end, 10);
+                if (*end != '\0' || n == 0 || n > 1024) {
+                    std::cerr << "bad number of jobs " << optarg << std::endl;
+                    return false;
+                }
+                command_line.jobs = n;
+                break;
+            }
+            case 'U':
+                command_line.uring = false;
+                break;
+            case 'F':
+                command_line.files_from = optarg;
+                break;
+            case '0':
+                command_line.null = true;
+                break;
+            case 'A':
+                command_line.tar = optarg;
+                break;
+            case 'G':
+                command_line.tar_globs.push_back(optarg);
+                break;
+            case 'E':
+                command_line.stop_on_error = true;
+                break;
+            case 'O':
+                if (strcmp(optarg, "inode") == 0) {
+                    command_line.read_order = ReadOrder::Inode;
+                } else if (strcmp(optarg, "extent") == 0) {
+                    command_line.read_order = ReadOrder::Extent;
+                } else {
+                    std::cerr << "unknown read order " << optarg << std::endl;
+                    return false;
+                }
+                break;
+            case 'I': {
+                char* end;
+                command_line.metrics_interval = strtod(optarg, &end);
+                if (*end != '\0' || !(command_line.metrics_interval > 0)) {
+                    std::cerr << "bad metrics interval " << optarg << std::endl;
+                    return false;
+                }
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    while (optind < argc) {
+        auto canon = std::filesystem::weakly_canonical(argv[optind++]).string();
+        command_line.files.emplace_back(canon);
+    }
+    if (command_line.files_from == "-") {
+        files_from = &std::cin;
+    } else if (!command_line.files_from.empty()) {
+        files_from_file.open(command_line.files_from);
+        if (!files_from_file) {
+            std::cerr << "cannot open " << command_line.files_from << std::endl;
+            return false;
+        }
+        files_from = &files_from_file;
+    }
+    if (!command_line.tar.empty()) {
+        if (!command_line.files.empty() || files_from != nullptr) {
+            std::cerr << "--tar reads no other files" << std::endl;
+            return false;
+        }
+        if (command_line.timeline != LnkOutput::TimelineFormat::None) {
+            std::cerr << "--timeline cannot read --tar" << std::endl;
+            return false;
+        }
+        tar_fd = command_line.tar == "-" ? 0 :
+                 open(command_line.tar.c_str(), O_RDONLY | O_CLOEXEC);
+        if (tar_fd < 0) {
+            std::cerr << "cannot open " << command_line.tar << std::endl;
+            return false;
+        }
+        if (command_line.tar_globs.empty()) {
+            command_line.tar_globs.push_back("*.lnk");
+        }
+    }
+    if (command_line.stats != LnkParser::StatsFormat::None) {
+        console_count.attach(std::cout);
+    }
+    if (command_line.stats == LnkParser::StatsFormat::JSON && !batch_stats.keep_per_file()) {
+        std::cerr << "cannot create a temporary file for --stats json" << std::endl;
+        return false;
+    }
+    if (!command_line.trace.empty()) {
+        // events go to the file as they come, a long batch does not collect them in memory
+        if (!LnkParser::trace_open(command_line.trace)) {
+            std::cerr << "cannot write trace to " << command_line.trace << std::endl;
+            return false;
+        }
+        LnkParser::trace_thread("main");
+    }
+    if (!command_line.metrics.empty()) {
+        metrics = std::make_unique<LnkOutput::MetricsFile>(command_line.metrics,
+                                                           command_line.metrics_interval);
+    }
+    return true;
+}
+// }}}
+
+// names {{{
+//! the files on the command line, then those of --files-from one at a time, so that a long
+//! list is neither kept in memory nor waited for
+class CommandLineNames: public NameSource
+{
+private:
+    NameList        m_args;
+    std::istream*   m_in;
+    char            m_delimiter;
+
+public:
+    CommandLineNames(): m_args(command_line.files), m_in(files_from),
+        m_delimiter(command_line.null ? '\0' : '\n') { }
+    bool
+    next(std::string& name) override
+    {
+        if (m_args.next(name)) {
+            return true;
+        }
+        while (m_in != nullptr && std::getline(*m_in, name, m_delimiter)) {
+            if (name.empty()) {
+                continue;
+            }
+            // the same as on the command line. this runs in the reading thread, where an
+            // exception would end the program, so the name stays as it is on errors.
+            std::error_code ec;
+            auto canon = std::filesystem::weakly_canonical(name, ec);
+            if (!ec) {
+                name = canon.string();
+            }
+            return true;
+        }
+        return false;
+    }
+};
+
+std::unique_ptr<NameSource>
+command_line_names()
+{
+    return std::make_unique<CommandLineNames>();
+}
+
+bool
+has_files()
+{
+    return !command_line.files.empty() || files_from != nullptr || tar_fd >= 0;
+}
+// }}}
+
+// console output {{{
+//! opened with the first file, runs without the cache if it cannot be opened
+static bool
+use_cache()
+{
+    static bool tried = false;
+    if (!tried && !command_line.cache.empty()) {
+        tried = true;
+        if (!result_cache.open(command_line.cache, command_line.fields)) {
+            std::cerr << "continuing without cache" << std::endl;
+        }
+    }
+    return result_cache.is_open();
+}
+
+//! with the cache the file is read here, so that its key comes from the open file
+static LnkParser::Status
+parse_cached(LnkParser::Parser& parser, const std::string& name, LnkOutput::StreamPtr& output)
+{
+    // the parser points into it until the next file
+    static std::vector<char> data;
+    LnkParser::StageTimer t(LnkParser::Stage::Read);
+    struct stat st;
+    int fd = open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    int error = fd < 0 ? errno : fstat(fd, &st) == -1 ? errno : read_fd(fd, data);
+    if (fd >= 0) {
+        close(fd);
+    }
+    t.stop();
+    LnkParser::Status status;
+    if (error != 0) {
+        // the same as the parser reports for files it cannot read
+        status = LnkParser::Status{LnkParser::ErrorKind::IoError, 0, nullptr, uint64_t(error)};
+        count_file(status, LnkParser::Diagnostics(), 0);
+        return status;
+    }
+    if (LnkParser::current_stats != nullptr) {
+        LnkParser::current_stats->bytes_read += data.size();
+    }
+    ResultCache::Key key = result_cache.key(st);
+    LnkParser::Diagnostics cached;
+    if (result_cache.lookup(key, output, cached)) {
+        count_file(status, cached, data.size());
+        return status;
+    }
+    parser.reset(data.data(), data.size());
+    status = parser.try_parse();
+    count_file(status, parser.diagnostics(), parser.size());
+    output = parser.output();
+    if (status.ok() && !parser.data().has_future_times()) {
+        result_cache.store(key, output, parser.diagnostics());
+    }
+    return status;
+}
+
+LnkParser::Status
+parse_file(LnkParser::Parser& parser, const std::string& name, LnkOutput::StreamPtr& output)
+{
+    CollectStats stats(&name);
+    LnkParser::Status status;
+    if (use_cache()) {
+        status = parse_cached(parser, name, output);
+    } else {
+        parser.reset(name);
+        status = parser.try_parse();
+        count_file(status, parser.diagnostics(), parser.size());
+        output = parser.output();
+    }
+    if (!command_line.yaml) {
+        return status;
+    }
+    if (!status.ok()) {
+        std::cerr << name << ": " << status.message() << std::endl;
+    } else {
+        CodecPtr c = codecs.get(command_line.codepage);
+        LnkParser::StageTimer t(LnkParser::Stage::Output);
+        dump_yaml(std::cout, output, c, name, command_line.default_info_level);
+    }
+    return status;
+}
+
+//! nothing is written before all files are parsed
+static int
+dump_timeline(NameSource& names)
+{
+    LnkParser::Parser parser(LnkParser::FieldSelection::data_only());
+    CodecPtr c = codecs.get(command_line.codepage);
+    uint64_t failed = batch_counters.failed;
+    try {
+        LnkOutput::Timeline timeline(command_line.timeline, c, TIMELINE_MEMORY);
+        std::string n;
+        while (names.next(n)) {
+            CollectStats stats(&n);
+            parser.reset(n);
+            LnkParser::Status status = parser.try_parse();
+            count_file(status, parser.diagnostics(), parser.size());
+            if (!status.ok()) {
+                std::cerr << n << ": " << status.message() << std::endl;
+                if (command_line.stop_on_error) {
+                    return ERROR_PARSE;
+                }
+                continue;
+            }
+            LnkParser::StageTimer t(LnkParser::Stage::Output);
+            timeline.add(n, parser.data());
+        }
+        // sorting and writing belongs to no single file
+        CollectStats stats;
+        LnkParser::StageTimer t(LnkParser::Stage::Output);
+        timeline.write(std::cout);
+    }
+    catch (std::runtime_error& e) {
+        std::cerr << e.what() << std::endl;
+        return ERROR_PARSE;
+    }
+    return batch_counters.failed > failed ? ERROR_PARSE : 0;
+}
+
+//! results of the pipeline come here in input order, to be counted and written like those of
+//! the batches on one thread. false at the first file that failed with --stop-on-error.
+static bool
+write_item(PipelineItem& item, const Pipeline& pipeline)
+{
+    if (metrics) {
+        metrics->queue_depth("parse", pipeline.waiting_for_parse());
+        metrics->queue_depth("write", pipeline.waiting_for_write());
+    }
+    count_file(item.status, item.diag, item.size);
+    if (!item.status.ok()) {
+        std::cerr << item.name << ": " << item.status.message() << std::endl;
+        return !command_line.stop_on_error;
+    }
+    uint64_t start = console_count.count();
+    std::cout.write(item.text.data(), item.text.size());
+    if (command_line.stats != LnkParser::StatsFormat::None) {
+        item.stats.output_bytes = console_count.count() - start;
+        batch_stats.add(item.name, item.stats);
+    }
+    return true;
+}
+
+//! YAML or rows, read by one thread, parsed and formatted by the workers of --jobs.
+//! rows come from Parser::data(), no output trees are built for them. the files are names,
+//! or the members of --tar. with --cache, the workers look up YAML of files that did not
+//! change and store what they parse; members of --tar have no file to tell that by.
+static int
+dump_pipelined(NameSource& names)
+{
+    bool table = command_line.table != LnkOutput::TableFormat::None;
+    size_t jobs = command_line.jobs;
+    if (jobs == 0) {
+        jobs = std::max(1U, std::thread::hardware_concurrency());
+    }
+    // codec tables are loaded once and shared, Codec::string does not modify them
+    CodecPtr c = codecs.get(command_line.codepage);
+    if (table) {
+        LnkOutput::TableWriter(std::cout, command_line.table, c).header();
+    }
+    Pipeline pipeline(jobs, PIPELINE_SLOTS,
+                      table ? LnkParser::FieldSelection::data_only() : command_line.fields,
+                      CollectStats::collect());
+    // one writer per worker, for the rows. they write to streams of the pipeline,
+    // so they are declared after it and go first.
+    std::vector<std::unique_ptr<LnkOutput::TableWriter>> tables(jobs);
+    bool cache = !table && use_cache();
+    auto format = [&](size_t worker, LnkParser::Parser& parser, PipelineItem& item,
+                      std::ostream& out) {
+        if (!table) {
+            dump_yaml(out, parser.output(), c, item.name, command_line.default_info_level);
+            if (cache && item.have_stat && !parser.data().has_future_times()) {
+                result_cache.store(result_cache.key(item.st), parser.output(), item.diag);
+            }
+            return;
+        }
+        auto& t = tables[worker];
+        if (!t) {
+            t = std::make_unique<LnkOutput::TableWriter>(out, command_line.table, c);
+        }
+        t->row(item.name, parser.data());
+        t->flush();
+    };
+    auto make = [](NameSource& n) {
+        return file_source(n, PIPELINE_LOOKAHEAD, command_line.uring);
+    };
+    std::unique_ptr<PipelineSource> source;
+    if (tar_fd >= 0) {
+        source = std::make_unique<TarSource>(tar_fd, command_line.tar, command_line.tar_globs);
+    } else if (command_line.read_order != ReadOrder::Input) {
+        source = std::make_unique<SortedSource>(names, command_line.read_order,
+                                                READ_ORDER_WINDOW, make);
+    } else {
+        source = make(names);
+    }
+    Pipeline::Lookup lookup;
+    if (cache) {
+        lookup = [&](PipelineItem& item, std::ostream& out) {
+            LnkOutput::StreamPtr output;
+            if (!item.have_stat ||
+                !result_cache.lookup(result_cache.key(item.st), output, item.diag))
+            {
+                return false;
+            }
+            item.status = LnkParser::Status();
+            LnkParser::StageTimer t(LnkParser::Stage::Output);
+            dump_yaml(out, output, c, item.name, command_line.default_info_level);
+            return true;
+        };
+    }
+    uint64_t failed = batch_counters.failed;
+    pipeline.run(*source, format, [&](PipelineItem& item) {
+        return write_item(item, pipeline);
+    }, lookup);
+    return batch_counters.failed > failed ? ERROR_PARSE : 0;
+}
+
+int
+dump_files(NameSource& names)
+{
+    if (command_line.timeline != LnkOutput::TimelineFormat::None) {
+        return dump_timeline(names);
+    }
+    return dump_pipelined(names);
+}
+// }}}
@@ -0,0 +1,94 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#ifndef __CLI_H__
+#define __CLI_H__
+
+// command line and console output, shared by the GUI and the headless executable
+#include "encoding.h"
+#include "output.h"
+#include "parse.h"
+#include "pipeline.h"
+#include "stats.h"
+#include "table.h"
+#include "timeline.h"
+#include <list>
+#include <memory>
+#include <string>
+
+const int           ERROR_USAGE = 2;
+const int           ERROR_PARSE = 1;
+//! memory for sorting --timeline, more is sorted in temporary files
+const size_t        TIMELINE_MEMORY = 256 << 20;
+//! files in flight between reading and writing, and files opened ahead of the one being read
+//! when io_uring is not used
+const size_t        PIPELINE_SLOTS = 256;
+const size_t        PIPELINE_LOOKAHEAD = 32;
+//! files sorted together by --read-order. the results of those read early wait in memory
+const size_t        READ_ORDER_WINDOW = 16384;
+
+extern const char*  about_blurb;
+extern const char*  usage_text;
+
+struct CommandLine
+{
+    LnkOutput::InfoLevel    default_info_level = LnkOutput::NORMAL;
+    bool                    yaml = false;
+    bool                    gui = false;
+    std::string             codepage;
+    LnkParser::FieldSelection fields;
+    bool                    summary = false;
+    bool                    stop_on_error = false;  // end the batch at the first failed file
+    std::string             serve;      // socket path
+    std::string             cache;      // path of the result cache file
+    LnkOutput::TableFormat  table = LnkOutput::TableFormat::None;
+    LnkOutput::TimelineFormat timeline = LnkOutput::TimelineFormat::None;
+    LnkParser::StatsFormat  stats = LnkParser::StatsFormat::None;
+    std::string             trace;      // path of the Chrome trace
+    std::string             metrics;    // path of the Prometheus metrics file
+    double                  metrics_interval = 15;
+    unsigned                jobs = 0;   // parse workers, 0 is one per CPU
+    bool                    uring = true;   // read batches with io_uring where it works
+    ReadOrder               read_order = ReadOrder::Input;
+    std::string             files_from; // path of a list of files, - for stdin
+    bool                    null = false;   // the list is separated by NUL, not newlines
+    std::string             tar;        // path of a tar archive, - for stdin
+    std::list<std::string>  tar_globs;  // of the members to read
+    std::list<std::string>  files;
+};
+
+extern CommandLine                  command_line;
+extern CodecFactory                 codecs;
+//! errors and warnings of all files opened so far
+extern LnkParser::BatchCounters     batch_counters;
+//! where the time went, only collected with --stats
+extern LnkParser::BatchStats        batch_stats;
+
+void        usage();
+//! fill command_line, false on bad options
+bool        cmdline(int argc, char **argv);
+//! true if there are files on the command line, a list from --files-from or --tar
+bool        has_files();
+//! the files on the command line, then those of --files-from as they are read. only one of
+//! these goes through the list.
+std::unique_ptr<NameSource>
+            command_line_names();
+//! parse one file with a parser that is reused between files. counts its errors and warnings
+//! and prints the file or the error on the console if --yaml. output is parser.output(),
+//! or the earlier result from the cache if the file did not change.
+LnkParser::Status
+            parse_file(LnkParser::Parser& parser, const std::string& name,
+                       LnkOutput::StreamPtr& output);
+//! console only. files that fail to parse are reported on stderr, the batch goes on unless
+//! --stop-on-error and returns ERROR_PARSE at the end if any failed. one row per file with --csv
+//! or --tsv, events of all files with --timeline, otherwise YAML. rows and YAML are made by
+//! parallel workers, unless --cache is used.
+int         dump_files(NameSource& names);
+//! after all files, batch_stats on stderr with --stats, the events to a file with --trace and
+//! the last update of --metrics
+void        write_stats();
+
+#endif // #ifndef __CLI_H__
@@ -5,6 +5,7 @@
  *****/
 
 #include "encoding.h"
+#include "stats.h"
 
 //! append codepoint to an utf-8 string
 void
@@ -47,6 +48,14 @@ std::string
 utf16le_to_utf8(const std::u16string& uni)
 {
     std::string r;
+    utf16le_to_utf8(uni, r);
+    return r;
+}
+
+void
+utf16le_to_utf8(std::u16string_view uni, std::string& r)
+{
+    LnkParser::StageTimer t(LnkParser::Stage::Decode);
     size_t i = 0;
     const auto len = uni.length();
     while (i < len) {
@@ -62,7 +71,7 @@ utf16le_to_utf8(const std::u16string& uni)
             if (i < len) {
                 uint16_t c2 = uni.at(i);
                 i++;
-                if (c2 >= 0xDC00 && c2 >= 0xDFFF) {
+                if (c2 >= 0xDC00 && c2 <= 0xDFFF) {
                     // paired high surrogate
                     codepoint_t c = ((c1 - 0xD800) << 10) + (c2 - 0xDC00) + 0x10000;
                     utf8_append(r, c);
@@ -77,7 +86,6 @@ utf16le_to_utf8(const std::u16string& uni)
             }
         }
     }
-    return r;
 }
 
 //! first value is codepoint at pos, second value is number of bytes taken.
@@ -120,6 +128,28 @@ utf8_codepoint(const std::string_view& s, size_t pos)
     }
 }
 
+void
+utf8_to_utf16le(std::string_view s, std::u16string& out)
+{
+    size_t pos = 0;
+    while (pos < s.length()) {
+        auto [c, n] = utf8_codepoint(s, pos);
+        pos += n;
+        if (c >= 0xD800 && c <= 0xDFFF) {
+            // surrogates encoded in utf-8 are not valid
+            out.push_back(char16_t(invalid_repl));
+        } else if (c <= 0xFFFF) {
+            out.push_back(char16_t(c));
+        } else if (c <= 0x10FFFF) {
+            c -= 0x10000;
+            out.push_back(char16_t(0xD800 + (c >> 10)));
+            out.push_back(char16_t(0xDC00 + (c & 0x3FF)));
+        } else {
+            out.push_back(char16_t(invalid_repl));
+        }
+    }
+}
+
 struct DoublesDef
 {
     uint8_t                     leadingByte;
@@ -176,7 +206,7 @@ public:
     }
 
     std::pair<codepoint_t, size_t>
-    decode_char(const std::string& s, size_t pos)
+    decode_char(std::string_view s, size_t pos)
     {
         uint8_t c1 = s.at(pos);
         if (m_doubles[c1] != nullptr) {
@@ -207,7 +237,7 @@ public:
     }
 
     std::string
-    decode_string(const std::string &s)
+    decode_string(std::string_view s)
     {
         size_t pos = 0;
         std::string r;
@@ -237,8 +267,9 @@ Codec::~Codec()
 }
 
 std::string
-Codec::string(const std::string& s) const
+Codec::string(std::string_view s) const
 {
+    LnkParser::StageTimer t(LnkParser::Stage::Decode);
     CodecImpl *i = (CodecImpl*)p;
     std::string r = i->decode_string(s);
     return r;
@@ -10,6 +10,7 @@
 #include <array>
 #include <memory>
 #include <string>
+#include <string_view>
 
 //! unicode code point
 typedef uint32_t codepoint_t;
@@ -17,6 +18,12 @@ typedef uint32_t codepoint_t;
 //! convert from utf16le to utf8.
 std::string utf16le_to_utf8(const std::u16string& uni);
 
+//! convert from utf16le to utf8, appending to out (keeps its capacity).
+void utf16le_to_utf8(std::u16string_view uni, std::string& out);
+
+//! convert from utf8 to utf16le, appending to out. invalid sequences become invalid_repl.
+void utf8_to_utf16le(std::string_view s, std::u16string& out);
+
 //! first value is codepoint at pos, second value is number of bytes taken.
 //! second value is 0 if pos >= length of string.
 std::pair<codepoint_t, size_t> utf8_codepoint(const std::string_view& s, size_t pos);
@@ -43,7 +50,7 @@ public:
     ~Codec();
 
     size_t index() const { return m_index; }
-    std::string string(const std::string &s) const;
+    std::string string(std::string_view s) const;
 };
 
 typedef std::shared_ptr<Codec> CodecPtr;
@@ -57,6 +64,9 @@ private:
 public:
     CodecPtr
     get(size_t index) {
+        if (index >= m_managed.size()) {
+            return {};
+        }
         std::shared_ptr<Codec> m = m_managed[index];
         if (m) {
             return m;
@@ -0,0 +1,152 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+// lnkdump2k-fuzz, libFuzzer target for the parser. one Parser is reset for every input, nothing
+// is read from or written to disk. what parses is dumped, written again and parsed a second
+// time, so the outputs and the writer see the same odd structures as the parser. the second
+// parse must succeed and give the same YAML as the first, leaving out the diagnostics, which
+// point into the input. otherwise the writer and the parser disagree.
+// with clang, configure with -DWITH_FUZZER=ON. without it the target has a main() that runs
+// the files given on the command line, for reproducing a crash or running the seeds under
+// another sanitizer. "make fuzz-seeds" writes a seed corpus from the generator of the benchmark.
+#include "encoding.h"
+#include "output.h"
+#include "parse.h"
+#include "writer.h"
+
+// std
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <ostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+
+#ifdef FUZZ_STANDALONE
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+#endif
+
+//! throws away what is written
+class NullBuffer: public std::streambuf
+{
+protected:
+    int_type overflow(int_type c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+//! everything but diagnostics, their offsets are of the input and not of what was written
+static LnkParser::FieldSelection
+without_diagnostics()
+{
+    LnkParser::FieldSelection f;
+    f.diagnostics = false;
+    return f;
+}
+
+//! LnkStruct::ExtraData has room for one block of each known kind, so a file that repeats one
+//! is written with the last of them in every place
+static bool
+repeats_block(const LnkStruct::ExtraData& e)
+{
+    for (size_t i = 0; i < e.signatures.size(); i++) {
+        uint32_t s = e.signatures[i];
+        bool unknown = std::any_of(e.unknown.begin(), e.unknown.end(),
+                                   [s](const LnkStruct::UnknownDataBlock& u) {
+                                       return u.Signature == s;
+                                   });
+        if (!unknown && std::find(e.signatures.begin() + i + 1, e.signatures.end(), s) !=
+                        e.signatures.end())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+extern "C" int
+LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    static LnkParser::Parser parser;
+    static LnkParser::Parser plain(without_diagnostics());
+    static LnkParser::Parser again(without_diagnostics());
+    static CodecFactory codecs;
+    static NullBuffer null;
+    static std::ostream out(&null);
+    static std::string written;
+    static std::ostringstream first;
+    static std::ostringstream second;
+
+    // the size picks the codec, so ANSI strings go through all of them
+    CodecPtr codec = codecs.get(size % codec_defs.size());
+    parser.reset(reinterpret_cast<const char*>(data), size);
+    LnkParser::Status status = parser.try_parse();
+    LnkOutput::dump_yaml(out, parser.output(), codec, "fuzz.lnk", LnkOutput::DEBUG);
+    LnkOutput::dump_json(out, parser.output(), codec, "fuzz.lnk", LnkOutput::DEBUG);
+    if (!status.ok()) {
+        return 0;
+    }
+    written.clear();
+    try {
+        LnkWriter::write(parser.data(), written);
+    } catch (const LnkWriter::Error&) {
+        // strings longer than their fields, the file was not written by windows
+        return 0;
+    }
+    again.reset(written.data(), written.size());
+    if (!again.try_parse().ok()) {
+        abort();
+    }
+    if (repeats_block(parser.data().extra_data)) {
+        return 0;
+    }
+    plain.reset(reinterpret_cast<const char*>(data), size);
+    plain.try_parse();
+    first.str("");
+    second.str("");
+    LnkOutput::dump_yaml(first, plain.output(), codec, "fuzz.lnk", LnkOutput::DEBUG);
+    LnkOutput::dump_yaml(second, again.output(), codec, "fuzz.lnk", LnkOutput::DEBUG);
+    if (first.str() != second.str()) {
+        abort();
+    }
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+static void
+run(const std::filesystem::path& path)
+{
+    std::ifstream f(path, std::ios::binary);
+    std::vector<char> buf((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(buf.data()), buf.size());
+}
+
+//! runs every file given, directories recursively
+int
+main(int argc, char **argv)
+{
+    size_t count = 0;
+    for (int i = 1; i < argc; i++) {
+        if (std::filesystem::is_directory(argv[i])) {
+            for (const auto& e: std::filesystem::recursive_directory_iterator(argv[i])) {
+                if (e.is_regular_file()) {
+                    run(e.path());
+                    count++;
+                }
+            }
+        } else {
+            run(argv[i]);
+            count++;
+        }
+    }
+    std::cerr << count << " inputs" << std::endl;
+    return 0;
+}
+#endif
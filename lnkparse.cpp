@@ -0,0 +1,335 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#include "lnkparse.h"
+#include "encoding.h"
+#include "output.h"
+#include "parse.h"
+#include <cstdio>
+#include <cstring>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <vector>
+
+static_assert(LNK_BAD_NETWORK_LINK_FLAGS == int(LnkParser::ErrorKind::BadNetworkLinkFlags));
+static_assert(LNK_UNIX_TIME == int(LnkOutput::IntegerValue::UnixTime));
+static_assert(LNK_FILETIME == int(LnkOutput::IntegerValue::FileTime));
+
+// memory resource over the hooks of the caller
+class HookResource: public std::pmr::memory_resource
+{
+private:
+    lnk_allocator       m_hooks;
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        void* p = m_hooks.alloc(m_hooks.ctx, bytes, alignment);
+        if (p == nullptr) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override
+    {
+        m_hooks.free(m_hooks.ctx, p, bytes, alignment);
+    }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+public:
+    HookResource(const lnk_allocator& hooks): m_hooks(hooks) { }
+};
+
+struct lnk_parser
+{
+    std::pmr::memory_resource*  memory;     // where this struct and output trees live
+    HookResource                hooks;
+    LnkParser::Parser           parser;
+    CodecFactory                codecs;
+    CodecPtr                    codec;
+    LnkOutput::InfoLevel        level;
+    std::string                 string;     // scratch for converted strings
+    std::vector<uint8_t>        array;      // scratch for arrays
+
+    lnk_parser(const lnk_allocator& a, const LnkParser::FieldSelection& fields):
+        memory(&hooks), hooks(a), parser(fields, &hooks), level(LnkOutput::NORMAL) { }
+    lnk_parser(const LnkParser::FieldSelection& fields):
+        memory(std::pmr::new_delete_resource()), hooks(lnk_allocator()), parser(fields),
+        level(LnkOutput::NORMAL) { }
+};
+
+// walk the output tree and hand each field to the sink {{{
+class SinkVisitor: public LnkOutput::OutputVisitor
+{
+private:
+    lnk_parser&         m_parser;
+    lnk_sink            m_sink;
+    void*               m_user;
+    bool                m_stopped;
+
+    void emit(lnk_field& f)
+    {
+        if (!m_stopped && m_sink(m_user, &f) != 0) {
+            m_stopped = true;
+        }
+    }
+
+    static lnk_field field(int type, const char* name)
+    {
+        lnk_field f;
+        std::memset(&f, 0, sizeof(f));
+        f.type = type;
+        f.name = name;
+        return f;
+    }
+
+    static void set_string(lnk_field& f, std::string_view s)
+    {
+        f.string = s.data();
+        f.length = s.size();
+    }
+
+public:
+    SinkVisitor(lnk_parser& parser, lnk_sink sink, void* user):
+        m_parser(parser), m_sink(sink), m_user(user), m_stopped(false) { }
+
+    bool stopped() const { return m_stopped; }
+
+    virtual void visit(const LnkOutput::IntegerValue* v)
+    {
+        lnk_field f = field(LNK_INTEGER, v->name());
+        f.integer = v->value();
+        f.form = int(v->form());
+        emit(f);
+    }
+
+    virtual void visit(const LnkOutput::StringValue* v)
+    {
+        lnk_field f = field(LNK_STRING, v->name());
+        if (v->is_utf8() || !m_parser.codec) {
+            set_string(f, v->string());
+            f.utf8 = v->is_utf8();
+        } else {
+            m_parser.string = m_parser.codec->string(v->string());
+            set_string(f, m_parser.string);
+            f.utf8 = 1;
+        }
+        emit(f);
+    }
+
+    virtual void visit(const LnkOutput::EnumeratedValue* v)
+    {
+        lnk_field f = field(LNK_ENUM, v->name());
+        f.integer = v->value();
+        if (v->describe() != nullptr) {
+            set_string(f, v->describe());
+            f.utf8 = 1;
+        }
+        emit(f);
+    }
+
+    virtual void visit(const LnkOutput::BitValue* v)
+    {
+        lnk_field f = field(LNK_BITS, v->name());
+        f.integer = v->value();
+        m_parser.string = LnkOutput::bitfield_as_string(v);
+        set_string(f, m_parser.string);
+        f.utf8 = 1;
+        emit(f);
+    }
+
+    virtual void visit(const LnkOutput::ArrayValue* v)
+    {
+        lnk_field f = field(LNK_ARRAY, v->name());
+        auto& a = m_parser.array;
+        a.clear();
+        for (size_t i = 0; i < v->size(); i++) {
+            uint64_t e = v->at(i);
+            for (size_t j = 0; j < v->element_size(); j++) {
+                a.push_back(uint8_t(e >> (8 * j)));
+            }
+        }
+        f.data = a.data();
+        f.length = v->size();
+        f.element_size = v->element_size();
+        emit(f);
+    }
+
+    virtual void visit(const LnkOutput::StructValue* v)
+    {
+        lnk_field f = field(LNK_STRUCT_BEGIN, v->name());
+        emit(f);
+        v->nest(this, m_parser.level);
+        f.type = LNK_STRUCT_END;
+        emit(f);
+    }
+};
+// }}}
+
+static int
+set_status(lnk_status* status, int result, const char* message)
+{
+    if (status != nullptr) {
+        status->result = result;
+        status->offset = 0;
+        status->value = 0;
+        snprintf(status->message, sizeof(status->message), "%s", message);
+    }
+    return result;
+}
+
+static int
+set_status(lnk_status* status, const LnkParser::Status& s)
+{
+    int result = int(s.kind);
+    if (status != nullptr) {
+        set_status(status, result, s.message().c_str());
+        status->offset = s.offset;
+        status->value = s.value;
+    }
+    return result;
+}
+
+//! a parser for opts in parser, or the reason why there is none: LNK_BAD_OPTIONS,
+//! LNK_NO_MEMORY or LNK_INTERNAL_ERROR
+static int
+new_parser(const lnk_options* opts, lnk_parser*& parser, lnk_status* status)
+{
+    lnk_options defaults;
+    std::memset(&defaults, 0, sizeof(defaults));
+    if (opts == nullptr) {
+        opts = &defaults;
+    }
+    void* mem = nullptr;
+    lnk_parser* p = nullptr;
+    parser = nullptr;
+    auto release = [&] {
+        if (p != nullptr) {
+            lnk_parser_free(p);
+        } else if (mem != nullptr) {
+            opts->allocator->free(opts->allocator->ctx, mem, sizeof(lnk_parser),
+                                  alignof(lnk_parser));
+        }
+    };
+    try {
+        LnkParser::FieldSelection fields;
+        if (opts->fields != nullptr) {
+            fields = LnkParser::FieldSelection::parse(opts->fields);
+        }
+        if (opts->allocator != nullptr) {
+            const lnk_allocator& a = *opts->allocator;
+            mem = a.alloc(a.ctx, sizeof(lnk_parser), alignof(lnk_parser));
+            if (mem == nullptr) {
+                return set_status(status, LNK_NO_MEMORY, "Out of memory");
+            }
+            p = new (mem) lnk_parser(a, fields);
+        } else {
+            p = new lnk_parser(fields);
+        }
+        p->level = opts->all ? LnkOutput::DEBUG : LnkOutput::NORMAL;
+        if (opts->codepage != nullptr) {
+            p->codec = p->codecs.get(opts->codepage);
+            if (!p->codec) {
+                lnk_parser_free(p);
+                return set_status(status, LNK_BAD_OPTIONS, "Unknown codepage");
+            }
+        }
+        parser = p;
+        return set_status(status, LNK_OK, "");
+    }
+    catch (LnkParser::Error& e) {
+        // only FieldSelection::parse throws it here
+        release();
+        return set_status(status, LNK_BAD_OPTIONS, e.what());
+    }
+    catch (std::bad_alloc&) {
+        release();
+        return set_status(status, LNK_NO_MEMORY, "Out of memory");
+    }
+    catch (std::exception& e) {
+        release();
+        return set_status(status, LNK_INTERNAL_ERROR, e.what());
+    }
+    catch (...) {
+        release();
+        return set_status(status, LNK_INTERNAL_ERROR, "Unknown error");
+    }
+}
+
+extern "C" {
+
+lnk_parser*
+lnk_parser_new(const lnk_options* opts)
+{
+    lnk_parser* p;
+    new_parser(opts, p, nullptr);
+    return p;
+}
+
+void
+lnk_parser_free(lnk_parser* parser)
+{
+    if (parser == nullptr) {
+        return;
+    }
+    std::pmr::memory_resource* memory = parser->memory;
+    if (memory == std::pmr::new_delete_resource()) {
+        delete parser;
+    } else {
+        // the hooks are a member, keep a copy for freeing the parser itself
+        HookResource hooks = parser->hooks;
+        parser->~lnk_parser();
+        hooks.deallocate(parser, sizeof(lnk_parser), alignof(lnk_parser));
+    }
+}
+
+int
+lnk_parser_parse(lnk_parser* parser, const void* ptr, size_t len, lnk_sink sink, void* user,
+                 lnk_status* status)
+{
+    try {
+        parser->parser.reset((const char*)ptr, len);
+        LnkParser::Status s = parser->parser.try_parse();
+        if (!s.ok()) {
+            return set_status(status, s);
+        }
+        if (sink != nullptr) {
+            SinkVisitor v(*parser, sink, user);
+            LnkOutput::StreamPtr o = parser->parser.output();
+            o->accept(&v, parser->level);
+            if (v.stopped()) {
+                return set_status(status, LNK_STOPPED, "Stopped by sink");
+            }
+        }
+        return set_status(status, LNK_OK, "");
+    }
+    catch (std::bad_alloc&) {
+        return set_status(status, LNK_NO_MEMORY, "Out of memory");
+    }
+    catch (std::exception& e) {
+        return set_status(status, LNK_INTERNAL_ERROR, e.what());
+    }
+}
+
+int
+lnk_parse_buffer(const void* ptr, size_t len, const lnk_options* opts, lnk_sink sink,
+                 void* user, lnk_status* status)
+{
+    lnk_parser* parser;
+    int r = new_parser(opts, parser, status);
+    if (parser == nullptr) {
+        return r;
+    }
+    r = lnk_parser_parse(parser, ptr, len, sink, user, status);
+    lnk_parser_free(parser);
+    return r;
+}
+
+}  // extern "C"
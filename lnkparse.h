@@ -0,0 +1,122 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#ifndef LNKPARSE_H
+#define LNKPARSE_H
+
+// C interface of the lnkparse library, for embedding the parser in other languages.
+// parsing a file walks its output tree and calls a sink for every field, in the same order
+// as lnkdump2k -y prints them. no C++ exceptions leave these functions.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//! return values. positive values are the parse errors of LnkParser::ErrorKind.
+enum lnk_result
+{
+    LNK_OK = 0,
+    LNK_IO_ERROR = 1,
+    LNK_TRUNCATED = 2,
+    LNK_INTEGER_OVERFLOW = 3,
+    LNK_BAD_HEADER_SIZE = 4,
+    LNK_BAD_MAGIC = 5,
+    LNK_BAD_LINK_FLAGS = 6,
+    LNK_BAD_LINK_INFO_HEADER_SIZE = 7,
+    LNK_BAD_LENGTH = 8,
+    LNK_BAD_OFFSET = 9,
+    LNK_BAD_NETWORK_LINK_FLAGS = 10,
+    LNK_STOPPED = -1,           // sink returned non-zero
+    LNK_BAD_OPTIONS = -2,       // unknown field name or codepage
+    LNK_NO_MEMORY = -3,         // allocation hook returned NULL
+    LNK_INTERNAL_ERROR = -4
+};
+
+//! memory hooks, called with 'ctx'. alloc returns NULL on failure. they provide the parser
+//! and the memory of output trees, which is most of it; smaller buffers come from new.
+typedef struct lnk_allocator
+{
+    void*       (*alloc)(void* ctx, size_t size, size_t alignment);
+    void        (*free)(void* ctx, void* ptr, size_t size, size_t alignment);
+    void*       ctx;
+} lnk_allocator;
+
+typedef struct lnk_options
+{
+    const char*             fields;     // NULL for all, otherwise the same as lnkdump2k -f
+    const char*             codepage;   // NULL to pass non-unicode strings as they are
+    int                     all;        // non-zero to include the fields of lnkdump2k -a
+    const lnk_allocator*    allocator;  // NULL for new/delete
+} lnk_options;
+
+enum lnk_field_type
+{
+    LNK_INTEGER,        // integer, form
+    LNK_STRING,         // string, length, utf8
+    LNK_ENUM,           // integer, string is the name of the value or NULL
+    LNK_BITS,           // integer, string lists names of the set bits
+    LNK_ARRAY,          // data, length elements of element_size bytes, little endian
+    LNK_STRUCT_BEGIN,   // fields until the matching LNK_STRUCT_END are nested in this one
+    LNK_STRUCT_END
+};
+
+enum lnk_integer_form
+{
+    LNK_DECIMAL,
+    LNK_HEX,
+    LNK_FILE_SIZE,
+    LNK_UNIX_TIME,
+    LNK_FILETIME            // 100 ns since 1601-01-01 UTC
+};
+
+//! one field. pointers are only valid during the call of the sink.
+typedef struct lnk_field
+{
+    int                     type;       // lnk_field_type
+    const char*             name;       // NUL-terminated, static
+    int64_t                 integer;
+    int                     form;       // lnk_integer_form
+    const char*             string;     // not NUL-terminated, see length
+    size_t                  length;
+    int                     utf8;       // 0 if string is in the codepage of the file
+    const void*             data;
+    size_t                  element_size;
+} lnk_field;
+
+//! return non-zero to stop parsing
+typedef int (*lnk_sink)(void* user, const lnk_field* field);
+
+//! error details. message is NUL-terminated.
+typedef struct lnk_status
+{
+    int                     result;     // lnk_result
+    uint64_t                offset;
+    uint64_t                value;
+    char                    message[256];
+} lnk_status;
+
+//! parser that keeps its memory between files. NULL if options are bad or memory runs out.
+//! one parser must not be used by two threads at the same time.
+typedef struct lnk_parser lnk_parser;
+lnk_parser*     lnk_parser_new(const lnk_options* opts);
+void            lnk_parser_free(lnk_parser* parser);
+//! parse a file in memory, it is not copied. status can be NULL. returns lnk_result.
+int             lnk_parser_parse(lnk_parser* parser, const void* ptr, size_t len,
+                                 lnk_sink sink, void* user, lnk_status* status);
+
+//! one-shot version of the above, for occasional files. LNK_BAD_OPTIONS or LNK_NO_MEMORY if
+//! no parser can be made for opts.
+int             lnk_parse_buffer(const void* ptr, size_t len, const lnk_options* opts,
+                                 lnk_sink sink, void* user, lnk_status* status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // LNKPARSE_H
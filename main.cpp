@@ -8,12 +8,14 @@
 #include "about.h"
 #include "blank.h"
 #include "lnk.h"
-#include "config.h"
 
 // main project
+#include "cli.h"
 #include "parse.h"
 #include "main.h"
+#include "serve.h"
 #include "output.h"
+#include "output_fltk.h"
 #include "struct.h"
 #include "themes.h"
 #include <FL/Fl_Double_Window.H>
@@ -24,7 +26,6 @@
 
 // std
 #include <filesystem>
-#include <getopt.h>
 #include <list>
 #include <string>
 #include <iostream>
@@ -34,31 +35,9 @@
 
 // globals {{{
 MainGui*            state;
-CodecFactory        codecs;
 
-static const int    ERROR_USAGE = 2;
-static const int    ERROR_PARSE = 1;
 static const int    MAX_GUI_ERROR_MSGS = 5;
 
-static const char *about_blurb =
-    "lnkump2000 " VERSION "\n"
-    "This program is free software: you can redistribute it and/or modify\n"
-    "it under the terms of the GNU General Public License as published by\n"
-    "the Free Software Foundation, either version 3 of the License, or\n"
-    "(at your option) any later version.\n"
-    "See file COPYING or https://www.gnu.org/licenses/gpl-3.0.txt\n";
-
-static const char *usage_text =
-    "Command line options:\n"
-    "   -h, --help          show this message and exit\n"
-    "   -a, --all           show more fields\n"
-    "   -y, --yaml          show output in YAML on the console\n"
-    "   -g, --gui           show output on GUI\n"
-    "   -c, --codepage X    if the file contains non-Unicode strings,\n"
-    "                       convert them using this codepage\n"
-    "Return value is always 0 if GUI is showing,\n"
-    "otherwise 0 for success, 1 for parse error, 2 for command line error.\n";
-
 static const char *shill_text =
     "You can send me some crypto if you're a cool hacker:\n"
     "XMR: 82tcaucC9ZHMSdT86omiTpVN2oQRghkHcRmRWhpLP1xDY2XMdDFRH77Jiuwh1Mdq6Y2M5mfBvwWGGCNyNhMWziPESWt7zuu\n"
@@ -67,69 +46,6 @@ static const char *shill_text =
 int open_files(const std::list<std::string>& names);
 // }}}
 
-// command line {{{
-static struct {
-    LnkOutput::InfoLevel    default_info_level = LnkOutput::NORMAL;
-    bool                    yaml = false;
-    bool                    gui = false;
-    std::string             codepage;
-    std::list<std::string>  files;
-} command_line;
-
-static void
-usage()
-{
-    std::cerr << about_blurb << usage_text;
-}
-
-static bool
-cmdline(int argc, char **argv)
-{
-    static struct option long_options[] = {
-        {"help",            no_argument, 0,             'h'},
-        {"all",             no_argument, 0,             'a'},
-        {"yaml",            no_argument, 0,             'y'},
-        {"gui",             no_argument, 0,             'g'},
-        {"codepage",        required_argument, 0,       'c'},
-        {NULL,              0, 0, 0}
-    };
-    while (true) {
-        int c = getopt_long(argc, argv, "haygc:", long_options, nullptr);
-        if (c == -1) {
-            break;
-        }
-        switch (c) {
-            case 'h':
-                usage();
-                exit(0);
-            case 'a':
-                command_line.default_info_level = LnkOutput::DEBUG;
-                break;
-            case 'y':
-                command_line.yaml = true;
-                break;
-            case 'g':
-                command_line.gui = true;
-                break;
-            case 'c':
-                errno = 0;
-                command_line.codepage = std::string(optarg);
-                if (errno != 0) {
-                    return false;
-                }
-                break;
-            default:
-                return false;
-        }
-    }
-    while (optind < argc) {
-        auto canon = std::filesystem::weakly_canonical(argv[optind++]).string();
-        command_line.files.emplace_back(canon);
-    }
-    return true;
-}
-// }}}
-
 // GUI {{{
 std::optional<std::string>
 urldecode(const std::string_view& v)
@@ -402,34 +318,25 @@ open_files(const std::list<std::string>& names)
 {
     std::list<std::string> error_names;
     std::list<std::string> error_msgs;
+    bool failed = false;
+    // one parser for all files, so its buffers are reused
+    LnkParser::Parser parser(command_line.fields);
     for (auto& n : names) {
-        try {
-            LnkParser::Parser parser(n);
-            parser.parse();
-            LnkOutput::StreamPtr o = parser.output();
-            if (command_line.yaml) {
-                CodecPtr c = codecs.get(command_line.codepage);
-                dump_yaml(std::cout, o, c, n, command_line.default_info_level);
-            }
-            if (command_line.gui && state) {
-                state->open_file(std::move(o), n);
-            }
-        }
-        catch (LnkParser::Error &e) {
-            // if we're doing console output, then put the error on console
-            if (command_line.yaml) {
-                std::cerr << n << ": " << e.what() << std::endl;
-            }
+        // if we're doing console output, this puts the file or the error on console
+        LnkOutput::StreamPtr output;
+        LnkParser::Status status = parse_file(parser, n, output);
+        if (!status.ok()) {
             // at the same time, if we're showing the GUI, log the message
             // and keep opening files
+            failed = true;
             if (command_line.gui) {
-                error_names.emplace_back(std::move(n));
-                error_msgs.emplace_back(std::string(e.what()));
-                continue;
-            } else {
-                // if we're not showing the GUI then bail
-                return ERROR_PARSE;
+                error_names.emplace_back(n);
+                error_msgs.emplace_back(status.message());
             }
+            continue;
+        }
+        if (command_line.gui && state) {
+            state->open_file(output, n);
         }
     }
     // show error summary on gui
@@ -448,9 +355,8 @@ open_files(const std::list<std::string>& names)
             }
         }
         state->error_msg(s.str() + ((error_names.size() > i) ? "..." : ""));
-        return ERROR_PARSE;
     }
-    return 0;
+    return failed ? ERROR_PARSE : 0;
 }
 
 int
@@ -460,29 +366,47 @@ main(int argc, char** argv)
         usage();
         return ERROR_USAGE;
     }
-    if (!command_line.gui && !command_line.yaml) {
+    if (!command_line.serve.empty()) {
+        // no GUI for the server
+        return serve(command_line.serve);
+    }
+    // tables, timelines, long lists of files and archives are for the console only
+    bool console = command_line.table != LnkOutput::TableFormat::None ||
+                   command_line.timeline != LnkOutput::TimelineFormat::None ||
+                   !command_line.files_from.empty() || !command_line.tar.empty();
+    if (!console && !command_line.gui && !command_line.yaml) {
         if (isatty(0)) {
             command_line.yaml = true;
         } else {
             command_line.gui = true;
         }
     }
-    state = command_line.gui ? new MainGui() : nullptr;
-    int ret = 0;
-    if (command_line.files.empty()) {
-        if (state != nullptr) {
-            state->open_blank();
-        } else {
+    if (console || !command_line.gui) {
+        // the same batch as lnkdump2k-cli, so -j, --no-uring and --read-order apply
+        command_line.yaml = true;
+        int ret = 0;
+        if (!has_files()) {
             usage();
+        } else {
+            ret = dump_files(*command_line_names());
         }
-    } else {
-        ret = open_files(command_line.files);
+        if (command_line.summary) {
+            batch_counters.print(std::cerr);
+        }
+        write_stats();
+        return ret;
     }
-    if (state != nullptr) {
-        Fl::run();
-        return 0;
+    state = new MainGui();
+    if (command_line.files.empty()) {
+        state->open_blank();
     } else {
-        return ret;
+        open_files(command_line.files);
     }
+    if (command_line.summary) {
+        batch_counters.print(std::cerr);
+    }
+    write_stats();
+    Fl::run();
+    return 0;
 }
 // }}}
@@ -0,0 +1,38 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+// lnkdump2k-cli, the same as lnkdump2k -y, without FLTK
+#include "cli.h"
+#include "serve.h"
+#include <iostream>
+
+int
+main(int argc, char** argv)
+{
+    if (!cmdline(argc, argv)) {
+        usage();
+        return ERROR_USAGE;
+    }
+    if (command_line.gui) {
+        std::cerr << "lnkdump2k-cli has no GUI, use lnkdump2k" << std::endl;
+        return ERROR_USAGE;
+    }
+    if (!command_line.serve.empty()) {
+        return serve(command_line.serve);
+    }
+    command_line.yaml = true;
+    int ret = 0;
+    if (!has_files()) {
+        usage();
+    } else {
+        ret = dump_files(*command_line_names());
+    }
+    if (command_line.summary) {
+        batch_counters.print(std::cerr);
+    }
+    write_stats();
+    return ret;
+}
@@ -0,0 +1,151 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#include "metrics.h"
+#include "output.h"
+
+// std
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+
+// posix
+#include <unistd.h>
+
+namespace LnkOutput {
+
+//! resident set size from /proc, 0 where there is none
+static uint64_t
+resident_bytes()
+{
+    std::ifstream statm("/proc/self/statm");
+    uint64_t size = 0, resident = 0;
+    if (!(statm >> size >> resident)) {
+        return 0;
+    }
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+//! # HELP and # TYPE lines before the samples of a metric
+static void
+describe(std::ostream& out, const char* name, const char* type, const char* help)
+{
+    out << "# HELP lnkdump2k_" << name << " " << help << "\n";
+    out << "# TYPE lnkdump2k_" << name << " " << type << "\n";
+}
+
+//! one sample per value, in hex, and one for the values that were not counted on their own
+static void
+value_counts(std::ostream& out, const char* name, const char* label,
+             const LnkParser::ValueCounts& counts)
+{
+    for (const auto& [value, count]: counts.counts) {
+        out << name << "{" << label << "=\"" << hex(int64_t(value)) << "\"} " << count << "\n";
+    }
+    if (counts.other > 0) {
+        out << name << "{" << label << "=\"other\"} " << counts.other << "\n";
+    }
+}
+
+MetricsFile::MetricsFile(const std::string& path, double interval):
+    m_path(path),
+    m_interval(std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(interval))),
+    m_last(Clock::now()), m_last_files(0), m_last_bytes(0)
+{
+}
+
+void
+MetricsFile::queue_depth(const std::string& queue, size_t depth)
+{
+    for (auto& q: m_queues) {
+        if (q.first == queue) {
+            q.second = depth;
+            return;
+        }
+    }
+    m_queues.emplace_back(queue, depth);
+}
+
+void
+MetricsFile::update(const LnkParser::BatchCounters& counters)
+{
+    if (Clock::now() - m_last >= m_interval) {
+        write(counters);
+    }
+}
+
+bool
+MetricsFile::write(const LnkParser::BatchCounters& counters)
+{
+    using namespace LnkParser;
+    Clock::time_point now = Clock::now();
+    double seconds = std::chrono::duration<double>(now - m_last).count();
+    std::ostringstream out;
+    describe(out, "files_total", "counter", "Files that were opened.");
+    out << "lnkdump2k_files_total " << counters.files << "\n";
+    describe(out, "files_failed_total", "counter", "Files that could not be parsed.");
+    out << "lnkdump2k_files_failed_total " << counters.failed << "\n";
+    describe(out, "files_with_warnings_total", "counter", "Files with at least one warning.");
+    out << "lnkdump2k_files_with_warnings_total " << counters.with_warnings << "\n";
+    describe(out, "read_bytes_total", "counter", "Bytes of the files that were read.");
+    out << "lnkdump2k_read_bytes_total " << counters.bytes << "\n";
+    describe(out, "files_per_second", "gauge", "Files since the last update, per second.");
+    out << "lnkdump2k_files_per_second "
+        << (seconds > 0 ? (counters.files - m_last_files) / seconds : 0) << "\n";
+    describe(out, "read_bytes_per_second", "gauge", "Bytes since the last update, per second.");
+    out << "lnkdump2k_read_bytes_per_second "
+        << (seconds > 0 ? (counters.bytes - m_last_bytes) / seconds : 0) << "\n";
+    describe(out, "errors_total", "counter", "Files that failed, by kind of error.");
+    for (size_t i = 0; i < ERROR_KINDS; i++) {
+        if (ErrorKind(i) != ErrorKind::None) {
+            out << "lnkdump2k_errors_total{kind=\"" << error_name(ErrorKind(i)) << "\"} "
+                << counters.errors[i] << "\n";
+        }
+    }
+    describe(out, "warnings_total", "counter", "Warnings, by kind.");
+    for (size_t i = 0; i < WARNING_KINDS; i++) {
+        out << "lnkdump2k_warnings_total{kind=\"" << warning_name(WarningKind(i)) << "\"} "
+            << counters.warnings[i] << "\n";
+    }
+    describe(out, "unknown_shell_items_total", "counter",
+             "Unknown shell items, by class type, the first ones that came up and other.");
+    value_counts(out, "lnkdump2k_unknown_shell_items_total", "class_type",
+                 counters.unknown_shell_items);
+    describe(out, "unknown_extra_data_blocks_total", "counter",
+             "Unknown extra data blocks, by signature, the first ones that came up and other.");
+    value_counts(out, "lnkdump2k_unknown_extra_data_blocks_total", "signature",
+                 counters.unknown_blocks);
+    if (!m_queues.empty()) {
+        describe(out, "queue_depth", "gauge", "Items waiting in a queue between stages.");
+        for (const auto& q: m_queues) {
+            out << "lnkdump2k_queue_depth{queue=\"" << q.first << "\"} " << q.second << "\n";
+        }
+    }
+    describe(out, "resident_memory_bytes", "gauge", "Resident set size.");
+    out << "lnkdump2k_resident_memory_bytes " << resident_bytes() << "\n";
+    describe(out, "last_update_seconds", "gauge", "Unix time of this update.");
+    out << "lnkdump2k_last_update_seconds " << std::time(nullptr) << "\n";
+
+    m_last = now;
+    m_last_files = counters.files;
+    m_last_bytes = counters.bytes;
+    // the collector only reads *.prom, so it does not see the temporary file
+    std::string tmp = m_path + ".tmp";
+    {
+        std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+        f << out.str();
+        f.flush();
+        if (!f) {
+            std::remove(tmp.c_str());
+            return false;
+        }
+    }
+    return std::rename(tmp.c_str(), m_path.c_str()) == 0;
+}
+
+};  // namespace LnkOutput
@@ -0,0 +1,46 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+// counters of a long batch in the Prometheus text format, for the textfile collector of the
+// node exporter. nothing listens on the network, the file is rewritten every few seconds.
+
+#include "parse.h"
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace LnkOutput {
+
+class MetricsFile
+{
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    std::string         m_path;
+    Clock::duration     m_interval;
+    Clock::time_point   m_last;
+    uint64_t            m_last_files;
+    uint64_t            m_last_bytes;
+    std::vector<std::pair<std::string, size_t>> m_queues;
+
+public:
+    //! written every interval seconds to path, through a temporary file next to it
+    MetricsFile(const std::string& path, double interval);
+    //! depth of a queue, shown from the next write on
+    void queue_depth(const std::string& queue, size_t depth);
+    //! write if the interval has passed since the last time, cheap enough for every file
+    void update(const LnkParser::BatchCounters& counters);
+    //! write now, replacing the file in one rename. false if it could not be written.
+    bool write(const LnkParser::BatchCounters& counters);
+};
+
+};  // namespace LnkOutput
+
+#endif  // METRICS_H
@@ -4,40 +4,92 @@
  * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
  *****/
 
+#include "civil.h"
 #include "output.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstddef>
+#include <cstring>
 #include <ctime>
-#include <list>
 #include <string>
 #include <iostream>
-#include <FL/Fl.H>
-#include <FL/Fl_Browser.H>
 
 namespace LnkOutput {
 
-static std::string
-iso8601_time(time_t unix_time)
+// arena {{{
+
+const size_t ARENA_BLOCK_SIZE = 16 * 1024;
+const size_t ARENA_BLOCK_ALIGN = alignof(std::max_align_t);
+
+Arena::~Arena()
 {
-    char buf[256] = "";
-    std::tm tm = *std::gmtime(&unix_time);
-    strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
-    return std::string(buf);
+    for (auto& b : m_blocks) {
+        m_upstream->deallocate(b.data, b.size, b.alignment);
+    }
+}
+
+void*
+Arena::do_allocate(size_t bytes, size_t alignment)
+{
+    while (m_current < m_blocks.size()) {
+        Block& b = m_blocks[m_current];
+        size_t start = (m_used + alignment - 1) & ~(alignment - 1);
+        if (start <= b.size && bytes <= b.size - start) {
+            m_used = start + bytes;
+            return b.data + start;
+        }
+        m_current++;
+        m_used = 0;
+    }
+    Block b;
+    b.size = std::max(ARENA_BLOCK_SIZE, bytes);
+    b.alignment = std::max(ARENA_BLOCK_ALIGN, alignment);
+    m_blocks.reserve(m_blocks.size() + 1);  // so the block is not lost if push_back throws
+    b.data = (std::byte*)m_upstream->allocate(b.size, b.alignment);
+    m_blocks.push_back(b);
+    m_current = m_blocks.size() - 1;
+    m_used = bytes;
+    return b.data;
 }
 
-static std::string
+// }}}
+
+std::string
+iso8601_time(time_t unix_time, int32_t hundred_ns)
+{
+    char buf[Civil::ISO8601_SIZE];
+    return std::string(buf, Civil::format_iso8601(buf, unix_time, hundred_ns));
+}
+
+std::string
+iso8601_time(LnkStruct::MSTimeProperty time)
+{
+    int32_t f = time.hundred_ns();
+    return iso8601_time(time.unix_time(), f != 0 ? f : -1);
+}
+
+//! like ctime, but in UTC
+std::string
 human_time(time_t unix_time)
 {
-    char buf[256] = "";
-    ctime_r(&unix_time, buf);
+    static const char* const days[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static const char* const months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                         "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+    Civil::DateTime t = Civil::from_unix(unix_time);
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s %s %2u %02u:%02u:%02u %" PRId64 " UTC",
+             days[t.weekday], months[t.date.month - 1], t.date.day, t.hour, t.minute, t.second,
+             t.date.year);
     return std::string(buf);
 }
 
-static const char*
+const char*
 safe_string(const char* d)
 {
     return d ? d : "Unknown";
 }
 
-static std::string
+std::string
 bitfield_as_string(const BitValue* f)
 {
     bool first = true;
@@ -57,7 +109,7 @@ bitfield_as_string(const BitValue* f)
     return s;
 }
 
-static std::string
+std::string
 hex(int64_t value)
 {
     char buf[64];
@@ -65,7 +117,7 @@ hex(int64_t value)
     return std::string{buf};
 }
 
-static std::string
+std::string
 hex(const ArrayValue* f)
 {
     const char* fmt;
@@ -94,7 +146,7 @@ hex(const ArrayValue* f)
     return s;
 }
 
-static std::string
+std::string
 as_file_size(int64_t value)
 {
     if (value < 0) {
@@ -138,7 +190,7 @@ protected:
         }
     }
 
-    static std::string escape(const std::string& s)
+    static std::string escape(std::string_view s)
     {
         size_t pos = 0;
         std::string r;
@@ -191,6 +243,9 @@ public:
             case IntegerValue::UnixTime:
                 s = iso8601_time(f->value());
                 break;
+            case IntegerValue::FileTime:
+                s = iso8601_time(LnkStruct::MSTimeProperty(f->value()));
+                break;
             default:
                 s = std::to_string(f->value());
         }
@@ -248,119 +303,190 @@ void dump_yaml(std::ostream& out, const StreamPtr& stream, CodecPtr codec,
     d.dump(stream, name);
 }
 
-// FLTK
+// JSON
 //------------------------------------------------------------------------
 
-class FltkDumper: public OutputVisitor
+std::string
+json_quote(std::string_view s)
+{
+    std::string r;
+    r.reserve(s.size() + 2);
+    r.push_back('"');
+    std::pair<codepoint_t, size_t> cp;
+    for (size_t pos = 0; cp = utf8_codepoint(s, pos), cp.second > 0; pos += cp.second) {
+        auto c = cp.first;
+        if (c == '"' || c == '\\') {
+            r.push_back('\\');
+            r.push_back(c);
+        } else if (c < 0x20) {
+            char tmp[8];
+            snprintf(tmp, sizeof(tmp), "\\u%04x", c);
+            r.append(tmp);
+        } else {
+            utf8_append(r, c);
+        }
+    }
+    r.push_back('"');
+    return r;
+}
+
+//! fields of one stream, in order
+class FieldCollector: public OutputVisitor
+{
+public:
+    std::vector<const BasicValue*> fields;
+
+    virtual void visit(const IntegerValue* f) { fields.push_back(f); }
+    virtual void visit(const StringValue* f) { fields.push_back(f); }
+    virtual void visit(const EnumeratedValue* f) { fields.push_back(f); }
+    virtual void visit(const BitValue* f) { fields.push_back(f); }
+    virtual void visit(const ArrayValue* f) { fields.push_back(f); }
+    virtual void visit(const StructValue* f) { fields.push_back(f); }
+};
+
+//! one JSON object per line. fields that repeat in a stream (shell items) become arrays.
+class JsonDumper: public OutputVisitor
 {
 protected:
-    Fl_Browser *            m_widget;
-    std::list<std::string>  m_path;
-    CodecPtr                m_codec;
-    InfoLevel               m_info_level;
+    std::ostream&   m_out;
+    CodecPtr        m_codec;
+    InfoLevel       m_info_level;
+    const char*     m_name;     // name of the value being written, nullptr inside arrays
+
+    //! second key of enums and bitfields, like in YAML
+    void numeric(uint64_t value)
+    {
+        if (m_name != nullptr) {
+            m_out << "," << json_quote(std::string(m_name) + "_Numeric") << ":" << value;
+        }
+    }
+
+    void object(const Stream* stream)
+    {
+        FieldCollector c;
+        stream->accept(&c, m_info_level);
+        const auto& fields = c.fields;
+        const char* saved_name = m_name;
+        bool first = true;
+        m_out << "{";
+        for (size_t i = 0; i < fields.size(); i++) {
+            const char* name = fields[i]->name();
+            bool seen = false;
+            size_t count = 0;
+            for (size_t j = 0; j < fields.size(); j++) {
+                if (strcmp(fields[j]->name(), name) == 0) {
+                    seen = seen || j < i;
+                    count++;
+                }
+            }
+            if (seen) {
+                continue;
+            }
+            if (!first) {
+                m_out << ",";
+            }
+            first = false;
+            m_out << json_quote(name) << ":";
+            if (count == 1) {
+                m_name = name;
+                fields[i]->accept(this);
+                continue;
+            }
+            m_name = nullptr;
+            m_out << "[";
+            for (size_t j = i; j < fields.size(); j++) {
+                if (strcmp(fields[j]->name(), name) == 0) {
+                    if (j > i) {
+                        m_out << ",";
+                    }
+                    fields[j]->accept(this);
+                }
+            }
+            m_out << "]";
+        }
+        m_out << "}";
+        m_name = saved_name;
+    }
 
 public:
-    FltkDumper(Fl_Browser* w, CodecPtr c, InfoLevel l):
-        m_widget(w), m_codec(c), m_info_level(l) { };
+    JsonDumper(std::ostream &out, CodecPtr c, InfoLevel l):
+        m_out(out), m_codec(c), m_info_level(l), m_name(nullptr) { }
 
-    void dump(const StreamPtr& stream)
+    void dump(const StreamPtr& stream, const std::string& name)
     {
-        m_path.clear();
-        stream->accept(this, m_info_level);
+        m_out << "{";
+        if (name.length() > 0) {
+            m_out << "\"File\":" << json_quote(name) << ",";
+        }
+        m_out << "\"Output\":";
+        object(stream.get());
+        m_out << "}" << std::endl;
     }
 
     virtual void visit(const IntegerValue* f)
     {
-        std::string s;
-        s.reserve(64);
-        s.append(f->name());
-        s.append("\t");
-        switch (f->form()) {
-            case IntegerValue::Decimal:
-                s.append(std::to_string(f->value()));
-                break;
-            case IntegerValue::Hex:
-                s.append(hex(f->value()));
-                break;
-            case IntegerValue::FileSize:
-                s.append(as_file_size(f->value()));
-                break;
-            case IntegerValue::UnixTime:
-                s.append(human_time(f->value()));
-                break;
+        if (f->form() == IntegerValue::UnixTime) {
+            m_out << json_quote(iso8601_time(f->value()));
+        } else if (f->form() == IntegerValue::FileTime) {
+            m_out << json_quote(iso8601_time(LnkStruct::MSTimeProperty(f->value())));
+        } else {
+            m_out << f->value();
         }
-        m_widget->add(s.c_str());
     }
 
     virtual void visit(const StringValue* f)
     {
-        std::string s;
-        s.reserve(64);
-        s.append(f->name());
-        s.append("\t");
-        if (f->is_utf8()) {
-            s.append(f->string());
+        if (f->is_utf8() || !m_codec) {
+            m_out << json_quote(f->string());
         } else {
-            s.append(m_codec ? m_codec->string(f->string()) : f->string());
+            m_out << json_quote(m_codec->string(f->string()));
         }
-        m_widget->add(s.c_str());
     }
 
     virtual void visit(const EnumeratedValue* f)
     {
-        std::string s;
-        s.reserve(64);
-        s.append(f->name());
-        s.append("\t");
-        s.append(hex(f->value()));
-        s.append(" (");
-        s.append(safe_string(f->describe()));
-        s.append(")");
-        m_widget->add(s.c_str());
+        const char* d = f->describe();
+        if (d != nullptr) {
+            m_out << json_quote(d);
+        } else {
+            m_out << "null";
+        }
+        numeric(f->value());
     }
 
     virtual void visit(const BitValue* f)
     {
-        std::string s;
-        s.reserve(64);
-        s.append(f->name());
-        s.append("\t");
-        s.append(hex(f->value()));
-        s.append(" ");
-        s.append(bitfield_as_string(f));
-        m_widget->add(s.c_str());
+        m_out << "[";
+        bool first = true;
+        for (int i = 0; i < f->num_bits(); i++) {
+            if (f->value_of(i) != 0) {
+                if (!first) {
+                    m_out << ",";
+                }
+                m_out << json_quote(safe_string(f->describe(i)));
+                first = false;
+            }
+        }
+        m_out << "]";
+        numeric(f->value());
     }
 
     virtual void visit(const ArrayValue* f)
     {
-        std::string s{f->name()};
-        s.append("\t");
-        s.append(hex(f));
-        m_widget->add(s.c_str());
+        m_out << json_quote(hex(f));
     }
 
     virtual void visit(const StructValue* f)
     {
-        std::string s;
-        s.reserve(64);
-        m_widget->add("");
-        m_path.emplace_back(std::string(f->name()));
-        s.append("/");
-        for (const auto& e : m_path) {
-            s.append(e);
-            s.append("/");
-        }
-        m_widget->add(s.c_str());
-        f->nest(this, m_info_level);
-        m_path.pop_back();
+        object(f->nested());
     }
 };
 
-void
-dump_fltk(Fl_Browser* widget, const StreamPtr& stream, CodecPtr codec, InfoLevel level)
+void dump_json(std::ostream& out, const StreamPtr& stream, CodecPtr codec,
+               const std::string& name, InfoLevel level)
 {
-    FltkDumper d(widget, codec, level);
-    d.dump(stream);
+    JsonDumper d(out, codec, level);
+    d.dump(stream, name);
 }
 
 }  // namespace LnkOutput
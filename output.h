@@ -8,9 +8,12 @@
 #define OUTPUT_H
 
 #include <memory>
+#include <memory_resource>
+#include <span>
 #include <string>
+#include <string_view>
 #include <ostream>
-#include <FL/Fl_Browser.H>
+#include <vector>
 #include "encoding.h"
 #include "struct.h"
 
@@ -26,16 +29,14 @@ class BitValue;
 class ArrayValue;
 class StructValue;
 class Stream;
-
-typedef std::unique_ptr<Stream>         StreamPtr;
-typedef std::unique_ptr<BasicValue>     BasicValuePtr;
+class StreamPtr;
 
 enum InfoLevel { NORMAL, DEBUG };
 
 void        dump_yaml(std::ostream& out, const StreamPtr& stream, CodecPtr codec,
                       const std::string& name, InfoLevel level);
-void        dump_fltk(Fl_Browser* widget, const StreamPtr& stream, CodecPtr codec,
-                      InfoLevel level);
+void        dump_json(std::ostream& out, const StreamPtr& stream, CodecPtr codec,
+                      const std::string& name, InfoLevel level);
 
 class OutputVisitor
 {
@@ -48,26 +49,87 @@ public:
     virtual void visit(const StructValue* f) = 0;
 };
 
+//! memory for the nodes of output trees. allocation is a pointer bump and nothing is freed
+//! until the arena is destroyed. reset() makes all blocks available for the next tree,
+//! so a reused arena stops allocating once it has grown to the size of the largest tree.
+//! destructors of the nodes are never called, so nodes only hold memory from the arena.
+//! a discarding arena hands out one empty stream that ignores everything put into it.
+//! blocks come from the upstream resource, which is new/delete unless given.
+class Arena: public std::pmr::memory_resource
+{
+private:
+    struct Block {
+        std::byte*              data;
+        size_t                  size;
+        size_t                  alignment;
+    };
+    std::pmr::memory_resource*  m_upstream;
+    std::vector<Block>      m_blocks;
+    size_t                  m_current;  // index of block that is being filled
+    size_t                  m_used;     // bytes used in current block
+    bool                    m_discard;
+    Stream*                 m_null;     // the only stream of a discarding arena
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void*, size_t, size_t) override { }
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return this == &other;
+    }
+
+public:
+    Arena(bool discard = false,
+          std::pmr::memory_resource* upstream = std::pmr::new_delete_resource()):
+        m_upstream(upstream), m_current(0), m_used(0), m_discard(discard), m_null(nullptr) { }
+    Arena(const Arena&) = delete;
+    ~Arena();
+    Arena& operator=(const Arena&) = delete;
+
+    //! forget all nodes, keep the memory
+    void reset()
+    {
+        if (!m_discard) {
+            m_current = 0;
+            m_used = 0;
+        }
+    }
+
+    bool discards() const { return m_discard; }
+
+    template <class T, class... Args>
+    T* make(Args&&... args)
+    {
+        void* mem = allocate(sizeof(T), alignof(T));
+        return new (mem) T(std::forward<Args>(args)...);
+    }
+
+    Stream* make_stream();
+};
 
 class BasicValue
 {
 protected:
-    // name should always point to a literal string (static lifetime)
+    // name should always point to a literal string (static lifetime),
+    // or into the arena of a stream that was read back by deserialize()
     const char*         m_name;
     InfoLevel           m_level;
-    BasicValue(const char* name): m_name(name), m_level(NORMAL) { }
+    BasicValue*         m_next;     // next field in the same Stream
+    BasicValue(const char* name): m_name(name), m_level(NORMAL), m_next(nullptr) { }
 public:
     virtual void accept(OutputVisitor* v) const = 0;
     virtual const char* name() const { return m_name; }
     void level(InfoLevel l) { m_level = l; }
     InfoLevel level() const { return m_level; }
     virtual ~BasicValue() { }
+    friend class Stream;
 };
 
 class IntegerValue: public BasicValue
 {
 public:
-    enum PreferForm { Decimal, Hex, FileSize, UnixTime };
+    // FileTime values are the raw 100 ns FILETIME, UnixTime values are seconds
+    enum PreferForm { Decimal, Hex, FileSize, UnixTime, FileTime };
 protected:
     int64_t             m_value;  // int64_t can store any integer value in the spec
     PreferForm          m_form;
@@ -82,14 +144,14 @@ public:
 class StringValue: public BasicValue
 {
 protected:
-    std::string         m_string;
+    std::pmr::string    m_string;
     bool                m_utf8;
 public:
     virtual void accept(OutputVisitor* v) const { v->visit(this); }
-    const std::string& string() const { return m_string; }
+    std::string_view string() const { return m_string; }
     bool is_utf8() const { return m_utf8; }
-    StringValue(const char* name, const std::string& string, bool is_utf8):
-        BasicValue(name), m_string(string), m_utf8(is_utf8) { }
+    StringValue(const char* name, std::string_view string, bool is_utf8, Arena& arena):
+        BasicValue(name), m_string(string, &arena), m_utf8(is_utf8) { }
 };
 
 class EnumeratedValue: public BasicValue
@@ -170,10 +232,10 @@ template <class T>
 class ConcreteVectorValue: public ArrayValue
 {
 protected:
-    std::vector<T>      m_vec;
+    std::pmr::vector<T> m_vec;
 public:
-    ConcreteVectorValue(const char* name, const std::vector<T>& other):
-        ArrayValue(name), m_vec(other) { }
+    ConcreteVectorValue(const char* name, std::span<const T> other, Arena& arena):
+        ArrayValue(name), m_vec(other.begin(), other.end(), &arena) { }
     virtual void accept(OutputVisitor* v) const { v->visit(this); }
     virtual size_t size() const { return m_vec.size(); }
     virtual int64_t at(size_t i) const { return (int64_t)m_vec.at(i); }
@@ -183,105 +245,137 @@ public:
 class StructValue: public BasicValue
 {
 protected:
-    StreamPtr               m_nested;
+    const Stream*       m_nested;
 public:
     virtual void accept(OutputVisitor* v) const { v->visit(this); }
     void nest(OutputVisitor* v, InfoLevel l) const;
-    StructValue(const char* name, StreamPtr nested):
-        BasicValue(name), m_nested(std::move(nested)) { }
+    const Stream* nested() const { return m_nested; }
+    StructValue(const char* name, const Stream* nested):
+        BasicValue(name), m_nested(nested) { }
 };
 
+//! list of fields. streams and their fields are allocated from an Arena.
 class Stream
 {
 protected:
-    std::list<BasicValuePtr> m_list;
+    Arena&              m_arena;
+    BasicValue*         m_first;
+    BasicValue*         m_last;
+    int                 m_size;
+
+    void append(BasicValue* v)
+    {
+        if (m_last) {
+            m_last->m_next = v;
+        } else {
+            m_first = v;
+        }
+        m_last = v;
+        m_size++;
+    }
+
 public:
-    Stream() { }
+    Stream(Arena& arena): m_arena(arena), m_first(nullptr), m_last(nullptr), m_size(0) { }
 
-    static StreamPtr make() { return std::make_unique<Stream>(); }
+    //! append a value of any class, nullptr if the stream discards it
+    template <class T, class... Args>
+    T* add(Args&&... args)
+    {
+        if (m_arena.discards()) {
+            return nullptr;
+        }
+        T* v = m_arena.make<T>(std::forward<Args>(args)...);
+        append(v);
+        return v;
+    }
 
     void put(const char* name, int64_t value, IntegerValue::PreferForm form = IntegerValue::Decimal)
     {
-        auto tmp = std::make_unique<IntegerValue>(name, value, form);
-        m_list.emplace_back(std::move(tmp));
+        add<IntegerValue>(name, value, form);
+    }
+
+    void put(const char* name, std::string_view s, bool is_utf8)
+    {
+        add<StringValue>(name, s, is_utf8, m_arena);
     }
 
-    void put(const char* name, const std::string& s, bool is_utf8)
+    void put(const char* name, const char* s, bool is_utf8)
     {
-        auto tmp = std::make_unique<StringValue>(name, s, is_utf8);
-        m_list.emplace_back(std::move(tmp));
+        put(name, std::string_view(s), is_utf8);
     }
 
     template <class T>
     void put(const char* name, const LnkStruct::EnumeratedProperty<T>& value)
     {
-        auto tmp = std::make_unique<ConcreteEnumeratedValue<T> >(name, value);
-        m_list.emplace_back(std::move(tmp));
+        add<ConcreteEnumeratedValue<T> >(name, value);
     }
 
     template <class T>
     void put(const char* name, const LnkStruct::BitfieldProperty<T>& value)
     {
-        auto tmp = std::make_unique<ConcreteBitValue<T> >(name, value);
-        m_list.emplace_back(std::move(tmp));
+        add<ConcreteBitValue<T> >(name, value);
     }
 
-    void put(const char* name, StreamPtr nested)
+    void put(const char* name, const Stream* nested)
     {
-        auto tmp = std::make_unique<StructValue>(name, std::move(nested));
-        m_list.emplace_back(std::move(tmp));
+        add<StructValue>(name, nested);
     }
 
     void put(const char* name, LnkStruct::MSTimeProperty time)
     {
-        auto tmp = std::make_unique<IntegerValue>(name, time.unix_time(), IntegerValue::UnixTime);
-        m_list.emplace_back(std::move(tmp));
+        add<IntegerValue>(name, int64_t(uint64_t(time)), IntegerValue::FileTime);
     }
 
     void put(const char* name, LnkStruct::FATTime time)
     {
-        auto tmp = std::make_unique<IntegerValue>(name, time.unix_time(), IntegerValue::UnixTime);
-        m_list.emplace_back(std::move(tmp));
+        add<IntegerValue>(name, time.unix_time(), IntegerValue::UnixTime);
     }
 
     void put(const char* name, LnkStruct::Guid guid)
     {
-        put(name, guid.string(), true);
+        if (discards()) {
+            return;
+        }
+        char buf[LnkStruct::Guid::STRING_SIZE];
+        put(name, guid.format(buf), true);
     }
 
     template <class T, size_t N>
     void put(const char* name, const std::array<T, N>& array)
     {
-        auto tmp = std::make_unique<ConcreteArrayValue<T, N> >(name, array);
-        m_list.emplace_back(std::move(tmp));
+        add<ConcreteArrayValue<T, N> >(name, array);
+    }
+
+    template <class T>
+    void put(const char* name, std::span<const T> vec)
+    {
+        add<ConcreteVectorValue<T> >(name, vec, m_arena);
     }
 
     template <class T>
     void put(const char* name, const std::vector<T>& vec)
     {
-        auto tmp = std::make_unique<ConcreteVectorValue<T> >(name, vec);
-        m_list.emplace_back(std::move(tmp));
+        put(name, std::span<const T>(vec));
     }
 
     template <class... Args>
     void put_debug(const char* name, Args...x)
     {
         put(name, x...);
-        auto& tmp = m_list.back();
-        tmp->level(DEBUG);
+        if (m_last) {
+            m_last->level(DEBUG);
+        }
     }
 
-    template <class... Args>
-    void put_debug(const char* name, StreamPtr nested)
+    //! true if nothing put into this stream is kept, output-only work can be skipped
+    bool discards() const
     {
-        put(name, std::move(nested));
-        auto& tmp = m_list.back();
-        tmp->level(DEBUG);
+        return m_arena.discards();
     }
 
     void accept(OutputVisitor *v, InfoLevel l) const
     {
-        for (const BasicValuePtr& field : m_list) {
+        for (const BasicValue* field = m_first; field != nullptr; field = field->m_next) {
             if ((l == NORMAL && field->level() == NORMAL) ||
                 (l == DEBUG))
             {
@@ -292,16 +386,59 @@ public:
 
     int size() const
     {
-        return m_list.size();
+        return m_size;
     }
 };
 
+inline Stream*
+Arena::make_stream()
+{
+    if (!m_discard) {
+        return make<Stream>(*this);
+    }
+    if (!m_null) {
+        m_null = make<Stream>(*this);
+    }
+    return m_null;
+}
+
 inline void
 StructValue::nest(LnkOutput::OutputVisitor* v, InfoLevel l) const
 {
     m_nested->accept(v, l);
 }
 
+//! root of an output tree, keeps the arena with its nodes alive
+class StreamPtr
+{
+private:
+    std::shared_ptr<Arena>  m_arena;
+    const Stream*           m_stream;
+
+public:
+    StreamPtr(): m_stream(nullptr) { }
+    StreamPtr(std::shared_ptr<Arena> arena, const Stream* stream):
+        m_arena(std::move(arena)), m_stream(stream) { }
+    const Stream* get() const { return m_stream; }
+    const Stream* operator->() const { return m_stream; }
+    const Stream& operator*() const { return *m_stream; }
+    explicit operator bool() const { return m_stream != nullptr; }
+};
+
+// formatting of values, shared by the dumpers
+std::string human_time(time_t unix_time);
+//! with 7 digits of fraction if hundred_ns is not negative
+std::string iso8601_time(time_t unix_time, int32_t hundred_ns = -1);
+//! with fraction only if the time has one
+std::string iso8601_time(LnkStruct::MSTimeProperty time);
+const char* safe_string(const char* d);
+std::string bitfield_as_string(const BitValue* f);
+std::string hex(int64_t value);
+std::string hex(const ArrayValue* f);
+std::string as_file_size(int64_t value);
+//! JSON string literal with quotes, invalid utf-8 is replaced
+std::string json_quote(std::string_view s);
+
 };  // namespace LnkOutput
 
 #endif  // OUTPUT_H
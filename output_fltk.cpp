@@ -0,0 +1,133 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#include "output_fltk.h"
+#include <list>
+#include <string>
+#include <FL/Fl.H>
+#include <FL/Fl_Browser.H>
+
+namespace LnkOutput {
+
+// FLTK
+//------------------------------------------------------------------------
+
+class FltkDumper: public OutputVisitor
+{
+protected:
+    Fl_Browser *            m_widget;
+    std::list<std::string>  m_path;
+    CodecPtr                m_codec;
+    InfoLevel               m_info_level;
+
+public:
+    FltkDumper(Fl_Browser* w, CodecPtr c, InfoLevel l):
+        m_widget(w), m_codec(c), m_info_level(l) { };
+
+    void dump(const StreamPtr& stream)
+    {
+        m_path.clear();
+        stream->accept(this, m_info_level);
+    }
+
+    virtual void visit(const IntegerValue* f)
+    {
+        std::string s;
+        s.reserve(64);
+        s.append(f->name());
+        s.append("\t");
+        switch (f->form()) {
+            case IntegerValue::Decimal:
+                s.append(std::to_string(f->value()));
+                break;
+            case IntegerValue::Hex:
+                s.append(hex(f->value()));
+                break;
+            case IntegerValue::FileSize:
+                s.append(as_file_size(f->value()));
+                break;
+            case IntegerValue::UnixTime:
+                s.append(human_time(f->value()));
+                break;
+            case IntegerValue::FileTime:
+                s.append(human_time(LnkStruct::MSTimeProperty(f->value()).unix_time()));
+                break;
+        }
+        m_widget->add(s.c_str());
+    }
+
+    virtual void visit(const StringValue* f)
+    {
+        std::string s;
+        s.reserve(64);
+        s.append(f->name());
+        s.append("\t");
+        if (f->is_utf8() || !m_codec) {
+            s.append(f->string());
+        } else {
+            s.append(m_codec->string(f->string()));
+        }
+        m_widget->add(s.c_str());
+    }
+
+    virtual void visit(const EnumeratedValue* f)
+    {
+        std::string s;
+        s.reserve(64);
+        s.append(f->name());
+        s.append("\t");
+        s.append(hex(f->value()));
+        s.append(" (");
+        s.append(safe_string(f->describe()));
+        s.append(")");
+        m_widget->add(s.c_str());
+    }
+
+    virtual void visit(const BitValue* f)
+    {
+        std::string s;
+        s.reserve(64);
+        s.append(f->name());
+        s.append("\t");
+        s.append(hex(f->value()));
+        s.append(" ");
+        s.append(bitfield_as_string(f));
+        m_widget->add(s.c_str());
+    }
+
+    virtual void visit(const ArrayValue* f)
+    {
+        std::string s{f->name()};
+        s.append("\t");
+        s.append(hex(f));
+        m_widget->add(s.c_str());
+    }
+
+    virtual void visit(const StructValue* f)
+    {
+        std::string s;
+        s.reserve(64);
+        m_widget->add("");
+        m_path.emplace_back(std::string(f->name()));
+        s.append("/");
+        for (const auto& e : m_path) {
+            s.append(e);
+            s.append("/");
+        }
+        m_widget->add(s.c_str());
+        f->nest(this, m_info_level);
+        m_path.pop_back();
+    }
+};
+
+void
+dump_fltk(Fl_Browser* widget, const StreamPtr& stream, CodecPtr codec, InfoLevel level)
+{
+    FltkDumper d(widget, codec, level);
+    d.dump(stream);
+}
+
+}  // namespace LnkOutput
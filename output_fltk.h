@@ -0,0 +1,21 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#ifndef OUTPUT_FLTK_H
+#define OUTPUT_FLTK_H
+
+// the only part of the output that needs FLTK, it is not in the parser library
+#include "output.h"
+#include <FL/Fl_Browser.H>
+
+namespace LnkOutput {
+
+void        dump_fltk(Fl_Browser* widget, const StreamPtr& stream, CodecPtr codec,
+                      InfoLevel level);
+
+};  // namespace LnkOutput
+
+#endif  // OUTPUT_FLTK_H
@@ -6,19 +6,22 @@
 
 #include "encoding.h"
 #include "parse.h"
+#include "stats.h"
 #include <array>
 #include <list>
 #include <string>
 #include <vector>
-#include <fstream>
+#include <cstdio>
+#include <algorithm>
 #include <cstdarg>
 #include <limits>
 #include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <span>
 
 namespace LnkParser {
 
-const size_t MAX_FILE_SIZE = 1024L * 1024;
-
 Error
 Error::format(const char *fmt, ...)
 {
@@ -31,6 +34,179 @@ Error::format(const char *fmt, ...)
     return rv;
 }
 
+std::string
+Status::message() const
+{
+    char msg[256] = "";
+    const char* f = field ? field : "?";
+    unsigned long long v = value;
+    switch (kind) {
+        case ErrorKind::None:
+            return {};
+        case ErrorKind::IoError:
+            snprintf(msg, sizeof(msg), "Cannot read file: %s", strerror(int(value)));
+            return msg;
+        case ErrorKind::Truncated:
+            snprintf(msg, sizeof(msg), "Unexpected end of file");
+            break;
+        case ErrorKind::IntegerOverflow:
+            snprintf(msg, sizeof(msg), "Integer overflow while reading stream");
+            break;
+        case ErrorKind::BadHeaderSize:
+            snprintf(msg, sizeof(msg), "Wrong header size, should be 0x4C, got %#llX", v);
+            break;
+        case ErrorKind::BadMagic:
+            snprintf(msg, sizeof(msg), "Wrong magic number, expected "
+                     "00021401-0000-0000-C000-000000000046");
+            break;
+        case ErrorKind::BadLinkFlags:
+            snprintf(msg, sizeof(msg), "Link flags are not valid: %#llX", v);
+            break;
+        case ErrorKind::BadLinkInfoHeaderSize:
+            snprintf(msg, sizeof(msg), "Wrong Link Info Header size, expected 0x1C or >=0x24, "
+                     "got %#llX", v);
+            break;
+        case ErrorKind::BadLength:
+            snprintf(msg, sizeof(msg), "Field '%s' has bad length %llu", f, v);
+            break;
+        case ErrorKind::BadOffset:
+            snprintf(msg, sizeof(msg), "Field '%s' offset beyond end of structure %llu", f, v);
+            break;
+        case ErrorKind::BadNetworkLinkFlags:
+            snprintf(msg, sizeof(msg), "CommonNetworkRelativeLink flags are not valid: %#llX", v);
+            break;
+    }
+    std::string r(msg);
+    r.append(" at offset ");
+    r.append(std::to_string(offset));
+    return r;
+}
+
+const char*
+error_name(ErrorKind kind)
+{
+    static const std::array<const char*, ERROR_KINDS> names = {
+        "None",
+        "IoError",
+        "Truncated",
+        "IntegerOverflow",
+        "BadHeaderSize",
+        "BadMagic",
+        "BadLinkFlags",
+        "BadLinkInfoHeaderSize",
+        "BadLength",
+        "BadOffset",
+        "BadNetworkLinkFlags"
+    };
+    return names.at(size_t(kind));
+}
+
+const char*
+warning_name(WarningKind kind)
+{
+    static const std::array<const char*, WARNING_KINDS> names = {
+        "NonZeroReserved",
+        "BadFlags",
+        "BadEnumValue",
+        "ShellItemOverrun",
+        "ShellItemTruncated",
+        "UnknownShellItem",
+        "UnknownExtraDataBlock",
+        "BadExtraDataBlockSize"
+    };
+    return names.at(size_t(kind));
+}
+
+std::string
+Warning::message() const
+{
+    char msg[256] = "";
+    snprintf(msg, sizeof(msg), "%s: field '%s' value %#llX at offset %zu", warning_name(kind),
+             field ? field : "?", (unsigned long long)value, offset);
+    return msg;
+}
+
+void
+ValueCounts::add(uint64_t value, uint64_t n)
+{
+    auto it = counts.find(value);
+    if (it != counts.end()) {
+        it->second += n;
+    } else if (counts.size() < LIMIT) {
+        counts.emplace(value, n);
+    } else {
+        other += n;
+    }
+}
+
+void
+ValueCounts::add(const ValueCounts& o)
+{
+    for (const auto& [value, n]: o.counts) {
+        add(value, n);
+    }
+    other += o.other;
+}
+
+void
+BatchCounters::add(const Status& status, const Diagnostics& diag, uint64_t size)
+{
+    files++;
+    bytes += size;
+    if (!status.ok()) {
+        failed++;
+        errors[size_t(status.kind)]++;
+    }
+    if (diag.total() > 0) {
+        with_warnings++;
+        for (size_t i = 0; i < WARNING_KINDS; i++) {
+            warnings[i] += diag.count(WarningKind(i));
+        }
+        for (const Warning& w: diag.warnings()) {
+            if (w.kind == WarningKind::UnknownShellItem) {
+                unknown_shell_items.add(w.value);
+            } else if (w.kind == WarningKind::UnknownExtraDataBlock) {
+                unknown_blocks.add(w.value);
+            }
+        }
+    }
+}
+
+void
+BatchCounters::add(const BatchCounters& other)
+{
+    files += other.files;
+    failed += other.failed;
+    with_warnings += other.with_warnings;
+    for (size_t i = 0; i < ERROR_KINDS; i++) {
+        errors[i] += other.errors[i];
+    }
+    for (size_t i = 0; i < WARNING_KINDS; i++) {
+        warnings[i] += other.warnings[i];
+    }
+    bytes += other.bytes;
+    unknown_shell_items.add(other.unknown_shell_items);
+    unknown_blocks.add(other.unknown_blocks);
+}
+
+void
+BatchCounters::print(std::ostream& out) const
+{
+    out << "files: " << files << std::endl;
+    out << "failed: " << failed << std::endl;
+    out << "with warnings: " << with_warnings << std::endl;
+    for (size_t i = 0; i < ERROR_KINDS; i++) {
+        if (errors[i] > 0) {
+            out << "error " << error_name(ErrorKind(i)) << ": " << errors[i] << std::endl;
+        }
+    }
+    for (size_t i = 0; i < WARNING_KINDS; i++) {
+        if (warnings[i] > 0) {
+            out << "warning " << warning_name(WarningKind(i)) << ": " << warnings[i] << std::endl;
+        }
+    }
+}
+
 //! check if (a+b) will give a different result than if both args were converted to a wider int
 template <typename T, typename U>
 static bool add_overflows(T a, U b)
@@ -75,51 +251,117 @@ static size_t u16_nchars(size_t bytes)
 }
 
 // the file is comprised of little endian numeric fields and strings
-// read the whole file and implement a basic API for reading relevant types
+// read the whole file and implement a basic API for reading relevant types.
+// errors do not throw, the stream remembers the first one (like failbit on iostreams)
+// and all reads after that return zeros. sections check failed() where it matters.
+// one stream is loaded with many files in turn, its buffers keep their capacity.
 class FileStream
 {
 private:
-    std::vector<char>       m_buffer;
+    std::vector<char>       m_buffer;   // contents of a file that was read from disk
+    const char*             m_data;     // m_buffer or memory of the caller
+    size_t                  m_size;
     size_t                  m_pos;
+    Status                  m_status;
+    std::u16string          m_u16;      // scratch for reading unicode strings
 
-private:
-    void int_overflow()
-    {
-        throw Error::format("Integer overflow while reading stream.");
-    }
 public:
-    FileStream (const std::string& filename)
+    FileStream(): m_data(nullptr), m_size(0), m_pos(0) { }
+    FileStream(const FileStream&) = delete;
+
+    void load(const std::string& filename)
     {
-        std::ifstream in;
-        in.open(filename, std::ios::in | std::ios::binary);
-        in.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        auto begin = std::istreambuf_iterator<char>(in);
-        auto end = std::istreambuf_iterator<char>();
-        for (size_t counter = 0; begin != end && counter < MAX_FILE_SIZE; begin++, counter++) {
-            m_buffer.push_back(*begin);
+        m_buffer.clear();
+        m_data = nullptr;
+        m_size = 0;
+        m_pos = 0;
+        m_status = Status();
+        // stdio, because filebuf throws on read errors (e.g. EISDIR) regardless of exceptions()
+        std::FILE* in = std::fopen(filename.c_str(), "rb");
+        if (in == nullptr) {
+            fail(ErrorKind::IoError, nullptr, errno);
+            return;
         }
-        in.close();
+        char chunk[4096];
+        size_t n;
+        while (m_buffer.size() < MAX_FILE_SIZE &&
+               (n = std::fread(chunk, 1, std::min(sizeof(chunk), MAX_FILE_SIZE - m_buffer.size()),
+                               in)) > 0)
+        {
+            m_buffer.insert(m_buffer.end(), chunk, chunk + n);
+        }
+        if (std::ferror(in)) {
+            fail(ErrorKind::IoError, nullptr, errno);
+        }
+        std::fclose(in);
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+    }
+    //! use memory that is owned by the caller, nothing is copied
+    void load(const char* data, size_t size)
+    {
+        m_data = data;
+        m_size = std::min(size, MAX_FILE_SIZE);
         m_pos = 0;
+        m_status = Status();
+    }
+    //! remember the first error
+    void fail(ErrorKind kind, const char* field, uint64_t value = 0)
+    {
+        fail_at(m_pos, kind, field, value);
+    }
+    void fail_at(size_t offset, ErrorKind kind, const char* field, uint64_t value = 0)
+    {
+        if (m_status.ok()) {
+            m_status.kind = kind;
+            m_status.offset = offset;
+            m_status.field = field;
+            m_status.value = value;
+        }
+    }
+    bool failed() const
+    {
+        return !m_status.ok();
+    }
+    const Status& status() const
+    {
+        return m_status;
     }
     bool is_eof() const
     {
-        return m_buffer.size() <= 0 || m_pos >= m_buffer.size() - 1;
+        return m_size <= 0 || m_pos >= m_size - 1;
+    }
+    //! number of bytes loaded
+    size_t size() const
+    {
+        return m_size;
+    }
+    //! number of bytes that can be read from current position
+    size_t remaining() const
+    {
+        return m_pos < m_size ? m_size - m_pos : 0;
     }
     char getc()
     {
-        if (add_overflows(m_pos, 1)) {
-            int_overflow();
+        if (m_pos >= m_size) {
+            fail(ErrorKind::Truncated, nullptr);
+            return 0;
         }
-        return m_buffer.at(m_pos++);
+        return m_data[m_pos++];
     }
-    char peek() const
+    char peek()
     {
-        return m_buffer.at(m_pos);
+        if (m_pos >= m_size) {
+            fail(ErrorKind::Truncated, nullptr);
+            return 0;
+        }
+        return m_data[m_pos];
     }
     void ignore(size_t len)
     {
         if (add_overflows(m_pos, len)) {
-            int_overflow();
+            fail(ErrorKind::IntegerOverflow, nullptr, len);
+            return;
         }
         m_pos += len;
     }
@@ -131,12 +373,16 @@ public:
     {
         return m_pos;
     }
-    //! always gets n bytes, or crashes
+    //! always gets n bytes, zeros past the end of file
     void read(char* buf, size_t n)
     {
-        for (size_t i = 0; i < n; i++) {
-            buf[i] = getc();
+        if (n > remaining()) {
+            fail(ErrorKind::Truncated, nullptr, n);
+            memset(buf, 0, n);
+            return;
         }
+        memcpy(buf, m_data + m_pos, n);
+        m_pos += n;
     }
     void operator >>(uint8_t & i)
     {
@@ -174,43 +420,65 @@ public:
         read((char*)tmp, sizeof(tmp));
         i = LnkStruct::Guid(std::to_array(tmp));
     }
-    std::string read_ansi(size_t max)
+    //! read NUL-terminated string into r, reusing its memory
+    void read_ansi(std::string& r, size_t max)
     {
-        // read NUL-terminated string
-        std::string r;
-        r.reserve(16);
+        r.clear();
         for (size_t i = 0; i < max; i++) {
             char c = getc();
             if (c == 0) {
-                return r;
+                return;
             }
             r.push_back(c);
         }
+    }
+    std::string read_ansi(size_t max)
+    {
+        std::string r;
+        read_ansi(r, max);
         return r;
     }
     //! reads at most 'max' number of 16bit characters, including NUL
-    std::u16string read_unicode(size_t max)
+    void read_unicode(std::u16string& r, size_t max)
     {
         // .lnk uses UTF16 for unicode
-        std::u16string r;
+        r.clear();
         for (size_t i = 0; i < max; i++) {
             uint16_t c;
             this->operator>>(c);
             if (c == 0) {
-                return r;
+                return;
             }
             r.push_back(c);
         }
+    }
+    std::u16string read_unicode(size_t max)
+    {
+        std::u16string r;
+        read_unicode(r, max);
         return r;
     }
+    //! same as read_unicode, converted to utf-8 into r. returns number of 16bit characters.
+    size_t read_unicode_utf8(std::string& r, size_t max)
+    {
+        read_unicode(m_u16, max);
+        r.clear();
+        utf16le_to_utf8(m_u16, r);
+        return m_u16.size();
+    }
     //! reads exactly 'len' number of bytes
-    std::string read_exact(size_t len)
+    void read_exact(std::string& r, size_t len)
     {
         // strings that are exact number of bytes in the format, but cut off on \0
         size_t pos = tellg();
-        std::string r = read_ansi(len);
+        read_ansi(r, len);
         seekg(pos);
         ignore(len);
+    }
+    std::string read_exact(size_t len)
+    {
+        std::string r;
+        read_exact(r, len);
         return r;
     }
     //! reads exactly 'len' number of bytes
@@ -223,37 +491,66 @@ public:
         ignore(len);
         return r;
     }
-    std::vector<uint8_t> read_binary(size_t len)
+    //! reads exactly 'len' number of bytes, converted to utf-8 into r
+    void read_exact_unicode_utf8(std::string& r, size_t len)
+    {
+        size_t pos = tellg();
+        read_unicode_utf8(r, u16_nchars(len));
+        seekg(pos);
+        ignore(len);
+    }
+    //! 'len' bytes in place, valid until the next load()
+    std::span<const uint8_t> read_binary(size_t len)
     {
-        std::vector<uint8_t> tmp(len);
-        read((char*)tmp.data(), len);
-        return tmp;
+        if (len > remaining()) {
+            fail(ErrorKind::Truncated, nullptr, len);
+            return {};
+        }
+        std::span<const uint8_t> r((const uint8_t*)m_data + m_pos, len);
+        m_pos += len;
+        return r;
     }
 };
 
 // sections start {{{
 
-template <class T>
+template <class T, class F>
 class Section
 {
 protected:
-    T                       m_data;
-    std::vector<Error>      m_warnings;
-    LnkOutput::StreamPtr    m_out;
+    T&                      m_data;     // owned by the parser, reused between files
+    Diagnostics&            m_diag;
+    LnkOutput::Arena&       m_arena;
+    LnkOutput::Stream*      m_out;
+    F                       m_fields;
+
+    void warn(WarningKind kind, size_t offset, const char* field, uint64_t value = 0)
+    {
+        m_diag.add(kind, offset, field, value);
+    }
+
+    //! index of a field in the section's field table, typos fail at compile time
+    static consteval int field(const char* name)
+    {
+        int bit = F::find(name);
+        if (bit < 0) {
+            throw "unknown field name";
+        }
+        return bit;
+    }
 
-    template <class... Args>
-    void warn(const char *fmt, Args... args)
+    //! true if the field was selected for the output
+    bool selected(int bit) const
     {
-        auto w = Error::format(fmt, args...);
-        m_warnings.push_back(w);
+        return m_fields.value_of(bit);
     }
 
 public:
-    Section(): m_out(LnkOutput::Stream::make()) { }
+    Section(T& data, F fields, Diagnostics& diag, LnkOutput::Arena& arena):
+        m_data(data), m_diag(diag), m_arena(arena), m_out(arena.make_stream()), m_fields(fields) { }
     T& data() { return m_data; }
     operator T& () { return m_data; }
-    std::vector<Error>& warnings() { return m_warnings; }
-    LnkOutput::StreamPtr output() { return std::move(m_out); }
+    LnkOutput::Stream* output() { return m_out; }
 };
 
 class BoundsChecker
@@ -282,16 +579,6 @@ public:
         return m_struct_end;
     }
 
-    //! set struct_end(). struct_start needs to be initalized before.
-    void
-    struct_len(size_t len, const char* name)
-    {
-        if (add_overflows(m_struct_start, len)) {
-            throw Error::format("Field '%s' has bad length %llu: integer overflow", name, len);
-        }
-        m_struct_end = m_struct_start + len;
-    }
-
     //! set struct_end(). struct_start needs to be initalized before.
     bool
     struct_len_nothrow(size_t len)
@@ -315,22 +602,6 @@ public:
         }
     }
 
-    //! check if at least 1 byte can be read from given offset
-    void
-    check_offsets(size_t off1, size_t off2, const char *field_name) const
-    {
-        if (add_overflows(m_struct_start, off1) || add_overflows(m_struct_start + off1, off2)) {
-            throw Error::format("Field '%s' has bad offset %llu+%llu+%llu: integer overflow",
-                                field_name, uint64_t(m_struct_start), uint64_t(off1),
-                                uint64_t(off2));
-        }
-        if (m_struct_start + off1 + off2 >= m_struct_end) {
-            throw Error::format("Field '%s' offset beyond end of structure %llu+%llu+%llu>%llu",
-                                field_name, uint64_t(m_struct_start), uint64_t(off1),
-                                uint64_t(off2), uint64_t(m_struct_end));
-        }
-    }
-
     //! check if at least 1 byte can be read from given offset
     bool
     check_offsets_nothrow(size_t off1, size_t off2) const
@@ -370,71 +641,128 @@ public:
 };
 
 // section 2.1
-class Header: public Section<LnkStruct::ShellLinkHeader>
+class Header: public Section<LnkStruct::ShellLinkHeader, HeaderFields_t>
 {
+private:
+    //! the time, and its flags after it if there are any
+    void put_time(bool wanted, const char* name, LnkStruct::MSTimeProperty time,
+                  const char* flags_name, LnkStruct::TimeFlags_t flags)
+    {
+        if (wanted) {
+            m_out->put(name, time);
+            if (flags.value() != 0) {
+                m_out->put(flags_name, flags);
+            }
+        }
+    }
+
 public:
-    Header(FileStream &in)
+    Header(FileStream &in, LnkStruct::ShellLinkHeader& data, HeaderFields_t fields,
+           Diagnostics& diag, LnkOutput::Arena& arena):
+        Section(data, fields, diag, arena)
     {
         LnkStruct::ShellLinkHeader r;
         in >> r.HeaderSize;
+        if (in.failed()) {
+            return;
+        }
         if (r.HeaderSize != 0x4C) {
-            throw Error::format("Wrong header size, should be 0x4C, got %#X", r.HeaderSize);
+            in.fail_at(0, ErrorKind::BadHeaderSize, "HeaderSize", r.HeaderSize);
+            return;
         }
         // magic number
         LnkStruct::Guid guid;
         static const char *magic = "00021401-0000-0000-C000-000000000046";
         in >> guid;
-        if (guid != magic) {
-            throw Error::format("Wrong magic number, expected %s, got %s",
-                                magic, guid.string().c_str());
+        if (!in.failed() && guid != magic) {
+            in.fail_at(sizeof(r.HeaderSize), ErrorKind::BadMagic, "LinkCLSID");
+            return;
         }
         in >> r.LinkFlags;
-        if (!r.LinkFlags.verify()) {
+        if (!in.failed() && !r.LinkFlags.verify()) {
             // Invalid link flags fatal, because these define further structure of the file
-            throw Error::format("Link flags are not valid: %#X, invalid bits are %#X",
-                                r.LinkFlags.value(), r.LinkFlags.get_invalid_bits());
+            in.fail(ErrorKind::BadLinkFlags, "LinkFlags", r.LinkFlags.value());
+            return;
+        }
+        if (selected(field("LinkFlags"))) {
+            m_out->put("LinkFlags", r.LinkFlags);
         }
-        m_out->put("LinkFlags", r.LinkFlags);
         in >> r.FileAttributes;
-        m_out->put("FileAttributes", r.FileAttributes);
+        if (!in.failed() && !r.FileAttributes.verify()) {
+            warn(WarningKind::BadFlags, in.tellg() - sizeof(uint32_t), "FileAttributes",
+                 r.FileAttributes.value());
+        }
+        if (selected(field("FileAttributes"))) {
+            m_out->put("FileAttributes", r.FileAttributes);
+        }
         in >> r.CreationTime;
-        m_out->put("CreationTime", r.CreationTime);
         in >> r.AccessTime;
-        m_out->put("AccessTime", r.AccessTime);
         in >> r.WriteTime;
-        m_out->put("WriteTime", r.WriteTime);
+        r.TimeFlags = {};
+        if (!in.failed()) {
+            LnkStruct::MSTimeProperty times[] = {r.CreationTime, r.AccessTime, r.WriteTime};
+            LnkStruct::check_times(times, r.TimeFlags.data(), 3,
+                                   LnkStruct::MSTimeProperty::now());
+        }
+        put_time(selected(field("CreationTime")), "CreationTime", r.CreationTime,
+                 "CreationTimeFlags", r.TimeFlags[0]);
+        put_time(selected(field("AccessTime")), "AccessTime", r.AccessTime,
+                 "AccessTimeFlags", r.TimeFlags[1]);
+        put_time(selected(field("WriteTime")), "WriteTime", r.WriteTime,
+                 "WriteTimeFlags", r.TimeFlags[2]);
         in >> r.FileSize;
-        m_out->put("FileSize", r.FileSize, LnkOutput::IntegerValue::FileSize);
+        if (selected(field("FileSize"))) {
+            m_out->put("FileSize", r.FileSize, LnkOutput::IntegerValue::FileSize);
+        }
         in >> r.IconIndex;
-        m_out->put_debug("IconIndex", r.IconIndex);
+        if (selected(field("IconIndex"))) {
+            m_out->put_debug("IconIndex", r.IconIndex);
+        }
         in >> r.ShowCommand;
-        m_out->put_debug("ShowCommand", r.ShowCommand);
+        if (!in.failed() && !r.ShowCommand.valid()) {
+            warn(WarningKind::BadEnumValue, in.tellg() - sizeof(uint32_t), "ShowCommand",
+                 r.ShowCommand.get_value());
+        }
+        if (selected(field("ShowCommand"))) {
+            m_out->put_debug("ShowCommand", r.ShowCommand);
+        }
         in >> r.HotKeyLow;
-        m_out->put_debug("HotKeyLow", r.HotKeyLow);
+        if (selected(field("HotKeyLow"))) {
+            m_out->put_debug("HotKeyLow", r.HotKeyLow);
+        }
         in >> r.HotKeyHigh;
-        m_out->put_debug("HotKeyHigh", r.HotKeyHigh);
+        if (selected(field("HotKeyHigh"))) {
+            m_out->put_debug("HotKeyHigh", r.HotKeyHigh);
+        }
+        size_t reserved_offset = in.tellg();
         in >> r.Reversed1;
         in >> r.Reserved2;
         in >> r.Reserved3;
+        if (!in.failed() && (r.Reversed1 != 0 || r.Reserved2 != 0 || r.Reserved3 != 0)) {
+            warn(WarningKind::NonZeroReserved, reserved_offset, "Reserved",
+                 r.Reversed1 | r.Reserved2 | r.Reserved3);
+        }
         m_data = r;
     }
 };
 
 // section 2.2
-class LinkTargetIdList: public Section<LnkStruct::LinkTargetIdList>, protected BoundsChecker
+class LinkTargetIdList: public Section<LnkStruct::LinkTargetIdList, IdListFields_t>,
+                        protected BoundsChecker
 {
 private:
     FileStream &m_in;
 
     bool
-    ext_BEEF0004(BoundsChecker& b, LnkOutput::StreamPtr& o, LnkStruct::ShellId_BeefBase z)
+    ext_BEEF0004(BoundsChecker& b, LnkOutput::Stream* o, LnkStruct::ShellId_BeefBase z,
+                 LnkStruct::ShellId_Beef0004& e)
     {
-        LnkStruct::ShellId_Beef0004 e;
         if (!b.struct_pop_nothrow(sizeof(e.CreationTime)+sizeof(e.AccessTime)+
                                     sizeof(e.WindowsVersion)))
         {
             return false;
         }
+        e.Version = z.Version;
         m_in >> e.CreationTime;
         m_in >> e.AccessTime;
         m_in >> e.WindowsVersion;
@@ -479,9 +807,9 @@ private:
             e.LongName = utf16le_to_utf8(s);
             o->put("LongName", e.LongName, true);
         }
-        if (z.Version >= 3 && e.LongStringSize > 0) {
-            std::string s = m_in.read_ansi(b.maxlen());
-            if (!b.struct_pop_nothrow(s.size()+1)) {
+        if (z.Version >= 3 && z.Version < 7 && e.LongStringSize > 0) {
+            m_in.read_ansi(e.LocalizedName, b.maxlen());
+            if (!b.struct_pop_nothrow(e.LocalizedName.size()+1)) {
                 return false;
             }
             o->put("LocalizedName", e.LocalizedName, false);
@@ -497,50 +825,54 @@ private:
         return true;
     }
 
-    LnkOutput::StreamPtr
-    x1f_root_folder(BoundsChecker b)
-    {
-        auto o = LnkOutput::Stream::make();
-        LnkStruct::ShellId_x1F_SortIndex_t sort_idx;
-        LnkStruct::Guid folder;
-        if (!b.struct_pop_nothrow(sizeof(sort_idx) + sizeof(folder))) {
+    LnkOutput::Stream*
+    x1f_root_folder(LnkStruct::LinkTargetIdList::ID& id, BoundsChecker b)
+    {
+        auto o = m_arena.make_stream();
+        auto& f = id.Item.emplace<LnkStruct::ShellId_x1F_Struct>();
+        if (!b.struct_pop_nothrow(sizeof(f.SortIndex) + sizeof(f.ShellFolder))) {
+            return truncated(o, "FolderShellId");
+        }
+        m_in >> f.SortIndex;
+        o->put_debug("SortIndex", f.SortIndex);
+        m_in >> f.ShellFolder;
+        if (o->discards()) {
             return o;
         }
-        m_in >> sort_idx;
-        o->put_debug("SortIndex", sort_idx);
-        m_in >> folder;
-        const char* desc = LnkStruct::shell_folder_guid_describe(folder.string().c_str());
+        char guid[LnkStruct::Guid::STRING_SIZE];
+        const char* desc = LnkStruct::shell_folder_guid_describe(f.ShellFolder.format(guid));
         if (desc) {
             o->put("ShellFolder", desc, true);
-            o->put_debug("ShellFolderGuid", folder);
+            o->put_debug("ShellFolderGuid", f.ShellFolder);
         } else {
-            o->put("ShellFolderGuid", folder);
+            o->put("ShellFolderGuid", f.ShellFolder);
         }
         return o;
     }
 
-    LnkOutput::StreamPtr
-    x20_volume(const LnkStruct::LinkTargetIdList::ID& id)
+    LnkOutput::Stream*
+    x20_volume(LnkStruct::LinkTargetIdList::ID& id)
     {
         // found no documentation on this
-        auto o = LnkOutput::Stream::make();
-        uint8_t flags = (id.Data.data()[0] & (~0x70));
-        o->put("Flags", flags, LnkOutput::IntegerValue::Hex);
+        auto o = m_arena.make_stream();
+        auto& f = id.Item.emplace<LnkStruct::ShellId_x20_Struct>();
+        f.Flags = (id.Data.data()[0] & (~0x70));
+        o->put("Flags", f.Flags, LnkOutput::IntegerValue::Hex);
         return o;
     }
 
-    LnkOutput::StreamPtr
-    x30_file(const LnkStruct::LinkTargetIdList::ID& id, BoundsChecker b)
+    LnkOutput::Stream*
+    x30_file(LnkStruct::LinkTargetIdList::ID& id, BoundsChecker b)
     {
-        auto o = LnkOutput::Stream::make();
-        LnkStruct::ShellId_x30_Struct f;
+        auto o = m_arena.make_stream();
+        auto& f = id.Item.emplace<LnkStruct::ShellId_x30_Struct>();
         f.Flags = (uint8_t)(id.Data.data()[0] & (~0x70));
         o->put_debug("Flags", f.Flags);
         size_t saved_itemid_offset = b.struct_start() - 1;  // for pre-xp / post-xp heuristic
         if (!b.struct_pop_nothrow(sizeof(f.Unknown1)+sizeof(f.FileSize)+sizeof(f.ModifiedTime)+
                                   sizeof(f.Attributes)))
         {
-            return o;
+            return truncated(o, "FileShellId");
         }
         m_in >> f.Unknown1;
         m_in >> f.FileSize;
@@ -556,14 +888,14 @@ private:
         if (f.is_unicode()) {
             std::u16string u = m_in.read_unicode(u16_nchars(b.maxlen()));
             if (!b.struct_pop_nothrow(u16s0_nbytes(u))) {
-                return o;
+                return truncated(o, "FileShellId");
             }
             f.Name = utf16le_to_utf8(u);
             o->put("Name", f.Name, true);
         } else {
             std::string a = m_in.read_ansi(b.maxlen());
             if (!b.struct_pop_nothrow(a.size()+1)) {
-                return o;
+                return truncated(o, "FileShellId");
             }
             f.Name = a;
             o->put("Name", f.Name, false);
@@ -597,19 +929,21 @@ private:
             // post-xp
             LnkStruct::ShellId_BeefBase z;
             if (!b.struct_pop_nothrow(sizeof(z.Size))) {
-                return o;
+                return truncated(o, "FileShellId");
             }
             m_in.seekg(b.struct_start());
             if (!b.struct_pop_nothrow(sizeof(z.Version)+sizeof(z.Signature))) {
-                return o;
+                return truncated(o, "FileShellId");
             }
             z.Size = maybe_size;
             m_in >> z.Version;
             o->put_debug("Version", z.Version);
             m_in >> z.Signature;
             o->put_debug("Signature", z.Signature, LnkOutput::IntegerValue::Hex);
-            if (z.Signature == LnkStruct::ShellId_Beef0004::Signature) {
-                ext_BEEF0004(b, o, z);
+            if (z.Signature == LnkStruct::ShellId_Beef0004::Signature &&
+                !ext_BEEF0004(b, o, z, f.Extension.emplace()))
+            {
+                warn(WarningKind::ShellItemTruncated, m_in.tellg(), "BEEF0004");
             }
         }
         else
@@ -619,14 +953,14 @@ private:
             if (f.is_unicode()) {
                 std::u16string u = m_in.read_unicode(u16_nchars(b.maxlen()));
                 if (!b.struct_pop_nothrow(u16s0_nbytes(u))) {
-                    return o;
+                    return truncated(o, "FileShellId");
                 }
                 f.SecondaryName = utf16le_to_utf8(u);
                 o->put("SecondaryName", f.SecondaryName, true);
             } else {
                 std::string a = m_in.read_ansi(b.maxlen());
                 if (!b.struct_pop_nothrow(a.size()+1)) {
-                    return o;
+                    return truncated(o, "FileShellId");
                 }
                 f.SecondaryName = a;
                 o->put("SecondaryName", f.SecondaryName, false);
@@ -635,15 +969,15 @@ private:
         return o;
     }
 
-    LnkOutput::StreamPtr
-    x40_network(const LnkStruct::LinkTargetIdList::ID& id, BoundsChecker b)
+    LnkOutput::Stream*
+    x40_network(LnkStruct::LinkTargetIdList::ID& id, BoundsChecker b)
     {
-        auto o = LnkOutput::Stream::make();
-        LnkStruct::ShellId_x40_Struct f;
+        auto o = m_arena.make_stream();
+        auto& f = id.Item.emplace<LnkStruct::ShellId_x40_Struct>();
         f.Type = id.Data.data()[0] & (~0x70);
         o->put("Type", f.Type);
         if (!b.struct_pop_nothrow(sizeof(f.Unknown1)+sizeof(f.Flags))) {
-            return o;
+            return truncated(o, "NetworkLocationShellId");
         }
         m_in >> f.Unknown1;
         m_in >> f.Flags;
@@ -670,16 +1004,16 @@ private:
         return o;
     }
 
-    LnkOutput::StreamPtr
-    x50_zip_folder(BoundsChecker b)
+    LnkOutput::Stream*
+    x50_zip_folder(LnkStruct::LinkTargetIdList::ID& id, BoundsChecker b)
     {
-        auto o = LnkOutput::Stream::make();
-        LnkStruct::ShellId_x50_Struct f;
+        auto o = m_arena.make_stream();
+        auto& f = id.Item.emplace<LnkStruct::ShellId_x50_Struct>();
         if (!b.struct_pop_nothrow(sizeof(f.Unknown1)+sizeof(f.Unknown2)+sizeof(f.Unknown3)+
                                   sizeof(f.Unknown4)+sizeof(f.Unknown5)+sizeof(f.Unknown6)+
                                   sizeof(f.Timestamp)+sizeof(f.Unknown7)+sizeof(f.Timestamp2)))
         {
-            return o;
+            return truncated(o, "ZipFolderShellId");
         }
         m_in >> f.Unknown1;
         m_in >> f.Unknown2;
@@ -695,7 +1029,7 @@ private:
             o->put("Timestamp2", f.Timestamp2);
         }
         if (!b.struct_pop_nothrow(sizeof(f.FullPathSize))) {
-            return o;
+            return truncated(o, "ZipFolderShellId");
         }
         m_in >> f.FullPathSize;  // ignore
         if (b.maxlen() <= 0) {
@@ -703,27 +1037,27 @@ private:
         }
         std::u16string tmp = m_in.read_unicode(u16_nchars(b.maxlen()));
         if (!b.struct_pop_nothrow(u16s0_nbytes(tmp))) {
-            return o;
+            return truncated(o, "ZipFolderShellId");
         }
         f.FullPath = utf16le_to_utf8(tmp);
         o->put("FullPath", f.FullPath, true);
         return o;
     }
 
-    LnkOutput::StreamPtr
-    x60_uri(const LnkStruct::LinkTargetIdList::ID& id, BoundsChecker b)
+    LnkOutput::Stream*
+    x60_uri(LnkStruct::LinkTargetIdList::ID& id, BoundsChecker b)
     {
-        auto o = LnkOutput::Stream::make();
-        LnkStruct::ShellId_x60_Struct f;
+        auto o = m_arena.make_stream();
+        auto& f = id.Item.emplace<LnkStruct::ShellId_x60_Struct>();
         if (!b.struct_pop_nothrow(sizeof(f.Flags))) {
-            return o;
+            return truncated(o, "URIShellId");
         }
         m_in >> f.Flags;
         o->put_debug("Flags", f.Flags);
         if ((id.Data.data()[0] & (~0x70)) == 0x01 && (f.Flags & (~0x80)) == 0x00) {
             // seems to only contain 1 byte flags, 4 bytes zero and a string
             if (!b.struct_pop_nothrow(sizeof(f.Unknown1))) {
-                return o;
+                return truncated(o, "URIShellId");
             }
             m_in >> f.Unknown1;
             if (f.is_unicode()) {
@@ -741,7 +1075,7 @@ private:
             return o;
         }
         if (!b.struct_pop_nothrow(sizeof(f.DataSize))) {
-            return o;
+            return truncated(o, "URIShellId");
         }
         m_in >> f.DataSize;
         if (f.DataSize > 0) {
@@ -749,12 +1083,17 @@ private:
                                       sizeof(f.Unknown4)+sizeof(f.Unknown5)+sizeof(f.Unknown6)+
                                       sizeof(f.Unknown7)+sizeof(f.Unknown8)+sizeof(f.String1Bytes)))
             {
-                return o;
+                return truncated(o, "URIShellId");
             }
             m_in >> f.Unknown1;
             m_in >> f.Unknown2;
             m_in >> f.Timestamp;
+            LnkStruct::check_times(&f.Timestamp, &f.TimestampFlags, 1,
+                                   LnkStruct::MSTimeProperty::now());
             o->put("Timestamp", f.Timestamp);
+            if (f.TimestampFlags.value() != 0) {
+                o->put("TimestampFlags", f.TimestampFlags);
+            }
             m_in >> f.Unknown4;
             m_in >> f.Unknown5;
             m_in >> f.Unknown6;
@@ -762,7 +1101,7 @@ private:
             m_in >> f.Unknown8;
             m_in >> f.String1Bytes;
             if (!b.struct_pop_nothrow(f.String1Bytes)) {
-                return o;
+                return truncated(o, "URIShellId");
             }
             if (f.is_unicode()) {
                 std::u16string u = m_in.read_exact_unicode(f.String1Bytes);
@@ -777,11 +1116,11 @@ private:
                 }
             }
             if (!b.struct_pop_nothrow(sizeof(f.String2Bytes))) {
-                return o;
+                return truncated(o, "URIShellId");
             }
             m_in >> f.String2Bytes;
             if (!b.struct_pop_nothrow(f.String2Bytes)) {
-                return o;
+                return truncated(o, "URIShellId");
             }
             if (f.is_unicode()) {
                 std::u16string u = m_in.read_exact_unicode(f.String2Bytes);
@@ -796,21 +1135,21 @@ private:
                 }
             }
             if (!b.struct_pop_nothrow(sizeof(f.String3Bytes))) {
-                return o;
+                return truncated(o, "URIShellId");
             }
             m_in >> f.String3Bytes;
             if (!b.struct_pop_nothrow(f.String3Bytes)) {
-                return o;
+                return truncated(o, "URIShellId");
             }
             if (f.is_unicode()) {
                 std::u16string u = m_in.read_exact_unicode(f.String3Bytes);
                 f.FTPPassword = utf16le_to_utf8(u);
-                if (f.FTPUser.size() > 0) {
+                if (f.FTPPassword.size() > 0) {
                     o->put("FTPPassword", f.FTPPassword, true);
                 }
             } else {
                 f.FTPPassword = m_in.read_exact(f.String3Bytes);
-                if (f.FTPUser.size() > 0) {
+                if (f.FTPPassword.size() > 0) {
                     o->put("FTPPassword", f.FTPPassword, false);
                 }
             }
@@ -834,15 +1173,15 @@ private:
         return o;
     }
 
-    LnkOutput::StreamPtr
-    x70_control_panel(BoundsChecker b)
+    LnkOutput::Stream*
+    x70_control_panel(LnkStruct::LinkTargetIdList::ID& id, BoundsChecker b)
     {
-        auto o = LnkOutput::Stream::make();
-        LnkStruct::ShellId_x70_Struct f;
+        auto o = m_arena.make_stream();
+        auto& f = id.Item.emplace<LnkStruct::ShellId_x70_Struct>();
         if (!b.struct_pop_nothrow(sizeof(f.SortOrder)+sizeof(f.Unknown1)+sizeof(f.Unknown2)+
                                   sizeof(f.Unknown3)+sizeof(f.GUID)))
         {
-            return o;
+            return truncated(o, "ControlPanelShellId");
         }
         m_in >> f.SortOrder;
         o->put_debug("SortOrder", f.SortOrder, LnkOutput::IntegerValue::Hex);
@@ -850,7 +1189,11 @@ private:
         m_in >> f.Unknown2;
         m_in >> f.Unknown3;
         m_in >> f.GUID;
-        const char* desc = LnkStruct::control_panel_guid_describe(f.GUID.string().c_str());
+        if (o->discards()) {
+            return o;
+        }
+        char guid[LnkStruct::Guid::STRING_SIZE];
+        const char* desc = LnkStruct::control_panel_guid_describe(f.GUID.format(guid));
         if (desc != nullptr) {
             o->put("Category", desc, true);
         }
@@ -858,16 +1201,16 @@ private:
         return o;
     }
 
-    LnkOutput::StreamPtr
-    x74_user_folder_delegate(BoundsChecker b)
+    LnkOutput::Stream*
+    x74_user_folder_delegate(LnkStruct::LinkTargetIdList::ID& id, BoundsChecker b)
     {
-        auto o = LnkOutput::Stream::make();
-        LnkStruct::ShellId_x74_Struct f;
+        auto o = m_arena.make_stream();
+        auto& f = id.Item.emplace<LnkStruct::ShellId_x74_Struct>();
         BoundsChecker outer = b;
         if (!b.struct_pop_nothrow(sizeof(f.Unknown1)+sizeof(f.DelegateOffset)+
                                   sizeof(f.SubShellItemSignature)+sizeof(f.SubShellItemSize)))
         {
-            return o;
+            return truncated(o, "UserFolderDelegate");
         }
         BoundsChecker inner = b;
         m_in >> f.Unknown1;
@@ -886,13 +1229,14 @@ private:
         {
             // inner item
             auto& s = f.SubShellItem;
-            inner.struct_len(f.SubShellItemSize, "SubShellItem");
-            if (inner.struct_end() > outer.struct_end() ||
+            if (!inner.struct_len_nothrow(f.SubShellItemSize) ||
+                inner.struct_end() > outer.struct_end() ||
                 inner.struct_end() > outer.struct_start() + f.DelegateOffset + 3 ||
                 !inner.struct_pop_nothrow(sizeof(s.ClsType)+sizeof(s.Unknown1)+
-                                          sizeof(s.ModifiedTime)+sizeof(s.FileAttributes)))
+                                          sizeof(s.FileSize)+sizeof(s.ModifiedTime)+
+                                          sizeof(s.FileAttributes)))
             {
-                return o;
+                return truncated(o, "UserFolderDelegate");
             }
             m_in >> s.ClsType;
             if (s.ClsType != 0x31) {
@@ -909,51 +1253,99 @@ private:
             s.PrimaryName = m_in.read_ansi(inner.maxlen());
             o->put("PrimaryName", s.PrimaryName, false);
         }
-        m_in.seekg(outer.struct_start() + 3 + f.DelegateOffset);
-        // delegate item
+        // delegate item, where DelegateOffset says and not where the inner item ended. the
+        // checks above keep it after the inner item and inside this one, bounds follow the seek.
+        m_in.seekg(b.struct_start(outer.struct_start() + 3 + f.DelegateOffset));
         if (!b.struct_pop_nothrow(sizeof(f.DelegateGuid)+sizeof(f.DelegateClass))) {
-            return o;
+            return truncated(o, "UserFolderDelegate");
         }
         m_in >> f.DelegateGuid;
         o->put_debug("DelegateGuid", f.DelegateGuid);
         m_in >> f.DelegateClass;
-        const char* desc = LnkStruct::shell_folder_guid_describe(f.DelegateClass.string().c_str());
-        if (desc != nullptr) {
-            o->put_debug("DelegateClass", desc, true);
+        if (!o->discards()) {
+            char guid[LnkStruct::Guid::STRING_SIZE];
+            const char* desc =
+                LnkStruct::shell_folder_guid_describe(f.DelegateClass.format(guid));
+            if (desc != nullptr) {
+                o->put_debug("DelegateClass", desc, true);
+            }
         }
         o->put_debug("DelegateClassGuid", f.DelegateClass);
         // extension block BEEF0004 follows
         LnkStruct::ShellId_BeefBase z;
         if (!b.struct_pop_nothrow(sizeof(z.Size)+sizeof(z.Version)+sizeof(z.Signature))) {
-            return o;
+            return truncated(o, "UserFolderDelegate");
         }
         m_in >> z.Size;
         m_in >> z.Version;
         m_in >> z.Signature;
-        if (z.Signature == LnkStruct::ShellId_Beef0004::Signature) {
-            ext_BEEF0004(b, o, z);
+        if (z.Signature == LnkStruct::ShellId_Beef0004::Signature &&
+            !ext_BEEF0004(b, o, z, f.Extension.emplace()))
+        {
+            warn(WarningKind::ShellItemTruncated, m_in.tellg(), "BEEF0004");
         }
         return o;
     }
 
+    //! for early returns from items that end before all of their fields
+    LnkOutput::Stream*
+    truncated(LnkOutput::Stream* o, const char* item)
+    {
+        warn(WarningKind::ShellItemTruncated, m_in.tellg(), item);
+        return o;
+    }
+
+    //! which field of the selection an item with this class type goes to
+    static int
+    item_field(uint8_t clstype)
+    {
+        if (clstype == 0x1F) {
+            return field("FolderShellId");
+        } else if ((clstype & 0x70) == 0x20) {
+            return field("VolumeShellId");
+        } else if ((clstype & 0x70) == 0x30) {
+            return field("FileShellId");
+        } else if ((clstype & 0x70) == 0x40) {
+            return field("NetworkLocationShellId");
+        } else if ((clstype & 0x70) == 0x50) {
+            return field("ZipFolderShellId");
+        } else if ((clstype & 0x70) == 0x60) {
+            return field("URIShellId");
+        } else if (clstype == 0x74) {
+            return field("UserFolderDelegate");
+        } else if ((clstype & 0x70) == 0x70) {
+            return field("ControlPanelShellId");
+        } else {
+            return field("UnknownShellId");
+        }
+    }
+
     void
     unknown_shellid(const LnkStruct::LinkTargetIdList::ID& id)
     {
-        auto o = LnkOutput::Stream::make();
+        auto o = m_arena.make_stream();
         o->put("Bytes", id.Data);
-        m_out->put_debug("UnknownShellId", std::move(o));
+        m_out->put_debug("UnknownShellId", o);
     }
 
 public:
-    LinkTargetIdList(FileStream &in):
-        m_in(in)
+    LinkTargetIdList(FileStream &in, LnkStruct::LinkTargetIdList& data, IdListFields_t fields,
+                     Diagnostics& diag, LnkOutput::Arena& arena):
+        Section(data, fields, diag, arena), m_in(in)
     {
         // the problem with this struct is that it is so poorly documented.
         // check bounds on each read and return if it would go past the end of the struct.
         // avoid throwing errors, just ignore them in this case.
         m_in >> m_data.IdListSize;
         struct_start(m_in.tellg());  // IdListSize does not include size of itself
-        struct_len(m_data.IdListSize, "LinkTargetIdList");
+        if (!struct_len_nothrow(m_data.IdListSize)) {
+            m_in.fail(ErrorKind::IntegerOverflow, "LinkTargetIdList", m_data.IdListSize);
+            return;
+        }
+        if (m_fields.value() == 0) {
+            m_in.seekg(struct_end());
+            return;
+        }
         while (true) {
             LnkStruct::LinkTargetIdList::ID id;
             BoundsChecker item_bounds;
@@ -963,7 +1355,7 @@ public:
                 return;
             }
             m_in >> id.ItemIdSize;  // ItemIdSize does include size of itself
-            if (id.ItemIdSize == 0) {
+            if (id.ItemIdSize == 0 || m_in.failed()) {
                 // terminal item
                 break;
             }
@@ -971,6 +1363,7 @@ public:
                 !item_bounds.struct_len_nothrow(id.ItemIdSize) ||
                 !item_bounds.struct_pop_nothrow(sizeof(id.ItemIdSize)))
             {
+                warn(WarningKind::ShellItemOverrun, struct_start(), "ItemIdSize", id.ItemIdSize);
                 //std::cerr << "size " << id.ItemIdSize << " too big, seek to structend " << struct_end() << std::endl; // TODO
                 m_in.seekg(struct_end());
                 return;
@@ -979,46 +1372,57 @@ public:
                 m_in.seekg(struct_end());
                 return;
             }
+            uint8_t clstype;
+            if (id.ItemIdSize > sizeof(id.ItemIdSize) && !selected(item_field(m_in.peek()))) {
+                // skip the whole item, nobody asked for it
+                struct_pop_nothrow(id.ItemIdSize);
+                m_in.seekg(struct_start());
+                continue;
+            }
             id.Data = in.read_binary(id.ItemIdSize - sizeof(id.ItemIdSize));
+            if (m_in.failed()) {
+                return;
+            }
             m_in.seekg(item_bounds.struct_start());  // after ItemIdSize
-            uint8_t clstype;
             if (!item_bounds.struct_pop_nothrow(sizeof(clstype))) {
                 m_in.seekg(struct_end());
                 return;
             }
             m_in >> clstype;
             if (clstype == 0x1F) {
-                auto o = x1f_root_folder(item_bounds);
-                m_out->put("FolderShellId", std::move(o));
+                auto o = x1f_root_folder(id, item_bounds);
+                m_out->put("FolderShellId", o);
             } else if ((clstype & 0x70) == 0x20) {
                 auto o = x20_volume(id);
                 o->put_debug("Bytes", id.Data);
-                m_out->put("VolumeShellId", std::move(o));
+                m_out->put("VolumeShellId", o);
             } else if ((clstype & 0x70) == 0x30) {
                 auto o = x30_file(id, item_bounds);
                 o->put_debug("Bytes", id.Data);
-                m_out->put("FileShellId", std::move(o));
+                m_out->put("FileShellId", o);
             } else if ((clstype & 0x70) == 0x40) {
                 auto o = x40_network(id, item_bounds);
                 o->put_debug("Bytes", id.Data);
-                m_out->put("NetworkLocationShellId", std::move(o));
+                m_out->put("NetworkLocationShellId", o);
             } else if ((clstype & 0x70) == 0x50) {
-                auto o = x50_zip_folder(item_bounds);
+                auto o = x50_zip_folder(id, item_bounds);
                 o->put_debug("Bytes", id.Data);
-                m_out->put("ZipFolderShellId", std::move(o));
+                m_out->put("ZipFolderShellId", o);
             } else if ((clstype & 0x70) == 0x60) {
                 auto o = x60_uri(id, item_bounds);
                 o->put_debug("Bytes", id.Data);
-                m_out->put("URIShellId", std::move(o));
+                m_out->put("URIShellId", o);
             } else if (clstype == 0x74) {
-                auto o = x74_user_folder_delegate(item_bounds);
+                auto o = x74_user_folder_delegate(id, item_bounds);
                 o->put_debug("Bytes", id.Data);
-                m_out->put("UserFolderDelegate", std::move(o));
+                m_out->put("UserFolderDelegate", o);
             } else if ((clstype & 0x70) == 0x70) {
-                auto o = x70_control_panel(item_bounds);
+                auto o = x70_control_panel(id, item_bounds);
                 o->put_debug("Bytes", id.Data);
-                m_out->put("ControlPanelShellId", std::move(o));
+                m_out->put("ControlPanelShellId", o);
             } else {
+                warn(WarningKind::UnknownShellItem, item_bounds.struct_start() - 1, "ClassType",
+                     clstype);
                 unknown_shellid(id);
             }
             struct_pop_nothrow(id.ItemIdSize);
@@ -1030,26 +1434,40 @@ public:
 };
 
 // section 2.3
-class LinkInfo: public Section<LnkStruct::LinkInfo>, protected BoundsChecker
+class LinkInfo: public Section<LnkStruct::LinkInfo, LinkInfoFields_t>, protected BoundsChecker
 {
 private:
     FileStream&  m_in;
 
-    //! reads a NUL-terminated 8-bit string at m_struct_start+off1+off2
-    std::string offset_ansi(size_t off1, size_t off2, const char* field_name)
+    //! check if at least 1 byte can be read from given offset, stop the parser if not
+    bool check_offsets(size_t off1, size_t off2, const char* field_name)
     {
-        check_offsets(off1, off2, field_name);
+        if (!check_offsets_nothrow(off1, off2)) {
+            m_in.fail_at(m_struct_start, ErrorKind::BadOffset, field_name, uint64_t(off1) + off2);
+            return false;
+        }
+        return true;
+    }
+
+    //! reads a NUL-terminated 8-bit string at m_struct_start+off1+off2 into r
+    void offset_ansi(std::string& r, size_t off1, size_t off2, const char* field_name)
+    {
+        if (!check_offsets(off1, off2, field_name)) {
+            r.clear();
+            return;
+        }
         m_in.seekg(m_struct_start + off1 + off2);
-        return m_in.read_ansi(maxlen(off1, off2));
+        m_in.read_ansi(r, maxlen(off1, off2));
     }
 
-    std::string offset_uni_cvt(size_t off1, size_t off2, const char* field_name)
+    void offset_uni_cvt(std::string& r, size_t off1, size_t off2, const char* field_name)
     {
-        check_offsets(off1, off2, field_name);
+        if (!check_offsets(off1, off2, field_name)) {
+            r.clear();
+            return;
+        }
         m_in.seekg(m_struct_start + off1 + off2);
-        auto tmp16 = m_in.read_unicode(maxlen(off1, off2));
-        auto tmp8 = utf16le_to_utf8(tmp16);
-        return tmp8;
+        m_in.read_unicode_utf8(r, maxlen(off1, off2));
     }
 
     void header()
@@ -1058,9 +1476,14 @@ private:
         auto &h = m_data.header;
         m_in >> h.LinkInfoSize;
         m_in >> h.LinkInfoHeaderSize;
-        struct_len(h.LinkInfoSize, "LinkInfo");
+        if (!struct_len_nothrow(h.LinkInfoSize)) {
+            m_in.fail(ErrorKind::IntegerOverflow, "LinkInfo", h.LinkInfoSize);
+            return;
+        }
         m_in >> h.LinkInfoFlags;
-        m_out->put_debug("LinkInfoFlags", h.LinkInfoFlags);
+        if (selected(field("LinkInfoFlags"))) {
+            m_out->put_debug("LinkInfoFlags", h.LinkInfoFlags);
+        }
         m_in >> h.VolumeIDOffset;
         m_in >> h.LocalBasePathOffset;
         m_in >> h.CommonNetworkRelativeLinkOffset;
@@ -1075,34 +1498,48 @@ private:
                 h.CommonPathSuffixOffsetUnicode = 0;
                 break;
             default:
-                throw Error::format("Wrong Link Info Header size, expected 0x1C or >=0x24, got %#X",
-                                    h.LinkInfoHeaderSize);
-        }
-        if (add_overflows(h.LinkInfoSize, m_struct_start)) {
-            throw Error::format("Link Info size is wrong, got %d bytes", h.LinkInfoSize);
+                m_in.fail_at(m_struct_start, ErrorKind::BadLinkInfoHeaderSize,
+                             "LinkInfoHeaderSize", h.LinkInfoHeaderSize);
+                return;
         }
     }
 
     void volume_id()
     {
         auto volid_offset = m_data.header.VolumeIDOffset;
-        check_offsets(volid_offset, 0x10, "VolumeID");  // 0x10 is the minimum size of VolumeID
+        // 0x10 is the minimum size of VolumeID
+        if (!check_offsets(volid_offset, 0x10, "VolumeID")) {
+            return;
+        }
         m_in.seekg(m_struct_start + volid_offset);
         auto &vi = m_data.data.VolumeID;
         m_in >> vi.Size;
-        check_offsets(volid_offset, vi.Size, "VolumeIDSize");
+        if (!check_offsets(volid_offset, vi.Size, "VolumeIDSize")) {
+            return;
+        }
         m_in >> vi.DriveType;
-        m_out->put("DriveType", vi.DriveType);
+        if (!m_in.failed() && !vi.DriveType.valid()) {
+            warn(WarningKind::BadEnumValue, m_in.tellg() - sizeof(uint32_t), "DriveType",
+                 vi.DriveType.get_value());
+        }
+        if (selected(field("DriveType"))) {
+            m_out->put("DriveType", vi.DriveType);
+        }
         m_in >> vi.DriveSerialNumber;
-        m_out->put_debug("DriveSerialNumber", vi.DriveSerialNumber);
+        if (selected(field("DriveSerialNumber"))) {
+            m_out->put_debug("DriveSerialNumber", vi.DriveSerialNumber);
+        }
         m_in >> vi.VolumeLabelOffset;
         m_in >> vi.VolumeLabelOffsetUnicode;
+        if (!selected(field("VolumeLabel"))) {
+            return;
+        }
         if (vi.has_unicode_label()) {
-            vi.VolumeLabelUnicode = offset_uni_cvt(volid_offset, vi.VolumeLabelOffsetUnicode,
-                                                   "VolumeLabelUnicode");
+            offset_uni_cvt(vi.VolumeLabelUnicode, volid_offset, vi.VolumeLabelOffsetUnicode,
+                           "VolumeLabelUnicode");
             m_out->put("VolumeLabel", vi.VolumeLabelUnicode, true);
         } else {
-            vi.VolumeLabel = offset_ansi(volid_offset, vi.VolumeLabelOffset, "VolumeLabel");
+            offset_ansi(vi.VolumeLabel, volid_offset, vi.VolumeLabelOffset, "VolumeLabel");
             m_out->put("VolumeLabel", vi.VolumeLabel, false);
         }
     }
@@ -1110,23 +1547,31 @@ private:
     void common_network_relative_link()
     {
         auto cnrl_offset = m_data.header.CommonNetworkRelativeLinkOffset;
-        check_offsets(cnrl_offset, 0x14, "CommonNetworkRelativeLinkOffset");
+        if (!check_offsets(cnrl_offset, 0x14, "CommonNetworkRelativeLinkOffset")) {
+            return;
+        }
         m_in.seekg(m_struct_start + cnrl_offset);
         auto &cnrl = m_data.data.CommonNetworkRelativeLink;
         m_in >> cnrl.Size;
-        check_offsets(cnrl_offset, cnrl.Size, "CommonNetworkRelativeLinkSize");
+        if (!check_offsets(cnrl_offset, cnrl.Size, "CommonNetworkRelativeLinkSize")) {
+            return;
+        }
         m_in >> cnrl.Flags;
         if (!cnrl.Flags.verify()) {
             // fatal, required to detect presence of offsets
-            throw Error::format("CommonNetworkRelativeLink flags are not valid: %#X, "
-                                "invalid bits are %#X", cnrl.Flags.value(),
-                                cnrl.Flags.invalid_bits);
+            m_in.fail(ErrorKind::BadNetworkLinkFlags, "CommonNetworkRelativeLinkFlags",
+                      cnrl.Flags.value());
+            return;
+        }
+        if (selected(field("CommonNetworkRelativeLinkFlags"))) {
+            m_out->put("CommonNetworkRelativeLinkFlags", cnrl.Flags);
         }
-        m_out->put("CommonNetworkRelativeLinkFlags", cnrl.Flags);
         m_in >> cnrl.NetNameOffset;
         m_in >> cnrl.DeviceNameOffset;
         m_in >> cnrl.NetworkProviderType;
-        m_out->put("NetworkProviderType", cnrl.NetworkProviderType);
+        if (selected(field("NetworkProviderType"))) {
+            m_out->put("NetworkProviderType", cnrl.NetworkProviderType);
+        }
         if (cnrl.has_optional_fields()) {
             m_in >> cnrl.NetNameOffsetUnicode;
             m_in >> cnrl.DeviceNameOffsetUnicode;
@@ -1134,49 +1579,89 @@ private:
             cnrl.NetNameOffsetUnicode = 0;
             cnrl.DeviceNameOffsetUnicode = 0;
         }
+        bool net_name = selected(field("NetName"));
+        bool device_name = selected(field("DeviceName")) && cnrl.has_device_name();
         if (cnrl.has_optional_fields()) {
-            cnrl.NetNameUnicode = offset_uni_cvt(cnrl_offset, cnrl.NetNameOffsetUnicode,
-                                                 "NetNameUnicode");
-            m_out->put("NetName", cnrl.NetNameUnicode, true);
-            if (cnrl.has_device_name()) {
-                cnrl.DeviceNameUnicode = offset_uni_cvt(cnrl_offset, cnrl.DeviceNameOffsetUnicode,
-                                                        "DeviceNameUnicode");
+            if (net_name) {
+                offset_uni_cvt(cnrl.NetNameUnicode, cnrl_offset, cnrl.NetNameOffsetUnicode,
+                               "NetNameUnicode");
+                m_out->put("NetName", cnrl.NetNameUnicode, true);
+            }
+            if (device_name) {
+                offset_uni_cvt(cnrl.DeviceNameUnicode, cnrl_offset, cnrl.DeviceNameOffsetUnicode,
+                               "DeviceNameUnicode");
                 m_out->put("DeviceName", cnrl.DeviceNameUnicode, true);
             }
         } else {
-            cnrl.NetName = offset_ansi(cnrl_offset, cnrl.NetNameOffset, "NetName");
-            m_out->put("NetName", cnrl.NetName, false);
-            if (cnrl.has_device_name()) {
-                cnrl.DeviceName = offset_ansi(cnrl_offset, cnrl.DeviceNameOffset, "DeviceName");
+            if (net_name) {
+                offset_ansi(cnrl.NetName, cnrl_offset, cnrl.NetNameOffset, "NetName");
+                m_out->put("NetName", cnrl.NetName, false);
+            }
+            if (device_name) {
+                offset_ansi(cnrl.DeviceName, cnrl_offset, cnrl.DeviceNameOffset, "DeviceName");
                 m_out->put("DeviceName", cnrl.DeviceName, false);
             }
         }
     }
 
 public:
-    LinkInfo(FileStream &in): m_in(in)
-    {
+    LinkInfo(FileStream &in, LnkStruct::LinkInfo& data, LinkInfoFields_t fields,
+             Diagnostics& diag, LnkOutput::Arena& arena):
+        Section(data, fields, diag, arena), m_in(in)
+    {
+        if (m_fields.value() == 0) {
+            // skip the whole structure
+            struct_start(m_in.tellg());
+            m_in >> m_data.header.LinkInfoSize;
+            if (!struct_len_nothrow(m_data.header.LinkInfoSize)) {
+                m_in.fail(ErrorKind::IntegerOverflow, "LinkInfo", m_data.header.LinkInfoSize);
+                return;
+            }
+            m_in.seekg(m_struct_end);
+            return;
+        }
         header();
+        if (m_in.failed()) {
+            return;
+        }
         if (m_data.header.has_volume_id_and_local_base_path()) {
             auto &h = m_data.header;
             auto &d = m_data.data;
-            volume_id();
-
+            if (selected(field("DriveType")) || selected(field("DriveSerialNumber")) ||
+                selected(field("VolumeLabel")))
+            {
+                volume_id();
+            }
+            bool local_base_path = selected(field("LocalBasePath"));
+            bool common_path_suffix = selected(field("CommonPathSuffix"));
             if (m_data.header.has_optional_fields()) {
-                d.LocalBasePathUnicode = offset_uni_cvt(h.LocalBasePathOffsetUnicode, 0,
-                                                        "LocalBasePathUnicode");
-                d.CommonPathSuffixUnicode = offset_uni_cvt(h.CommonPathSuffixOffsetUnicode, 0,
-                                                           "LocalBasePathUnicode");
-                m_out->put("LocalBasePath", d.LocalBasePathUnicode, true);
-                m_out->put("CommonPathSuffix", d.CommonPathSuffixUnicode, true);
+                if (local_base_path) {
+                    offset_uni_cvt(d.LocalBasePathUnicode, h.LocalBasePathOffsetUnicode, 0,
+                                   "LocalBasePathUnicode");
+                    m_out->put("LocalBasePath", d.LocalBasePathUnicode, true);
+                }
+                if (common_path_suffix) {
+                    offset_uni_cvt(d.CommonPathSuffixUnicode, h.CommonPathSuffixOffsetUnicode, 0,
+                                   "LocalBasePathUnicode");
+                    m_out->put("CommonPathSuffix", d.CommonPathSuffixUnicode, true);
+                }
             } else {
-                d.LocalBasePath = offset_ansi(h.LocalBasePathOffset, 0, "LocalBasePath");
-                d.CommonPathSuffix = offset_ansi(h.CommonPathSuffixOffset, 0, "CommonPathSuffix");
-                m_out->put("LocalBasePath", d.LocalBasePath, false);
-                m_out->put("CommonPathSuffix", d.CommonPathSuffix, false);
+                if (local_base_path) {
+                    offset_ansi(d.LocalBasePath, h.LocalBasePathOffset, 0, "LocalBasePath");
+                    m_out->put("LocalBasePath", d.LocalBasePath, false);
+                }
+                if (common_path_suffix) {
+                    offset_ansi(d.CommonPathSuffix, h.CommonPathSuffixOffset, 0,
+                                "CommonPathSuffix");
+                    m_out->put("CommonPathSuffix", d.CommonPathSuffix, false);
+                }
             }
         }
-        if (m_data.header.has_common_network_relative_link()) {
+        if (m_data.header.has_common_network_relative_link() &&
+            (selected(field("CommonNetworkRelativeLinkFlags")) ||
+             selected(field("NetworkProviderType")) || selected(field("NetName")) ||
+             selected(field("DeviceName"))))
+        {
             common_network_relative_link();
         }
         m_in.seekg(m_struct_end);
@@ -1184,219 +1669,279 @@ public:
 };
 
 // section 2.4
-class StringData: public Section<LnkStruct::StringData>
+class StringData: public Section<LnkStruct::StringData, StringDataFields_t>
 {
 private:
     FileStream& m_in;
 
     // the strings in this section are prefixed with size
     //! read ansi string at current offset (as defined in 2.4 - 16bit length, then chars)
-    std::string ansi()
+    void ansi(std::string& s)
     {
         uint16_t n_chars;
         m_in >> n_chars;
-        return m_in.read_exact(n_chars);
+        m_in.read_exact(s, n_chars);
     }
 
     //! read unicode string at current offset (as defined in 2.4 - 16bit length, then chars)
-    std::string uni_cvt()
+    void uni_cvt(std::string& s)
+    {
+        uint16_t n_chars;
+        m_in >> n_chars;
+        m_in.read_exact_unicode_utf8(s, n_chars*sizeof(uint16_t));
+    }
+
+    //! skip string at current offset without converting it
+    void skip(bool unicode)
     {
         uint16_t n_chars;
         m_in >> n_chars;
-        std::u16string u = m_in.read_exact_unicode(n_chars*sizeof(uint16_t));
-        return utf16le_to_utf8(u);
+        m_in.ignore(unicode ? n_chars*sizeof(uint16_t) : n_chars);
+    }
+
+    //! read the string if the field was selected, otherwise skip it
+    void string(std::string& s, const char* name, int bit, bool unicode)
+    {
+        if (selected(bit)) {
+            if (unicode) {
+                uni_cvt(s);
+            } else {
+                ansi(s);
+            }
+            m_out->put(name, s, unicode);
+        } else {
+            skip(unicode);
+        }
     }
 
 public:
-    StringData(FileStream &in, LnkStruct::ShellLinkHeader& h): m_in(in)
+    StringData(FileStream &in, LnkStruct::ShellLinkHeader& h, LnkStruct::StringData& data,
+               StringDataFields_t fields, Diagnostics& diag, LnkOutput::Arena& arena):
+        Section(data, fields, diag, arena), m_in(in)
     {
         auto& s = m_data;
         bool unicode = h.has_unicode_strings();
         if (h.has_name_string()) {
-            s.Name = unicode ? uni_cvt() : ansi();
-            m_out->put("Name", s.Name, unicode);
+            string(s.Name, "Name", field("Name"), unicode);
         }
         if (h.has_relpath_string()) {
-            s.RelativePath = unicode ? uni_cvt() : ansi();
-            m_out->put("RelativePath", s.RelativePath, unicode);
+            string(s.RelativePath, "RelativePath", field("RelativePath"), unicode);
         }
         if (h.has_workdir_string()) {
-            s.WorkingDir = unicode ? uni_cvt() : ansi();
-            m_out->put("WorkingDir", s.WorkingDir, unicode);
+            string(s.WorkingDir, "WorkingDir", field("WorkingDir"), unicode);
         }
         if (h.has_args_string()) {
-            s.CommandLine = unicode ? uni_cvt() : ansi();
-            m_out->put("CommandLine", s.CommandLine, unicode);
+            string(s.CommandLine, "CommandLine", field("CommandLine"), unicode);
         }
         if (h.has_iconloc_string()) {
-            s.IconLocation = unicode ? uni_cvt() : ansi();
-            m_out->put("IconLocation", s.IconLocation, unicode);
+            string(s.IconLocation, "IconLocation", field("IconLocation"), unicode);
         }
         s.UnicodeFlag = unicode;
     }
 };
 
 // section 2.5
-class ExtraData: public Section<LnkStruct::ExtraDataPH>
+class ExtraData: public Section<LnkStruct::ExtraData, ExtraDataFields_t>
 {
 private:
     FileStream &m_in;
     void console_data()
     {
-        auto x = std::make_unique<LnkStruct::ConsoleDataBlock>();
-        auto o = LnkOutput::Stream::make();
-        m_in >> x->FillAttributes;
-        o->put("FillAttributes", x->FillAttributes);
-        m_in >> x->PopupFillAttributes;
-        o->put("PopupFillAttributes", x->PopupFillAttributes);
-        m_in >> x->ScreenBufferSizeX;
-        o->put("ScreenBufferSizeX", x->ScreenBufferSizeX);
-        m_in >> x->ScreenBufferSizeY;
-        o->put("ScreenBufferSizeY", x->ScreenBufferSizeY);
-        m_in >> x->WindowSizeX;
-        o->put("WindowSizeX", x->WindowSizeX);
-        m_in >> x->WindowSizeY;
-        o->put("WindowSizeY", x->WindowSizeY);
-        m_in >> x->WindowOriginX;
-        o->put("WindowOriginX", x->WindowOriginX);
-        m_in >> x->WindowOriginY;
-        o->put("WindowOriginY", x->WindowOriginY);
-        m_in >> x->FontSize;
-        o->put("FontSize", x->FontSize);
-        m_in >> x->FontFamily;
-        o->put("FontFamily", x->FontFamily.family());
-        o->put("FontPitch", x->FontFamily.pitch());
-        m_in >> x->FontWeight;
-        o->put("FontWeight", x->FontWeight);
-        x->FaceName = utf16le_to_utf8(m_in.read_exact_unicode(64));
-        o->put("FaceName", x->FaceName, true);
-        m_in >> x->CursorSize;
-        o->put("CursorSize", x->CursorSize);
-        m_in >> x->FullScreen;
-        o->put("FullScreen", x->FullScreen);
-        m_in >> x->QuickEdit;
-        o->put("QuickEdit", x->QuickEdit);
-        m_in >> x->InsertMode;
-        o->put("InsertMode", x->InsertMode);
-        m_in >> x->AutoPosition;
-        o->put("AutoPosition", x->AutoPosition);
-        m_in >> x->HistoryBufferSize;
-        o->put("HistoryBufferSize", x->HistoryBufferSize);
-        m_in >> x->NumberOfHistoryBuffers;
-        o->put("NumberOfHistoryBuffers", x->NumberOfHistoryBuffers);
-        m_in >> x->HistoryNoDup;
-        o->put("HistoryNoDup", x->HistoryNoDup);
-        m_out->put("ConsoleDataBlock", std::move(o));
+        auto& x = m_data.console;
+        auto o = m_arena.make_stream();
+        m_in >> x.FillAttributes;
+        o->put("FillAttributes", x.FillAttributes);
+        m_in >> x.PopupFillAttributes;
+        o->put("PopupFillAttributes", x.PopupFillAttributes);
+        m_in >> x.ScreenBufferSizeX;
+        o->put("ScreenBufferSizeX", x.ScreenBufferSizeX);
+        m_in >> x.ScreenBufferSizeY;
+        o->put("ScreenBufferSizeY", x.ScreenBufferSizeY);
+        m_in >> x.WindowSizeX;
+        o->put("WindowSizeX", x.WindowSizeX);
+        m_in >> x.WindowSizeY;
+        o->put("WindowSizeY", x.WindowSizeY);
+        m_in >> x.WindowOriginX;
+        o->put("WindowOriginX", x.WindowOriginX);
+        m_in >> x.WindowOriginY;
+        o->put("WindowOriginY", x.WindowOriginY);
+        m_in >> x.Reserved1;
+        m_in >> x.Reserved2;
+        m_in >> x.FontSize;
+        o->put("FontSize", x.FontSize);
+        m_in >> x.FontFamily;
+        o->put("FontFamily", x.FontFamily.family());
+        o->put("FontPitch", x.FontFamily.pitch());
+        m_in >> x.FontWeight;
+        o->put("FontWeight", x.FontWeight);
+        m_in.read_exact_unicode_utf8(x.FaceName, 64);
+        o->put("FaceName", x.FaceName, true);
+        m_in >> x.CursorSize;
+        o->put("CursorSize", x.CursorSize);
+        m_in >> x.FullScreen;
+        o->put("FullScreen", x.FullScreen);
+        m_in >> x.QuickEdit;
+        o->put("QuickEdit", x.QuickEdit);
+        m_in >> x.InsertMode;
+        o->put("InsertMode", x.InsertMode);
+        m_in >> x.AutoPosition;
+        o->put("AutoPosition", x.AutoPosition);
+        m_in >> x.HistoryBufferSize;
+        o->put("HistoryBufferSize", x.HistoryBufferSize);
+        m_in >> x.NumberOfHistoryBuffers;
+        o->put("NumberOfHistoryBuffers", x.NumberOfHistoryBuffers);
+        m_in >> x.HistoryNoDup;
+        o->put("HistoryNoDup", x.HistoryNoDup);
+        for (auto& c: x.ColorTable) {
+            m_in >> c;
+        }
+        m_out->put("ConsoleDataBlock", o);
     }
     void console_fe_data()
     {
-        auto x = std::make_unique<LnkStruct::ConsoleFeDataBlock>();
-        auto o = LnkOutput::Stream::make();
-        m_in >> x->CodePage;
-        o->put("CodePage", x->CodePage);
-        m_out->put("ConsoleFeDataBlock", std::move(o));
+        auto& x = m_data.console_fe;
+        auto o = m_arena.make_stream();
+        m_in >> x.CodePage;
+        o->put("CodePage", x.CodePage);
+        m_out->put("ConsoleFeDataBlock", o);
     }
     void darwin_data()
     {
-        auto x = std::make_unique<LnkStruct::DarwinDataBlock>();
-        auto o = LnkOutput::Stream::make();
-        x->DarwinDataAnsi = m_in.read_exact(260);
+        auto& x = m_data.darwin;
+        auto o = m_arena.make_stream();
+        m_in.read_exact(x.DarwinDataAnsi, 260);
         // spec says to ignore DarwinDataAnsi
-        x->DarwinDataUnicode = utf16le_to_utf8(m_in.read_exact_unicode(260));
-        o->put("DarwinDataUnicode", x->DarwinDataUnicode, true);
-        m_out->put("DarwinDataBlock", std::move(o));
+        m_in.read_exact_unicode_utf8(x.DarwinDataUnicode, 260);
+        o->put("DarwinDataUnicode", x.DarwinDataUnicode, true);
+        m_out->put("DarwinDataBlock", o);
     }
     void env_var_data()
     {
-        auto x = std::make_unique<LnkStruct::EnvVarDataBlock>();
-        auto o = LnkOutput::Stream::make();
-        x->TargetAnsi = m_in.read_exact(260);
-        o->put("TargetAnsi", x->TargetAnsi, false);
-        x->TargetUnicode = utf16le_to_utf8(m_in.read_exact_unicode(260));
-        o->put("TargetUnicode", x->TargetUnicode, true);
-        m_out->put("EnvironmentVariableDataBlock", std::move(o));
+        auto& x = m_data.env_var;
+        auto o = m_arena.make_stream();
+        m_in.read_exact(x.TargetAnsi, 260);
+        o->put("TargetAnsi", x.TargetAnsi, false);
+        m_in.read_exact_unicode_utf8(x.TargetUnicode, 260);
+        o->put("TargetUnicode", x.TargetUnicode, true);
+        m_out->put("EnvironmentVariableDataBlock", o);
     }
     void icon_env_data()
     {
-        auto x = std::make_unique<LnkStruct::IconEnvDataBlock>();
-        auto o = LnkOutput::Stream::make();
-        x->TargetAnsi = m_in.read_exact(260);
-        o->put("TargetAnsi", x->TargetAnsi, false);
-        x->TargetUnicode = utf16le_to_utf8(m_in.read_exact_unicode(260));
-        o->put("TargetUnicode", x->TargetUnicode, true);
-        m_out->put("IconEnvironmentDataBlock", std::move(o));
+        auto& x = m_data.icon_env;
+        auto o = m_arena.make_stream();
+        m_in.read_exact(x.TargetAnsi, 260);
+        o->put("TargetAnsi", x.TargetAnsi, false);
+        m_in.read_exact_unicode_utf8(x.TargetUnicode, 260);
+        o->put("TargetUnicode", x.TargetUnicode, true);
+        m_out->put("IconEnvironmentDataBlock", o);
     }
     void known_folder_data()
     {
-        auto x = std::make_unique<LnkStruct::KnownFolderDataBlock>();
-        auto o = LnkOutput::Stream::make();
-        m_in >> x->KnownFolderId;
-        o->put("KnownFolderId", x->KnownFolderId);
-        m_in >> x->Offset;
-        o->put("Offset", x->Offset);
-        m_out->put("KnownFolderDataBlock", std::move(o));
+        auto& x = m_data.known_folder;
+        auto o = m_arena.make_stream();
+        m_in >> x.KnownFolderId;
+        o->put("KnownFolderId", x.KnownFolderId);
+        m_in >> x.Offset;
+        o->put("Offset", x.Offset);
+        m_out->put("KnownFolderDataBlock", o);
     }
     void property_store(const LnkStruct::ExtraDataBlockHeader &h)  // TODO
     {
-        auto o = LnkOutput::Stream::make();
-        auto b = m_in.read_binary(h.BlockSize - 8);
-        o->put("Bytes", b);
-        m_out->put_debug("PropertyStoreDataBlock", std::move(o));
+        auto& x = m_data.property_store;
+        auto o = m_arena.make_stream();
+        x.Data = m_in.read_binary(h.BlockSize - 8);
+        o->put("Bytes", x.Data);
+        m_out->put_debug("PropertyStoreDataBlock", o);
     }
     void shim_data(const LnkStruct::ExtraDataBlockHeader &h)
     {
-        auto x = std::make_unique<LnkStruct::ShimDataBlock>();
-        auto o = LnkOutput::Stream::make();
+        auto& x = m_data.shim;
+        auto o = m_arena.make_stream();
         size_t len = h.BlockSize - 8;
-        x->LayerName = utf16le_to_utf8(m_in.read_exact_unicode(len));
-        o->put("LayerName", x->LayerName, true);
-        m_out->put("ShimDataBlock", std::move(o));
+        m_in.read_exact_unicode_utf8(x.LayerName, len);
+        o->put("LayerName", x.LayerName, true);
+        m_out->put("ShimDataBlock", o);
     }
     void special_folder()
     {
-        auto x = std::make_unique<LnkStruct::SpecialFolderDataBlock>();
-        auto o = LnkOutput::Stream::make();
-        m_in >> x->SpecialFolderId;
-        o->put("SpecialFolderId", x->SpecialFolderId);
-        m_in >> x->Offset;
-        o->put("Offset", x->Offset);
-        m_out->put("SpecialFolderDataBlock", std::move(o));
+        auto& x = m_data.special_folder;
+        auto o = m_arena.make_stream();
+        m_in >> x.SpecialFolderId;
+        o->put("SpecialFolderId", x.SpecialFolderId);
+        m_in >> x.Offset;
+        o->put("Offset", x.Offset);
+        m_out->put("SpecialFolderDataBlock", o);
     }
     void tracker_data()
     {
-        auto x = std::make_unique<LnkStruct::TrackerDataBlock>();
-        auto o = LnkOutput::Stream::make();
-        m_in >> x->Length;
-        m_in >> x->Version;
-        x->MachineID = m_in.read_exact(16);
-        o->put("MachineID", x->MachineID, false);
-        m_in >> x->Droid1;  // TODO fix these, this representation is probably not correct, size ok
-        m_in >> x->Droid2;
-        // o->put("Droid", x->Droid1);
-        // o->put("Droid", x->Droid2);
-        m_in >> x->DroidBirth1;
-        m_in >> x->DroidBirth2;
-        // o->put("DroidBirth", x->DroidBirth1);
-        // o->put("DroidBirth", x->DroidBirth2);
-        m_out->put("TrackerDataBlock", std::move(o));
+        auto& x = m_data.tracker;
+        auto o = m_arena.make_stream();
+        m_in >> x.Length;
+        m_in >> x.Version;
+        m_in.read_exact(x.MachineID, 16);
+        o->put("MachineID", x.MachineID, false);
+        m_in >> x.Droid1;  // TODO fix these, this representation is probably not correct, size ok
+        m_in >> x.Droid2;
+        // o->put("Droid", x.Droid1);
+        // o->put("Droid", x.Droid2);
+        m_in >> x.DroidBirth1;
+        m_in >> x.DroidBirth2;
+        // o->put("DroidBirth", x.DroidBirth1);
+        // o->put("DroidBirth", x.DroidBirth2);
+        m_out->put("TrackerDataBlock", o);
     }
     void vista_block(const LnkStruct::ExtraDataBlockHeader &h)  // TODO
     {
-        auto o = LnkOutput::Stream::make();
-        auto b = m_in.read_binary(h.BlockSize - 8);
-        o->put("Bytes", b);
-        m_out->put_debug("VistaAndAboveIDListDataBlock", std::move(o));
+        auto& x = m_data.vista_id_list;
+        auto o = m_arena.make_stream();
+        x.Data = m_in.read_binary(h.BlockSize - 8);
+        o->put("Bytes", x.Data);
+        m_out->put_debug("VistaAndAboveIDListDataBlock", o);
     }
     void unknown_block(const LnkStruct::ExtraDataBlockHeader &h)
     {
-        auto o = LnkOutput::Stream::make();
+        auto o = m_arena.make_stream();
         auto b = m_in.read_binary(h.BlockSize - 8);
+        m_data.unknown.push_back(LnkStruct::UnknownDataBlock{h.BlockSignature, b});
         o->put("Bytes", b);
-        m_out->put_debug("UnknownExtraDataBlock", std::move(o));
+        m_out->put_debug("UnknownExtraDataBlock", o);
+    }
+    //! which field of the selection a block with this signature goes to
+    static int
+    block_field(uint32_t signature)
+    {
+        switch (signature) {
+            case LnkStruct::ConsoleDataBlock::Signature:
+                return field("ConsoleDataBlock");
+            case LnkStruct::ConsoleFeDataBlock::Signature:
+                return field("ConsoleFeDataBlock");
+            case LnkStruct::DarwinDataBlock::Signature:
+                return field("DarwinDataBlock");
+            case LnkStruct::EnvVarDataBlock::Signature:
+                return field("EnvironmentVariableDataBlock");
+            case LnkStruct::IconEnvDataBlock::Signature:
+                return field("IconEnvironmentDataBlock");
+            case LnkStruct::KnownFolderDataBlock::Signature:
+                return field("KnownFolderDataBlock");
+            case LnkStruct::PropertyStoreDataBlock::Signature:
+                return field("PropertyStoreDataBlock");
+            case LnkStruct::ShimDataBlock::Signature:
+                return field("ShimDataBlock");
+            case LnkStruct::SpecialFolderDataBlock::Signature:
+                return field("SpecialFolderDataBlock");
+            case LnkStruct::TrackerDataBlock::Signature:
+                return field("TrackerDataBlock");
+            case LnkStruct::VistaAndAboveIDListDataBlock::Signature:
+                return field("VistaAndAboveIDListDataBlock");
+            default:
+                return field("UnknownExtraDataBlock");
+        }
     }
+
 public:
-    ExtraData(FileStream &in):
-        m_in(in)
+    ExtraData(FileStream &in, LnkStruct::ExtraData& data, ExtraDataFields_t fields,
+              Diagnostics& diag, LnkOutput::Arena& arena):
+        Section(data, fields, diag, arena), m_in(in)
     {
         if (m_in.is_eof()) {
             return;
@@ -1406,10 +1951,22 @@ public:
             LnkStruct::ExtraDataBlockHeader h;
             in >> h.BlockSize;
             // spec says <4 but we need to read the signature unconditionally?
-            if (h.BlockSize < 8) {
+            if (h.BlockSize < 8 || m_in.failed()) {
+                if (h.BlockSize >= 4 && !m_in.failed()) {
+                    warn(WarningKind::BadExtraDataBlockSize, pos, "BlockSize", h.BlockSize);
+                }
                 break;
             }
             in >> h.BlockSignature;
+            int bit = block_field(h.BlockSignature);
+            if (bit == field("UnknownExtraDataBlock")) {
+                warn(WarningKind::UnknownExtraDataBlock, pos, "BlockSignature", h.BlockSignature);
+            }
+            if (!selected(bit)) {
+                m_in.seekg(pos + h.BlockSize);
+                continue;
+            }
+            m_data.signatures.push_back(h.BlockSignature);
             switch (h.BlockSignature) {
                 case LnkStruct::ConsoleDataBlock::Signature:
                     console_data();
@@ -1455,66 +2012,293 @@ public:
 
 // end of sections }}}
 
+// field selection {{{
+
+//! set all bits that have a name in the field table
+template <class T>
+static void
+select_all(LnkStruct::BitfieldProperty<T>& fields)
+{
+    for (size_t i = 0; i < T::description.size(); i++) {
+        if (T::description[i] != nullptr) {
+            fields = fields.value() | (1U << i);
+        }
+    }
+}
+
+//! select section, or a field in it if name is not empty. false if there is no such field.
+template <class T>
+static bool
+select_field(LnkStruct::BitfieldProperty<T>& fields, const std::string& name)
+{
+    if (name.empty()) {
+        select_all(fields);
+        return true;
+    }
+    int bit = LnkStruct::BitfieldProperty<T>::find(name.c_str());
+    if (bit < 0) {
+        return false;
+    }
+    fields = fields.value() | (1U << bit);
+    return true;
+}
+
+FieldSelection::FieldSelection(): diagnostics(true), everything(true), output(true)
+{
+    select_all(header);
+    select_all(id_list);
+    select_all(link_info);
+    select_all(string_data);
+    select_all(extra_data);
+}
+
+FieldSelection
+FieldSelection::data_only()
+{
+    FieldSelection r;
+    r.diagnostics = false;
+    r.output = false;
+    return r;
+}
+
+FieldSelection
+FieldSelection::parse(const std::string& expr)
+{
+    FieldSelection r;
+    r.header = 0;
+    r.id_list = 0;
+    r.link_info = 0;
+    r.string_data = 0;
+    r.extra_data = 0;
+    r.diagnostics = false;
+    r.everything = false;
+    size_t prev = 0;
+    while (prev <= expr.size()) {
+        size_t comma = expr.find(',', prev);
+        if (comma == std::string::npos) {
+            comma = expr.size();
+        }
+        std::string item = expr.substr(prev, comma - prev);
+        prev = comma + 1;
+        if (item.empty()) {
+            continue;
+        }
+        size_t dot = item.find('.');
+        std::string section = item.substr(0, dot);
+        std::string name = (dot == std::string::npos) ? std::string() : item.substr(dot + 1);
+        bool ok;
+        if (section == "ShellLinkHeader") {
+            ok = select_field(r.header, name);
+        } else if (section == "LinkTargetIdList") {
+            ok = select_field(r.id_list, name);
+        } else if (section == "LinkInfo") {
+            ok = select_field(r.link_info, name);
+        } else if (section == "StringData") {
+            ok = select_field(r.string_data, name);
+        } else if (section == "ExtraData") {
+            ok = select_field(r.extra_data, name);
+        } else if (section == "Diagnostics" && name.empty()) {
+            r.diagnostics = true;
+            ok = true;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            throw Error::format("Unknown field '%s'", item.c_str());
+        }
+    }
+    // nothing would be printed for any file
+    if (r.header.value() == 0 && r.id_list.value() == 0 && r.link_info.value() == 0 &&
+        r.string_data.value() == 0 && r.extra_data.value() == 0 && !r.diagnostics)
+    {
+        throw Error::format("No fields in '%s'", expr.c_str());
+    }
+    return r;
+}
+// }}}
+
+//! warnings as a section of the output
+static LnkOutput::Stream*
+diagnostics_output(const Diagnostics& diag, LnkOutput::Arena& arena)
+{
+    auto o = arena.make_stream();
+    for (const Warning& w : diag.warnings()) {
+        auto ow = arena.make_stream();
+        ow->put("Offset", w.offset, LnkOutput::IntegerValue::Hex);
+        if (w.field != nullptr) {
+            ow->put("Field", w.field, true);
+        }
+        ow->put("Value", w.value, LnkOutput::IntegerValue::Hex);
+        o->put(warning_name(w.kind), ow);
+    }
+    if (diag.total() > diag.warnings().size()) {
+        o->put("NotShown", diag.total() - diag.warnings().size());
+    }
+    return o;
+}
+
 struct ParserPriv
 {
-    std::unique_ptr<FileStream> m_in;
-    std::list<Error>            m_warnings;
-    LnkStruct::All              m_lnk;
-    LnkOutput::StreamPtr        m_output;
+    FileStream                          m_in;
+    Diagnostics                         m_diag;
+    LnkStruct::All                      m_lnk;
+    std::shared_ptr<LnkOutput::Arena>   m_arena;
+    LnkOutput::Stream*                  m_output;
+    FieldSelection                      m_fields;
+    std::pmr::memory_resource*          m_memory;
+
+    //! forget the previous file, keep the memory
+    void reset()
+    {
+        m_diag.clear();
+        m_lnk.clear();
+        if (m_arena.use_count() == 1) {
+            m_arena->reset();
+        } else {
+            // nodes of the previous output are still in use
+            m_arena = std::make_shared<LnkOutput::Arena>(!m_fields.output, m_memory);
+        }
+        m_output = m_arena->make_stream();
+    }
 };
 
-Parser::Parser(const std::string &file_name)
+Parser::Parser(const FieldSelection& fields):
+    Parser(fields, std::pmr::new_delete_resource())
+{
+}
+
+Parser::Parser(const FieldSelection& fields, std::pmr::memory_resource* memory)
 {
     auto p = new ParserPriv();
-    p->m_in = std::make_unique<FileStream>(file_name);
-    p->m_output = std::make_unique<LnkOutput::Stream>();
+    p->m_fields = fields;
+    p->m_memory = memory;
+    p->reset();
     this->p = p;
 }
 
+Parser::Parser(const std::string &file_name, const FieldSelection& fields): Parser(fields)
+{
+    reset(file_name);
+}
+
+void
+Parser::reset(const std::string &file_name)
+{
+    auto p = (ParserPriv*)this->p;
+    p->reset();
+    StageTimer t(Stage::Read);
+    p->m_in.load(file_name);
+    t.stop();
+    if (current_stats != nullptr) {
+        current_stats->bytes_read += p->m_in.size();
+    }
+}
+
+void
+Parser::reset(const char* buf, size_t size)
+{
+    auto p = (ParserPriv*)this->p;
+    p->reset();
+    p->m_in.load(buf, size);
+}
+
 void
 Parser::parse()
+{
+    Status s = try_parse();
+    if (!s.ok()) {
+        throw Error(s);
+    }
+}
+
+Status
+Parser::try_parse()
 {
     // output will be arranged in a different order from how the data is in the file
     // this is because LinkTargetIdList is 2nd and not interesting in most cases.
+    // bad input does not throw, sections stop early and the error is kept in the stream.
     auto p = (ParserPriv*)this->p;
-    Header h(*p->m_in);
-    LnkOutput::StreamPtr o_shid;
-    LnkOutput::StreamPtr o_str;
-    std::move(h.warnings().begin(), h.warnings().end(), p->m_warnings.end());
-    p->m_lnk.header = std::move(h.data());
+    const auto& f = p->m_fields;
+    auto& in = p->m_in;
+    auto& arena = *p->m_arena;
+    TraceSpan t_parse("Parse");
+    if (in.failed()) {
+        return in.status();
+    }
+    StageTimer t_hdr(Stage::Header);
+    Header h(in, p->m_lnk.header, f.header, p->m_diag, arena);
+    t_hdr.stop();
+    if (in.failed()) {
+        return in.status();
+    }
+    LnkOutput::Stream* o_shid = nullptr;
+    LnkOutput::Stream* o_str;
     // put the header first
-    p->m_output->put("ShellLinkHeader", h.output());
-    if (p->m_lnk.header.has_link_target_id_list()) {
-        LinkTargetIdList idlist(*p->m_in);
-        std::move(idlist.warnings().begin(), idlist.warnings().end(), p->m_warnings.end());
+    auto o_hdr = h.output();
+    if (f.everything || o_hdr->size() > 0) {
+        p->m_output->put("ShellLinkHeader", o_hdr);
+    }
+    // sections after the last selected one do not need to be read at all
+    bool need_extra = f.extra_data.value() != 0;
+    bool need_strings = need_extra || f.string_data.value() != 0;
+    bool need_info = need_strings || f.link_info.value() != 0;
+    bool need_idlist = need_info || f.id_list.value() != 0;
+    if (p->m_lnk.header.has_link_target_id_list() && need_idlist) {
+        StageTimer t(Stage::LinkTargetIdList);
+        LinkTargetIdList idlist(in, p->m_lnk.id_list, f.id_list, p->m_diag, arena);
+        t.stop();
         // leave idlist for later
         o_shid = idlist.output();
-        p->m_lnk.id_list = std::move(idlist);
+        p->m_lnk.id_list_present = true;
+        if (in.failed()) {
+            return in.status();
+        }
     }
-    if (p->m_lnk.header.has_link_info()) {
-        LinkInfo li(*p->m_in);
+    if (p->m_lnk.header.has_link_info() && need_info) {
+        StageTimer t(Stage::LinkInfo);
+        LinkInfo li(in, p->m_lnk.info, f.link_info, p->m_diag, arena);
+        t.stop();
         // put linkinfo second
-        p->m_output->put("LinkInfo", li.output());
-        std::move(li.warnings().begin(), li.warnings().end(), p->m_warnings.end());
-        p->m_lnk.info = std::move(li.data());
-    }
-    StringData s(*p->m_in, p->m_lnk.header);
-    o_str = s.output();
-    // put stringdata third
-    if (o_str->size() > 0) {
-        p->m_output->put("StringData", std::move(o_str));
-    }
-    std::move(s.warnings().begin(), s.warnings().end(), p->m_warnings.end());
-    p->m_lnk.string_data = std::move(s.data());
+        auto o_li = li.output();
+        if (f.everything || o_li->size() > 0) {
+            p->m_output->put("LinkInfo", o_li);
+        }
+        p->m_lnk.info_present = true;
+        if (in.failed()) {
+            return in.status();
+        }
+    }
+    if (need_strings) {
+        StageTimer t(Stage::StringData);
+        StringData s(in, p->m_lnk.header, p->m_lnk.string_data, f.string_data, p->m_diag,
+                     arena);
+        t.stop();
+        o_str = s.output();
+        // put stringdata third
+        if (o_str->size() > 0) {
+            p->m_output->put("StringData", o_str);
+        }
+        if (in.failed()) {
+            return in.status();
+        }
+    }
     // put shellids fourth
     if (o_shid != nullptr && o_shid->size() > 0) {
-        p->m_output->put("LinkTargetIdList", std::move(o_shid));
+        p->m_output->put("LinkTargetIdList", o_shid);
     }
-    ExtraData e(*p->m_in);
-    if (p->m_output->size() > 0) {
-        p->m_output->put("ExtraData", e.output());
+    if (need_extra) {
+        StageTimer t(Stage::ExtraData);
+        ExtraData e(in, p->m_lnk.extra_data, f.extra_data, p->m_diag, arena);
+        t.stop();
+        auto o_extra = e.output();
+        if (f.everything || o_extra->size() > 0) {
+            p->m_output->put("ExtraData", o_extra);
+        }
+    }
+    if (f.diagnostics && p->m_diag.total() > 0) {
+        p->m_output->put("Diagnostics", diagnostics_output(p->m_diag, arena));
     }
-    std::move(e.warnings().begin(), e.warnings().end(), p->m_warnings.end());
+    return in.status();
 }
 
 Parser::~Parser()
@@ -1530,11 +2314,25 @@ Parser::data()
     return p->m_lnk;
 }
 
+const Diagnostics&
+Parser::diagnostics() const
+{
+    auto p = (ParserPriv*)this->p;
+    return p->m_diag;
+}
+
+size_t
+Parser::size() const
+{
+    auto p = (ParserPriv*)this->p;
+    return p->m_in.size();
+}
+
 const LnkOutput::StreamPtr
 Parser::output()
 {
     auto p = (ParserPriv*)this->p;
-    return std::move(p->m_output);
+    return LnkOutput::StreamPtr(p->m_arena, p->m_output);
 }
 
 };  // namespace LnkFile
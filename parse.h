@@ -7,6 +7,10 @@
 #ifndef LNKFILE_H
 #define LNKFILE_H
 
+#include <array>
+#include <map>
+#include <ostream>
+#include <vector>
 #include "output.h"
 #include "struct.h"
 
@@ -14,24 +18,310 @@ namespace LnkParser {
 
 class FileStream;
 
+//! kinds of errors that stop the parser
+enum class ErrorKind
+{
+    None,
+    IoError,                // file could not be read, value is errno
+    Truncated,              // read past the end of file
+    IntegerOverflow,        // length or offset does not fit size_t
+    BadHeaderSize,          // value is HeaderSize
+    BadMagic,               // LinkCLSID is wrong
+    BadLinkFlags,           // value is LinkFlags
+    BadLinkInfoHeaderSize,  // value is LinkInfoHeaderSize
+    BadLength,              // length of field goes past the end of structure, value is length
+    BadOffset,              // offset of field points past the end of structure, value is offset
+    BadNetworkLinkFlags     // value is CommonNetworkRelativeLinkFlags
+};
+
+const size_t ERROR_KINDS = size_t(ErrorKind::BadNetworkLinkFlags) + 1;
+
+//! anything after this is not read
+const size_t MAX_FILE_SIZE = 1024L * 1024;
+
+//! short name of error kind, like "Truncated"
+const char* error_name(ErrorKind kind);
+
+//! result of parsing. message is only formatted when someone asks for it.
+struct Status
+{
+    ErrorKind           kind = ErrorKind::None;
+    size_t              offset = 0;         // file offset where the error was found
+    const char*         field = nullptr;    // name of the field, always a literal string
+    uint64_t            value = 0;          // offending value, see ErrorKind
+
+    bool ok() const { return kind == ErrorKind::None; }
+    std::string message() const;
+};
+
 class Error: public std::runtime_error
 {
 public:
     explicit Error(const char *msg): std::runtime_error(msg) { }
     explicit Error(std::string msg): std::runtime_error(msg) { }
+    explicit Error(const Status& s): std::runtime_error(s.message()) { }
     static Error format(const char *fmt, ...);
 };
 
+// diagnostics {{{
+
+//! kinds of problems that do not stop the parser
+enum class WarningKind
+{
+    NonZeroReserved,        // reserved field is not zero, value is the field
+    BadFlags,               // undefined bits are set in a bit field, value is the field
+    BadEnumValue,           // value is not one of the defined values
+    ShellItemOverrun,       // ItemIdSize goes past the end of LinkTargetIdList, value is ItemIdSize
+    ShellItemTruncated,     // shell item ends before all of its fields, field is the item type
+    UnknownShellItem,       // value is class type of the item
+    UnknownExtraDataBlock,  // value is BlockSignature
+    BadExtraDataBlockSize   // block cannot hold its own signature, value is BlockSize
+};
+
+const size_t WARNING_KINDS = size_t(WarningKind::BadExtraDataBlockSize) + 1;
+
+//! short name of warning kind, like "ShellItemTruncated"
+const char* warning_name(WarningKind kind);
+
+struct Warning
+{
+    WarningKind         kind;
+    size_t              offset;             // file offset where the problem was found
+    const char*         field;              // name of the field, always a literal string
+    uint64_t            value;              // see WarningKind
+
+    std::string message() const;
+};
+
+//! warnings of one file. all of them are counted, the first MAX_WARNINGS are also kept.
+class Diagnostics
+{
+public:
+    static const size_t MAX_WARNINGS = 32;
+
+private:
+    std::vector<Warning>                    m_warnings;
+    std::array<uint32_t, WARNING_KINDS>     m_counts;
+    uint32_t                                m_total;
+
+public:
+    Diagnostics() { clear(); }
+    void add(WarningKind kind, size_t offset, const char* field, uint64_t value = 0)
+    {
+        m_counts[size_t(kind)]++;
+        m_total++;
+        if (m_warnings.size() < MAX_WARNINGS) {
+            m_warnings.push_back(Warning{kind, offset, field, value});
+        }
+    }
+    //! count warnings without keeping them, for results that were not parsed just now
+    void add_count(WarningKind kind, uint32_t count)
+    {
+        m_counts[size_t(kind)] += count;
+        m_total += count;
+    }
+    //! forget everything, keep the memory
+    void clear()
+    {
+        m_warnings.clear();
+        m_counts.fill(0);
+        m_total = 0;
+    }
+    const std::vector<Warning>& warnings() const { return m_warnings; }
+    uint32_t count(WarningKind kind) const { return m_counts[size_t(kind)]; }
+    uint32_t total() const { return m_total; }
+};
+
+//! counts by value, for the labels of metrics. the first LIMIT values that come up are
+//! counted on their own and later ones in other, so the memory and the number of series stay
+//! bounded and no count ever moves from one series to another.
+struct ValueCounts
+{
+    static const size_t                     LIMIT = 32;
+
+    std::map<uint64_t, uint64_t>            counts;
+    uint64_t                                other = 0;
+
+    void add(uint64_t value, uint64_t n = 1);
+    void add(const ValueCounts& other);
+};
+
+//! totals over many files, cheap enough to update after every file
+struct BatchCounters
+{
+    uint64_t                                files = 0;
+    uint64_t                                failed = 0;
+    uint64_t                                with_warnings = 0;
+    uint64_t                                bytes = 0;
+    std::array<uint64_t, ERROR_KINDS>       errors = {};
+    std::array<uint64_t, WARNING_KINDS>     warnings = {};
+    // by value of the warnings that are kept, see Diagnostics::MAX_WARNINGS
+    ValueCounts                             unknown_shell_items;    // by class type
+    ValueCounts                             unknown_blocks;         // by BlockSignature
+
+    //! size is the number of bytes of the file that were read
+    void add(const Status& status, const Diagnostics& diag, uint64_t size = 0);
+    //! merge counters of another batch, e.g. from another thread
+    void add(const BatchCounters& other);
+    //! one line per non-zero counter
+    void print(std::ostream& out) const;
+};
+// }}}
+
+// field selection {{{
+// names of the fields in each section, as they are put into the output.
+// field selection is compiled into one bitmask per section.
+class HeaderFieldsTmpl
+{
+public:
+    typedef uint32_t data_type;
+    static const uint32_t invalid_bits = 0;
+    constexpr static std::array<const char *, 32> description = {
+        "LinkFlags",                            // 0
+        "FileAttributes",                       // 1
+        "CreationTime",                         // 2
+        "AccessTime",                           // 3
+        "WriteTime",                            // 4
+        "FileSize",                             // 5
+        "IconIndex",                            // 6
+        "ShowCommand",                          // 7
+        "HotKeyLow",                            // 8
+        "HotKeyHigh"                            // 9
+    };
+};
+
+class IdListFieldsTmpl
+{
+public:
+    typedef uint32_t data_type;
+    static const uint32_t invalid_bits = 0;
+    constexpr static std::array<const char *, 32> description = {
+        "FolderShellId",                        // 0
+        "VolumeShellId",                        // 1
+        "FileShellId",                          // 2
+        "NetworkLocationShellId",               // 3
+        "ZipFolderShellId",                     // 4
+        "URIShellId",                           // 5
+        "UserFolderDelegate",                   // 6
+        "ControlPanelShellId",                  // 7
+        "UnknownShellId"                        // 8
+    };
+};
+
+class LinkInfoFieldsTmpl
+{
+public:
+    typedef uint32_t data_type;
+    static const uint32_t invalid_bits = 0;
+    constexpr static std::array<const char *, 32> description = {
+        "LinkInfoFlags",                        // 0
+        "DriveType",                            // 1
+        "DriveSerialNumber",                    // 2
+        "VolumeLabel",                          // 3
+        "LocalBasePath",                        // 4
+        "CommonPathSuffix",                     // 5
+        "CommonNetworkRelativeLinkFlags",       // 6
+        "NetworkProviderType",                  // 7
+        "NetName",                              // 8
+        "DeviceName"                            // 9
+    };
+};
+
+class StringDataFieldsTmpl
+{
+public:
+    typedef uint32_t data_type;
+    static const uint32_t invalid_bits = 0;
+    constexpr static std::array<const char *, 32> description = {
+        "Name",                                 // 0
+        "RelativePath",                         // 1
+        "WorkingDir",                           // 2
+        "CommandLine",                          // 3
+        "IconLocation"                          // 4
+    };
+};
+
+class ExtraDataFieldsTmpl
+{
+public:
+    typedef uint32_t data_type;
+    static const uint32_t invalid_bits = 0;
+    constexpr static std::array<const char *, 32> description = {
+        "ConsoleDataBlock",                     // 0
+        "ConsoleFeDataBlock",                   // 1
+        "DarwinDataBlock",                      // 2
+        "EnvironmentVariableDataBlock",         // 3
+        "IconEnvironmentDataBlock",             // 4
+        "KnownFolderDataBlock",                 // 5
+        "PropertyStoreDataBlock",               // 6
+        "ShimDataBlock",                        // 7
+        "SpecialFolderDataBlock",               // 8
+        "TrackerDataBlock",                     // 9
+        "VistaAndAboveIDListDataBlock",         // 10
+        "UnknownExtraDataBlock"                 // 11
+    };
+};
+
+typedef LnkStruct::BitfieldProperty<HeaderFieldsTmpl>       HeaderFields_t;
+typedef LnkStruct::BitfieldProperty<IdListFieldsTmpl>       IdListFields_t;
+typedef LnkStruct::BitfieldProperty<LinkInfoFieldsTmpl>     LinkInfoFields_t;
+typedef LnkStruct::BitfieldProperty<StringDataFieldsTmpl>   StringDataFields_t;
+typedef LnkStruct::BitfieldProperty<ExtraDataFieldsTmpl>    ExtraDataFields_t;
+
+//! which fields are put into the output. parser skips sub-structures that nobody asked for,
+//! and those are also missing from Parser::data().
+struct FieldSelection
+{
+    HeaderFields_t          header;
+    IdListFields_t          id_list;
+    LinkInfoFields_t        link_info;
+    StringDataFields_t      string_data;
+    ExtraDataFields_t       extra_data;
+    bool                    diagnostics;
+    bool                    everything;
+    bool                    output;     // false: only fill Parser::data(), output() is empty
+
+    //! select everything
+    FieldSelection();
+    //! select everything, but build no output. for callers that only read Parser::data().
+    static FieldSelection data_only();
+    //! comma-separated list of "Section" or "Section.Field", such as
+    //! "ShellLinkHeader.WriteTime,LinkInfo". "Diagnostics" adds the warnings.
+    //! throws Error on unknown names and if nothing is selected.
+    static FieldSelection parse(const std::string& expr);
+};
+// }}}
+
 class Parser final
 {
 private:
     void*                       p;
 
 public:
-    Parser(const std::string &file_name);
+    //! parser without input, call reset() before parsing
+    Parser(const FieldSelection& fields = FieldSelection());
+    //! output memory is taken from 'memory' in large blocks
+    Parser(const FieldSelection& fields, std::pmr::memory_resource* memory);
+    Parser(const std::string &file_name, const FieldSelection& fields = FieldSelection());
+    Parser(const Parser&) = delete;
+    Parser& operator=(const Parser&) = delete;
     ~Parser();
+    //! start over with another file. read buffer, output memory and data() are reused,
+    //! unless output() of the previous file is still held somewhere.
+    void                        reset(const std::string &file_name);
+    //! same, but parse a file that is already in memory. it is not copied and needs to stay
+    //! valid until the next reset, because data() may point into it.
+    void                        reset(const char* buf, size_t size);
+    //! throws Error if the file could not be parsed
     void                        parse();
+    //! same as parse(), but returns the error instead of throwing it
+    Status                      try_parse();
+    //! typed contents of the last parsed file, including shell items and extra data blocks
     LnkStruct::All&             data();
+    //! warnings of the last parsed file
+    const Diagnostics&          diagnostics() const;
+    //! bytes of the last file that were read, at most MAX_FILE_SIZE
+    size_t                      size() const;
     const LnkOutput::StreamPtr  output();
 };
 
@@ -0,0 +1,427 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#include "pipeline.h"
+
+// std
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <tuple>
+
+// posix
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#endif
+
+// file source {{{
+int
+read_fd(int fd, std::vector<char>& data)
+{
+    char chunk[4096];
+    ssize_t n;
+    data.clear();
+    while (data.size() < LnkParser::MAX_FILE_SIZE &&
+           (n = ::read(fd, chunk, std::min(sizeof(chunk),
+                                           LnkParser::MAX_FILE_SIZE - data.size()))) != 0)
+    {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    return 0;
+}
+
+FileSource::FileSource(NameSource& names, size_t lookahead):
+    m_names(names), m_lookahead(std::max<size_t>(lookahead, 1))
+{
+}
+
+FileSource::~FileSource()
+{
+    for (auto& o: m_ahead) {
+        if (o.fd >= 0) {
+            close(o.fd);
+        }
+    }
+}
+
+bool
+FileSource::next(PipelineItem& item)
+{
+    // open the files ahead and let the kernel start reading them
+    while (m_ahead.size() < m_lookahead && m_more) {
+        Open o{{}, -1, 0};
+        if (!(m_more = m_names.next(o.name))) {
+            break;
+        }
+        o.fd = open(o.name.c_str(), O_RDONLY | O_CLOEXEC);
+        if (o.fd < 0) {
+            o.error = errno;
+        } else {
+#ifdef POSIX_FADV_WILLNEED
+            posix_fadvise(o.fd, 0, LnkParser::MAX_FILE_SIZE, POSIX_FADV_WILLNEED);
+#endif
+        }
+        m_ahead.push_back(std::move(o));
+    }
+    if (m_ahead.empty()) {
+        return false;
+    }
+    Open& o = m_ahead.front();
+    LnkParser::StageTimer t(LnkParser::Stage::Read);
+    item.name = std::move(o.name);
+    item.data.clear();
+    item.read_error = o.error;
+    if (o.fd >= 0) {
+        // before the read, a change while reading shows in the next stat
+        item.have_stat = fstat(o.fd, &item.st) == 0;
+        item.read_error = read_fd(o.fd, item.data);
+        close(o.fd);
+    }
+    t.stop();
+    if (LnkParser::current_stats != nullptr) {
+        LnkParser::current_stats->bytes_read += item.data.size();
+    }
+    m_ahead.pop_front();
+    return true;
+}
+// }}}
+
+// sorted source {{{
+//! where a file is on the disk, as far as can be told without reading it
+struct Place
+{
+    dev_t           dev = 0;
+    bool            by_inode = true;    // position is the inode, not a physical address
+    uint64_t        position = 0;
+    uint64_t        index;
+    std::string     name;
+};
+
+//! one stat, and with Extent one FIEMAP for the first extent. a file that cannot be stat'ed
+//! goes first, reading it fails the same way later.
+static void
+find_place(Place& p, ReadOrder order)
+{
+    struct stat st;
+    if (stat(p.name.c_str(), &st) != 0) {
+        return;
+    }
+    p.dev = st.st_dev;
+    p.position = st.st_ino;
+#ifdef FS_IOC_FIEMAP
+    if (order != ReadOrder::Extent || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        return;
+    }
+    int fd = open(p.name.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    // room for one extent after the header
+    alignas(fiemap) char buf[sizeof(fiemap) + sizeof(fiemap_extent)];
+    memset(buf, 0, sizeof(buf));
+    auto map = reinterpret_cast<fiemap*>(buf);
+    map->fm_length = FIEMAP_MAX_OFFSET;
+    map->fm_extent_count = 1;
+    // not on tmpfs, NFS and the like, the inode is all there is then
+    if (ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents == 1 &&
+        !(map->fm_extents[0].fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DATA_INLINE)))
+    {
+        p.by_inode = false;
+        p.position = map->fm_extents[0].fe_physical;
+    }
+    close(fd);
+#else
+    (void) order;
+#endif
+}
+
+SortedSource::SortedSource(NameSource& names, ReadOrder order, size_t window, const Make& make):
+    m_names(names), m_order(order), m_window(std::max<size_t>(window, 1)), m_make(make)
+{
+}
+
+void
+SortedSource::load()
+{
+    LnkParser::TraceSpan span("Sort");
+    // the source of the window before reads the names that are replaced here
+    m_source.reset();
+    m_list.reset();
+    std::vector<Place> places;
+    Place p;
+    while (places.size() < m_window && (m_more = m_names.next(p.name))) {
+        p.index = m_base + places.size();
+        find_place(p, m_order);
+        places.push_back(std::move(p));
+        p = Place();
+    }
+    m_base += places.size();
+    std::sort(places.begin(), places.end(), [](const Place& a, const Place& b) {
+        return std::tie(a.dev, a.by_inode, a.position, a.index) <
+               std::tie(b.dev, b.by_inode, b.position, b.index);
+    });
+    m_sorted.clear();
+    m_indexes.clear();
+    for (auto& p: places) {
+        m_sorted.push_back(std::move(p.name));
+        m_indexes.push_back(p.index);
+    }
+    m_taken = 0;
+    m_list = std::make_unique<NameList>(m_sorted);
+    m_source = m_make(*m_list);
+    span.stop("\"files\":" + std::to_string(places.size()));
+}
+
+bool
+SortedSource::next(PipelineItem& item)
+{
+    while (!m_source || !m_source->next(item)) {
+        if (!m_more) {
+            return false;
+        }
+        load();
+    }
+    item.index = m_indexes[m_taken++];
+    return true;
+}
+// }}}
+
+// pipeline {{{
+//! appends to a string that can be changed between items
+class TextBuffer: public std::streambuf
+{
+private:
+    std::string*    m_text = nullptr;
+
+protected:
+    int_type
+    overflow(int_type c) override
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            m_text->push_back(traits_type::to_char_type(c));
+        }
+        return c;
+    }
+    std::streamsize
+    xsputn(const char* s, std::streamsize n) override
+    {
+        m_text->append(s, n);
+        return n;
+    }
+
+public:
+    void target(std::string* text) { m_text = text; }
+};
+
+//! the stream of one worker
+struct Pipeline::WorkerOutput
+{
+    TextBuffer          buf;
+    std::ostream        out;
+
+    WorkerOutput(): out(&buf) { }
+};
+
+// the state of a slot is the sequence number of its item times 4 plus the phase. slot k starts
+// as free for item k, each stage waits for the phase of the one before it and moves the slot on:
+// free for item i -> read -> parsed -> free for item i + size. no stage takes a lock.
+static const uint64_t FREE = 0;
+static const uint64_t READ = 1;
+static const uint64_t PARSED = 2;
+static const uint64_t NO_END = ~uint64_t(0);
+
+Pipeline::Pipeline(size_t workers, size_t slots, const LnkParser::FieldSelection& fields,
+                   bool stats):
+    m_workers(std::max<size_t>(workers, 1)), m_fields(fields), m_stats(stats),
+    m_slots(new Slot[std::max<size_t>(slots, 1)]), m_size(std::max<size_t>(slots, 1))
+{
+    for (size_t w = 0; w < m_workers; w++) {
+        m_outputs.push_back(std::make_unique<WorkerOutput>());
+    }
+}
+
+Pipeline::~Pipeline()
+{
+}
+
+//! spin, then yield, then sleep until ready, false if the pipeline was stopped meanwhile
+template <class F>
+bool
+Pipeline::wait(F ready)
+{
+    for (unsigned i = 0; !ready(); i++) {
+        if (m_stop.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        if (i < 64) {
+            continue;
+        } else if (i < 1024) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+    return true;
+}
+
+void
+Pipeline::read(PipelineSource& source)
+{
+    for (uint64_t i = 0; ; i++) {
+        Slot& s = m_slots[i % m_size];
+        if (!wait([&] { return s.state.load(std::memory_order_acquire) == i * 4 + FREE; })) {
+            return;
+        }
+        s.item.index = i;
+        s.item.have_stat = false;
+        s.item.stats = {};
+        LnkParser::StatsScope scope(m_stats ? &s.item.stats : nullptr);
+        if (!source.next(s.item)) {
+            m_end.store(i, std::memory_order_release);
+            return;
+        }
+        m_read++;
+        s.state.store(i * 4 + READ, std::memory_order_release);
+    }
+}
+
+void
+Pipeline::parse(size_t worker, const Format& format, const Lookup& lookup)
+{
+    LnkParser::Parser parser(m_fields);
+    TextBuffer& buf = m_outputs[worker]->buf;
+    std::ostream& out = m_outputs[worker]->out;
+    while (true) {
+        uint64_t i = m_next_parse++;
+        Slot& s = m_slots[i % m_size];
+        if (!wait([&] {
+                return s.state.load(std::memory_order_acquire) == i * 4 + READ ||
+                       i >= m_end.load(std::memory_order_acquire);
+            }))
+        {
+            return;
+        }
+        if (s.state.load(std::memory_order_acquire) != i * 4 + READ) {
+            return;
+        }
+        PipelineItem& item = s.item;
+        LnkParser::StatsScope scope(m_stats ? &item.stats : nullptr);
+        LnkParser::TraceSpan span("File");
+        item.text.clear();
+        buf.target(&item.text);
+        if (item.read_error != 0) {
+            // the same as the parser reports for files it cannot read
+            item.status = LnkParser::Status{LnkParser::ErrorKind::IoError, 0, nullptr,
+                                            uint64_t(item.read_error)};
+            item.diag.clear();
+        } else if (!lookup || !lookup(item, out)) {
+            parser.reset(item.data.data(), item.data.size());
+            item.status = parser.try_parse();
+            item.diag = parser.diagnostics();
+            if (item.status.ok()) {
+                LnkParser::StageTimer t(LnkParser::Stage::Output);
+                format(worker, parser, item, out);
+            }
+        }
+        out.flush();
+        item.size = item.data.size();
+        if (LnkParser::current_trace != nullptr) {
+            span.stop("\"file\":" + LnkOutput::json_quote(item.name));
+        }
+        m_parsed++;
+        s.state.store(i * 4 + PARSED, std::memory_order_release);
+    }
+}
+
+bool
+Pipeline::run(PipelineSource& source, const Format& format, const Write& write,
+              const Lookup& lookup)
+{
+    for (size_t k = 0; k < m_size; k++) {
+        m_slots[k].state.store(k * 4 + FREE);
+    }
+    m_next_parse = 0;
+    m_read = m_parsed = m_written = 0;
+    m_end = NO_END;
+    m_stop = false;
+    bool traced = LnkParser::current_trace != nullptr;
+    std::thread reader([&] {
+        if (traced) {
+            LnkParser::trace_thread("read");
+        }
+        read(source);
+    });
+    std::vector<std::thread> workers;
+    for (size_t w = 0; w < m_workers; w++) {
+        workers.emplace_back([&, w] {
+            if (traced) {
+                LnkParser::trace_thread(("parse " + std::to_string(w + 1)).c_str());
+            }
+            parse(w, format, lookup);
+        });
+    }
+    bool completed = true;
+    std::map<uint64_t, PipelineItem> early;
+    uint64_t next_index = 0;
+    auto write_next = [&](PipelineItem& item) {
+        if (!write(item)) {
+            return false;
+        }
+        m_written++;
+        next_index++;
+        return true;
+    };
+    for (uint64_t i = 0; completed; i++) {
+        Slot& s = m_slots[i % m_size];
+        wait([&] {
+            return s.state.load(std::memory_order_acquire) == i * 4 + PARSED ||
+                   i >= m_end.load(std::memory_order_acquire);
+        });
+        if (s.state.load(std::memory_order_acquire) != i * 4 + PARSED) {
+            break;
+        }
+        // the slot is free either way, the ring does not wait for the items that come late
+        if (s.item.index != next_index) {
+            // only the results wait, the contents of up to a window of files would not fit.
+            // the buffer stays with the slot for the next item.
+            std::vector<char> data = std::move(s.item.data);
+            early.emplace(s.item.index, std::move(s.item));
+            s.item.data = std::move(data);
+            s.item.data.clear();
+        } else {
+            completed = write_next(s.item);
+        }
+        s.state.store((i + m_size) * 4 + FREE, std::memory_order_release);
+        while (completed && !early.empty() && early.begin()->first == next_index) {
+            completed = write_next(early.begin()->second);
+            early.erase(early.begin());
+        }
+    }
+    if (!completed) {
+        m_stop = true;
+    }
+    reader.join();
+    for (auto& t: workers) {
+        t.join();
+    }
+    return completed;
+}
+// }}}
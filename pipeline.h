@@ -0,0 +1,207 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+// batch runs in three stages, so that waiting for the disk and parsing overlap: one thread
+// reads files ahead, workers parse and format them, and the calling thread writes the results
+// in input order. items go around one ring of slots, each stage follows the one before it,
+// and reading waits when the ring is full of results that are not written yet.
+#include "parse.h"
+#include "stats.h"
+#include <atomic>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// posix
+#include <sys/stat.h>
+
+//! one file on its way through the stages
+struct PipelineItem
+{
+    uint64_t                index;      // in input order, the order of reading if not set
+    std::string             name;
+    std::vector<char>       data;       // contents, at most LnkParser::MAX_FILE_SIZE
+    size_t                  size;       // of data when it was parsed, data may be gone later
+    int                     read_error; // errno, 0 if the file was read
+    bool                    have_stat;  // st is set, not for members of --tar
+    struct stat             st;         // of the open file, taken before it was read
+    LnkParser::Status       status;
+    LnkParser::Diagnostics  diag;
+    std::string             text;       // formatted output, if status is ok
+    LnkParser::FileStats    stats;      // if current_stats is set in the reading thread
+};
+
+//! contents of fd into data, at most LnkParser::MAX_FILE_SIZE. returns errno or 0.
+int         read_fd(int fd, std::vector<char>& data);
+
+//! names of the files of a batch, one at a time, from the command line or from a stream
+class NameSource
+{
+public:
+    virtual ~NameSource() { }
+    //! false at the end
+    virtual bool next(std::string& name) = 0;
+};
+
+//! names from a list, which must live as long as this
+class NameList: public NameSource
+{
+private:
+    std::list<std::string>::const_iterator  m_next;
+    std::list<std::string>::const_iterator  m_end;
+
+public:
+    explicit NameList(const std::list<std::string>& names):
+        m_next(names.begin()), m_end(names.end()) { }
+    bool
+    next(std::string& name) override
+    {
+        if (m_next == m_end) {
+            return false;
+        }
+        name = *m_next++;
+        return true;
+    }
+};
+
+//! where the items come from. next() is only called from the reading thread.
+class PipelineSource
+{
+public:
+    virtual ~PipelineSource() { }
+    //! fill name and data or read_error of the next item, false at the end. a source that
+    //! reads out of order sets index too, items then wait for their turn to be written.
+    virtual bool next(PipelineItem& item) = 0;
+};
+
+//! files by name. a few files ahead of the one being read are opened and the kernel is asked
+//! to read them in the background, so that the latency of slow disks and NFS overlaps.
+class FileSource: public PipelineSource
+{
+private:
+    struct Open
+    {
+        std::string     name;
+        int             fd;
+        int             error;
+    };
+
+    NameSource&                             m_names;
+    bool                                    m_more = true;
+    std::list<Open>                         m_ahead;
+    size_t                                  m_lookahead;
+
+public:
+    //! names are taken as they are needed, they must live as long as this
+    FileSource(NameSource& names, size_t lookahead);
+    FileSource(const FileSource&) = delete;
+    FileSource& operator=(const FileSource&) = delete;
+    ~FileSource();
+    bool next(PipelineItem& item) override;
+};
+
+//! order of reading the files
+enum class ReadOrder {Input, Inode, Extent};
+
+//! the files of names sorted by where they are on the disk, window files at a time: by device,
+//! then by inode or, with Extent, by the physical address of the first extent where FIEMAP
+//! gives one. each window is read by a source from make. on a hard disk or a disk image, the
+//! reads go across the disk once per window instead of back and forth.
+class SortedSource: public PipelineSource
+{
+public:
+    typedef std::function<std::unique_ptr<PipelineSource>(NameSource& names)> Make;
+
+private:
+    NameSource&                             m_names;
+    bool                                    m_more = true;
+    ReadOrder                               m_order;
+    size_t                                  m_window;
+    Make                                    m_make;
+    uint64_t                                m_base = 0;     // index of the first of the window
+    std::list<std::string>                  m_sorted;       // names of the window
+    std::vector<uint64_t>                   m_indexes;      // of the files in m_sorted
+    size_t                                  m_taken = 0;
+    std::unique_ptr<NameList>               m_list;         // of m_sorted, for m_source
+    std::unique_ptr<PipelineSource>         m_source;
+
+    void load();
+
+public:
+    SortedSource(NameSource& names, ReadOrder order, size_t window, const Make& make);
+    SortedSource(const SortedSource&) = delete;
+    SortedSource& operator=(const SortedSource&) = delete;
+    bool next(PipelineItem& item) override;
+};
+
+class Pipeline
+{
+public:
+    //! in a worker, after the item was parsed without error. what is written to out goes to
+    //! item.text. out and parser stay the same for each worker, which is 0 to workers - 1.
+    typedef std::function<void(size_t worker, LnkParser::Parser& parser, PipelineItem& item,
+                               std::ostream& out)> Format;
+    //! in the calling thread, in input order. false stops the pipeline.
+    typedef std::function<bool(PipelineItem& item)> Write;
+    //! in a worker, before the item is parsed. true if it set status and diag from an
+    //! earlier run and wrote the text to out, the item is not parsed then. called from all
+    //! workers at once.
+    typedef std::function<bool(PipelineItem& item, std::ostream& out)> Lookup;
+
+private:
+    struct WorkerOutput;
+    struct Slot
+    {
+        // sequence number of the item * 4 + phase, see pipeline.cpp
+        std::atomic<uint64_t>   state;
+        PipelineItem            item;
+    };
+
+    size_t                      m_workers;
+    LnkParser::FieldSelection   m_fields;
+    bool                        m_stats;
+    std::unique_ptr<Slot[]>     m_slots;
+    size_t                      m_size;
+    std::vector<std::unique_ptr<WorkerOutput>> m_outputs;
+    std::atomic<uint64_t>       m_next_parse;   // next item for a worker to take
+    std::atomic<uint64_t>       m_read;         // items that were read
+    std::atomic<uint64_t>       m_parsed;
+    std::atomic<uint64_t>       m_written;
+    std::atomic<uint64_t>       m_end;          // number of items, once the source is done
+    std::atomic<bool>           m_stop;
+
+    template <class F> bool wait(F ready);
+    void read(PipelineSource& source);
+    void parse(size_t worker, const Format& format, const Lookup& lookup);
+
+public:
+    //! workers threads with one parser each, slots items in flight. with stats, every item
+    //! has its FileStats and its threads are traced if the calling thread is.
+    Pipeline(size_t workers, size_t slots, const LnkParser::FieldSelection& fields, bool stats);
+    Pipeline(const Pipeline&) = delete;
+    Pipeline& operator=(const Pipeline&) = delete;
+    //! the streams given to Format live until here
+    ~Pipeline();
+    //! all items of source, until write returns false. returns false then. items are written
+    //! in the order of their indexes, those that come early are kept until it is their turn,
+    //! without their data. with lookup, only the items that it does not know are parsed.
+    bool run(PipelineSource& source, const Format& format, const Write& write,
+             const Lookup& lookup = Lookup());
+    //! items that were read and wait for a worker
+    size_t waiting_for_parse() const { return m_read - m_parsed; }
+    //! items that were parsed and wait to be written, usually behind a slow one or one that
+    //! is read later
+    size_t waiting_for_write() const { return m_parsed - m_written; }
+};
+
+#endif // #ifndef __PIPELINE_H__
@@ -0,0 +1,426 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#include "serialize.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+// tree    := magic:"LNKO" version:uint strings stream
+// strings := count:uint (length:uint bytes)*
+// stream  := count:uint field*
+// field   := tag:u8 name:uint payload
+// uint is LEB128, int is zigzag LEB128. names and descriptions are indices into strings,
+// descriptions are index + 1 with 0 for none. tag is the type in the low bits, DEBUG_BIT
+// if the field is DEBUG level and UTF8_BIT for strings in UTF-8.
+// payload of each type:
+//   I  form:u8 value:int
+//   S  length:uint bytes
+//   E  value:int description:uint
+//   B  num_bits:u8 value:uint valid_bits:uint, then description:uint for each set bit
+//   A  element_size:u8 count:uint, then bytes if element_size is 1, else uint elements
+//   T  stream
+
+namespace LnkOutput {
+
+static const char       MAGIC[4] = {'L', 'N', 'K', 'O'};
+static const uint64_t   VERSION = 2;
+
+enum Tag: uint8_t
+{
+    TAG_INTEGER = 1,
+    TAG_STRING,
+    TAG_ENUM,
+    TAG_BITS,
+    TAG_ARRAY,
+    TAG_STRUCT,
+    TAG_TYPE_MASK = 0x0F,
+    UTF8_BIT = 0x40,
+    DEBUG_BIT = 0x80
+};
+
+// values without LnkStruct types behind them {{{
+class StoredEnumeratedValue: public EnumeratedValue
+{
+protected:
+    int64_t             m_value;
+    const char*         m_description;
+public:
+    virtual void accept(OutputVisitor* v) const { v->visit(this); }
+    virtual const char* describe() const { return m_description; }
+    virtual int64_t value() const { return m_value; }
+    StoredEnumeratedValue(const char* name, int64_t value, const char* description):
+        EnumeratedValue(name), m_value(value), m_description(description) { }
+};
+
+class StoredBitValue: public BitValue
+{
+protected:
+    int                 m_num_bits;
+    uint64_t            m_value;
+    uint64_t            m_valid;
+    const char**        m_descriptions;     // num_bits entries, only set bits have one
+public:
+    virtual void accept(OutputVisitor* v) const { v->visit(this); }
+    virtual int num_bits() const { return m_num_bits; }
+    virtual uint64_t value() const { return m_value; }
+    virtual bool value_of(int bit) const { return (m_value >> bit) & 1; }
+    virtual bool is_valid_bit(int bit) const { return (m_valid >> bit) & 1; }
+    virtual const char* describe(int bit) const { return m_descriptions[bit]; }
+    StoredBitValue(const char* name, int num_bits, uint64_t value, uint64_t valid,
+                   const char** descriptions):
+        BitValue(name), m_num_bits(num_bits), m_value(value), m_valid(valid),
+        m_descriptions(descriptions) { }
+};
+// }}}
+
+// writing {{{
+class Serializer: public OutputVisitor
+{
+private:
+    std::string         m_body;
+    std::vector<std::string_view> m_strings;
+    std::unordered_map<std::string_view, uint64_t> m_index;
+
+    static void uint(std::string& out, uint64_t v)
+    {
+        while (v >= 0x80) {
+            out.push_back(char(v | 0x80));
+            v >>= 7;
+        }
+        out.push_back(char(v));
+    }
+
+    void uint(uint64_t v) { uint(m_body, v); }
+    void sint(int64_t v) { uint((uint64_t(v) << 1) ^ uint64_t(v >> 63)); }
+
+    uint64_t string_index(std::string_view s)
+    {
+        auto [it, added] = m_index.try_emplace(s, m_strings.size());
+        if (added) {
+            m_strings.push_back(s);
+        }
+        return it->second;
+    }
+
+    void description(const char* d)
+    {
+        uint(d ? string_index(d) + 1 : 0);
+    }
+
+    void head(uint8_t tag, const BasicValue* f)
+    {
+        m_body.push_back(char(tag | (f->level() == DEBUG ? DEBUG_BIT : 0)));
+        uint(string_index(f->name()));
+    }
+
+public:
+    void stream(const Stream& s)
+    {
+        uint(s.size());
+        s.accept(this, DEBUG);
+    }
+
+    void finish(std::string& out)
+    {
+        out.append(MAGIC, sizeof(MAGIC));
+        uint(out, VERSION);
+        uint(out, m_strings.size());
+        for (auto s : m_strings) {
+            uint(out, s.size());
+            out.append(s);
+        }
+        out.append(m_body);
+    }
+
+    virtual void visit(const IntegerValue* f)
+    {
+        head(TAG_INTEGER, f);
+        m_body.push_back(char(f->form()));
+        sint(f->value());
+    }
+
+    virtual void visit(const StringValue* f)
+    {
+        head(TAG_STRING | (f->is_utf8() ? UTF8_BIT : 0), f);
+        uint(f->string().size());
+        m_body.append(f->string());
+    }
+
+    virtual void visit(const EnumeratedValue* f)
+    {
+        head(TAG_ENUM, f);
+        sint(f->value());
+        description(f->describe());
+    }
+
+    virtual void visit(const BitValue* f)
+    {
+        head(TAG_BITS, f);
+        m_body.push_back(char(f->num_bits()));
+        uint(f->value());
+        uint64_t valid = 0;
+        for (int i = 0; i < f->num_bits(); i++) {
+            valid |= uint64_t(f->is_valid_bit(i)) << i;
+        }
+        uint(valid);
+        for (int i = 0; i < f->num_bits(); i++) {
+            if (f->value_of(i)) {
+                description(f->describe(i));
+            }
+        }
+    }
+
+    virtual void visit(const ArrayValue* f)
+    {
+        head(TAG_ARRAY, f);
+        m_body.push_back(char(f->element_size()));
+        uint(f->size());
+        uint64_t mask = f->element_size() < 8 ? (1ULL << (8 * f->element_size())) - 1 : ~0ULL;
+        for (size_t i = 0; i < f->size(); i++) {
+            if (f->element_size() == 1) {
+                m_body.push_back(char(f->at(i)));
+            } else {
+                uint(uint64_t(f->at(i)) & mask);
+            }
+        }
+    }
+
+    virtual void visit(const StructValue* f)
+    {
+        head(TAG_STRUCT, f);
+        stream(*f->nested());
+    }
+};
+
+void
+serialize(const Stream& stream, std::string& out)
+{
+    Serializer s;
+    s.stream(stream);
+    s.finish(out);
+}
+// }}}
+
+// reading {{{
+class Deserializer
+{
+private:
+    std::string_view    m_data;
+    size_t              m_pos;
+    Arena&              m_arena;
+    std::vector<const char*> m_strings;
+    bool                m_failed;
+    int                 m_depth;
+
+    static const int    MAX_DEPTH = 16;
+
+    bool need(size_t n)
+    {
+        if (m_failed || n > m_data.size() - m_pos) {
+            m_failed = true;
+        }
+        return !m_failed;
+    }
+
+    uint8_t byte()
+    {
+        return need(1) ? uint8_t(m_data[m_pos++]) : 0;
+    }
+
+    uint64_t uint()
+    {
+        uint64_t v = 0;
+        for (int shift = 0; shift < 64 && need(1); shift += 7) {
+            uint8_t b = m_data[m_pos++];
+            v |= uint64_t(b & 0x7F) << shift;
+            if (!(b & 0x80)) {
+                return v;
+            }
+        }
+        m_failed = true;
+        return 0;
+    }
+
+    int64_t sint()
+    {
+        uint64_t v = uint();
+        return int64_t(v >> 1) ^ -int64_t(v & 1);
+    }
+
+    std::string_view bytes()
+    {
+        uint64_t len = uint();
+        if (!need(len)) {
+            return {};
+        }
+        std::string_view s = m_data.substr(m_pos, len);
+        m_pos += len;
+        return s;
+    }
+
+    const char* string(uint64_t i)
+    {
+        if (i >= m_strings.size()) {
+            m_failed = true;
+            return "";
+        }
+        return m_strings[i];
+    }
+
+    const char* description()
+    {
+        uint64_t i = uint();
+        return i ? string(i - 1) : nullptr;
+    }
+
+    template <class T>
+    BasicValue* array(Stream* s, const char* name, uint64_t count)
+    {
+        std::vector<T> v;
+        for (uint64_t i = 0; i < count && !m_failed; i++) {
+            v.push_back(sizeof(T) == 1 ? byte() : uint());
+        }
+        return s->add<ConcreteVectorValue<T> >(name, std::span<const T>(v), m_arena);
+    }
+
+    void field(Stream* s)
+    {
+        uint8_t tag = byte();
+        const char* name = string(uint());
+        BasicValue* v = nullptr;
+        switch (tag & TAG_TYPE_MASK) {
+            case TAG_INTEGER: {
+                uint8_t form = byte();
+                if (form > IntegerValue::FileTime) {
+                    m_failed = true;
+                    return;
+                }
+                v = s->add<IntegerValue>(name, sint(), IntegerValue::PreferForm(form));
+                break;
+            }
+            case TAG_STRING:
+                v = s->add<StringValue>(name, bytes(), (tag & UTF8_BIT) != 0, m_arena);
+                break;
+            case TAG_ENUM: {
+                int64_t value = sint();
+                v = s->add<StoredEnumeratedValue>(name, value, description());
+                break;
+            }
+            case TAG_BITS: {
+                int num_bits = byte();
+                uint64_t value = uint();
+                uint64_t valid = uint();
+                if (num_bits > 64) {
+                    m_failed = true;
+                    return;
+                }
+                auto d = (const char**)m_arena.allocate(sizeof(const char*) * num_bits,
+                                                        alignof(const char*));
+                for (int i = 0; i < num_bits; i++) {
+                    d[i] = ((value >> i) & 1) ? description() : nullptr;
+                }
+                v = s->add<StoredBitValue>(name, num_bits, value, valid, d);
+                break;
+            }
+            case TAG_ARRAY: {
+                uint8_t element_size = byte();
+                uint64_t count = uint();
+                // every element takes at least one byte
+                if (!need(count)) {
+                    return;
+                }
+                if (element_size == 1) {
+                    v = array<uint8_t>(s, name, count);
+                } else if (element_size == 2) {
+                    v = array<uint16_t>(s, name, count);
+                } else if (element_size == 4) {
+                    v = array<uint32_t>(s, name, count);
+                } else if (element_size == 8) {
+                    v = array<uint64_t>(s, name, count);
+                } else {
+                    m_failed = true;
+                    return;
+                }
+                break;
+            }
+            case TAG_STRUCT:
+                v = s->add<StructValue>(name, stream());
+                break;
+            default:
+                m_failed = true;
+                return;
+        }
+        if (v != nullptr && (tag & DEBUG_BIT)) {
+            v->level(DEBUG);
+        }
+    }
+
+public:
+    Deserializer(std::string_view data, Arena& arena):
+        m_data(data), m_pos(0), m_arena(arena), m_failed(false), m_depth(0) { }
+
+    bool failed() const { return m_failed || m_pos != m_data.size(); }
+
+    //! magic, version and string table, false if the data is not a tree of this version
+    bool header()
+    {
+        if (!need(sizeof(MAGIC)) || memcmp(m_data.data(), MAGIC, sizeof(MAGIC)) != 0) {
+            return false;
+        }
+        m_pos += sizeof(MAGIC);
+        if (uint() != VERSION) {
+            return false;
+        }
+        uint64_t count = uint();
+        // every string takes at least one byte
+        if (!need(count)) {
+            return false;
+        }
+        m_strings.reserve(count);
+        for (uint64_t i = 0; i < count && !m_failed; i++) {
+            std::string_view s = bytes();
+            char* r = (char*)m_arena.allocate(s.size() + 1, 1);
+            std::copy(s.begin(), s.end(), r);
+            r[s.size()] = 0;
+            m_strings.push_back(r);
+        }
+        return !m_failed;
+    }
+
+    Stream* stream()
+    {
+        Stream* s = m_arena.make_stream();
+        uint64_t count = uint();
+        if (++m_depth > MAX_DEPTH) {
+            m_failed = true;
+        }
+        for (uint64_t i = 0; i < count && !m_failed; i++) {
+            field(s);
+        }
+        m_depth--;
+        return s;
+    }
+};
+
+StreamPtr
+deserialize(std::string_view data)
+{
+    auto arena = std::make_shared<Arena>();
+    Deserializer d(data, *arena);
+    if (!d.header()) {
+        return StreamPtr();
+    }
+    Stream* s = d.stream();
+    if (d.failed()) {
+        return StreamPtr();
+    }
+    return StreamPtr(arena, s);
+}
+// }}}
+
+};  // namespace LnkOutput
@@ -0,0 +1,27 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+// compact binary form of output trees, to store them and print them later without the .lnk
+// file. enumerations and bit fields keep their descriptions, every dumper works on the copy.
+// the format is versioned, trees of another version are not read. see serialize.cpp.
+
+#include "output.h"
+#include <string>
+#include <string_view>
+
+namespace LnkOutput {
+
+//! append the tree to out, with fields of all levels
+void        serialize(const Stream& stream, std::string& out);
+//! tree in a new arena, empty StreamPtr if data is damaged or of another version
+StreamPtr   deserialize(std::string_view data);
+
+};  // namespace LnkOutput
+
+#endif  // SERIALIZE_H
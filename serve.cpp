@@ -0,0 +1,509 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+// lnkdump2k --serve SOCKET
+//
+// clients send requests, one per line, and get one line of JSON back for each, in order:
+//   FILE <path>                    parse a file that the server can read
+//   DATA <length> [name]           followed by <length> bytes of a .lnk file
+//   QUIT                           close the connection (so does EOF)
+// answers are {"File":..., "Output":{...}} like dump_json, or {"File":..., "Error":...}.
+// one thread reads the requests of all connections with poll and queues them one by one for
+// a pool of workers, each with its own parser, so the requests of one client are parsed side
+// by side and no client waits for another. answers wait until those before them on the same
+// connection are sent. a client that has nothing in work and sends nothing for IDLE_TIMEOUT
+// seconds is dropped.
+
+#include "cli.h"
+#include "serve.h"
+
+// std
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+// posix
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+//! seconds a connection may stay silent with nothing in work, or leave an answer unread
+static const int        IDLE_TIMEOUT = 10;
+//! requests of one connection in work, more are not read until some are answered
+static const uint64_t   MAX_PENDING = 32;
+//! longest request line, a longer one ends the connection
+static const size_t     MAX_LINE = 64 << 10;
+//! milliseconds without accept when the process is out of file descriptors
+static const int        ACCEPT_BACKOFF = 100;
+
+typedef std::chrono::steady_clock Clock;
+
+// connections {{{
+//! the writing side of a client, shared by the requests in work. the socket is closed when
+//! the last of them is answered and the reading side is done with it.
+class Connection
+{
+private:
+    int                     m_fd;
+    int                     m_wake;         // written to when reading can go on
+    std::mutex              m_mutex;
+    std::map<uint64_t, std::string> m_ready;    // answers that wait for earlier ones
+    uint64_t                m_next = 0;     // the answer to send next
+    bool                    m_sending = false;
+    std::atomic<uint64_t>   m_answered{0};
+    std::atomic<bool>       m_throttled{false};
+    std::atomic<bool>       m_broken{false};
+
+    bool write_all(const std::string& s)
+    {
+        size_t done = 0;
+        while (done < s.size()) {
+            ssize_t n = send(m_fd, s.data() + done, s.size() - done, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+
+public:
+    Connection(int fd, int wake): m_fd(fd), m_wake(wake)
+    {
+        // a client that does not read its answers fails the send after this
+        timeval tv = {IDLE_TIMEOUT, 0};
+        setsockopt(m_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    }
+    Connection(const Connection&) = delete;
+    ~Connection() { close(m_fd); }
+
+    int fd() const { return m_fd; }
+    uint64_t answered() const { return m_answered; }
+    bool broken() const { return m_broken; }
+
+    //! the reader stops reading until an answer is sent, then gets woken up. false if an
+    //! answer came in the meantime and it can go on.
+    bool
+    throttle(uint64_t requests)
+    {
+        m_throttled = true;
+        if (requests - m_answered < MAX_PENDING) {
+            m_throttled = false;
+            return false;
+        }
+        return true;
+    }
+
+    //! the answer to request seq. whoever brings the next answer in order sends it and those
+    //! after it that are ready, the others only leave theirs.
+    void
+    answer(uint64_t seq, std::string text)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_ready.emplace(seq, std::move(text));
+        if (m_sending) {
+            return;
+        }
+        m_sending = true;
+        while (!m_ready.empty() && m_ready.begin()->first == m_next) {
+            std::string s = std::move(m_ready.begin()->second);
+            m_ready.erase(m_ready.begin());
+            m_next++;
+            lock.unlock();
+            if (!m_broken && !write_all(s)) {
+                m_broken = true;
+            }
+            m_answered++;
+            if (m_throttled.exchange(false)) {
+                char c = 0;
+                [[maybe_unused]] ssize_t n = write(m_wake, &c, 1);
+            }
+            lock.lock();
+        }
+        m_sending = false;
+    }
+};
+
+//! one request, or an answer that needs no parser, like an error about the request
+struct Request
+{
+    enum Kind { File, Data, Answer };
+
+    std::shared_ptr<Connection> conn;
+    uint64_t                seq;
+    Kind                    kind;
+    std::string             name;
+    std::vector<char>       data;
+    std::string             text;
+};
+
+class RequestQueue
+{
+private:
+    std::mutex              m_mutex;
+    std::condition_variable m_ready;
+    std::deque<Request>     m_requests;
+    bool                    m_closed = false;
+
+public:
+    void push(Request&& r)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_requests.push_back(std::move(r));
+        }
+        m_ready.notify_one();
+    }
+    //! false once the queue is closed and empty
+    bool pop(Request& r)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_ready.wait(lock, [this] { return m_closed || !m_requests.empty(); });
+        if (m_requests.empty()) {
+            return false;
+        }
+        r = std::move(m_requests.front());
+        m_requests.pop_front();
+        return true;
+    }
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        m_ready.notify_all();
+    }
+};
+// }}}
+
+// requests {{{
+static std::string
+error_line(const std::string& name, const std::string& message)
+{
+    return "{\"File\":" + LnkOutput::json_quote(name) + ",\"Error\":" +
+           LnkOutput::json_quote(message) + "}\n";
+}
+
+static void
+work(RequestQueue& queue, CodecPtr codec)
+{
+    LnkParser::Parser parser(command_line.fields);
+    std::ostringstream out;
+    Request r;
+    while (queue.pop(r)) {
+        if (r.kind == Request::Answer || r.conn->broken()) {
+            r.conn->answer(r.seq, std::move(r.text));
+        } else {
+            if (r.kind == Request::File) {
+                parser.reset(r.name);
+            } else {
+                parser.reset(r.data.data(), r.data.size());
+            }
+            LnkParser::Status status = parser.try_parse();
+            out.str("");
+            if (status.ok()) {
+                dump_json(out, parser.output(), codec, r.name, command_line.default_info_level);
+            } else {
+                out << error_line(r.name, status.message());
+            }
+            r.conn->answer(r.seq, out.str());
+        }
+        // the last request of a closed connection closes its socket here
+        r = Request();
+    }
+}
+
+//! the reading side of a connection, only used by the thread that polls
+struct Client
+{
+    std::shared_ptr<Connection> conn;
+    std::string             in;             // read and not used yet, from pos
+    size_t                  pos = 0;
+    uint64_t                requests = 0;
+    bool                    in_data = false;    // the bytes of a DATA request come next
+    size_t                  data_length = 0;
+    std::string             data_name;
+    bool                    eof = false;    // of the socket, what is in `in` is still used
+    bool                    done = false;   // nothing more is read
+    bool                    throttled = false;
+    Clock::time_point       active;
+
+    void
+    issue(RequestQueue& queue, Request::Kind kind, std::string name, std::string text = "")
+    {
+        Request r;
+        r.conn = conn;
+        r.seq = requests++;
+        r.kind = kind;
+        r.name = std::move(name);
+        r.text = std::move(text);
+        if (kind == Request::Data) {
+            r.data.assign(in.begin() + pos, in.begin() + pos + data_length);
+            pos += data_length;
+        }
+        queue.push(std::move(r));
+    }
+
+    //! queue the requests that were read completely, as long as not too many are in work
+    void
+    requests_from_input(RequestQueue& queue)
+    {
+        do {
+            take(queue);
+        } while (throttled && !conn->throttle(requests));
+    }
+
+private:
+    void
+    take(RequestQueue& queue)
+    {
+        while (!done && !(throttled = requests - conn->answered() >= MAX_PENDING)) {
+            if (in_data) {
+                if (in.size() - pos < data_length) {
+                    done = eof;
+                    break;
+                }
+                in_data = false;
+                issue(queue, Request::Data, std::move(data_name));
+                continue;
+            }
+            size_t nl = in.find('\n', pos);
+            if (nl == std::string::npos && !eof) {
+                if (in.size() - pos > MAX_LINE) {
+                    issue(queue, Request::Answer, "", error_line("", "Request line is too long"));
+                    done = true;
+                }
+                break;
+            }
+            if (nl == std::string::npos && pos == in.size()) {
+                done = true;
+                break;
+            }
+            // at the end of the stream, a last line without a newline counts
+            size_t end = nl == std::string::npos ? in.size() : nl;
+            std::string line = in.substr(pos, end - pos);
+            pos = std::min(end + 1, in.size());
+            if (line.starts_with("FILE ")) {
+                issue(queue, Request::File, line.substr(5));
+            } else if (line.starts_with("DATA ")) {
+                char* e = nullptr;
+                unsigned long long len = strtoull(line.c_str() + 5, &e, 10);
+                std::string name = (*e == ' ') ? std::string(e + 1) : std::string();
+                if (e == line.c_str() + 5 || len > LnkParser::MAX_FILE_SIZE) {
+                    // the data cannot be skipped reliably, so give up on this client
+                    issue(queue, Request::Answer, "",
+                          error_line(name, "Bad length in request: " + line));
+                    done = true;
+                    break;
+                }
+                in_data = true;
+                data_length = len;
+                data_name = std::move(name);
+            } else if (line == "QUIT") {
+                done = true;
+            } else if (!line.empty()) {
+                issue(queue, Request::Answer, "", error_line("", "Unknown request: " + line));
+            }
+        }
+        if (pos > in.size() / 2) {
+            in.erase(0, pos);
+            pos = 0;
+        }
+    }
+};
+
+//! what can be read from the client without blocking. sets eof at the end of the stream.
+static void
+read_some(Client& c)
+{
+    char buf[64 << 10];
+    while (true) {
+        ssize_t n = recv(c.conn->fd(), buf, sizeof(buf), MSG_DONTWAIT);
+        if (n > 0) {
+            c.in.append(buf, n);
+            c.active = Clock::now();
+            return;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        c.eof = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+        return;
+    }
+}
+// }}}
+
+//! make room for the socket at path. only a socket that no server answers on is removed.
+static bool
+clear_path(const std::string& path, const sockaddr_un& addr)
+{
+    struct stat st;
+    if (lstat(path.c_str(), &st) < 0) {
+        if (errno == ENOENT) {
+            return true;
+        }
+        std::cerr << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        std::cerr << path << ": exists and is not a socket" << std::endl;
+        return false;
+    }
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe < 0) {
+        std::cerr << "socket: " << strerror(errno) << std::endl;
+        return false;
+    }
+    bool live = connect(probe, (const sockaddr*)&addr, sizeof(addr)) == 0;
+    close(probe);
+    if (live) {
+        std::cerr << path << ": another server is listening" << std::endl;
+        return false;
+    }
+    // left over from a previous server
+    if (unlink(path.c_str()) < 0) {
+        std::cerr << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int
+serve(const std::string& path)
+{
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << path << ": socket path is too long" << std::endl;
+        return ERROR_USAGE;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    if (!clear_path(path, addr)) {
+        return ERROR_PARSE;
+    }
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0) {
+        std::cerr << "socket: " << strerror(errno) << std::endl;
+        return ERROR_PARSE;
+    }
+    int wake[2];
+    if (bind(sock, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(sock, SOMAXCONN) < 0 ||
+        pipe2(wake, O_CLOEXEC | O_NONBLOCK) < 0)
+    {
+        std::cerr << path << ": " << strerror(errno) << std::endl;
+        close(sock);
+        return ERROR_PARSE;
+    }
+    // codec tables are loaded once and shared, Codec::string does not modify them
+    CodecPtr codec = codecs.get(command_line.codepage);
+    RequestQueue queue;
+    unsigned n_workers = command_line.jobs;
+    if (n_workers == 0) {
+        n_workers = std::max(1U, std::thread::hardware_concurrency());
+    }
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < n_workers; i++) {
+        workers.emplace_back([&queue, codec] { work(queue, codec); });
+    }
+    std::list<Client> clients;
+    std::vector<pollfd> fds;
+    Clock::time_point accept_after;
+    while (true) {
+        Clock::time_point now = Clock::now();
+        bool accepting = now >= accept_after;
+        fds.clear();
+        fds.push_back(pollfd{wake[0], POLLIN, 0});
+        fds.push_back(pollfd{sock, short(accepting ? POLLIN : 0), 0});
+        for (auto c = clients.begin(); c != clients.end(); ) {
+            bool in_work = c->requests != c->conn->answered();
+            if (in_work) {
+                c->active = now;
+            }
+            // the connection closes once the requests in work are answered
+            if (c->done || c->conn->broken() ||
+                (!in_work && now - c->active > std::chrono::seconds(IDLE_TIMEOUT)))
+            {
+                c = clients.erase(c);
+                continue;
+            }
+            // -1 is left out by poll, a closed socket would always be ready
+            int fd = c->throttled || c->eof ? -1 : c->conn->fd();
+            fds.push_back(pollfd{fd, POLLIN, 0});
+            c++;
+        }
+        if (poll(fds.data(), fds.size(), accepting ? 1000 : ACCEPT_BACKOFF) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "poll: " << strerror(errno) << std::endl;
+            break;
+        }
+        if (fds[0].revents & POLLIN) {
+            char buf[256];
+            while (read(wake[0], buf, sizeof(buf)) > 0) { }
+        }
+        auto f = fds.begin() + 2;
+        for (auto& c : clients) {
+            if ((f++)->revents != 0) {
+                read_some(c);
+            }
+            // throttled clients may go on with what they have read before
+            c.requests_from_input(queue);
+        }
+        if (!(fds[1].revents & POLLIN)) {
+            continue;
+        }
+        int fd = accept4(sock, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                // until a connection closes, retry from time to time
+                accept_after = now + std::chrono::milliseconds(ACCEPT_BACKOFF);
+                continue;
+            }
+            if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN ||
+                errno == EPROTO)
+            {
+                continue;
+            }
+            std::cerr << "accept: " << strerror(errno) << std::endl;
+            break;
+        }
+        clients.push_back(Client());
+        clients.back().conn = std::make_shared<Connection>(fd, wake[1]);
+        clients.back().active = now;
+    }
+    // the workers finish what is queued and stop, nothing refers to this frame after that
+    clients.clear();
+    queue.close();
+    for (auto& t : workers) {
+        t.join();
+    }
+    close(wake[0]);
+    close(wake[1]);
+    close(sock);
+    return ERROR_PARSE;
+}
@@ -0,0 +1,16 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#ifndef __SERVE_H__
+#define __SERVE_H__
+
+#include <string>
+
+//! answer parse requests on a unix socket until killed, using the options of command_line.
+//! returns only if the socket cannot be set up.
+int         serve(const std::string& path);
+
+#endif // #ifndef __SERVE_H__
@@ -0,0 +1,284 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#include "stats.h"
+#include "output.h"
+
+// std
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+namespace LnkParser {
+
+const char*
+stage_name(Stage stage)
+{
+    static const char* names[STAGES] = {
+        "Read", "Header", "LinkTargetIdList", "LinkInfo", "StringData", "ExtraData", "Decode",
+        "Output"
+    };
+    return names[size_t(stage)];
+}
+
+void
+FileStats::add(const FileStats& other)
+{
+    for (size_t i = 0; i < STAGES; i++) {
+        ticks[i] += other.ticks[i];
+    }
+    bytes_read += other.bytes_read;
+    allocations += other.allocations;
+    allocated += other.allocated;
+    output_bytes += other.output_bytes;
+}
+
+uint64_t
+FileStats::total_ticks() const
+{
+    uint64_t t = 0;
+    for (size_t i = 0; i < STAGES; i++) {
+        if (Stage(i) != Stage::Decode) {
+            t += ticks[i];
+        }
+    }
+    return t;
+}
+
+double
+ticks_per_second()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    static double measured = 0;
+    if (measured == 0) {
+        using Clock = std::chrono::steady_clock;
+        Clock::time_point start = Clock::now();
+        uint64_t t0 = ticks();
+        while (Clock::now() - start < std::chrono::milliseconds(20)) { }
+        uint64_t t1 = ticks();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        measured = (t1 - t0) / seconds;
+    }
+    return measured;
+#else
+    return 1e9;
+#endif
+}
+
+//! one FileStats as the members of a JSON object
+static void
+json_members(std::ostream& out, const FileStats& s, double ns)
+{
+    out << "\"ns\":{";
+    for (size_t i = 0; i < STAGES; i++) {
+        out << (i > 0 ? "," : "") << '"' << stage_name(Stage(i)) << "\":"
+            << uint64_t(s.ticks[i] * ns);
+    }
+    out << "},\"bytes_read\":" << s.bytes_read << ",\"allocations\":" << s.allocations
+        << ",\"allocated_bytes\":" << s.allocated << ",\"output_bytes\":" << s.output_bytes;
+}
+
+//! the slowest file at the end, where sort_heap puts it
+static bool
+faster(const std::pair<std::string, FileStats>& a, const std::pair<std::string, FileStats>& b)
+{
+    return a.second.total_ticks() > b.second.total_ticks();
+}
+
+BatchStats::~BatchStats()
+{
+    if (m_per_file != nullptr) {
+        fclose(m_per_file);
+    }
+}
+
+bool
+BatchStats::keep_per_file()
+{
+    if (m_per_file == nullptr) {
+        m_per_file = tmpfile();
+    }
+    return m_per_file != nullptr;
+}
+
+void
+BatchStats::add(const std::string& name, const FileStats& stats)
+{
+    if (m_per_file != nullptr) {
+        std::ostringstream record;
+        record << (m_files > 0 ? ",\n" : "\n") << "{\"name\":" << LnkOutput::json_quote(name)
+               << ",";
+        json_members(record, stats, 1e9 / ticks_per_second());
+        record << "}";
+        const std::string& s = record.str();
+        if (fwrite(s.data(), 1, s.size(), m_per_file) != s.size()) {
+            // print_json() leaves out the records instead of writing half of one
+            fclose(m_per_file);
+            m_per_file = nullptr;
+        }
+    }
+    m_files++;
+    m_total.add(stats);
+    if (m_slowest.size() < SLOWEST) {
+        m_slowest.emplace_back(name, stats);
+        std::push_heap(m_slowest.begin(), m_slowest.end(), faster);
+    } else if (stats.total_ticks() > m_slowest.front().second.total_ticks()) {
+        std::pop_heap(m_slowest.begin(), m_slowest.end(), faster);
+        m_slowest.back() = {name, stats};
+        std::push_heap(m_slowest.begin(), m_slowest.end(), faster);
+    }
+}
+
+void
+BatchStats::add_total(const FileStats& stats)
+{
+    m_total.add(stats);
+}
+
+void
+BatchStats::print_table(std::ostream& out) const
+{
+    const double us = 1e6 / ticks_per_second();
+    const uint64_t total = m_total.total_ticks();
+    const uint64_t files = std::max<uint64_t>(m_files, 1);
+    out << std::left << std::setw(20) << "stage" << std::right << std::setw(14) << "total ms"
+        << std::setw(8) << "share" << std::setw(14) << "us per file" << std::endl;
+    out << std::fixed;
+    for (size_t i = 0; i < STAGES; i++) {
+        uint64_t t = m_total.ticks[i];
+        out << std::left << std::setw(20) << stage_name(Stage(i)) << std::right
+            << std::setprecision(3) << std::setw(14) << t * us / 1000
+            << std::setprecision(1) << std::setw(7) << (total > 0 ? 100.0 * t / total : 0.0)
+            << "%" << std::setprecision(2) << std::setw(14) << t * us / files << std::endl;
+    }
+    out << "files: " << m_files << std::endl;
+    out << "total ms: " << std::setprecision(3) << total * us / 1000 << std::endl;
+    out << "bytes read: " << m_total.bytes_read << std::endl;
+    out << "allocations: " << m_total.allocations << std::endl;
+    out << "allocated bytes: " << m_total.allocated << std::endl;
+    out << "output bytes: " << m_total.output_bytes << std::endl;
+    // the outliers are usually what one is looking for
+    auto slowest = m_slowest;
+    std::sort_heap(slowest.begin(), slowest.end(), faster);
+    for (const auto& f: slowest) {
+        out << "slowest " << std::setprecision(2) << f.second.total_ticks() * us << " us: "
+            << f.first << std::endl;
+    }
+    out.copyfmt(std::ios(nullptr));
+}
+
+void
+BatchStats::print_json(std::ostream& out) const
+{
+    const double ns = 1e9 / ticks_per_second();
+    out << "{\"files\":" << m_files << ",\"total\":{";
+    json_members(out, m_total, ns);
+    out << "},\"per_file\":[";
+    if (m_per_file != nullptr && fflush(m_per_file) == 0 && fseek(m_per_file, 0, SEEK_SET) == 0) {
+        char buf[1 << 16];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), m_per_file)) > 0) {
+            out.write(buf, n);
+        }
+        fseek(m_per_file, 0, SEEK_END);
+    }
+    out << "\n]}" << std::endl;
+}
+
+// trace {{{
+
+// buffers of all threads that were ever traced. the lock is taken once per thread and when
+// a buffer is full, for the file.
+static std::mutex trace_lock;
+static std::vector<std::unique_ptr<TraceBuffer>> trace_buffers;
+static uint64_t trace_start;
+static FILE* trace_file = nullptr;
+
+bool
+trace_open(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(trace_lock);
+    trace_file = fopen(path.c_str(), "w");
+    if (trace_file == nullptr) {
+        return false;
+    }
+    // measure now and not in the middle of the first event
+    ticks_per_second();
+    trace_start = ticks();
+    // every event after this follows one before it
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+          "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+          "\"args\":{\"name\":\"lnkdump2k\"}}", trace_file);
+    return true;
+}
+
+void
+trace_thread(const char* name)
+{
+    if (current_trace != nullptr) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(trace_lock);
+    if (trace_file == nullptr) {
+        return;
+    }
+    auto b = std::make_unique<TraceBuffer>();
+    b->tid = trace_buffers.size() + 1;
+    b->thread_name = name;
+    b->events.reserve(TraceBuffer::CAPACITY);
+    fprintf(trace_file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+            "\"args\":{\"name\":%s}}", b->tid, LnkOutput::json_quote(name).c_str());
+    current_trace = b.get();
+    trace_buffers.push_back(std::move(b));
+}
+
+//! the events of b, with the lock held
+static void
+write_events(TraceBuffer& b)
+{
+    const double us = 1e6 / ticks_per_second();
+    for (const auto& e: b.events) {
+        // a thread is registered after trace_open(), so nothing is before trace_start
+        fprintf(trace_file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                "\"ts\":%.3f,\"dur\":%.3f", e.name, b.tid, (e.start - trace_start) * us,
+                (e.end - e.start) * us);
+        if (!e.args.empty()) {
+            fprintf(trace_file, ",\"args\":{%s}", e.args.c_str());
+        }
+        fputs("}", trace_file);
+    }
+    b.events.clear();
+}
+
+void
+TraceBuffer::flush()
+{
+    std::lock_guard<std::mutex> lock(trace_lock);
+    write_events(*this);
+}
+
+bool
+trace_close()
+{
+    std::lock_guard<std::mutex> lock(trace_lock);
+    if (trace_file == nullptr) {
+        return true;
+    }
+    for (auto& b: trace_buffers) {
+        write_events(*b);
+    }
+    fputs("\n]}\n", trace_file);
+    bool ok = !ferror(trace_file);
+    ok = fclose(trace_file) == 0 && ok;
+    trace_file = nullptr;
+    return ok;
+}
+// }}}
+
+};  // namespace LnkParser
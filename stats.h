@@ -0,0 +1,236 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#ifndef STATS_H
+#define STATS_H
+
+// where the time of a batch goes, for --stats and --trace. timers read the time stamp counter
+// and only if someone collects: each one checks thread-local pointers first, so they can stay
+// in the parser and cost next to nothing otherwise.
+
+#include <array>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+namespace LnkParser {
+
+//! parts of the work on one file. Decode is the conversion of strings to UTF-8, it happens
+//! in the sections and in the output and is also contained in their times.
+enum class Stage
+{
+    Read,                   // file from disk to memory
+    Header,
+    LinkTargetIdList,
+    LinkInfo,
+    StringData,
+    ExtraData,
+    Decode,
+    Output                  // formatting of YAML or table rows
+};
+
+const size_t STAGES = size_t(Stage::Output) + 1;
+
+//! name of stage, like "LinkInfo"
+const char* stage_name(Stage stage);
+
+//! counters of one file
+struct FileStats
+{
+    std::array<uint64_t, STAGES>    ticks = {};
+    uint64_t                        bytes_read = 0;
+    uint64_t                        allocations = 0;    // only if operator new counts them
+    uint64_t                        allocated = 0;      // bytes of those allocations
+    uint64_t                        output_bytes = 0;
+
+    void add(const FileStats& other);
+    //! ticks of all stages, without Decode, which is contained in the others
+    uint64_t total_ticks() const;
+};
+
+//! stats of the current thread, nullptr when they are not collected
+inline thread_local FileStats* current_stats = nullptr;
+
+//! time stamp counter, or nanoseconds where there is none
+inline uint64_t
+ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+//! measured against the steady clock the first time, which takes 20 ms
+double      ticks_per_second();
+
+// trace {{{
+
+//! one complete event ("ph": "X") of the Chrome trace format
+struct TraceEvent
+{
+    const char*     name;       // always a literal string
+    uint64_t        start;      // ticks
+    uint64_t        end;
+    std::string     args;       // members of the "args" object in JSON, usually empty
+};
+
+//! events of one thread. only that thread adds to it, so recording takes no lock until the
+//! buffer is full and goes to the trace file.
+struct TraceBuffer
+{
+    static const size_t         CAPACITY = 4096;
+
+    uint32_t                    tid;
+    std::string                 thread_name;
+    std::vector<TraceEvent>     events;
+
+    void
+    add(TraceEvent&& event)
+    {
+        events.push_back(std::move(event));
+        if (events.size() >= CAPACITY) {
+            flush();
+        }
+    }
+    //! write the events to the trace file and empty the buffer
+    void flush();
+};
+
+//! buffer of the current thread, nullptr when it is not traced
+inline thread_local TraceBuffer* current_trace = nullptr;
+
+//! start a trace in the Chrome trace format, for chrome://tracing or Perfetto. false if the
+//! file cannot be created.
+bool        trace_open(const std::string& path);
+
+//! start recording the events of this thread, after trace_open(). the buffer is kept after
+//! the thread ends, until trace_close().
+void        trace_thread(const char* name);
+
+//! write the events that are left in the buffers and end the trace. call it after the traced
+//! threads are done. false if the file could not be written.
+bool        trace_close();
+
+//! an event from construction to stop() or destruction, if this thread is traced
+class TraceSpan
+{
+private:
+    TraceBuffer*    m_trace;
+    const char*     m_name;
+    uint64_t        m_start;
+
+public:
+    explicit TraceSpan(const char* name):
+        m_trace(current_trace), m_name(name), m_start(m_trace != nullptr ? ticks() : 0) { }
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+    ~TraceSpan() { stop(); }
+    //! args are JSON members, like "\"file\":\"a.lnk\""
+    void stop(std::string args = {})
+    {
+        if (m_trace != nullptr) {
+            m_trace->add(TraceEvent{m_name, m_start, ticks(), std::move(args)});
+            m_trace = nullptr;
+        }
+    }
+};
+// }}}
+
+//! adds the time from construction to stop() or destruction to a stage of current_stats and
+//! traces it as an event. each string that is decoded would be an event of its own, so Decode
+//! is only counted.
+class StageTimer
+{
+private:
+    FileStats*      m_stats;
+    TraceBuffer*    m_trace;
+    Stage           m_stage;
+    uint64_t        m_start;
+
+public:
+    explicit StageTimer(Stage stage):
+        m_stats(current_stats), m_trace(stage != Stage::Decode ? current_trace : nullptr),
+        m_stage(stage), m_start(m_stats != nullptr || m_trace != nullptr ? ticks() : 0) { }
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+    ~StageTimer() { stop(); }
+    void stop()
+    {
+        if (m_stats == nullptr && m_trace == nullptr) {
+            return;
+        }
+        uint64_t end = ticks();
+        if (m_stats != nullptr) {
+            m_stats->ticks[size_t(m_stage)] += end - m_start;
+            m_stats = nullptr;
+        }
+        if (m_trace != nullptr) {
+            m_trace->add(TraceEvent{stage_name(m_stage), m_start, end, {}});
+            m_trace = nullptr;
+        }
+    }
+};
+
+//! collect into stats on this thread until the end of the scope, nullptr collects nothing
+class StatsScope
+{
+private:
+    FileStats*      m_previous;
+
+public:
+    explicit StatsScope(FileStats* stats): m_previous(current_stats) { current_stats = stats; }
+    StatsScope(const StatsScope&) = delete;
+    StatsScope& operator=(const StatsScope&) = delete;
+    ~StatsScope() { current_stats = m_previous; }
+};
+
+enum class StatsFormat { None, Table, JSON };
+
+//! stats of every file and their sum. only the slowest files stay in memory, the records of
+//! the others for print_json() go to a temporary file as they are added.
+class BatchStats
+{
+public:
+    //! files in the table of print_table()
+    static const size_t SLOWEST = 10;
+
+private:
+    std::vector<std::pair<std::string, FileStats>>  m_slowest;  // heap, fastest first
+    uint64_t                                        m_files = 0;
+    FileStats                                       m_total;
+    FILE*                                           m_per_file = nullptr;
+
+public:
+    BatchStats() { }
+    BatchStats(const BatchStats&) = delete;
+    BatchStats& operator=(const BatchStats&) = delete;
+    ~BatchStats();
+    //! keep a record of every file for print_json(), before the first add(). false if the
+    //! temporary file cannot be created.
+    bool keep_per_file();
+    void add(const std::string& name, const FileStats& stats);
+    //! work that belongs to no single file, like writing a sorted timeline
+    void add_total(const FileStats& stats);
+    //! sum and share of each stage, the counters and the slowest files
+    void print_table(std::ostream& out) const;
+    //! sum and every file since keep_per_file(), times in nanoseconds
+    void print_json(std::ostream& out) const;
+};
+
+};  // namespace LnkParser
+
+#endif  // STATS_H
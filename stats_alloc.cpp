@@ -0,0 +1,41 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+// heap allocations for --stats, counted on threads that collect stats. part of the executables
+// and not of lnkparse, so programs that link the library keep their own operator new.
+// in a file of its own, so that gcc does not inline it and then see free() on memory of new.
+#include "stats.h"
+
+// std
+#include <cstdlib>
+#include <new>
+
+void*
+operator new(size_t size)
+{
+    LnkParser::FileStats* s = LnkParser::current_stats;
+    if (s != nullptr) {
+        s->allocations++;
+        s->allocated += size;
+    }
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void
+operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void
+operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
@@ -4,8 +4,9 @@
  * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
  *****/
 
+#include <chrono>
 #include <cstring>
-#include <ctime>
+#include "civil.h"
 #include "encoding.h"
 #include "struct.h"
 
@@ -268,20 +269,55 @@ const char* control_panel_guid_describe(const char* guid)
     return nullptr;
 }
 
+MSTimeProperty
+MSTimeProperty::now()
+{
+    auto d = std::chrono::system_clock::now().time_since_epoch();
+    return UNIX_EPOCH + std::chrono::duration_cast<std::chrono::nanoseconds>(d).count() / 100;
+}
+
+void
+check_times(const MSTimeProperty* times, TimeFlags_t* flags, size_t n, MSTimeProperty now)
+{
+    const uint64_t second = 10000000;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t t = times[i];
+        uint8_t zero = t == 0;
+        uint8_t future = t > uint64_t(now);
+        uint8_t whole = (t % second == 0) & !zero;
+        flags[i] = zero | (future << 1) | (whole << 2);
+    }
+}
+
+bool
+All::has_future_times() const
+{
+    constexpr int future_bit = TimeFlags_t::find("InFuture");
+    static_assert(future_bit >= 0);
+    for (auto& flags: header.TimeFlags) {
+        if (flags.value_of(future_bit)) {
+            return true;
+        }
+    }
+    for (auto& id: id_list.IdList) {
+        auto uri = std::get_if<ShellId_x60_Struct>(&id.Item);
+        if (uri != nullptr && uri->TimestampFlags.value_of(future_bit)) {
+            return true;
+        }
+    }
+    return false;
+}
+
 time_t
-FATTime::unix_time()
+FATTime::unix_time() const
 {
-    struct tm u;
     uint16_t lo_word = get_bits< 0, 15>(m_fat);
     uint16_t hi_word = get_bits<16, 31>(m_fat);
-    u.tm_sec         = get_bits< 0,  4>(hi_word) * 2;
-    u.tm_min         = get_bits< 5, 10>(hi_word);
-    u.tm_hour        = get_bits<11, 15>(hi_word);
-    u.tm_mday        = get_bits< 0,  4>(lo_word);
-    u.tm_mon         = get_bits< 5,  8>(lo_word) - 1;
-    u.tm_year        = get_bits< 9, 15>(lo_word) + 80;
-    time_t t = timegm(&u);
-    return t;
+    int64_t days = Civil::days_from_civil(get_bits< 9, 15>(lo_word) + 1980,
+                                          get_bits< 5,  8>(lo_word),
+                                          get_bits< 0,  4>(lo_word));
+    return days * Civil::SECONDS_PER_DAY + get_bits<11, 15>(hi_word) * 3600 +
+           get_bits< 5, 10>(hi_word) * 60 + get_bits< 0,  4>(hi_word) * 2;
 }
 
 };  // namespace LnkStruct
@@ -13,10 +13,13 @@
 #include <list>
 #include <memory>
 #include <optional>
+#include <span>
 #include <string>
 #include <string_view>
+#include <variant>
 
 #include <cstdio>  // for format
+#include <cstring>  // for strcmp
 
 namespace LnkStruct {
 
@@ -41,26 +44,49 @@ protected:
 public:
     constexpr Guid(std::array<uint8_t, 16> b): bytes(b) { }
     constexpr Guid(): bytes() { }
-    std::string string() const
+    //! the 16 bytes as they are in the file
+    const std::array<uint8_t, 16>& data() const { return bytes; }
+    static const size_t STRING_SIZE = 37;
+    //! formats into buf, which must hold STRING_SIZE chars
+    const char* format(char* buf) const
     {
-        char buf[64];
-        snprintf(buf, sizeof(buf), "%08X-%04X-%04X-%04X-%012lX",
+        snprintf(buf, STRING_SIZE, "%08X-%04X-%04X-%04X-%012lX",
                  comp1(), comp2(), comp3(), comp4(), comp5());
-        return std::string(buf);
+        return buf;
+    }
+    std::string string() const
+    {
+        char buf[STRING_SIZE];
+        return std::string(format(buf));
+    }
+    bool operator==(const char *other)
+    {
+        char buf[STRING_SIZE];
+        return strcmp(format(buf), other) == 0;
     }
-    bool operator==(const char *other) { return string() == other; }
 };
 
+//! FILETIME, 100 ns since 1601-01-01 UTC
 class MSTimeProperty
 {
 protected:
     uint64_t data;
 public:
+    static const uint64_t UNIX_EPOCH = 116444736000000000;
+    MSTimeProperty(): data(0) { }
+    MSTimeProperty(uint64_t filetime): data(filetime) { }
+    //! current system time
+    static MSTimeProperty now();
     time_t unix_time() const
     {
         time_t u = (data / 10000000) - 11644473600;
         return u;
     }
+    //! part of the time below one second, in 100 ns
+    uint32_t hundred_ns() const
+    {
+        return data % 10000000;
+    }
     operator uint64_t& ()
     {
         return data;
@@ -93,7 +119,7 @@ public:
         }
         return nullptr;
     }
-    bool valid()
+    bool valid() const
     {
         for (auto p : T::description) {
             if (p.first == value)
@@ -358,6 +384,23 @@ public:
 // section 2.1.2
 typedef BitfieldProperty<FileAttributesTmpl> FileAttributes_t;
 
+class TimeFlagsTmpl
+{
+public:
+    typedef uint8_t data_type;
+    static const uint8_t invalid_bits = 0b11111000;
+    constexpr static std::array<const char *, 8> description = {
+        "Zero",                                 // 0
+        "InFuture",                             // 1, later than the time of parsing
+        "WholeSecond"                           // 2, no fraction, set by some tools
+    };
+};
+// what looks wrong about a time, put after it as XxxFlags when not empty
+typedef BitfieldProperty<TimeFlagsTmpl> TimeFlags_t;
+
+//! what looks wrong about each of n times, in one pass without branches
+void check_times(const MSTimeProperty* times, TimeFlags_t* flags, size_t n, MSTimeProperty now);
+
 // section 2.1
 struct ShellLinkHeader
 {
@@ -376,6 +419,7 @@ struct ShellLinkHeader
     uint16_t            Reversed1;
     uint32_t            Reserved2;
     uint32_t            Reserved3;
+    std::array<TimeFlags_t, 3> TimeFlags;   // of CreationTime, AccessTime, WriteTime
     bool has_link_info() const 
     {
         constexpr int info_bit = decltype(LinkFlags)::find("HasLinkInfo");
@@ -428,15 +472,6 @@ struct ShellLinkHeader
 // end of section 2.1 }}}
 
 // section 2.2, (shellids) {{{
-struct LinkTargetIdList {
-    uint16_t            IdListSize;
-    struct ID {
-        uint16_t                ItemIdSize;
-        std::vector<uint8_t>    Data;
-    };
-    std::list<ID>       IdList;
-};
-
 /*
 taken from:
 https://github.com/libyal/libfwsi/blob/main/documentation/Windows%20Shell%20Item%20format.asciidoc
@@ -460,6 +495,17 @@ public:
 };
 typedef EnumeratedProperty<ShellId_x1F_SortIndex_Tmpl> ShellId_x1F_SortIndex_t;
 
+struct ShellId_x1F_Struct
+{
+    ShellId_x1F_SortIndex_t SortIndex;
+    Guid                    ShellFolder;
+};
+
+struct ShellId_x20_Struct
+{
+    uint8_t                 Flags;
+};
+
 class ShellId_x30_Flags_Tmpl
 {
 public:
@@ -486,7 +532,52 @@ public:
     FATTime(uint32_t fat_time): m_fat(fat_time) { }
     FATTime(): m_fat(0) { }
     operator uint32_t&() { return m_fat; }
-    time_t unix_time();
+    operator uint32_t() const { return m_fat; }
+    time_t unix_time() const;
+};
+
+struct ShellId_BeefBase
+{
+    uint16_t                Size;
+    uint16_t                Version;
+    uint32_t                Signature;
+};
+
+class ShellId_Beef_Winver_Tmpl
+{
+public:
+    typedef uint16_t data_type;
+    constexpr static std::array<std::pair<uint16_t, const char*>, 4> description = {{
+        { 0x0014, "Windows XP or 2003" },
+        { 0x0026, "Windows Vista" },
+        { 0x002A, "Windows 7, 8.0" },
+        { 0x002E, "Windows 8.1, 10" }
+    }};
+};
+typedef EnumeratedProperty<ShellId_Beef_Winver_Tmpl> ShellId_Beef_Winver_t;
+
+struct ShellId_Beef0004
+{
+    static const uint32_t   Signature = 0xBEEF0004;
+    uint16_t                Version;
+    FATTime                 CreationTime;
+    FATTime                 AccessTime;
+    ShellId_Beef_Winver_t   WindowsVersion;
+    // version >= 7
+    uint16_t                Unknown1;
+    uint64_t                FileReference;
+    uint64_t                Unknown2;
+    // version >= 3
+    uint16_t                LongStringSize;
+    // version >= 9
+    uint32_t                Unknown3;
+    // version >= 8
+    uint32_t                Unknown4;
+    // version >= 3
+    std::string             LongName;
+    // version >= 3 && LongStringSize > 0, ansi before version 7
+    std::string             LocalizedName;
+
 };
 
 struct ShellId_x30_Struct
@@ -499,6 +590,7 @@ struct ShellId_x30_Struct
     std::string             Name;
     std::string             SecondaryName;
     Guid                    ShellFolder;
+    std::optional<ShellId_Beef0004> Extension;  // post-xp
     bool is_unicode() const
     {
         constexpr int uni_bit = decltype(Flags)::find("HasUnicodeStrings");
@@ -611,6 +703,7 @@ struct ShellId_x60_Struct
     uint32_t                Unknown1;
     uint32_t                Unknown2;
     MSTimeProperty          Timestamp;
+    TimeFlags_t             TimestampFlags;
     uint32_t                Unknown4;
     uint32_t                Unknown5;
     uint32_t                Unknown6;
@@ -660,53 +753,26 @@ struct ShellId_x74_Struct
     }                       SubShellItem;
     Guid                    DelegateGuid;
     Guid                    DelegateClass;
-    // continues with 0xBEEF0004
+    std::optional<ShellId_Beef0004> Extension;  // block 0xBEEF0004 that follows
 };
 
 const char* shell_folder_guid_describe(const char* guid);  // clstype 0x1F, 0x30
 const char* control_panel_guid_describe(const char* guid); // clstype 0x70
 
-struct ShellId_BeefBase
-{
-    uint16_t                Size;
-    uint16_t                Version;
-    uint32_t                Signature;
-};
-
-class ShellId_Beef_Winver_Tmpl
-{
-public:
-    typedef uint16_t data_type;
-    constexpr static std::array<std::pair<uint16_t, const char*>, 4> description = {{
-        { 0x0014, "Windows XP or 2003" },
-        { 0x0026, "Windows Vista" },
-        { 0x002A, "Windows 7, 8.0" },
-        { 0x002E, "Windows 8.1, 10" }
-    }};
-};
-typedef EnumeratedProperty<ShellId_Beef_Winver_Tmpl> ShellId_Beef_Winver_t;
-
-struct ShellId_Beef0004
-{
-    static const uint32_t   Signature = 0xBEEF0004;
-    FATTime                 CreationTime;
-    FATTime                 AccessTime;
-    ShellId_Beef_Winver_t   WindowsVersion;
-    // version >= 7
-    uint16_t                Unknown1;
-    uint64_t                FileReference;
-    uint64_t                Unknown2;
-    // version >= 3
-    uint16_t                LongStringSize;
-    // version >= 9
-    uint32_t                Unknown3;
-    // version >= 8
-    uint32_t                Unknown4;
-    // version >= 3
-    std::string             LongName;
-    // version >= 3 && LongStringSize > 0
-    std::string             LocalizedName;
+// decoded shell items, monostate if the class type is unknown
+typedef std::variant<std::monostate, ShellId_x1F_Struct, ShellId_x20_Struct, ShellId_x30_Struct,
+                     ShellId_x40_Struct, ShellId_x50_Struct, ShellId_x60_Struct,
+                     ShellId_x70_Struct, ShellId_x74_Struct> ShellItem;
 
+struct LinkTargetIdList {
+    uint16_t            IdListSize;
+    struct ID {
+        uint16_t                    ItemIdSize;
+        std::span<const uint8_t>    Data;       // points into the parser's read buffer
+        ShellItem                   Item;
+    };
+    std::vector<ID>     IdList;
+    void clear() { IdListSize = 0; IdList.clear(); }
 };
 // end of section 2.2 }}}
 
@@ -884,11 +950,34 @@ struct LinkInfoData
     std::string     CommonPathSuffix;
     std::string     LocalBasePathUnicode;
     std::string     CommonPathSuffixUnicode;
+    //! zero everything, strings keep their capacity
+    void clear()
+    {
+        auto& v = VolumeID;
+        v.Size = v.DriveSerialNumber = v.VolumeLabelOffset = v.VolumeLabelOffsetUnicode = 0;
+        v.DriveType = 0;
+        v.VolumeLabel.clear();
+        v.VolumeLabelUnicode.clear();
+        auto& c = CommonNetworkRelativeLink;
+        c.Size = c.NetNameOffset = c.DeviceNameOffset = 0;
+        c.NetNameOffsetUnicode = c.DeviceNameOffsetUnicode = 0;
+        c.Flags = 0;
+        c.NetworkProviderType = 0;
+        c.NetName.clear();
+        c.DeviceName.clear();
+        c.NetNameUnicode.clear();
+        c.DeviceNameUnicode.clear();
+        LocalBasePath.clear();
+        CommonPathSuffix.clear();
+        LocalBasePathUnicode.clear();
+        CommonPathSuffixUnicode.clear();
+    }
 };
 
 struct LinkInfo {
     LinkInfoHeader  header;
     LinkInfoData    data;
+    void clear() { header = LinkInfoHeader(); data.clear(); }
 };
 // end of section 2.3 }}}
 
@@ -900,6 +989,15 @@ struct StringData {
     std::string     CommandLine;
     std::string     IconLocation;
     bool            UnicodeFlag;
+    void clear()
+    {
+        Name.clear();
+        RelativePath.clear();
+        WorkingDir.clear();
+        CommandLine.clear();
+        IconLocation.clear();
+        UnicodeFlag = false;
+    }
 };
 // end of section 2.4 }}}
 
@@ -1041,7 +1139,7 @@ struct KnownFolderDataBlock
 struct PropertyStoreDataBlock
 {
     static const uint32_t Signature = 0xA0000009;
-    // oh my God TODO
+    std::span<const uint8_t>    Data;  // serialized property storage, not decoded yet
 };
 
 struct ShimDataBlock
@@ -1072,26 +1170,71 @@ struct TrackerDataBlock
 struct VistaAndAboveIDListDataBlock
 {
     static const uint32_t Signature = 0xA000000C;
-    // another IDList TODO
+    std::span<const uint8_t>    Data;  // another IDList, not decoded yet
 };
 
-// ExtraData structures will not be saved anywhere after parsing
-struct ExtraDataPH
+struct UnknownDataBlock
 {
+    uint32_t                    Signature;
+    std::span<const uint8_t>    Data;
 };
-// end of section 2.5 }}}
 
-typedef std::optional<LinkInfo>                         OptionalLinkInfo;
-typedef std::optional<LinkTargetIdList>                 OptionalIdList;
+//! blocks keep their storage between files, only the ones listed in signatures are valid.
+struct ExtraData
+{
+    ConsoleDataBlock                console;
+    ConsoleFeDataBlock              console_fe;
+    DarwinDataBlock                 darwin;
+    EnvVarDataBlock                 env_var;
+    IconEnvDataBlock                icon_env;
+    KnownFolderDataBlock            known_folder;
+    PropertyStoreDataBlock          property_store;
+    ShimDataBlock                   shim;
+    SpecialFolderDataBlock          special_folder;
+    TrackerDataBlock                tracker;
+    VistaAndAboveIDListDataBlock    vista_id_list;
+    std::vector<UnknownDataBlock>   unknown;
+    std::vector<uint32_t>           signatures;  // in file order
+    bool has(uint32_t signature) const
+    {
+        for (uint32_t s : signatures) {
+            if (s == signature) {
+                return true;
+            }
+        }
+        return false;
+    }
+    template <class Block> bool has() const { return has(Block::Signature); }
+    void clear() { unknown.clear(); signatures.clear(); }
+};
+// end of section 2.5 }}}
 
+//! everything that is kept after parsing. a parser reuses one of these for each file,
+//! so sections that were not read are cleared and flagged instead of being destroyed.
 struct All
 {
     ShellLinkHeader         header;
-    OptionalIdList          id_list;
-    OptionalLinkInfo        info;
+    LinkTargetIdList        id_list;
+    LinkInfo                info;
     StringData              string_data;
-    bool has_id_list() const { return id_list.has_value(); }
-    bool has_link_info() const { return info.has_value(); }
+    ExtraData               extra_data;
+    bool                    id_list_present;
+    bool                    info_present;
+    bool has_id_list() const { return id_list_present; }
+    bool has_link_info() const { return info_present; }
+    //! a time is flagged InFuture. that depends on when the file was parsed, so the output
+    //! is not kept for later runs.
+    bool has_future_times() const;
+    void clear()
+    {
+        header = ShellLinkHeader();
+        id_list.clear();
+        info.clear();
+        string_data.clear();
+        extra_data.clear();
+        id_list_present = false;
+        info_present = false;
+    }
 };
 
 } // namespace LnkStruct
@@ -0,0 +1,208 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#include "table.h"
+#include "output.h"
+#include <algorithm>
+
+namespace LnkOutput {
+
+static const char* const columns[] = {
+    "File", "LinkFlags", "FileAttributes", "CreationTime", "AccessTime", "WriteTime",
+    "FileSize", "IconIndex", "ShowCommand", "DriveType", "DriveSerialNumber", "VolumeLabel",
+    "LocalBasePath", "CommonPathSuffix", "NetName", "DeviceName", "Name", "RelativePath",
+    "WorkingDir", "CommandLine", "IconLocation", "EnvironmentTarget", "KnownFolderId",
+    "MachineID"
+};
+
+//! fixed size strings are padded with NUL
+static std::string_view
+until_nul(const std::string& s)
+{
+    return std::string_view(s.data(), std::min(s.find('\0'), s.size()));
+}
+
+//! names of the set bits separated by '|'
+template <class T>
+static std::string
+bits(const LnkStruct::BitfieldProperty<T>& b)
+{
+    std::string s;
+    for (int i = 0; i < b.num_bits(); i++) {
+        if (b.value_of(i)) {
+            if (!s.empty()) {
+                s.push_back('|');
+            }
+            s.append(safe_string(b.describe(i)));
+        }
+    }
+    return s;
+}
+
+TableWriter::TableWriter(std::ostream& out, TableFormat format, CodecPtr codec):
+    m_out(out), m_format(format), m_codec(codec), m_column(0)
+{
+    m_buf.reserve(FLUSH_SIZE + 4096);
+}
+
+//! CSV quotes fields as in RFC 4180, TSV has no quoting, so tabs and newlines become spaces
+void
+TableWriter::cell(std::string_view s)
+{
+    if (m_column++ > 0) {
+        m_buf.push_back(m_format == TableFormat::TSV ? '\t' : ',');
+    }
+    if (m_format == TableFormat::TSV) {
+        for (char c : s) {
+            m_buf.push_back((c == '\t' || c == '\n' || c == '\r') ? ' ' : c);
+        }
+    } else if (s.find_first_of(",\"\r\n") == std::string_view::npos) {
+        m_buf.append(s);
+    } else {
+        m_buf.push_back('"');
+        for (char c : s) {
+            if (c == '"') {
+                m_buf.push_back('"');
+            }
+            m_buf.push_back(c);
+        }
+        m_buf.push_back('"');
+    }
+}
+
+void
+TableWriter::cell(uint64_t v)
+{
+    cell(std::to_string(v));
+}
+
+//! empty if not set
+void
+TableWriter::time(LnkStruct::MSTimeProperty t)
+{
+    if (uint64_t(t) == 0) {
+        cell("");
+    } else {
+        cell(iso8601_time(t));
+    }
+}
+
+void
+TableWriter::ansi(std::string_view s)
+{
+    cell(m_codec ? m_codec->string(s) : std::string(s));
+}
+
+void
+TableWriter::end_row()
+{
+    m_buf.push_back('\n');
+    m_column = 0;
+    if (m_buf.size() >= FLUSH_SIZE) {
+        flush();
+    }
+}
+
+void
+TableWriter::header()
+{
+    for (auto c : columns) {
+        cell(c);
+    }
+    end_row();
+}
+
+void
+TableWriter::row(const std::string& name, const LnkStruct::All& data)
+{
+    auto& h = data.header;
+    cell(name);
+    cell(bits(h.LinkFlags));
+    cell(bits(h.FileAttributes));
+    time(h.CreationTime);
+    time(h.AccessTime);
+    time(h.WriteTime);
+    cell(h.FileSize);
+    cell(h.IconIndex);
+    cell(safe_string(h.ShowCommand.describe(h.ShowCommand.get_value())));
+
+    auto& ih = data.info.header;
+    auto& id = data.info.data;
+    bool volume = data.has_link_info() && ih.has_volume_id_and_local_base_path();
+    bool cnr = data.has_link_info() && ih.has_common_network_relative_link();
+    auto& v = id.VolumeID;
+    if (volume) {
+        cell(safe_string(v.DriveType.describe(v.DriveType.get_value())));
+        cell(hex(v.DriveSerialNumber));
+        if (v.has_unicode_label()) {
+            cell(v.VolumeLabelUnicode);
+        } else {
+            ansi(v.VolumeLabel);
+        }
+    } else {
+        cell("");
+        cell("");
+        cell("");
+    }
+    if (volume && ih.has_optional_fields() == 1) {
+        cell(id.LocalBasePathUnicode);
+        cell(id.CommonPathSuffixUnicode);
+    } else if (volume) {
+        ansi(id.LocalBasePath);
+        ansi(id.CommonPathSuffix);
+    } else {
+        cell("");
+        cell("");
+    }
+    auto& c = id.CommonNetworkRelativeLink;
+    if (cnr && c.has_optional_fields()) {
+        cell(c.NetNameUnicode);
+        cell(c.DeviceNameUnicode);
+    } else if (cnr) {
+        ansi(c.NetName);
+        ansi(c.DeviceName);
+    } else {
+        cell("");
+        cell("");
+    }
+
+    // strings that are not in the file are empty
+    auto& s = data.string_data;
+    for (auto str : {&s.Name, &s.RelativePath, &s.WorkingDir, &s.CommandLine,
+                     &s.IconLocation})
+    {
+        if (s.UnicodeFlag) {
+            cell(*str);
+        } else {
+            ansi(*str);
+        }
+    }
+
+    auto& x = data.extra_data;
+    if (!x.has<LnkStruct::EnvVarDataBlock>()) {
+        cell("");
+    } else if (!until_nul(x.env_var.TargetUnicode).empty()) {
+        cell(until_nul(x.env_var.TargetUnicode));
+    } else {
+        ansi(until_nul(x.env_var.TargetAnsi));
+    }
+    cell(x.has<LnkStruct::KnownFolderDataBlock>() ? x.known_folder.KnownFolderId.string() : "");
+    if (x.has<LnkStruct::TrackerDataBlock>()) {
+        ansi(until_nul(x.tracker.MachineID));
+    } else {
+        cell("");
+    }
+    end_row();
+}
+
+void
+TableWriter::flush()
+{
+    m_out.write(m_buf.data(), m_buf.size());
+    m_buf.clear();
+}
+
+};  // namespace LnkOutput
@@ -0,0 +1,51 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#ifndef TABLE_H
+#define TABLE_H
+
+// one row per file with fixed columns, for loading many files into other tools.
+// rows are made from Parser::data(), so the parser does not need to build output trees.
+
+#include "encoding.h"
+#include "struct.h"
+#include <ostream>
+#include <string>
+
+namespace LnkOutput {
+
+enum class TableFormat { None, CSV, TSV };
+
+class TableWriter
+{
+private:
+    std::ostream&       m_out;
+    TableFormat         m_format;
+    CodecPtr            m_codec;
+    std::string         m_buf;      // rows not written yet
+    size_t              m_column;
+
+    static const size_t FLUSH_SIZE = 1 << 16;
+
+    void cell(std::string_view s);
+    void cell(uint64_t v);
+    void time(LnkStruct::MSTimeProperty t);
+    void ansi(std::string_view s);
+    void end_row();
+
+public:
+    //! codec converts non-Unicode strings, they are copied unchanged without one
+    TableWriter(std::ostream& out, TableFormat format, CodecPtr codec);
+    ~TableWriter() { flush(); }
+    //! names of the columns
+    void header();
+    void row(const std::string& name, const LnkStruct::All& data);
+    void flush();
+};
+
+};  // namespace LnkOutput
+
+#endif  // TABLE_H
@@ -0,0 +1,316 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#include "tar.h"
+
+// std
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+// posix
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const size_t     BLOCK = 512;
+static const size_t     BUFFER_SIZE = 256 << 10;
+
+// header {{{
+// offsets and sizes of the fields of a ustar header that are used here
+static const size_t     NAME = 0, NAME_SIZE = 100;
+static const size_t     SIZE = 124, SIZE_SIZE = 12;
+static const size_t     CHECKSUM = 148, CHECKSUM_SIZE = 8;
+static const size_t     TYPE = 156;
+static const size_t     MAGIC = 257;
+static const size_t     PREFIX = 345, PREFIX_SIZE = 155;
+
+//! a string field, which ends with NUL or fills the field
+static std::string
+field(const char* h, size_t offset, size_t size)
+{
+    const char* s = h + offset;
+    return std::string(s, std::find(s, s + size, '\0'));
+}
+
+//! an octal number, or base 256 with the high bit of the first byte set as GNU tar writes
+//! large sizes. false if it is neither.
+static bool
+number(const char* h, size_t offset, size_t size, uint64_t& value)
+{
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(h + offset);
+    value = 0;
+    if (s[0] & 0x80) {
+        for (size_t i = 1; i < size; i++) {
+            if (value >> 56) {
+                return false;
+            }
+            value = (value << 8) | s[i];
+        }
+        return (s[0] & 0x7F) == 0;
+    }
+    size_t i = 0;
+    while (i < size && s[i] == ' ') {
+        i++;
+    }
+    bool digits = false;
+    for (; i < size && s[i] >= '0' && s[i] <= '7'; i++) {
+        value = (value << 3) | (s[i] - '0');
+        digits = true;
+    }
+    return digits && (i == size || s[i] == ' ' || s[i] == '\0');
+}
+
+//! the sum of the bytes of the header with the checksum field as spaces
+static bool
+checksum_ok(const char* h)
+{
+    uint64_t stored;
+    if (!number(h, CHECKSUM, CHECKSUM_SIZE, stored)) {
+        return false;
+    }
+    uint64_t sum = 0;
+    for (size_t i = 0; i < BLOCK; i++) {
+        bool in_field = i >= CHECKSUM && i < CHECKSUM + CHECKSUM_SIZE;
+        sum += in_field ? ' ' : static_cast<unsigned char>(h[i]);
+    }
+    return sum == stored;
+}
+
+//! path and size of the next member from the records of a pax header, "LEN key=value\n"
+static void
+pax_records(const std::vector<char>& data, std::string& path, uint64_t& size, bool& has_size)
+{
+    size_t p = 0;
+    while (p < data.size()) {
+        size_t len = 0;
+        size_t q = p;
+        while (q < data.size() && data[q] >= '0' && data[q] <= '9') {
+            len = len * 10 + (data[q++] - '0');
+        }
+        // the length counts itself, the space and the newline at the end
+        if (q >= data.size() || data[q] != ' ' || len < q - p + 2 || len > data.size() - p ||
+            data[p + len - 1] != '\n')
+        {
+            return;
+        }
+        std::string record(data.data() + q + 1, data.data() + p + len - 1);
+        size_t eq = record.find('=');
+        if (eq != std::string::npos) {
+            std::string key = record.substr(0, eq);
+            if (key == "path") {
+                path = record.substr(eq + 1);
+            } else if (key == "size") {
+                has_size = true;
+                size = strtoull(record.c_str() + eq + 1, nullptr, 10);
+            }
+        }
+        p += len;
+    }
+}
+// }}}
+
+// source {{{
+TarSource::TarSource(int fd, const std::string& path, const std::list<std::string>& globs):
+    m_fd(fd), m_path(path), m_globs(globs),
+    m_seekable(false), m_size(UINT64_MAX), m_buffer(BUFFER_SIZE)
+{
+    // lseek goes past the end of a file without an error, so skip needs the size to notice
+    // a truncated archive. other things that seek, like block devices, are read through.
+    struct stat st;
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    if (start >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= start) {
+        m_seekable = true;
+        m_size = st.st_size - start;
+    }
+}
+
+//! exactly size bytes, 0 or errno, EBADMSG at the end of the archive
+int
+TarSource::read(char* out, size_t size)
+{
+    while (size > 0) {
+        if (m_begin == m_end) {
+            ssize_t n = ::read(m_fd, m_buffer.data(), m_buffer.size());
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return errno;
+            }
+            if (n == 0) {
+                return EBADMSG;
+            }
+            m_begin = 0;
+            m_end = n;
+        }
+        size_t n = std::min(size, m_end - m_begin);
+        if (out != nullptr) {
+            memcpy(out, &m_buffer[m_begin], n);
+            out += n;
+        }
+        m_begin += n;
+        m_offset += n;
+        size -= n;
+    }
+    return 0;
+}
+
+//! past size bytes, with lseek where the archive is a file. EBADMSG past the end.
+int
+TarSource::skip(uint64_t size)
+{
+    size_t buffered = std::min<uint64_t>(size, m_end - m_begin);
+    m_begin += buffered;
+    m_offset += buffered;
+    size -= buffered;
+    if (size > 0 && m_seekable) {
+        if (m_offset > m_size || size > m_size - m_offset) {
+            return EBADMSG;
+        }
+        if (lseek(m_fd, size, SEEK_CUR) < 0) {
+            return errno;
+        }
+        m_offset += size;
+        return 0;
+    }
+    while (size > 0) {
+        size_t n = std::min<uint64_t>(size, m_buffer.size());
+        if (int error = read(nullptr, n)) {
+            return error;
+        }
+        size -= n;
+    }
+    return 0;
+}
+
+bool
+TarSource::wanted(const std::string& name) const
+{
+    // Windows does not tell "Desktop.LNK" from "Desktop.lnk"
+#ifdef FNM_CASEFOLD
+    const int flags = FNM_CASEFOLD;
+#else
+    const int flags = 0;
+#endif
+    for (auto& g: m_globs) {
+        if (fnmatch(g.c_str(), name.c_str(), flags) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//! the last item, one that could not be read
+bool
+TarSource::fail(PipelineItem& item, const std::string& name, int error)
+{
+    item.name = name.empty() ? m_path : name;
+    item.data.clear();
+    item.read_error = error;
+    m_done = true;
+    return true;
+}
+
+bool
+TarSource::next(PipelineItem& item)
+{
+    if (m_done) {
+        return false;
+    }
+    char h[BLOCK];
+    // names and sizes of GNU and pax headers, for the member after them
+    std::string long_name;
+    uint64_t pax_size = 0;
+    bool has_pax_size = false;
+    std::vector<char> extra;
+    while (true) {
+        if (int error = read(h, BLOCK)) {
+            // some writers stop without the blocks of zeroes at the end
+            if (error == EBADMSG && m_begin == m_end && m_offset % BLOCK == 0 &&
+                long_name.empty() && !has_pax_size)
+            {
+                m_done = true;
+                return false;
+            }
+            return fail(item, long_name, error);
+        }
+        if (std::all_of(h, h + BLOCK, [](char c) { return c == '\0'; })) {
+            m_done = true;
+            return false;
+        }
+        if (!checksum_ok(h)) {
+            return fail(item, long_name, EBADMSG);
+        }
+        uint64_t size;
+        if (!number(h, SIZE, SIZE_SIZE, size)) {
+            return fail(item, long_name, EBADMSG);
+        }
+        char type = h[TYPE];
+        uint64_t padded = (size + BLOCK - 1) / BLOCK * BLOCK;
+        if (type == 'L' || type == 'x') {
+            // a name or records for the next member, never large
+            if (size > LnkParser::MAX_FILE_SIZE) {
+                return fail(item, long_name, EBADMSG);
+            }
+            extra.resize(size);
+            if (int error = read(extra.data(), size)) {
+                return fail(item, long_name, error);
+            }
+            if (int error = skip(padded - size)) {
+                return fail(item, long_name, error);
+            }
+            if (type == 'L') {
+                long_name.assign(extra.begin(), std::find(extra.begin(), extra.end(), '\0'));
+            } else {
+                pax_records(extra, long_name, pax_size, has_pax_size);
+            }
+            continue;
+        }
+        std::string name = long_name;
+        if (name.empty()) {
+            name = field(h, NAME, NAME_SIZE);
+            // the prefix is only there in POSIX ustar, GNU tar has other fields there
+            if (memcmp(h + MAGIC, "ustar\0", 6) == 0 && h[PREFIX] != '\0') {
+                name = field(h, PREFIX, PREFIX_SIZE) + "/" + name;
+            }
+        }
+        if (has_pax_size) {
+            size = pax_size;
+            padded = (size + BLOCK - 1) / BLOCK * BLOCK;
+        }
+        long_name.clear();
+        has_pax_size = false;
+        // regular files only, links and directories have no data of their own
+        bool regular = type == '0' || type == '\0' || type == '7';
+        if (!regular || !wanted(name)) {
+            if (int error = skip(padded)) {
+                return fail(item, name, error);
+            }
+            continue;
+        }
+        // as much as FileSource would read, the rest is skipped
+        LnkParser::StageTimer t(LnkParser::Stage::Read);
+        size_t length = std::min<uint64_t>(size, LnkParser::MAX_FILE_SIZE);
+        item.data.resize(length);
+        if (int error = read(item.data.data(), length)) {
+            return fail(item, name, error);
+        }
+        if (int error = skip(padded - length)) {
+            return fail(item, name, error);
+        }
+        t.stop();
+        if (LnkParser::current_stats != nullptr) {
+            LnkParser::current_stats->bytes_read += length;
+        }
+        item.name = std::move(name);
+        item.read_error = 0;
+        return true;
+    }
+}
+// }}}
@@ -0,0 +1,46 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#ifndef __TAR_H__
+#define __TAR_H__
+
+// members of a tar archive for the pipeline, read from the archive in one pass without
+// extracting anything. the archive can be a pipe, like the output of zcat.
+#include "pipeline.h"
+#include <list>
+#include <string>
+
+//! the regular members of the archive on fd whose paths match one of globs, as items named by
+//! their paths. ustar with GNU long names and pax paths and sizes, like GNU tar and bsdtar
+//! write. a damaged or truncated archive ends with an item that cannot be read (EBADMSG).
+class TarSource: public PipelineSource
+{
+private:
+    int                     m_fd;
+    std::string             m_path;         // of the archive, for errors before a member
+    std::list<std::string>  m_globs;
+    bool                    m_seekable;
+    uint64_t                m_size;         // from the start of the archive, if it is a file
+    bool                    m_done = false;
+    std::vector<char>       m_buffer;
+    size_t                  m_begin = 0;    // of what was read and not used yet
+    size_t                  m_end = 0;
+    uint64_t                m_offset = 0;   // in the archive, of m_begin
+
+    int read(char* out, size_t size);
+    int skip(uint64_t size);
+    bool wanted(const std::string& name) const;
+    bool fail(PipelineItem& item, const std::string& name, int error);
+
+public:
+    //! fd is not closed here. path is the name of the archive for errors.
+    TarSource(int fd, const std::string& path, const std::list<std::string>& globs);
+    TarSource(const TarSource&) = delete;
+    TarSource& operator=(const TarSource&) = delete;
+    bool next(PipelineItem& item) override;
+};
+
+#endif // #ifndef __TAR_H__
@@ -0,0 +1,745 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+// lnkdump2k-test, checks for ctest of the parts that only the fuzzer would otherwise exercise.
+// "lnkdump2k-test NAME..." runs the named checks, without names it runs all of them. every
+// check is a test of its own in CMakeLists.txt. what is needed on disk goes to a directory
+// under TMPDIR that is removed at the end.
+#include "cache.h"
+#include "civil.h"
+#include "pipeline.h"
+#include "serialize.h"
+#include "tar.h"
+#include "timeline.h"
+#include "writer.h"
+
+// std
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// posix
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// checks {{{
+static int failures = 0;
+
+//! reports a check that failed, the test goes on with the next one
+static void
+check(bool ok, const char* what, int line)
+{
+    if (!ok) {
+        std::cerr << "test.cpp:" << line << ": failed: " << what << std::endl;
+        failures++;
+    }
+}
+
+#define CHECK(x) check((x), #x, __LINE__)
+
+//! a directory of its own for the files of a test, removed with this
+class TempDir
+{
+private:
+    std::filesystem::path   m_path;
+
+public:
+    TempDir()
+    {
+        const char* tmp = getenv("TMPDIR");
+        std::string pattern = std::string(tmp != nullptr ? tmp : "/tmp") + "/lnkdump2k-XXXXXX";
+        if (mkdtemp(pattern.data()) == nullptr) {
+            std::cerr << pattern << ": " << strerror(errno) << std::endl;
+            exit(2);
+        }
+        m_path = pattern;
+    }
+    TempDir(const TempDir&) = delete;
+    ~TempDir() { std::filesystem::remove_all(m_path); }
+
+    std::string path(const std::string& name) const { return m_path / name; }
+
+    std::string
+    write(const std::string& name, const std::string& data) const
+    {
+        std::ofstream(path(name), std::ios::binary) << data;
+        return path(name);
+    }
+};
+
+//! a small ShellLink file with unicode strings and an ExtraData block, different for
+//! different names
+static std::string
+sample_lnk(const std::string& name)
+{
+    LnkStruct::All lnk;
+    lnk.clear();
+    lnk.header.LinkFlags = 0x80 | 0x04 | 0x20;     // IsUnicode, HasName, HasArguments
+    lnk.header.FileAttributes = 0x20;
+    lnk.header.WriteTime = 133000000000000000ULL;
+    lnk.header.ShowCommand = 1;
+    lnk.string_data.Name = name;
+    lnk.string_data.CommandLine = "--open \"" + name + "\" \u00e9\u4e2d";
+    lnk.string_data.UnicodeFlag = true;
+    auto& e = lnk.extra_data;
+    // the signature is an in-class constant, push_back would need its address
+    e.signatures.push_back(uint32_t(e.env_var.Signature));
+    e.env_var.TargetAnsi = "%USERPROFILE%\\" + name;
+    e.env_var.TargetUnicode = "%USERPROFILE%\\" + name + "\u00e9";
+    std::string out;
+    LnkWriter::write(lnk, out);
+    return out;
+}
+
+//! YAML of an output tree, to compare two of them
+static std::string
+yaml(const LnkOutput::StreamPtr& output)
+{
+    static CodecFactory codecs;
+    std::ostringstream out;
+    LnkOutput::dump_yaml(out, output, codecs.get(0), "test.lnk", LnkOutput::DEBUG);
+    return out.str();
+}
+// }}}
+
+// timeline {{{
+//! lines of ExternalSorter in the order of std::stable_sort, in memory, with runs on disk and
+//! with more runs than are merged at once. keys are close together like timestamps, with
+//! many ties, and sometimes anywhere in the 64 bits so that every radix pass is used.
+static void
+test_timeline_sort()
+{
+    uint64_t state = 1;
+    auto random = [&state] {
+        // splitmix64
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    };
+    std::vector<std::pair<uint64_t, std::string>> lines;
+    for (size_t i = 0; i < 200000; i++) {
+        uint64_t key = random() % 16 == 0 ? random() : 133000000000000000ULL + random() % 5000;
+        lines.emplace_back(key, std::to_string(key) + " " + std::to_string(i) + "\n");
+    }
+    std::string expected;
+    {
+        auto sorted = lines;
+        std::stable_sort(sorted.begin(), sorted.end(),
+                         [](auto& a, auto& b) { return a.first < b.first; });
+        for (auto& [key, line]: sorted) {
+            expected += line;
+        }
+    }
+    // everything in memory, a few runs, and 11 runs of the smallest budget with at most 2, 3
+    // and 4 at once, so that runs are merged before there are all of them
+    struct Case
+    {
+        size_t  budget;
+        size_t  max_runs;
+    };
+    for (Case c: {Case{256 << 20, LnkOutput::ExternalSorter::MAX_RUNS},
+                  Case{4 << 20, LnkOutput::ExternalSorter::MAX_RUNS},
+                  Case{1 << 20, LnkOutput::ExternalSorter::MAX_RUNS},
+                  Case{1 << 20, 2}, Case{1 << 20, 3}, Case{1 << 20, 4}})
+    {
+        LnkOutput::ExternalSorter sorter(c.budget, c.max_runs);
+        for (auto& [key, line]: lines) {
+            sorter.add(key, line);
+        }
+        std::ostringstream out;
+        sorter.write(out);
+        if (out.str() != expected) {
+            std::cerr << "test.cpp: wrong order with a budget of " << c.budget << " and "
+                      << c.max_runs << " runs" << std::endl;
+            failures++;
+        }
+    }
+}
+// }}}
+
+// tar {{{
+//! a ustar header, POSIX or with the magic of GNU tar
+static void
+tar_header(std::string& out, const std::string& name, char type, size_t size, bool gnu,
+           const std::string& prefix = "")
+{
+    char h[512] = {};
+    memcpy(h, name.data(), std::min<size_t>(name.size(), 100));
+    snprintf(h + 100, 8, "%07o", 0644);
+    snprintf(h + 124, 12, "%011zo", size);
+    h[156] = type;
+    memcpy(h + 257, gnu ? "ustar  \0" : "ustar\0" "00", 8);
+    memcpy(h + 345, prefix.data(), std::min<size_t>(prefix.size(), 155));
+    memset(h + 148, ' ', 8);
+    unsigned sum = 0;
+    for (unsigned char c: h) {
+        sum += c;
+    }
+    snprintf(h + 148, 8, "%06o", sum);
+    out.append(h, sizeof(h));
+}
+
+//! contents of a member, padded to whole blocks
+static void
+tar_data(std::string& out, const std::string& data)
+{
+    out += data;
+    out.append((512 - data.size() % 512) % 512, '\0');
+}
+
+static void
+tar_member(std::string& out, const std::string& name, const std::string& data, bool gnu)
+{
+    tar_header(out, name, '0', data.size(), gnu);
+    tar_data(out, data);
+}
+
+static void
+tar_end(std::string& out)
+{
+    out.append(1024, '\0');
+}
+
+//! "LEN key=value\n", where LEN counts itself
+static std::string
+pax_record(const std::string& key, const std::string& value)
+{
+    size_t len = key.size() + value.size() + 3;
+    while (std::to_string(len).size() + key.size() + value.size() + 3 != len) {
+        len++;
+    }
+    return std::to_string(len) + " " + key + "=" + value + "\n";
+}
+
+//! what TarSource gives for the archive, read from a file or from a pipe
+static std::vector<PipelineItem>
+tar_items(const std::string& archive, bool pipe, const std::list<std::string>& globs = {"*"})
+{
+    TempDir dir;
+    int fd;
+    std::thread writer;
+    if (pipe) {
+        int fds[2];
+        if (::pipe(fds) < 0) {
+            std::cerr << "pipe: " << strerror(errno) << std::endl;
+            exit(2);
+        }
+        fd = fds[0];
+        writer = std::thread([&archive, out = fds[1]] {
+            size_t done = 0;
+            while (done < archive.size()) {
+                ssize_t n = ::write(out, archive.data() + done, archive.size() - done);
+                if (n <= 0) {
+                    break;
+                }
+                done += n;
+            }
+            close(out);
+        });
+    } else {
+        fd = open(dir.write("test.tar", archive).c_str(), O_RDONLY);
+    }
+    std::vector<PipelineItem> items;
+    {
+        TarSource source(fd, "test.tar", globs);
+        PipelineItem item;
+        while (source.next(item)) {
+            items.push_back(std::move(item));
+        }
+    }
+    if (writer.joinable()) {
+        // the rest of the archive, so that the writer does not wait for a reader
+        char rest[4096];
+        while (::read(fd, rest, sizeof(rest)) > 0) { }
+        writer.join();
+    }
+    close(fd);
+    return items;
+}
+
+static bool
+is_member(const PipelineItem& item, const std::string& name, const std::string& data)
+{
+    return item.read_error == 0 && item.name == name &&
+           std::string(item.data.begin(), item.data.end()) == data;
+}
+
+//! GNU long names, and what is not a regular file or does not match is left out
+static void
+test_tar_gnu()
+{
+    std::string long_name = "Users/" + std::string(120, 'x') + "/Recent/Long.LNK";
+    std::string a;
+    tar_header(a, "Users/", '5', 0, true);
+    tar_member(a, "Users/a.lnk", "first", true);
+    tar_header(a, "././@LongLink", 'L', long_name.size() + 1, true);
+    tar_data(a, long_name + '\0');
+    tar_member(a, long_name.substr(0, 100), "second", true);
+    tar_header(a, "Users/link.lnk", '2', 0, true);
+    tar_member(a, "Users/notes.txt", std::string(2000, 'n'), true);
+    tar_member(a, "Users/b.lnk", "third", true);
+    tar_end(a);
+    for (bool pipe: {false, true}) {
+        auto items = tar_items(a, pipe, {"*.lnk"});
+        CHECK(items.size() == 3);
+        if (items.size() == 3) {
+            CHECK(is_member(items[0], "Users/a.lnk", "first"));
+            CHECK(is_member(items[1], long_name, "second"));
+            CHECK(is_member(items[2], "Users/b.lnk", "third"));
+        }
+    }
+}
+
+//! pax paths and sizes, the size in the header is then not used
+static void
+test_tar_pax()
+{
+    std::string long_name = std::string(150, 'p') + "/Pax.lnk";
+    std::string records = pax_record("mtime", "1700000000.5") + pax_record("path", long_name) +
+                          pax_record("size", "7");
+    std::string a;
+    tar_header(a, "PaxHeaders/Pax.lnk", 'x', records.size(), false);
+    tar_data(a, records);
+    tar_header(a, "Pax.lnk", '0', 0, false);
+    tar_data(a, "content");
+    tar_member(a, "after.lnk", "after", false);
+    tar_end(a);
+    for (bool pipe: {false, true}) {
+        auto items = tar_items(a, pipe);
+        CHECK(items.size() == 2);
+        if (items.size() == 2) {
+            CHECK(is_member(items[0], long_name, "content"));
+            CHECK(is_member(items[1], "after.lnk", "after"));
+        }
+    }
+}
+
+//! the prefix field of POSIX ustar, and an archive without the blocks of zeroes at the end
+static void
+test_tar_ustar()
+{
+    std::string prefix = "Users/Bob/AppData/Roaming/Microsoft/Windows/" + std::string(80, 'u');
+    std::string a;
+    tar_header(a, "Recent/Deep.lnk", '0', 4, false, prefix);
+    tar_data(a, "deep");
+    tar_member(a, "flat.lnk", "flat", false);
+    for (bool pipe: {false, true}) {
+        auto items = tar_items(a, pipe, {"*.LNK"});
+        CHECK(items.size() == 2);
+        if (items.size() == 2) {
+            CHECK(is_member(items[0], prefix + "/Recent/Deep.lnk", "deep"));
+            CHECK(is_member(items[1], "flat.lnk", "flat"));
+        }
+    }
+}
+
+//! an archive cut short ends with an item that cannot be read, from a file as from a pipe,
+//! also where the cut is in a member that is skipped with lseek
+static void
+test_tar_truncated()
+{
+    std::string a;
+    tar_member(a, "a.lnk", "first", false);
+    tar_member(a, "big.txt", std::string(300000, 'b'), false);
+    tar_member(a, "z.lnk", "last", false);
+    tar_end(a);
+    size_t last = 1024 + 512 + 300032;
+    // in the skipped member, past what is read in one go; in the header of the last member;
+    // and in the data of the last member
+    for (size_t cut: {size_t(200000), last + 100, last + 514}) {
+        for (bool pipe: {false, true}) {
+            auto items = tar_items(a.substr(0, cut), pipe, {"*.lnk"});
+            CHECK(items.size() == 2);
+            if (items.size() == 2) {
+                CHECK(is_member(items[0], "a.lnk", "first"));
+                CHECK(items[1].read_error == EBADMSG);
+            }
+        }
+    }
+    // cut where a member ends, some writers leave out the blocks of zeroes
+    auto items = tar_items(a.substr(0, last), false, {"*.lnk"});
+    CHECK(items.size() == 1);
+}
+// }}}
+
+// civil {{{
+//! Civil against timegm and gmtime_r, over the whole range of FILETIME: every day of the
+//! first 800 years and of the years around now, and random seconds up to the last FILETIME
+static void
+test_civil_dates()
+{
+    const int64_t first = -11644473600;                         // 1601-01-01, FILETIME 0
+    const int64_t last = first + int64_t(UINT64_MAX / 10000000);  // in the year 60056
+    size_t wrong = 0;
+    auto compare = [&wrong](int64_t t) {
+        time_t tt = t;
+        tm expected;
+        if (gmtime_r(&tt, &expected) == nullptr) {
+            return;
+        }
+        Civil::DateTime d = Civil::from_unix(t);
+        int64_t days = Civil::days_from_civil(expected.tm_year + 1900LL, expected.tm_mon + 1,
+                                              expected.tm_mday);
+        bool ok = d.date.year == expected.tm_year + 1900LL &&
+                  d.date.month == unsigned(expected.tm_mon + 1) &&
+                  d.date.day == unsigned(expected.tm_mday) &&
+                  d.hour == unsigned(expected.tm_hour) && d.minute == unsigned(expected.tm_min) &&
+                  d.second == unsigned(expected.tm_sec) &&
+                  d.weekday == unsigned(expected.tm_wday);
+        int64_t seconds = expected.tm_hour * 3600 + expected.tm_min * 60 + expected.tm_sec;
+        ok = ok && days * Civil::SECONDS_PER_DAY + seconds == timegm(&expected);
+        char buf[Civil::ISO8601_SIZE];
+        char strf[64];
+        Civil::format_iso8601(buf, t);
+        // %Y is not padded, so only four digit years are compared
+        if (expected.tm_year + 1900 >= 1000 && expected.tm_year + 1900 <= 9999) {
+            strftime(strf, sizeof(strf), "%Y-%m-%dT%H:%M:%SZ", &expected);
+            ok = ok && strcmp(buf, strf) == 0;
+        }
+        if (!ok && wrong++ < 10) {
+            std::cerr << "test.cpp: wrong date for " << t << ": " << buf << std::endl;
+        }
+    };
+    for (int64_t t = first; t < first + 800 * 366 * Civil::SECONDS_PER_DAY;
+         t += Civil::SECONDS_PER_DAY)
+    {
+        compare(t);
+    }
+    for (int64_t t = 1000000000; t < 5000000000; t += Civil::SECONDS_PER_DAY + 1) {
+        compare(t);
+    }
+    uint64_t state = 1;
+    for (int i = 0; i < 1000000; i++) {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        compare(first + int64_t((state >> 11) % uint64_t(last - first + 1)));
+    }
+    for (int64_t t: {first, first - 1, int64_t(-1), int64_t(0), last, last + 1}) {
+        compare(t);
+    }
+    if (wrong > 0) {
+        failures++;
+    }
+}
+// }}}
+
+// serialize {{{
+//! the tree of a parse, serialized
+static LnkOutput::StreamPtr
+sample_output(LnkParser::Parser& parser, const std::string& name)
+{
+    static std::string data;
+    data = sample_lnk(name);
+    parser.reset(data.data(), data.size());
+    CHECK(parser.try_parse().ok());
+    return parser.output();
+}
+
+//! every dumper gives the same for the copy as for the tree of the parser, and the copy
+//! serializes to the same bytes
+static void
+test_serialize_roundtrip()
+{
+    static CodecFactory codecs;
+    LnkParser::Parser parser;
+    for (const char* name: {"a", "second file", "\u4e2d\u6587 name"}) {
+        LnkOutput::StreamPtr output = sample_output(parser, name);
+        std::string data;
+        LnkOutput::serialize(*output, data);
+        LnkOutput::StreamPtr copy = LnkOutput::deserialize(data);
+        CHECK(bool(copy));
+        if (!copy) {
+            continue;
+        }
+        for (auto level: {LnkOutput::NORMAL, LnkOutput::DEBUG}) {
+            std::ostringstream a, b;
+            LnkOutput::dump_yaml(a, output, codecs.get(0), name, level);
+            LnkOutput::dump_yaml(b, copy, codecs.get(0), name, level);
+            CHECK(a.str() == b.str());
+            a.str("");
+            b.str("");
+            LnkOutput::dump_json(a, output, codecs.get(0), name, level);
+            LnkOutput::dump_json(b, copy, codecs.get(0), name, level);
+            CHECK(a.str() == b.str());
+        }
+        std::string again;
+        LnkOutput::serialize(*copy, again);
+        CHECK(again == data);
+    }
+}
+
+//! cut short or of another version is not read; with a byte changed, it may be read or not,
+//! but the dumpers do not fail on what is read
+static void
+test_serialize_damaged()
+{
+    static CodecFactory codecs;
+    LnkParser::Parser parser;
+    std::string data;
+    LnkOutput::serialize(*sample_output(parser, "damaged"), data);
+    for (size_t size = 0; size < data.size(); size++) {
+        if (LnkOutput::deserialize(std::string_view(data).substr(0, size))) {
+            std::cerr << "test.cpp: tree cut at " << size << " was read" << std::endl;
+            failures++;
+        }
+    }
+    std::string other = data;
+    other[4]++;     // the version follows the magic
+    CHECK(!LnkOutput::deserialize(other));
+    std::ostringstream out;
+    for (size_t i = 0; i < data.size(); i++) {
+        for (unsigned char x: {0x01, 0x80, 0xFF}) {
+            std::string bad = data;
+            bad[i] ^= x;
+            if (LnkOutput::StreamPtr s = LnkOutput::deserialize(bad)) {
+                LnkOutput::dump_yaml(out, s, codecs.get(0), "damaged", LnkOutput::DEBUG);
+                LnkOutput::dump_json(out, s, codecs.get(0), "damaged", LnkOutput::DEBUG);
+            }
+        }
+    }
+}
+// }}}
+
+// cache {{{
+//! parses the file and stores the result in the cache, returns the YAML of the result
+static std::string
+cache_store(const std::string& cache_path, const std::string& file)
+{
+    LnkParser::FieldSelection fields;
+    ResultCache cache;
+    LnkParser::Parser parser(file, fields);
+    CHECK(cache.open(cache_path, fields));
+    CHECK(parser.try_parse().ok());
+    struct stat st;
+    CHECK(stat(file.c_str(), &st) == 0);
+    cache.store(cache.key(st), parser.output(), parser.diagnostics());
+    return yaml(parser.output());
+}
+
+//! YAML of what the cache has for the file, empty on a miss
+static std::string
+cache_lookup(const std::string& cache_path, const std::string& file)
+{
+    LnkParser::FieldSelection fields;
+    ResultCache cache;
+    CHECK(cache.open(cache_path, fields));
+    struct stat st;
+    LnkOutput::StreamPtr output;
+    LnkParser::Diagnostics diag;
+    if (stat(file.c_str(), &st) != 0 || !cache.lookup(cache.key(st), output, diag)) {
+        return std::string();
+    }
+    return yaml(output);
+}
+
+//! the same output from the cache as from the parser, also after the cache is reopened
+static void
+test_cache_hit()
+{
+    TempDir dir;
+    std::string cache = dir.path("cache");
+    std::string a = dir.write("a.lnk", sample_lnk("first"));
+    std::string b = dir.write("b.lnk", sample_lnk("second"));
+    std::string yaml_a = cache_store(cache, a);
+    std::string yaml_b = cache_store(cache, b);
+    CHECK(!yaml_a.empty() && yaml_a != yaml_b);
+    CHECK(cache_lookup(cache, a) == yaml_a);
+    CHECK(cache_lookup(cache, b) == yaml_b);
+    // a later record replaces an earlier one
+    yaml_a = cache_store(cache, a);
+    CHECK(cache_lookup(cache, a) == yaml_a);
+}
+
+//! a file that was changed since is a miss
+static void
+test_cache_stale()
+{
+    TempDir dir;
+    std::string cache = dir.path("cache");
+    std::string a = dir.write("a.lnk", sample_lnk("first"));
+    cache_store(cache, a);
+    // a longer name, the modification time may not change within the resolution of the clock
+    dir.write("a.lnk", sample_lnk("first, changed"));
+    CHECK(cache_lookup(cache, a).empty());
+    std::string yaml_a = cache_store(cache, a);
+    CHECK(cache_lookup(cache, a) == yaml_a);
+}
+
+//! a record with any byte changed is a miss, and is good again once it is written again
+static void
+test_cache_corrupt()
+{
+    TempDir dir;
+    std::string cache = dir.path("cache");
+    std::string a = dir.write("a.lnk", sample_lnk("first"));
+    std::string yaml_a = cache_store(cache, a);
+    std::string good;
+    {
+        std::ifstream f(cache, std::ios::binary);
+        good.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    }
+    // the header of the file is checked on its own, the record follows it
+    const size_t header = 16;
+    CHECK(good.size() > header);
+    for (size_t i = header; i < good.size(); i++) {
+        std::string bad = good;
+        bad[i] ^= 0x20;
+        dir.write("cache", bad);
+        if (!cache_lookup(cache, a).empty()) {
+            std::cerr << "test.cpp: corrupt byte " << i << " was not noticed" << std::endl;
+            failures++;
+        }
+    }
+    dir.write("cache", good);
+    std::string bad = good;
+    bad[bad.size() - 3] ^= 0x01;
+    dir.write("cache", bad);
+    CHECK(cache_lookup(cache, a).empty());
+    CHECK(cache_store(cache, a) == yaml_a);
+    CHECK(cache_lookup(cache, a) == yaml_a);
+}
+// }}}
+
+// pipeline {{{
+//! items "0.lnk" to "N-1.lnk" in a random order with their indexes, like SortedSource gives
+//! them. every seventh cannot be read.
+class ShuffledSource: public PipelineSource
+{
+private:
+    std::vector<uint64_t>   m_order;
+    size_t                  m_next = 0;
+
+public:
+    ShuffledSource(size_t n, uint64_t seed): m_order(n)
+    {
+        for (size_t i = 0; i < n; i++) {
+            m_order[i] = i;
+        }
+        std::shuffle(m_order.begin(), m_order.end(), std::mt19937_64(seed));
+    }
+    bool
+    next(PipelineItem& item) override
+    {
+        if (m_next == m_order.size()) {
+            return false;
+        }
+        item.index = m_order[m_next++];
+        item.name = std::to_string(item.index) + ".lnk";
+        item.data.clear();
+        item.read_error = item.index % 7 == 3 ? EIO : 0;
+        if (item.read_error == 0) {
+            std::string data = sample_lnk(item.name);
+            item.data.assign(data.begin(), data.end());
+        }
+        return true;
+    }
+};
+
+//! what the workers write for an item, the name comes from the parsed file
+static void
+format_name(size_t, LnkParser::Parser& parser, PipelineItem&, std::ostream& out)
+{
+    out << parser.data().string_data.Name << "\n";
+}
+
+//! every item once and in the order of the indexes, with more items than slots, so that
+//! most of them come early and wait, and with read errors in between
+static void
+test_pipeline_order()
+{
+    for (size_t workers: {1, 3}) {
+        const size_t n = 500;
+        ShuffledSource source(n, workers);
+        Pipeline pipeline(workers, 8, LnkParser::FieldSelection(), false);
+        uint64_t next = 0;
+        bool completed = pipeline.run(source, format_name, [&](PipelineItem& item) {
+            CHECK(item.index == next);
+            CHECK(item.name == std::to_string(next) + ".lnk");
+            if (next % 7 == 3) {
+                CHECK(item.status.kind == LnkParser::ErrorKind::IoError);
+                CHECK(item.status.value == EIO);
+            } else {
+                CHECK(item.status.ok());
+                CHECK(item.text == item.name + "\n");
+            }
+            next++;
+            return true;
+        });
+        CHECK(completed);
+        CHECK(next == n);
+    }
+}
+
+//! run() ends when write returns false, with items still coming and waiting, and nothing
+//! is written after that
+static void
+test_pipeline_stop()
+{
+    for (uint64_t stop: {0, 1, 3, 250, 499}) {
+        ShuffledSource source(500, stop);
+        Pipeline pipeline(3, 8, LnkParser::FieldSelection(), false);
+        uint64_t written = 0;
+        bool completed = pipeline.run(source, format_name, [&](PipelineItem& item) {
+            CHECK(item.index == written);
+            written++;
+            return item.index != stop;
+        });
+        CHECK(!completed);
+        CHECK(written == stop + 1);
+    }
+}
+// }}}
+
+static const std::map<std::string, void (*)()> tests = {
+    {"cache-corrupt",       test_cache_corrupt},
+    {"cache-hit",           test_cache_hit},
+    {"cache-stale",         test_cache_stale},
+    {"civil-dates",         test_civil_dates},
+    {"pipeline-order",      test_pipeline_order},
+    {"pipeline-stop",       test_pipeline_stop},
+    {"serialize-damaged",   test_serialize_damaged},
+    {"serialize-roundtrip", test_serialize_roundtrip},
+    {"tar-gnu",             test_tar_gnu},
+    {"tar-pax",             test_tar_pax},
+    {"tar-truncated",       test_tar_truncated},
+    {"tar-ustar",           test_tar_ustar},
+    {"timeline-sort",       test_timeline_sort},
+};
+
+int
+main(int argc, char** argv)
+{
+    if (argc < 2) {
+        for (auto& [name, test]: tests) {
+            int before = failures;
+            test();
+            std::cout << name << (failures == before ? ": ok" : ": FAILED") << std::endl;
+        }
+    }
+    for (int i = 1; i < argc; i++) {
+        auto test = tests.find(argv[i]);
+        if (test == tests.end()) {
+            std::cerr << "unknown test " << argv[i] << std::endl;
+            return 2;
+        }
+        test->second();
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,350 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#include "timeline.h"
+#include "output.h"
+
+// std
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <queue>
+#include <stdexcept>
+
+namespace LnkOutput {
+
+static const uint64_t FILETIME_SECOND = 10000000;
+static const size_t   RUN_BUFFER_SIZE = 1 << 16;
+
+// sorter {{{
+static std::runtime_error
+io_error(const char* what)
+{
+    return std::runtime_error(std::string(what) + ": " + strerror(errno));
+}
+
+//! one line in a run file: key:u64 size:u32 bytes
+class RunReader
+{
+private:
+    FILE*               m_file;
+    std::string         m_line;
+    uint64_t            m_key;
+    bool                m_done;
+
+public:
+    RunReader(FILE* f): m_file(f), m_key(0), m_done(false)
+    {
+        rewind(m_file);
+        next();
+    }
+
+    void next()
+    {
+        uint32_t size;
+        if (fread(&m_key, sizeof(m_key), 1, m_file) != 1 ||
+            fread(&size, sizeof(size), 1, m_file) != 1)
+        {
+            m_done = true;
+            return;
+        }
+        m_line.resize(size);
+        if (fread(m_line.data(), 1, size, m_file) != size) {
+            throw io_error("temporary file");
+        }
+    }
+
+    bool done() const { return m_done; }
+    uint64_t key() const { return m_key; }
+    std::string_view line() const { return m_line; }
+};
+
+static void
+write_run_line(FILE* f, uint64_t key, std::string_view line)
+{
+    uint32_t size = line.size();
+    if (fwrite(&key, sizeof(key), 1, f) != 1 || fwrite(&size, sizeof(size), 1, f) != 1 ||
+        fwrite(line.data(), 1, size, f) != size)
+    {
+        throw io_error("temporary file");
+    }
+}
+
+static FILE*
+new_run()
+{
+    FILE* f = tmpfile();
+    if (f == nullptr) {
+        throw io_error("temporary file");
+    }
+    setvbuf(f, nullptr, _IOFBF, RUN_BUFFER_SIZE);
+    return f;
+}
+
+ExternalSorter::ExternalSorter(size_t budget, size_t max_runs):
+    m_budget(std::clamp<size_t>(budget, 1 << 20, UINT32_MAX)),
+    m_max_runs(std::max<size_t>(max_runs, 2))
+{
+}
+
+ExternalSorter::~ExternalSorter()
+{
+    for (FILE* f : m_runs) {
+        fclose(f);
+    }
+}
+
+//! LSD radix sort, 16 bits per pass. passes where all keys have the same digit are skipped,
+//! which are most of them for timestamps that are close together.
+void
+ExternalSorter::sort_chunk()
+{
+    if (m_entries.size() < 2) {
+        return;
+    }
+    std::vector<uint32_t> count(1 << 16);
+    m_tmp.resize(m_entries.size());
+    for (int shift = 0; shift < 64; shift += 16) {
+        std::fill(count.begin(), count.end(), 0);
+        for (auto& e : m_entries) {
+            count[(e.key >> shift) & 0xFFFF]++;
+        }
+        if (count[(m_entries[0].key >> shift) & 0xFFFF] == m_entries.size()) {
+            continue;
+        }
+        uint32_t sum = 0;
+        for (auto& c : count) {
+            uint32_t n = c;
+            c = sum;
+            sum += n;
+        }
+        for (auto& e : m_entries) {
+            m_tmp[count[(e.key >> shift) & 0xFFFF]++] = e;
+        }
+        m_entries.swap(m_tmp);
+    }
+}
+
+void
+ExternalSorter::spill()
+{
+    sort_chunk();
+    if (m_runs.size() >= m_max_runs) {
+        // keep the number of open files down, merge what is there into one run first
+        FILE* f = new_run();
+        merge(m_runs, [f](uint64_t key, std::string_view line) {
+            write_run_line(f, key, line);
+        });
+        m_runs.push_back(f);
+    }
+    FILE* f = new_run();
+    m_runs.push_back(f);
+    for (auto& e : m_entries) {
+        write_run_line(f, e.key, std::string_view(m_pool).substr(e.offset, e.size));
+    }
+    if (fflush(f) != 0) {
+        throw io_error("temporary file");
+    }
+    m_pool.clear();
+    m_entries.clear();
+}
+
+//! runs are closed and removed from the list. ties go to the earlier run, which keeps
+//! lines with the same key in the order they were added.
+template <class Sink>
+void
+ExternalSorter::merge(std::vector<FILE*>& runs, Sink sink)
+{
+    std::vector<RunReader> readers;
+    readers.reserve(runs.size());
+    for (FILE* f : runs) {
+        readers.emplace_back(f);
+    }
+    auto later = [&readers](size_t a, size_t b) {
+        uint64_t ka = readers[a].key(), kb = readers[b].key();
+        return ka > kb || (ka == kb && a > b);
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heap(later);
+    for (size_t i = 0; i < readers.size(); i++) {
+        if (!readers[i].done()) {
+            heap.push(i);
+        }
+    }
+    while (!heap.empty()) {
+        size_t i = heap.top();
+        heap.pop();
+        sink(readers[i].key(), readers[i].line());
+        readers[i].next();
+        if (!readers[i].done()) {
+            heap.push(i);
+        }
+    }
+    for (FILE* f : runs) {
+        fclose(f);
+    }
+    runs.clear();
+}
+
+void
+ExternalSorter::add(uint64_t key, std::string_view line)
+{
+    // entries need twice their size while sorting
+    if (m_pool.size() + line.size() + 2 * sizeof(Entry) * (m_entries.size() + 1) > m_budget &&
+        !m_entries.empty())
+    {
+        spill();
+    }
+    m_entries.push_back(Entry{key, uint32_t(m_pool.size()), uint32_t(line.size())});
+    m_pool.append(line);
+}
+
+void
+ExternalSorter::write(std::ostream& out)
+{
+    if (m_runs.empty()) {
+        sort_chunk();
+        for (auto& e : m_entries) {
+            out << std::string_view(m_pool).substr(e.offset, e.size);
+        }
+    } else {
+        spill();
+        merge(m_runs, [&out](uint64_t, std::string_view line) {
+            out << line;
+        });
+    }
+    m_pool.clear();
+    m_entries.clear();
+}
+// }}}
+
+// timeline {{{
+Timeline::Timeline(TimelineFormat format, CodecPtr codec, size_t budget):
+    m_format(format), m_codec(codec), m_sorter(budget)
+{
+}
+
+std::string
+Timeline::ansi(const std::string& s) const
+{
+    return m_codec ? m_codec->string(s) : s;
+}
+
+//! type is one of m, a, c, b as in mactime
+void
+Timeline::event(uint64_t filetime, char type, const std::string& file, const char* source,
+                int item, std::string_view name, uint64_t size)
+{
+    if (filetime == 0) {
+        return;
+    }
+    std::string src(source);
+    if (item >= 0) {
+        src = "LinkTargetIdList[" + std::to_string(item) + "]." + src;
+    }
+    int64_t unix_time = LnkStruct::MSTimeProperty(filetime).unix_time();
+    m_line.clear();
+    if (m_format == TimelineFormat::Bodyfile) {
+        // MD5|name|inode|mode|UID|GID|size|atime|mtime|ctime|crtime, only one time is set
+        std::string t = std::to_string(unix_time);
+        m_line.append("0|").append(file).append(" (").append(src);
+        if (!name.empty()) {
+            m_line.append(": ").append(name);
+        }
+        m_line.append(")|0|0|0|0|").append(std::to_string(size));
+        for (char c : {'a', 'm', 'c', 'b'}) {
+            m_line.append("|").append(c == type ? t : "0");
+        }
+    } else {
+        m_line.append(iso8601_time(LnkStruct::MSTimeProperty(filetime))).append(",");
+        m_line.push_back(type);
+        for (std::string_view s : {std::string_view(file), std::string_view(src), name}) {
+            m_line.push_back(',');
+            if (s.find_first_of(",\"\r\n") == std::string_view::npos) {
+                m_line.append(s);
+            } else {
+                m_line.push_back('"');
+                for (char c : s) {
+                    if (c == '"') {
+                        m_line.push_back('"');
+                    }
+                    m_line.push_back(c);
+                }
+                m_line.push_back('"');
+            }
+        }
+        m_line.append(",").append(std::to_string(size));
+    }
+    m_line.push_back('\n');
+    m_sorter.add(filetime, m_line);
+}
+
+void
+Timeline::event(const LnkStruct::FATTime& t, char type, const std::string& file,
+                const char* source, int item, std::string_view name, uint64_t size)
+{
+    if (uint32_t(t) == 0) {
+        return;
+    }
+    uint64_t filetime = uint64_t(t.unix_time()) * FILETIME_SECOND +
+                        LnkStruct::MSTimeProperty::UNIX_EPOCH;
+    event(filetime, type, file, source, item, name, size);
+}
+
+void
+Timeline::add(const std::string& file, const LnkStruct::All& data)
+{
+    auto& h = data.header;
+    event(h.CreationTime, 'b', file, "ShellLinkHeader.CreationTime", -1, "", h.FileSize);
+    event(h.AccessTime, 'a', file, "ShellLinkHeader.AccessTime", -1, "", h.FileSize);
+    event(h.WriteTime, 'm', file, "ShellLinkHeader.WriteTime", -1, "", h.FileSize);
+    if (!data.has_id_list()) {
+        return;
+    }
+    // extension block BEEF0004, its times are shown in the shell item in YAML
+    auto beef = [&](const std::optional<LnkStruct::ShellId_Beef0004>& e, const char* created,
+                    const char* accessed, int i, const std::string& fallback, uint64_t size) {
+        if (!e) {
+            return;
+        }
+        std::string_view name = e->LongName.empty() ? fallback : e->LongName;
+        event(e->CreationTime, 'b', file, created, i, name, size);
+        event(e->AccessTime, 'a', file, accessed, i, name, size);
+    };
+    int i = 0;
+    for (auto& id : data.id_list.IdList) {
+        if (auto f = std::get_if<LnkStruct::ShellId_x30_Struct>(&id.Item)) {
+            std::string name = f->is_unicode() ? f->Name : ansi(f->Name);
+            event(f->ModifiedTime, 'm', file, "FileShellId.ModifiedTime", i, name, f->FileSize);
+            beef(f->Extension, "FileShellId.CreationTime", "FileShellId.AccessTime", i, name,
+                 f->FileSize);
+        } else if (auto f = std::get_if<LnkStruct::ShellId_x74_Struct>(&id.Item)) {
+            auto& s = f->SubShellItem;
+            std::string name = ansi(s.PrimaryName);
+            event(s.ModifiedTime, 'm', file, "UserFolderDelegate.ModifiedTime", i, name,
+                  s.FileSize);
+            beef(f->Extension, "UserFolderDelegate.CreationTime",
+                 "UserFolderDelegate.AccessTime", i, name, s.FileSize);
+        } else if (auto f = std::get_if<LnkStruct::ShellId_x50_Struct>(&id.Item)) {
+            event(f->Timestamp, 'm', file, "ZipFolderShellId.Timestamp", i, f->FullPath, 0);
+        } else if (auto f = std::get_if<LnkStruct::ShellId_x60_Struct>(&id.Item)) {
+            std::string name = f->is_unicode() ? f->URI : ansi(f->URI);
+            event(f->Timestamp, 'm', file, "URIShellId.Timestamp", i, name, 0);
+        }
+        i++;
+    }
+}
+
+void
+Timeline::write(std::ostream& out)
+{
+    if (m_format == TimelineFormat::CSV) {
+        out << "Time,Type,File,Source,Name,Size\n";
+    }
+    m_sorter.write(out);
+}
+// }}}
+
+};  // namespace LnkOutput
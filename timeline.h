@@ -0,0 +1,89 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+// one line per timestamp of all files, sorted by time. lines are kept in memory up to a budget,
+// then sorted and written to temporary files, which are merged at the end.
+
+#include "encoding.h"
+#include "struct.h"
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace LnkOutput {
+
+enum class TimelineFormat { None, Bodyfile, CSV };
+
+//! lines sorted by a 64-bit key, ties stay in the order they were added.
+//! throws std::runtime_error if a temporary file cannot be written.
+class ExternalSorter
+{
+private:
+    struct Entry
+    {
+        uint64_t        key;
+        uint32_t        offset;     // of the line in m_pool
+        uint32_t        size;
+    };
+
+    size_t              m_budget;
+    size_t              m_max_runs;
+    std::string         m_pool;
+    std::vector<Entry>  m_entries;
+    std::vector<Entry>  m_tmp;      // radix sort scratch
+    std::vector<FILE*>  m_runs;
+
+    void sort_chunk();
+    void spill();
+    //! merge runs, write each line with sink(key, line)
+    template <class Sink> void merge(std::vector<FILE*>& runs, Sink sink);
+
+public:
+    //! runs on disk before they are merged into one, each is an open file
+    static const size_t MAX_RUNS = 64;
+
+    //! memory for lines and their keys, in bytes, at least 1 MiB. max_runs is at least 2.
+    ExternalSorter(size_t budget, size_t max_runs = MAX_RUNS);
+    ExternalSorter(const ExternalSorter&) = delete;
+    ExternalSorter& operator=(const ExternalSorter&) = delete;
+    ~ExternalSorter();
+    void add(uint64_t key, std::string_view line);
+    //! write all lines in order, the sorter is empty afterwards
+    void write(std::ostream& out);
+};
+
+class Timeline
+{
+private:
+    TimelineFormat      m_format;
+    CodecPtr            m_codec;
+    ExternalSorter      m_sorter;
+    std::string         m_line;
+
+    void event(uint64_t filetime, char type, const std::string& file, const char* source,
+               int item, std::string_view name, uint64_t size);
+    void event(const LnkStruct::FATTime& t, char type, const std::string& file,
+               const char* source, int item, std::string_view name, uint64_t size);
+    std::string ansi(const std::string& s) const;
+
+public:
+    //! codec converts non-Unicode names, they are copied unchanged without one
+    Timeline(TimelineFormat format, CodecPtr codec, size_t budget);
+    //! timestamps of the header and of the shell items, zero timestamps are left out
+    void add(const std::string& file, const LnkStruct::All& data);
+    //! header line for CSV, then all events in order
+    void write(std::ostream& out);
+};
+
+};  // namespace LnkOutput
+
+#endif  // TIMELINE_H
@@ -0,0 +1,554 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#include "config.h"
+#include "uring.h"
+
+#ifdef HAVE_IO_URING
+
+// std
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+// posix
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+//! files in one batch, and the buffer of each. most LNK files are a few KiB, a file that is
+//! larger or fills its buffer is read again with read_fd(). the 4 MiB of buffers are within
+//! the usual 8 MiB of RLIMIT_MEMLOCK, without it they are not registered.
+static const unsigned    BATCH = 256;
+static const size_t      BUFFER_SIZE = 16 << 10;
+//! one operation per file in a round
+static const unsigned    RING_ENTRIES = BATCH;
+//! io_uring_enter failing with EAGAIN or EBUSY while the rest of a round is waited for
+static const int         DRAIN_TRIES = 100;
+
+// ring {{{
+// no liburing, the three system calls are enough for what is done here
+static int
+sys_setup(unsigned entries, io_uring_params* params)
+{
+    return int(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int
+sys_enter(int fd, unsigned submit, unsigned wait, unsigned flags)
+{
+    return int(syscall(__NR_io_uring_enter, fd, submit, wait, flags, nullptr, 0));
+}
+
+static int
+sys_register(int fd, unsigned op, void* arg, unsigned n)
+{
+    return int(syscall(__NR_io_uring_register, fd, op, arg, n));
+}
+
+//! submission and completion queues shared with the kernel. only used by one thread, the
+//! kernel is the other side of the heads and tails.
+class Ring
+{
+private:
+    int             m_fd = -1;
+    void*           m_sq_ring = MAP_FAILED;
+    size_t          m_sq_size = 0;
+    void*           m_cq_ring = MAP_FAILED;
+    size_t          m_cq_size = 0;
+    io_uring_sqe*   m_sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t          m_sqes_size = 0;
+    unsigned*       m_sq_tail = nullptr;
+    unsigned*       m_sq_mask = nullptr;
+    unsigned*       m_sq_array = nullptr;
+    unsigned*       m_cq_head = nullptr;
+    unsigned*       m_cq_tail = nullptr;
+    unsigned*       m_cq_mask = nullptr;
+    io_uring_cqe*   m_cqes = nullptr;
+    unsigned        m_tail = 0;     // of the entries filled in so far
+    unsigned        m_queued = 0;   // entries the kernel did not take yet
+    unsigned        m_pending = 0;  // entries whose completion did not come yet
+
+public:
+    Ring() { }
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+    ~Ring();
+    //! false with errno if the ring cannot be set up
+    bool init(unsigned entries);
+    int fd() const { return m_fd; }
+    //! next submission entry, zeroed. at most entries between calls to complete()
+    io_uring_sqe* sqe();
+    //! submit the entries and call done(cqe) for count completions. false with errno if
+    //! io_uring_enter fails, the operations that did not complete may still be running then.
+    template <class F> bool complete(unsigned count, F done);
+    //! of the entries since the last successful complete(), those to wait for after a failure
+    unsigned pending() const { return m_pending; }
+};
+
+Ring::~Ring()
+{
+    if (m_sqes != MAP_FAILED) {
+        munmap(m_sqes, m_sqes_size);
+    }
+    if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring) {
+        munmap(m_cq_ring, m_cq_size);
+    }
+    if (m_sq_ring != MAP_FAILED) {
+        munmap(m_sq_ring, m_sq_size);
+    }
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool
+Ring::init(unsigned entries)
+{
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    m_fd = sys_setup(entries, &p);
+    if (m_fd < 0) {
+        return false;
+    }
+    m_sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    m_cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single) {
+        m_sq_size = m_cq_size = std::max(m_sq_size, m_cq_size);
+    }
+    m_sq_ring = mmap(nullptr, m_sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     m_fd, IORING_OFF_SQ_RING);
+    if (m_sq_ring == MAP_FAILED) {
+        return false;
+    }
+    if (single) {
+        m_cq_ring = m_sq_ring;
+    } else {
+        m_cq_ring = mmap(nullptr, m_cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         m_fd, IORING_OFF_CQ_RING);
+        if (m_cq_ring == MAP_FAILED) {
+            return false;
+        }
+    }
+    m_sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      m_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return false;
+    }
+    m_sqes = static_cast<io_uring_sqe*>(sqes);
+    char* sq = static_cast<char*>(m_sq_ring);
+    m_sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    m_sq_mask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    m_sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    m_tail = *m_sq_tail;
+    char* cq = static_cast<char*>(m_cq_ring);
+    m_cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    m_cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    m_cq_mask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+    return true;
+}
+
+io_uring_sqe*
+Ring::sqe()
+{
+    unsigned i = m_tail++ & *m_sq_mask;
+    m_sq_array[i] = i;
+    m_queued++;
+    m_pending++;
+    memset(&m_sqes[i], 0, sizeof(io_uring_sqe));
+    return &m_sqes[i];
+}
+
+template <class F>
+bool
+Ring::complete(unsigned count, F done)
+{
+    std::atomic_ref<unsigned>(*m_sq_tail).store(m_tail, std::memory_order_release);
+    while (count > 0) {
+        int n = sys_enter(m_fd, m_queued, count, IORING_ENTER_GETEVENTS);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        m_queued -= std::min(unsigned(n), m_queued);
+        unsigned head = *m_cq_head;
+        unsigned tail = std::atomic_ref<unsigned>(*m_cq_tail).load(std::memory_order_acquire);
+        for (; head != tail; head++) {
+            done(m_cqes[head & *m_cq_mask]);
+            count--;
+            m_pending--;
+        }
+        std::atomic_ref<unsigned>(*m_cq_head).store(head, std::memory_order_release);
+    }
+    return true;
+}
+// }}}
+
+// source {{{
+class UringSource: public PipelineSource
+{
+private:
+    struct Entry
+    {
+        std::string         name;
+        int                 fd;
+        int                 error;
+        struct statx        stx;        // from the kernel, into st
+        struct stat         st;
+        bool                stat_ok;
+        size_t              length;     // in the buffer of the entry
+        bool                sync;       // data was read with read_fd()
+        std::vector<char>   data;
+        uint64_t            ticks;      // share of the batch, for --stats
+    };
+
+    NameSource&                             m_names;
+    bool                                    m_more = true;
+    // declared before the ring, which must be gone before the buffers are
+    std::vector<char>                       m_buffers;
+    Ring                                    m_ring;
+    bool                                    m_fixed = false;    // buffers are registered
+    bool                                    m_broken = false;   // the ring failed
+    std::vector<Entry>                      m_batch;
+    size_t                                  m_count = 0;
+    size_t                                  m_taken = 0;
+
+    char* buffer(size_t i) { return m_buffers.data() + i * BUFFER_SIZE; }
+    //! user_data of an operation on entry i, so that finish() can handle any completion
+    static uint64_t tag(size_t i, unsigned op) { return i | uint64_t(op) << 32; }
+    void finish(const io_uring_cqe& c);
+    bool drain();
+    void failed();
+    bool load();
+    bool open_all();
+    bool stat_all();
+    bool read_all();
+    void close_all();
+
+public:
+    UringSource(NameSource& names):
+        m_names(names), m_buffers(BATCH * BUFFER_SIZE),
+        m_batch(BATCH) { }
+    //! false if io_uring or one of the operations is not available
+    bool init();
+    bool next(PipelineItem& item) override;
+};
+
+bool
+UringSource::init()
+{
+    if (!m_ring.init(RING_ENTRIES)) {
+        return false;
+    }
+    // openat, statx and close came in 5.6, with the probe
+    std::vector<char> mem(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+    auto probe = reinterpret_cast<io_uring_probe*>(mem.data());
+    if (sys_register(m_ring.fd(), IORING_REGISTER_PROBE, probe, 256) < 0) {
+        return false;
+    }
+    for (unsigned op: {IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ_FIXED,
+                       IORING_OP_READ, IORING_OP_CLOSE}) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+            return false;
+        }
+    }
+    // pinned memory counts against RLIMIT_MEMLOCK, without it plain reads do the same
+    iovec iov{m_buffers.data(), m_buffers.size()};
+    m_fixed = sys_register(m_ring.fd(), IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+    return true;
+}
+
+//! of any operation, by the tag in user_data
+void
+UringSource::finish(const io_uring_cqe& c)
+{
+    Entry& e = m_batch[c.user_data & 0xffffffff];
+    switch (c.user_data >> 32) {
+        case IORING_OP_OPENAT:
+            if (c.res < 0) {
+                e.error = -c.res;
+            } else {
+                e.fd = c.res;
+            }
+            break;
+        case IORING_OP_STATX:
+            e.stat_ok = c.res == 0;
+            break;
+        case IORING_OP_READ_FIXED:
+        case IORING_OP_READ:
+            if (c.res < 0) {
+                e.error = -c.res;
+                break;
+            }
+            e.length = c.res;
+            // it was shorter than statx said, or it grew and there may be more
+            e.sync = e.length < size_t(e.st.st_size) || e.length == BUFFER_SIZE;
+            break;
+        case IORING_OP_CLOSE:
+            // nothing to do about a file that fails to close, the data was read
+            e.fd = -1;
+            break;
+    }
+}
+
+//! wait for the operations that are still running after complete() failed, so that the files
+//! opened late are closed and nothing writes into the batch once it is read without the ring
+bool
+UringSource::drain()
+{
+    for (int tries = 0; tries < DRAIN_TRIES; tries++) {
+        if (m_ring.complete(m_ring.pending(), [&](const io_uring_cqe& c) { finish(c); })) {
+            return true;
+        }
+        if (errno != EAGAIN && errno != EBUSY) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+}
+
+//! the ring is not used again. when the running operations cannot be waited for, the kernel
+//! may still write into the entries and the buffers, and open or close files: both are left
+//! to it, with the files it opens, rather than closing a number that may be in use again.
+void
+UringSource::failed()
+{
+    m_broken = true;
+    if (drain()) {
+        return;
+    }
+    auto old = new std::vector<Entry>(std::move(m_batch));
+    static_cast<void>(new std::vector<char>(std::move(m_buffers)));
+    m_batch = std::vector<Entry>(BATCH);
+    for (size_t i = 0; i < m_count; i++) {
+        m_batch[i].name = (*old)[i].name;
+        m_batch[i].fd = -1;
+    }
+}
+
+bool
+UringSource::open_all()
+{
+    for (size_t i = 0; i < m_count; i++) {
+        Entry& e = m_batch[i];
+        io_uring_sqe* s = m_ring.sqe();
+        s->opcode = IORING_OP_OPENAT;
+        s->fd = AT_FDCWD;
+        s->addr = reinterpret_cast<uint64_t>(e.name.c_str());
+        s->open_flags = O_RDONLY | O_CLOEXEC;
+        s->user_data = tag(i, IORING_OP_OPENAT);
+    }
+    return m_ring.complete(m_count, [&](const io_uring_cqe& c) { finish(c); });
+}
+
+//! of the open files, not by name, so that it is the file that is read, before it is read
+bool
+UringSource::stat_all()
+{
+    static const char empty[] = "";
+    unsigned stats = 0;
+    for (size_t i = 0; i < m_count; i++) {
+        Entry& e = m_batch[i];
+        if (e.fd < 0) {
+            continue;
+        }
+        io_uring_sqe* s = m_ring.sqe();
+        s->opcode = IORING_OP_STATX;
+        s->fd = e.fd;
+        s->addr = reinterpret_cast<uint64_t>(empty);
+        s->statx_flags = AT_EMPTY_PATH;
+        s->len = STATX_BASIC_STATS;
+        s->off = reinterpret_cast<uint64_t>(&e.stx);
+        s->user_data = tag(i, IORING_OP_STATX);
+        stats++;
+    }
+    bool ok = m_ring.complete(stats, [&](const io_uring_cqe& c) { finish(c); });
+    for (size_t i = 0; ok && i < m_count; i++) {
+        Entry& e = m_batch[i];
+        if (e.stat_ok) {
+            e.st = {};
+            e.st.st_dev = makedev(e.stx.stx_dev_major, e.stx.stx_dev_minor);
+            e.st.st_ino = e.stx.stx_ino;
+            e.st.st_mode = e.stx.stx_mode;
+            e.st.st_size = e.stx.stx_size;
+            e.st.st_mtim.tv_sec = e.stx.stx_mtime.tv_sec;
+            e.st.st_mtim.tv_nsec = e.stx.stx_mtime.tv_nsec;
+        }
+    }
+    return ok;
+}
+
+bool
+UringSource::read_all()
+{
+    unsigned reads = 0;
+    for (size_t i = 0; i < m_count; i++) {
+        Entry& e = m_batch[i];
+        if (e.fd < 0) {
+            continue;
+        }
+        // directories, devices and large files the same way as FileSource
+        if (!e.stat_ok || !S_ISREG(e.st.st_mode) || size_t(e.st.st_size) > BUFFER_SIZE) {
+            e.sync = true;
+            continue;
+        }
+        io_uring_sqe* s = m_ring.sqe();
+        s->opcode = m_fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        s->fd = e.fd;
+        s->addr = reinterpret_cast<uint64_t>(buffer(i));
+        s->len = BUFFER_SIZE;
+        s->off = 0;
+        s->buf_index = 0;
+        s->user_data = tag(i, s->opcode);
+        reads++;
+    }
+    if (!m_ring.complete(reads, [&](const io_uring_cqe& c) { finish(c); })) {
+        return false;
+    }
+    // the reads above were at offset 0, so read_fd() starts at the beginning
+    for (size_t i = 0; i < m_count; i++) {
+        Entry& e = m_batch[i];
+        if (e.fd >= 0 && e.sync) {
+            e.error = read_fd(e.fd, e.data);
+        }
+    }
+    return true;
+}
+
+void
+UringSource::close_all()
+{
+    unsigned closes = 0;
+    if (!m_broken) {
+        for (size_t i = 0; i < m_count; i++) {
+            Entry& e = m_batch[i];
+            if (e.fd >= 0) {
+                io_uring_sqe* s = m_ring.sqe();
+                s->opcode = IORING_OP_CLOSE;
+                s->fd = e.fd;
+                s->user_data = tag(i, IORING_OP_CLOSE);
+                closes++;
+            }
+        }
+        if (m_ring.complete(closes, [&](const io_uring_cqe& c) { finish(c); })) {
+            return;
+        }
+        failed();
+    }
+    for (size_t i = 0; i < m_count; i++) {
+        if (m_batch[i].fd >= 0) {
+            close(m_batch[i].fd);
+            m_batch[i].fd = -1;
+        }
+    }
+}
+
+//! the next batch, false if there are no more names
+bool
+UringSource::load()
+{
+    m_count = 0;
+    m_taken = 0;
+    while (m_count < BATCH && m_more && (m_more = m_names.next(m_batch[m_count].name))) {
+        Entry& e = m_batch[m_count++];
+        e.fd = -1;
+        e.error = 0;
+        e.stat_ok = false;
+        e.length = 0;
+        e.sync = false;
+        e.data.clear();
+    }
+    if (m_count == 0) {
+        return false;
+    }
+    LnkParser::TraceSpan span("Read");
+    uint64_t start = LnkParser::current_stats != nullptr ? LnkParser::ticks() : 0;
+    if (!m_broken && (!open_all() || !stat_all() || !read_all())) {
+        // the batch starts over below, without the ring
+        failed();
+        close_all();
+    }
+    if (m_broken) {
+        for (size_t i = 0; i < m_count; i++) {
+            Entry& e = m_batch[i];
+            e.sync = true;
+            e.fd = open(e.name.c_str(), O_RDONLY | O_CLOEXEC);
+            e.stat_ok = e.fd >= 0 && fstat(e.fd, &e.st) == 0;
+            e.error = e.fd < 0 ? errno : read_fd(e.fd, e.data);
+        }
+    }
+    close_all();
+    if (LnkParser::current_stats != nullptr) {
+        uint64_t share = (LnkParser::ticks() - start) / m_count;
+        for (size_t i = 0; i < m_count; i++) {
+            m_batch[i].ticks = share;
+        }
+    }
+    span.stop("\"files\":" + std::to_string(m_count));
+    return true;
+}
+
+bool
+UringSource::next(PipelineItem& item)
+{
+    if (m_taken == m_count && !load()) {
+        return false;
+    }
+    size_t i = m_taken++;
+    Entry& e = m_batch[i];
+    item.name = std::move(e.name);
+    item.read_error = e.error;
+    item.have_stat = e.stat_ok;
+    item.st = e.st;
+    if (e.error != 0) {
+        item.data.clear();
+    } else if (e.sync) {
+        item.data.swap(e.data);
+    } else {
+        item.data.assign(buffer(i), buffer(i) + e.length);
+    }
+    if (LnkParser::current_stats != nullptr) {
+        LnkParser::current_stats->ticks[size_t(LnkParser::Stage::Read)] += e.ticks;
+        LnkParser::current_stats->bytes_read += item.data.size();
+    }
+    return true;
+}
+// }}}
+
+std::unique_ptr<PipelineSource>
+file_source(NameSource& names, size_t lookahead, bool uring)
+{
+    if (uring) {
+        auto source = std::make_unique<UringSource>(names);
+        if (source->init()) {
+            return source;
+        }
+    }
+    return std::make_unique<FileSource>(names, lookahead);
+}
+
+#else
+
+std::unique_ptr<PipelineSource>
+file_source(NameSource& names, size_t lookahead, bool)
+{
+    return std::make_unique<FileSource>(names, lookahead);
+}
+
+#endif // #ifdef HAVE_IO_URING
@@ -0,0 +1,22 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#ifndef __URING_H__
+#define __URING_H__
+
+// files for the pipeline read with io_uring on linux. a batch of files is opened and stat'ed
+// with one system call, read into buffers that are registered with the kernel once with
+// another, and closed with a third. where io_uring is missing or not allowed, FileSource
+// reads them instead.
+#include "pipeline.h"
+#include <memory>
+
+//! the files of names, with io_uring if uring is true and it works here, otherwise with
+//! FileSource and lookahead. names must live as long as the source.
+std::unique_ptr<PipelineSource>
+            file_source(NameSource& names, size_t lookahead, bool uring);
+
+#endif // #ifndef __URING_H__
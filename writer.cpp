@@ -0,0 +1,589 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#include "writer.h"
+#include "encoding.h"
+#include <string_view>
+#include <variant>
+
+// what is taken from where:
+// - shell items are copied from ID::Data if it is not empty. otherwise they are encoded from
+//   ID::Item, which works for the types that the parser reads completely: root folder (0x1F),
+//   file (0x30, with BEEF0004), network location (0x40), URI (0x61) and user folder delegate
+//   (0x74). other items need Data. a URI item has the short form if its Flags are 0 or only
+//   IsUnicode, as in the parser.
+// - strings that are unicode in the file are utf-8 in the structures and converted back.
+//   ansi strings are written byte for byte, in whatever code page they are.
+// - LinkInfo with LinkInfoHeaderSize >= 0x24, a VolumeLabelOffset of 0x14 and a NetNameOffset
+//   above 0x14 gets the optional unicode strings, as in the parser.
+// - ExtraData blocks are written in the order of ExtraData::signatures, unknown ones from
+//   ExtraData::unknown in their order.
+// a file parsed with all fields and written again is the same file, unless it had something
+// that the parser skips: padding, reserved bytes in items, data after the terminal block.
+
+namespace LnkWriter {
+
+//! little endian output, sizes and offsets are patched in when they are known
+class Out
+{
+private:
+    std::string&        m_out;
+    std::u16string      m_u16;
+
+public:
+    explicit Out(std::string& out): m_out(out) { }
+    size_t tell() const { return m_out.size(); }
+    void u8(uint8_t v) { m_out.push_back(char(v)); }
+    void u16(uint16_t v) { u8(v); u8(v >> 8); }
+    void u32(uint32_t v) { u16(v); u16(v >> 16); }
+    void u64(uint64_t v) { u32(v); u32(v >> 32); }
+    void zeros(size_t n) { m_out.append(n, '\0'); }
+    void bytes(std::span<const uint8_t> b) { m_out.append((const char*)b.data(), b.size()); }
+    void guid(const LnkStruct::Guid& g) { bytes(g.data()); }
+    void
+    patch16(size_t pos, size_t v, const char* field)
+    {
+        if (v > 0xFFFF) {
+            throw Error(std::string(field) + " is too big");
+        }
+        m_out[pos] = char(v);
+        m_out[pos+1] = char(v >> 8);
+    }
+    void
+    patch32(size_t pos, size_t v)
+    {
+        for (int i = 0; i < 4; i++) {
+            m_out[pos+i] = char(v >> (i * 8));
+        }
+    }
+    //! NUL-terminated
+    void
+    ansi(std::string_view s)
+    {
+        m_out.append(s);
+        u8(0);
+    }
+    //! exactly 'size' bytes, NUL-terminated unless the string fills them
+    void
+    ansi(std::string_view s, size_t size, const char* field)
+    {
+        if (s.size() > size) {
+            throw Error(std::string(field) + " is too long");
+        }
+        m_out.append(s);
+        zeros(size - s.size());
+    }
+    //! utf-8 to utf-16, returns the number of 16 bit characters without NUL
+    size_t
+    unicode(std::string_view s, bool nul = true)
+    {
+        m_u16.clear();
+        utf8_to_utf16le(s, m_u16);
+        for (char16_t c: m_u16) {
+            u16(c);
+        }
+        if (nul) {
+            u16(0);
+        }
+        return m_u16.size();
+    }
+    //! exactly 'size' bytes, the same way as ansi()
+    void
+    unicode(std::string_view s, size_t size, const char* field)
+    {
+        size_t n = unicode(s, false) * 2;
+        if (n > size) {
+            throw Error(std::string(field) + " is too long");
+        }
+        zeros(size - n);
+    }
+};
+
+// header {{{
+
+static void
+header(Out& out, const LnkStruct::All& lnk)
+{
+    auto& h = lnk.header;
+    static const LnkStruct::Guid clsid{{0x01, 0x14, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                        0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46}};
+    constexpr int id_list_bit = LnkStruct::LinkFlags_t::find("HasLinkTargetIdList");
+    constexpr int info_bit = LnkStruct::LinkFlags_t::find("HasLinkInfo");
+    static_assert(id_list_bit >= 0 && info_bit >= 0);
+    uint32_t flags = h.LinkFlags.value() & ~((1U << id_list_bit) | (1U << info_bit));
+    flags |= (lnk.has_id_list() << id_list_bit) | (lnk.has_link_info() << info_bit);
+    out.u32(0x4C);
+    out.guid(clsid);
+    out.u32(flags);
+    out.u32(h.FileAttributes.value());
+    out.u64(h.CreationTime);
+    out.u64(h.AccessTime);
+    out.u64(h.WriteTime);
+    out.u32(h.FileSize);
+    out.u32(h.IconIndex);
+    out.u32(h.ShowCommand.get_value());
+    out.u8(h.HotKeyLow.get_value());
+    out.u8(h.HotKeyHigh.value());
+    out.u16(h.Reversed1);
+    out.u32(h.Reserved2);
+    out.u32(h.Reserved3);
+}
+
+// }}}
+
+// shell items {{{
+
+static void
+beef0004(Out& out, size_t item_start, const LnkStruct::ShellId_Beef0004& e)
+{
+    size_t start = out.tell();
+    out.u16(0);
+    out.u16(e.Version);
+    out.u32(e.Signature);
+    out.u32(e.CreationTime);
+    out.u32(e.AccessTime);
+    out.u16(e.WindowsVersion.get_value());
+    if (e.Version >= 7) {
+        out.u16(e.Unknown1);
+        out.u64(e.FileReference);
+        out.u64(e.Unknown2);
+    }
+    if (e.Version >= 3) {
+        out.u16(e.LongStringSize);
+    }
+    if (e.Version >= 9) {
+        out.u32(e.Unknown3);
+    }
+    if (e.Version >= 8) {
+        out.u32(e.Unknown4);
+    }
+    if (e.Version >= 3) {
+        out.unicode(e.LongName);
+        if (e.LongStringSize > 0) {
+            if (e.Version >= 7) {
+                out.unicode(e.LocalizedName);
+            } else {
+                out.ansi(e.LocalizedName);
+            }
+        }
+    }
+    // the last two bytes point back to the start of the extension
+    out.u16(start - item_start);
+    out.patch16(start, out.tell() - start, "BEEF0004");
+}
+
+static void
+x30_file(Out& out, size_t item_start, const LnkStruct::ShellId_x30_Struct& f)
+{
+    out.u8(0x30 | f.Flags.value());
+    out.u8(f.Unknown1);
+    out.u32(f.FileSize);
+    out.u32(f.ModifiedTime);
+    out.u16(f.Attributes);
+    if (f.is_unicode()) {
+        out.unicode(f.Name);
+    } else {
+        out.ansi(f.Name);
+    }
+    if (!f.Extension && f.SecondaryName.empty()) {
+        return;
+    }
+    if ((out.tell() - item_start) % 2 != 0) {
+        out.u8(0);
+    }
+    if (f.Extension) {
+        beef0004(out, item_start, *f.Extension);
+    } else if (f.is_unicode()) {
+        out.unicode(f.SecondaryName);
+    } else {
+        out.ansi(f.SecondaryName);
+    }
+}
+
+static void
+x40_network(Out& out, const LnkStruct::ShellId_x40_Struct& f)
+{
+    out.u8(0x40 | f.Type.get_value());
+    out.u8(f.Unknown1);
+    out.u8(f.Flags.value());
+    out.ansi(f.Location);
+    if (f.has_description()) {
+        out.ansi(f.Description);
+    }
+    if (f.has_comments()) {
+        out.ansi(f.Comments);
+    }
+}
+
+//! string with its size in bytes before it, including NUL
+static void
+sized_string(Out& out, const std::string& s, bool unicode)
+{
+    size_t start = out.tell();
+    out.u32(0);
+    if (unicode) {
+        out.unicode(s);
+    } else {
+        out.ansi(s);
+    }
+    out.patch32(start, out.tell() - start - sizeof(uint32_t));
+}
+
+static void
+x60_uri(Out& out, const LnkStruct::ShellId_x60_Struct& f)
+{
+    bool unicode = f.is_unicode();
+    out.u8(0x61);
+    out.u8(f.Flags.value());
+    if ((f.Flags.value() & ~0x80) == 0) {
+        out.u32(f.Unknown1);
+    } else {
+        out.u16(f.DataSize);
+        if (f.DataSize > 0) {
+            out.u32(f.Unknown1);
+            out.u32(f.Unknown2);
+            out.u64(f.Timestamp);
+            out.u32(f.Unknown4);
+            out.u32(f.Unknown5);
+            out.u32(f.Unknown6);
+            out.u32(f.Unknown7);
+            out.u32(f.Unknown8);
+            sized_string(out, f.FTPHostname, unicode);
+            sized_string(out, f.FTPUser, unicode);
+            sized_string(out, f.FTPPassword, unicode);
+        }
+    }
+    if (unicode) {
+        out.unicode(f.URI);
+    } else {
+        out.ansi(f.URI);
+    }
+}
+
+static void
+x74_user_folder_delegate(Out& out, size_t item_start, const LnkStruct::ShellId_x74_Struct& f)
+{
+    auto& s = f.SubShellItem;
+    out.u8(0x74);
+    out.u8(f.Unknown1);
+    size_t delegate_offset = out.tell();
+    out.u16(0);
+    out.u32(f.Signature);
+    size_t sub_size = out.tell();
+    out.u16(0);
+    out.u8(s.ClsType);
+    out.u8(s.Unknown1);
+    out.u32(s.FileSize);
+    out.u32(s.ModifiedTime);
+    out.u16(s.FileAttributes);
+    out.ansi(s.PrimaryName);
+    out.u16(s.Unknown2);
+    out.patch16(sub_size, out.tell() - sub_size - sizeof(uint16_t), "SubShellItemSize");
+    // from the end of the offset itself
+    out.patch16(delegate_offset, out.tell() - delegate_offset - sizeof(uint16_t),
+                "DelegateOffset");
+    out.guid(f.DelegateGuid);
+    out.guid(f.DelegateClass);
+    if (f.Extension) {
+        beef0004(out, item_start, *f.Extension);
+    }
+}
+
+static void
+shell_item(Out& out, const LnkStruct::LinkTargetIdList::ID& id)
+{
+    size_t start = out.tell();
+    out.u16(0);
+    if (!id.Data.empty()) {
+        out.bytes(id.Data);
+    } else if (auto f = std::get_if<LnkStruct::ShellId_x1F_Struct>(&id.Item)) {
+        out.u8(0x1F);
+        out.u8(f->SortIndex.get_value());
+        out.guid(f->ShellFolder);
+    } else if (auto f = std::get_if<LnkStruct::ShellId_x30_Struct>(&id.Item)) {
+        x30_file(out, start, *f);
+    } else if (auto f = std::get_if<LnkStruct::ShellId_x40_Struct>(&id.Item)) {
+        x40_network(out, *f);
+    } else if (auto f = std::get_if<LnkStruct::ShellId_x60_Struct>(&id.Item)) {
+        x60_uri(out, *f);
+    } else if (auto f = std::get_if<LnkStruct::ShellId_x74_Struct>(&id.Item)) {
+        x74_user_folder_delegate(out, start, *f);
+    } else {
+        throw Error("shell item of this type needs Data");
+    }
+    out.patch16(start, out.tell() - start, "ItemIdSize");
+}
+
+static void
+id_list(Out& out, const LnkStruct::LinkTargetIdList& l)
+{
+    size_t start = out.tell();
+    out.u16(0);
+    for (const auto& id: l.IdList) {
+        shell_item(out, id);
+    }
+    out.u16(0);
+    out.patch16(start, out.tell() - start - sizeof(uint16_t), "IdListSize");
+}
+
+// }}}
+
+// link info {{{
+
+static void
+volume_id(Out& out, const LnkStruct::LinkInfoData::VOLUMEID& v)
+{
+    size_t start = out.tell();
+    out.u32(0);
+    out.u32(v.DriveType.get_value());
+    out.u32(v.DriveSerialNumber);
+    if (v.has_unicode_label()) {
+        out.u32(0x14);
+        out.u32(0x14);
+        out.unicode(v.VolumeLabelUnicode);
+    } else {
+        out.u32(0x10);
+        out.ansi(v.VolumeLabel);
+    }
+    out.patch32(start, out.tell() - start);
+}
+
+static void
+common_network_relative_link(Out& out, const LnkStruct::LinkInfoData::CNR& c)
+{
+    size_t start = out.tell();
+    bool unicode = c.has_optional_fields();
+    out.u32(0);
+    out.u32(c.Flags.value());
+    out.u32(unicode ? 0x1C : 0x14);
+    size_t device = out.tell();
+    out.u32(0);
+    out.u32(c.NetworkProviderType.get_value());
+    size_t offsets_unicode = out.tell();
+    if (unicode) {
+        out.zeros(8);
+    }
+    out.ansi(c.NetName);
+    if (c.has_device_name()) {
+        out.patch32(device, out.tell() - start);
+        out.ansi(c.DeviceName);
+    }
+    if (unicode) {
+        out.patch32(offsets_unicode, out.tell() - start);
+        out.unicode(c.NetNameUnicode);
+        if (c.has_device_name()) {
+            out.patch32(offsets_unicode + 4, out.tell() - start);
+            out.unicode(c.DeviceNameUnicode);
+        }
+    }
+    out.patch32(start, out.tell() - start);
+}
+
+static void
+link_info(Out& out, const LnkStruct::LinkInfo& li)
+{
+    auto& h = li.header;
+    auto& d = li.data;
+    size_t start = out.tell();
+    bool unicode = h.has_optional_fields() == 1;
+    out.u32(0);
+    out.u32(unicode ? 0x24 : 0x1C);
+    out.u32(h.LinkInfoFlags.value());
+    size_t offsets = out.tell();
+    out.zeros(unicode ? 6 * 4 : 4 * 4);
+    if (h.has_volume_id_and_local_base_path()) {
+        out.patch32(offsets, out.tell() - start);
+        volume_id(out, d.VolumeID);
+        out.patch32(offsets + 4, out.tell() - start);
+        out.ansi(d.LocalBasePath);
+    }
+    if (h.has_common_network_relative_link()) {
+        out.patch32(offsets + 8, out.tell() - start);
+        common_network_relative_link(out, d.CommonNetworkRelativeLink);
+    }
+    out.patch32(offsets + 12, out.tell() - start);
+    out.ansi(d.CommonPathSuffix);
+    if (unicode) {
+        if (h.has_volume_id_and_local_base_path()) {
+            out.patch32(offsets + 16, out.tell() - start);
+            out.unicode(d.LocalBasePathUnicode);
+        }
+        out.patch32(offsets + 20, out.tell() - start);
+        out.unicode(d.CommonPathSuffixUnicode);
+    }
+    out.patch32(start, out.tell() - start);
+}
+
+// }}}
+
+// string data {{{
+
+static void
+string(Out& out, const std::string& s, bool unicode)
+{
+    size_t start = out.tell();
+    out.u16(0);
+    if (unicode) {
+        out.patch16(start, out.unicode(s, false), "StringData");
+    } else {
+        out.patch16(start, s.size(), "StringData");
+        out.bytes({(const uint8_t*)s.data(), s.size()});
+    }
+}
+
+static void
+string_data(Out& out, const LnkStruct::ShellLinkHeader& h, const LnkStruct::StringData& s)
+{
+    bool unicode = h.has_unicode_strings();
+    if (h.has_name_string()) {
+        string(out, s.Name, unicode);
+    }
+    if (h.has_relpath_string()) {
+        string(out, s.RelativePath, unicode);
+    }
+    if (h.has_workdir_string()) {
+        string(out, s.WorkingDir, unicode);
+    }
+    if (h.has_args_string()) {
+        string(out, s.CommandLine, unicode);
+    }
+    if (h.has_iconloc_string()) {
+        string(out, s.IconLocation, unicode);
+    }
+}
+
+// }}}
+
+// extra data {{{
+
+static void
+console(Out& out, const LnkStruct::ConsoleDataBlock& x)
+{
+    out.u16(x.FillAttributes.value());
+    out.u16(x.PopupFillAttributes.value());
+    out.u16(x.ScreenBufferSizeX);
+    out.u16(x.ScreenBufferSizeY);
+    out.u16(x.WindowSizeX);
+    out.u16(x.WindowSizeY);
+    out.u16(x.WindowOriginX);
+    out.u16(x.WindowOriginY);
+    out.u32(x.Reserved1);
+    out.u32(x.Reserved2);
+    out.u32(x.FontSize);
+    out.u32(x.FontFamily.value);
+    out.u32(x.FontWeight);
+    out.unicode(x.FaceName, 64, "FaceName");
+    out.u32(x.CursorSize);
+    out.u32(x.FullScreen);
+    out.u32(x.QuickEdit);
+    out.u32(x.InsertMode);
+    out.u32(x.AutoPosition);
+    out.u32(x.HistoryBufferSize);
+    out.u32(x.NumberOfHistoryBuffers);
+    out.u32(x.HistoryNoDup);
+    for (uint32_t c: x.ColorTable) {
+        out.u32(c);
+    }
+}
+
+//! the 260 ansi and 520 unicode bytes of Darwin and the environment variable blocks
+static void
+target_pair(Out& out, const std::string& ansi, const std::string& unicode)
+{
+    out.ansi(ansi, 260, "TargetAnsi");
+    out.unicode(unicode, 520, "TargetUnicode");
+}
+
+static void
+tracker(Out& out, const LnkStruct::TrackerDataBlock& x)
+{
+    out.u32(x.Length);
+    out.u32(x.Version);
+    out.ansi(x.MachineID, 16, "MachineID");
+    out.guid(x.Droid1);
+    out.guid(x.Droid2);
+    out.guid(x.DroidBirth1);
+    out.guid(x.DroidBirth2);
+}
+
+static void
+extra_data(Out& out, const LnkStruct::ExtraData& e)
+{
+    size_t unknown = 0;
+    for (uint32_t signature: e.signatures) {
+        size_t start = out.tell();
+        out.u32(0);
+        out.u32(signature);
+        switch (signature) {
+            case LnkStruct::ConsoleDataBlock::Signature:
+                console(out, e.console);
+                break;
+            case LnkStruct::ConsoleFeDataBlock::Signature:
+                out.u32(e.console_fe.CodePage);
+                break;
+            case LnkStruct::DarwinDataBlock::Signature:
+                target_pair(out, e.darwin.DarwinDataAnsi, e.darwin.DarwinDataUnicode);
+                break;
+            case LnkStruct::EnvVarDataBlock::Signature:
+                target_pair(out, e.env_var.TargetAnsi, e.env_var.TargetUnicode);
+                break;
+            case LnkStruct::IconEnvDataBlock::Signature:
+                target_pair(out, e.icon_env.TargetAnsi, e.icon_env.TargetUnicode);
+                break;
+            case LnkStruct::KnownFolderDataBlock::Signature:
+                out.guid(e.known_folder.KnownFolderId);
+                out.u32(e.known_folder.Offset);
+                break;
+            case LnkStruct::PropertyStoreDataBlock::Signature:
+                out.bytes(e.property_store.Data);
+                break;
+            case LnkStruct::ShimDataBlock::Signature:
+                // at least 0x88 bytes in the block
+                out.unicode(e.shim.LayerName);
+                if (out.tell() - start < 0x88) {
+                    out.zeros(0x88 - (out.tell() - start));
+                }
+                break;
+            case LnkStruct::SpecialFolderDataBlock::Signature:
+                out.u32(e.special_folder.SpecialFolderId);
+                out.u32(e.special_folder.Offset);
+                break;
+            case LnkStruct::TrackerDataBlock::Signature:
+                tracker(out, e.tracker);
+                break;
+            case LnkStruct::VistaAndAboveIDListDataBlock::Signature:
+                out.bytes(e.vista_id_list.Data);
+                break;
+            default:
+                if (unknown >= e.unknown.size() || e.unknown[unknown].Signature != signature) {
+                    throw Error("no data for unknown ExtraData block");
+                }
+                out.bytes(e.unknown[unknown++].Data);
+                break;
+        }
+        out.patch32(start, out.tell() - start);
+    }
+    out.u32(0);  // terminal block
+}
+
+// }}}
+
+void
+write(const LnkStruct::All& lnk, std::string& out_string)
+{
+    Out out(out_string);
+    header(out, lnk);
+    if (lnk.has_id_list()) {
+        id_list(out, lnk.id_list);
+    }
+    if (lnk.has_link_info()) {
+        link_info(out, lnk.info);
+    }
+    string_data(out, lnk.header, lnk.string_data);
+    extra_data(out, lnk.extra_data);
+}
+
+};  // namespace LnkWriter
@@ -0,0 +1,34 @@
+﻿
+/*****
+ * Part of LnkDump2000
+ * Licence: GPL, version 3 or later (see COPYING file or https://www.gnu.org/licenses/gpl-3.0.txt)
+ *****/
+
+#ifndef WRITER_H
+#define WRITER_H
+
+// the reverse of the parser, LnkStruct::All to the bytes of a ShellLink file. used to generate
+// corpora and to check that parsing and writing again gives the same file. see writer.cpp.
+
+#include "struct.h"
+#include <stdexcept>
+#include <string>
+
+namespace LnkWriter {
+
+//! the structures cannot be written, for example a string does not fit in its field
+class Error: public std::runtime_error
+{
+public:
+    explicit Error(const char *msg): std::runtime_error(msg) { }
+    explicit Error(std::string msg): std::runtime_error(msg) { }
+};
+
+//! append a ShellLink file with the contents of lnk to out. sizes and offsets are computed,
+//! the flags of IDList and LinkInfo follow has_id_list() and has_link_info(), everything else
+//! is written as it is. throws Error, out may then hold part of the file.
+void        write(const LnkStruct::All& lnk, std::string& out);
+
+};  // namespace LnkWriter
+
+#endif  // WRITER_H